@@ -0,0 +1,874 @@
+#define _DEFAULT_SOURCE /* for mmap and fstat */
+
+#include <stdio.h> /* for fopen, fwrite and fprintf */
+#include <stdlib.h> /* for malloc, realloc and free */
+#include <string.h> /* for memcmp, strlen and strncpy */
+#include <fcntl.h> /* for open */
+#include <unistd.h> /* for read and close */
+#include <sys/stat.h> /* for stat */
+#include <sys/mman.h> /* for mmap */
+
+#include "archive.h"
+#include "consts.h"
+#include "buffer.h"
+#include "hash.h"
+
+/* =============================================
+ * =============================================
+ * Note: an archive packs the .ob, .ent and .ext
+ * files of many objects into one file:
+ *
+ *   header   ARCHIVE_HEADER_LENGTH bytes
+ *   members  a record per member
+ *   symbols  a record per entry symbol
+ *   slots    the hash index of the symbols
+ *   strings  the member and symbol names
+ *   files    the member files, every file 
+ *            starts at ARCHIVE_ALIGNMENT
+ *
+ * numbers are little endian. the header, the 
+ * records and the slots have a fixed layout so 
+ * an archive is used by mapping them, without
+ * parsing. a symbol is found by one FNV-1a hash
+ * and a short probe of the open addressed slots
+ * and a member file is mapped on its own, at an
+ * aligned offset.
+ * ==============================================
+ * ============================================*/
+
+#define ARCHIVE_MAGIC "OBARCHV1"
+#define ARCHIVE_MAGIC_LENGTH (8)
+#define ARCHIVE_HEADER_LENGTH (64)
+#define ARCHIVE_MEMBER_LENGTH (8 + ARCHIVE_FILES * 16)
+#define ARCHIVE_SYMBOL_LENGTH (16)
+#define ARCHIVE_SLOT_LENGTH (4)
+#define ARCHIVE_ALIGNMENT (4096)
+#define MIN_SLOTS (16)
+#define MIN_SYMBOL_CAPACITY (64)
+#define COPY_CHUNK_LENGTH (65536)
+
+/* header field offsets */
+#define HEADER_MEMBERS (8)
+#define HEADER_SYMBOLS (12)
+#define HEADER_SLOTS (16)
+#define HEADER_STRINGS (20)
+#define HEADER_INDEX_LENGTH (24)
+
+typedef struct {
+	unsigned long name; /* offset in the strings */
+	unsigned long name_length;
+	unsigned long member;
+	unsigned long address;
+} archive_symbol_t;
+
+static const char *extentions[ARCHIVE_FILES] = {".ob", ".ent", ".ext"};
+
+/* the archive being created */
+static buffer_t strings; /* the member names, then the symbol names */
+static archive_symbol_t *symbols = NULL;
+static unsigned long symbol_count = 0;
+static unsigned long symbol_capacity = 0;
+static unsigned char *index_bytes = NULL;
+static unsigned long index_length = 0;
+static unsigned long slot_count = 0;
+
+/************************************************
+ * NAME: put_number
+ * PARAMS: p - the bytes to write to
+ * 	   value - the number
+ * 	   width - number of bytes
+ * DESCRIPTION: store a little endian number
+ ***********************************************/
+static void put_number(unsigned char *p, unsigned long value, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++) {
+		p[i] = i < (int)sizeof(value) ? (value >> (8 * i)) & 0xff : 0;
+	}
+}
+
+/************************************************
+ * NAME: get_number
+ * PARAMS: p - the bytes to read
+ * 	   width - number of bytes
+ * RETURN VALUE: the little endian number
+ ***********************************************/
+static unsigned long get_number(const unsigned char *p, int width)
+{
+	unsigned long value = 0;
+	int i;
+
+	for (i = width < (int)sizeof(value) ? width : (int)sizeof(value); i > 0; i--) {
+		value = (value << 8) | p[i - 1];
+	}
+	return value;
+}
+
+/************************************************
+ * NAME: align
+ * PARAMS: offset - a file offset
+ * RETURN VALUE: the offset rounded up to the 
+ * 		 alignment of member files
+ ***********************************************/
+static unsigned long align(unsigned long offset)
+{
+	return (offset + ARCHIVE_ALIGNMENT - 1) & ~(unsigned long)(ARCHIVE_ALIGNMENT - 1);
+}
+
+/************************************************
+ * NAME: build_member_filename
+ * PARAMS: filename - output buffer of 
+ * 		      MAX_FILENAME_LENGTH bytes
+ * 	   member - the member, without extention
+ * 	   file - the member file
+ ***********************************************/
+static void build_member_filename(char *filename, const char *member, archive_file_t file)
+{
+	strncpy(filename, member, MAX_FILENAME_LENGTH - 1);
+	filename[MAX_FILENAME_LENGTH - 1] = '\0';
+	strncat(filename, extentions[file], MAX_FILENAME_LENGTH - 1 - strlen(filename));
+}
+
+/************************************************
+ * NAME: read_file
+ * PARAMS: filename - the file to read
+ * 	   length - the file length
+ * RETURN VALUE: the file contents or NULL on
+ * 		 error
+ ***********************************************/
+static char *read_file(const char *filename, unsigned long *length)
+{
+	FILE *fp = fopen(filename, "rb");
+	char *text;
+	long size;
+
+	if (NULL == fp) {
+		return NULL;
+	}
+
+	if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+		fclose(fp);
+		return NULL;
+	}
+
+	text = malloc(size + 1);
+	if (NULL == text || fread(text, 1, size, fp) != (unsigned long)size) {
+		free(text);
+		fclose(fp);
+		return NULL;
+	}
+	text[size] = '\0';
+
+	fclose(fp);
+	*length = size;
+	return text;
+}
+
+/************************************************
+ * NAME: add_symbols
+ * PARAMS: text - the .ent file of a member
+ * 	   member - the member index
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: add the name \t address lines of
+ * 		an entries file, the address is
+ * 		base 4
+ ***********************************************/
+static int add_symbols(const char *text, unsigned long member)
+{
+	unsigned long capacity = symbol_capacity ? symbol_capacity * 2 : MIN_SYMBOL_CAPACITY;
+	archive_symbol_t *grown;
+	const char *name;
+	unsigned long name_length;
+	unsigned long address;
+
+	while (*text) {
+		for (name = text; *text && *text != '\t' && *text != '\n'; text++)
+			;
+		name_length = text - name;
+		if (*text != '\t' || 0 == name_length) {
+			return 1;
+		}
+
+		for (address = 0, text++; *text >= '0' && *text <= '3'; text++) {
+			address = address * 4 + (*text - '0');
+		}
+		if (*text == '\n') {
+			text++;
+		} else if (*text) {
+			return 1;
+		}
+
+		if (symbol_count == symbol_capacity) {
+			grown = realloc(symbols, capacity * sizeof(*symbols));
+			if (NULL == grown) {
+				return 1;
+			}
+			symbols = grown;
+			symbol_capacity = capacity;
+			capacity *= 2;
+		}
+
+		symbols[symbol_count].name = strings.length;
+		symbols[symbol_count].name_length = name_length;
+		symbols[symbol_count].member = member;
+		symbols[symbol_count].address = address;
+		if (buffer_append(&strings, name, name_length)) {
+			return 1;
+		}
+		symbol_count++;
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: find_slot
+ * PARAMS: index - the archive index
+ * 	   member_count - number of members
+ * 	   symbols_count - number of symbols
+ * 	   slots_count - number of slots, a power
+ * 	   		 of two
+ * 	   name - the symbol name
+ * 	   length - the name length
+ * RETURN VALUE: the slot of the symbol, or the
+ * 		 free slot it would take
+ ***********************************************/
+static unsigned long find_slot(const unsigned char *index,
+			       unsigned long member_count,
+			       unsigned long symbols_count,
+			       unsigned long slots_count,
+			       const char *name,
+			       unsigned long length)
+{
+	const unsigned char *symbol_records = index + ARCHIVE_HEADER_LENGTH + \
+					      member_count * ARCHIVE_MEMBER_LENGTH;
+	const unsigned char *slots = symbol_records + symbols_count * ARCHIVE_SYMBOL_LENGTH;
+	const char *names = (const char *)slots + slots_count * ARCHIVE_SLOT_LENGTH;
+	const unsigned char *symbol;
+	unsigned long slot;
+	unsigned long symbol_index;
+
+	for (slot = hash_bytes(HASH_SEED, name, length) & (slots_count - 1);
+	     (symbol_index = get_number(slots + slot * ARCHIVE_SLOT_LENGTH, ARCHIVE_SLOT_LENGTH));
+	     slot = (slot + 1) & (slots_count - 1)) {
+		symbol = symbol_records + (symbol_index - 1) * ARCHIVE_SYMBOL_LENGTH;
+		if (get_number(symbol + 4, 4) == length && \
+		    memcmp(names + get_number(symbol, 4), name, length) == 0) {
+			break;
+		}
+	}
+	return slot;
+}
+
+/************************************************
+ * NAME: copy_file
+ * PARAMS: fp - the archive
+ * 	   filename - the member file
+ * 	   length - the member file length
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int copy_file(FILE *fp, const char *filename, unsigned long length)
+{
+	char chunk[COPY_CHUNK_LENGTH];
+	FILE *member = fopen(filename, "rb");
+	unsigned long count;
+
+	if (NULL == member) {
+		return 1;
+	}
+
+	for (; length; length -= count) {
+		count = fread(chunk, 1, length < COPY_CHUNK_LENGTH ? length : COPY_CHUNK_LENGTH, member);
+		if (0 == count || fwrite(chunk, 1, count, fp) != count) {
+			fclose(member);
+			return 1;
+		}
+	}
+
+	fclose(member);
+	return 0;
+}
+
+/************************************************
+ * NAME: pad
+ * PARAMS: fp - the archive
+ * 	   offset - the current offset
+ * 	   aligned - the offset to pad to
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int pad(FILE *fp, unsigned long offset, unsigned long aligned)
+{
+	for (; offset < aligned; offset++) {
+		if (EOF == fputc(0, fp)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: collect_symbols
+ * PARAMS: members - the members
+ * 	   count - number of members
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: collect the member names and the
+ * 		symbols of their .ent files
+ ***********************************************/
+static int collect_symbols(char *members[], int count)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	unsigned long length;
+	char *text;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (buffer_append(&strings, members[i], strlen(members[i]))) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+	}
+
+	/* a member without entries has no .ent file */
+	for (i = 0; i < count; i++) {
+		build_member_filename(filename, members[i], ARCHIVE_ENT);
+		if (NULL == (text = read_file(filename, &length))) {
+			continue;
+		}
+		if (add_symbols(text, i)) {
+			fprintf(stderr, "%s: malformed entries file\n", filename);
+			free(text);
+			return 1;
+		}
+		free(text);
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: member_record
+ * PARAMS: member - the member index
+ * RETURN VALUE: the record of the member in the
+ * 		 index being built
+ ***********************************************/
+static unsigned char *member_record(unsigned long member)
+{
+	return index_bytes + ARCHIVE_HEADER_LENGTH + member * ARCHIVE_MEMBER_LENGTH;
+}
+
+/************************************************
+ * NAME: build_index
+ * PARAMS: members - the members
+ * 	   count - number of members
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: fill the header and the member 
+ * 		records, the member files are laid
+ * 		out after the index
+ ***********************************************/
+static int build_index(char *members[], int count)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	unsigned long name_offset = 0;
+	unsigned long offset;
+	unsigned char *record;
+	struct stat st;
+	int i;
+	int j;
+
+	/* keep the load factor at most a half */
+	for (slot_count = MIN_SLOTS; slot_count < 2 * symbol_count; slot_count *= 2)
+		;
+
+	index_length = ARCHIVE_HEADER_LENGTH + \
+		       count * ARCHIVE_MEMBER_LENGTH + \
+		       symbol_count * ARCHIVE_SYMBOL_LENGTH + \
+		       slot_count * ARCHIVE_SLOT_LENGTH + \
+		       strings.length;
+	index_bytes = calloc(index_length, 1);
+	if (NULL == index_bytes) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	memcpy(index_bytes, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH);
+	put_number(index_bytes + HEADER_MEMBERS, count, 4);
+	put_number(index_bytes + HEADER_SYMBOLS, symbol_count, 4);
+	put_number(index_bytes + HEADER_SLOTS, slot_count, 4);
+	put_number(index_bytes + HEADER_STRINGS, strings.length, 4);
+	put_number(index_bytes + HEADER_INDEX_LENGTH, index_length, 8);
+	memcpy(index_bytes + index_length - strings.length, strings.data, strings.length);
+
+	offset = align(index_length);
+	for (i = 0; i < count; i++) {
+		record = member_record(i);
+		put_number(record, name_offset, 4);
+		put_number(record + 4, strlen(members[i]), 4);
+		name_offset += strlen(members[i]);
+
+		for (j = 0; j < ARCHIVE_FILES; j++) {
+			build_member_filename(filename, members[i], j);
+			if (stat(filename, &st)) {
+				/* only the object file is required */
+				if (ARCHIVE_OB == j) {
+					perror(filename);
+					return 1;
+				}
+				continue;
+			}
+			put_number(record + 8 + j * 16, offset, 8);
+			put_number(record + 16 + j * 16, st.st_size, 8);
+			offset = align(offset + st.st_size);
+		}
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: index_symbols
+ * PARAMS: members - the members
+ * 	   count - number of members
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: fill the symbol records and the
+ * 		slots, a symbol may be exported by
+ * 		a single member
+ ***********************************************/
+static int index_symbols(char *members[], int count)
+{
+	unsigned char *symbol_records = member_record(count);
+	unsigned char *slots = symbol_records + symbol_count * ARCHIVE_SYMBOL_LENGTH;
+	unsigned char *record;
+	unsigned long existing;
+	unsigned long slot;
+	unsigned long i;
+
+	for (i = 0; i < symbol_count; i++) {
+		slot = find_slot(index_bytes, count, symbol_count, slot_count,
+				 strings.data + symbols[i].name,
+				 symbols[i].name_length);
+		existing = get_number(slots + slot * ARCHIVE_SLOT_LENGTH, ARCHIVE_SLOT_LENGTH);
+		if (existing) {
+			fprintf(stderr, "%s: symbol %.*s already exported by %s\n",
+				members[symbols[i].member],
+				(int)symbols[i].name_length, strings.data + symbols[i].name,
+				members[get_number(symbol_records + (existing - 1) * ARCHIVE_SYMBOL_LENGTH + 8, 4)]);
+			return 1;
+		}
+
+		record = symbol_records + i * ARCHIVE_SYMBOL_LENGTH;
+		put_number(record, symbols[i].name, 4);
+		put_number(record + 4, symbols[i].name_length, 4);
+		put_number(record + 8, symbols[i].member, 4);
+		put_number(record + 12, symbols[i].address, 4);
+		put_number(slots + slot * ARCHIVE_SLOT_LENGTH, i + 1, ARCHIVE_SLOT_LENGTH);
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: write_archive
+ * PARAMS: filename - the archive
+ * 	   members - the members
+ * 	   count - number of members
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write the index and copy the 
+ * 		member files to their offsets
+ ***********************************************/
+static int write_archive(const char *filename, char *members[], int count)
+{
+	char member_filename[MAX_FILENAME_LENGTH];
+	FILE *fp = fopen(filename, "wb");
+	unsigned long offset = index_length;
+	unsigned char *record;
+	int failed = 0;
+	int i;
+	int j;
+
+	if (NULL == fp) {
+		perror(filename);
+		return 1;
+	}
+
+	failed = fwrite(index_bytes, 1, index_length, fp) != index_length;
+	for (i = 0; i < count && !failed; i++) {
+		record = member_record(i);
+		for (j = 0; j < ARCHIVE_FILES && !failed; j++) {
+			if (0 == get_number(record + 8 + j * 16, 8)) {
+				continue;
+			}
+			build_member_filename(member_filename, members[i], j);
+			failed = pad(fp, offset, get_number(record + 8 + j * 16, 8)) || \
+				 copy_file(fp, member_filename, get_number(record + 16 + j * 16, 8));
+			offset = get_number(record + 8 + j * 16, 8) + get_number(record + 16 + j * 16, 8);
+		}
+	}
+
+	if (fclose(fp) || failed) {
+		perror(filename);
+		remove(filename);
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: archive_create
+ * PARAMS: filename - the archive to create
+ * 	   members - the objects to pack, without
+ * 	             extention. the .ob file must
+ * 	             exist, the .ent and .ext 
+ * 	             files are packed if present
+ * 	   count - number of members
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: pack the objects and index the 
+ * 		symbols of their .ent files
+ ***********************************************/
+int archive_create(const char *filename, char *members[], int count)
+{
+	int failed;
+
+	buffer_init(&strings);
+	symbol_count = 0;
+
+	failed = collect_symbols(members, count) || \
+		 build_index(members, count) || \
+		 index_symbols(members, count) || \
+		 write_archive(filename, members, count);
+
+	free(index_bytes);
+	free(symbols);
+	buffer_free(&strings);
+	index_bytes = NULL;
+	symbols = NULL;
+	symbol_capacity = 0;
+	return failed;
+}
+
+/************************************************
+ * NAME: index_strings
+ * PARAMS: archive - an open archive
+ * RETURN VALUE: the strings of the index
+ ***********************************************/
+static const char *index_strings(const archive_t *archive)
+{
+	return (const char *)archive->index + \
+	       ARCHIVE_HEADER_LENGTH + \
+	       archive->member_count * ARCHIVE_MEMBER_LENGTH + \
+	       archive->symbol_count * ARCHIVE_SYMBOL_LENGTH + \
+	       archive->slot_count * ARCHIVE_SLOT_LENGTH;
+}
+
+/************************************************
+ * NAME: index_member
+ * PARAMS: archive - an open archive
+ * 	   member - the member index
+ * RETURN VALUE: the record of the member
+ ***********************************************/
+static const unsigned char *index_member(const archive_t *archive, unsigned long member)
+{
+	return archive->index + ARCHIVE_HEADER_LENGTH + member * ARCHIVE_MEMBER_LENGTH;
+}
+
+/************************************************
+ * NAME: check_index
+ * PARAMS: archive - an archive with its index
+ * 		     mapped
+ * 	   strings_length - length of the strings
+ * RETURN VALUE: an error message, NULL if the
+ * 		 records are in bounds
+ ***********************************************/
+static const char *check_index(const archive_t *archive, unsigned long strings_length)
+{
+	const unsigned char *record;
+	const unsigned char *slots;
+	unsigned long offset;
+	unsigned long length;
+	unsigned long slot;
+	unsigned long used = 0;
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < archive->member_count; i++) {
+		record = index_member(archive, i);
+		if (get_number(record, 4) + get_number(record + 4, 4) > strings_length) {
+			return "member name out of bounds";
+		}
+		for (j = 0; j < ARCHIVE_FILES; j++) {
+			offset = get_number(record + 8 + j * 16, 8);
+			length = get_number(record + 16 + j * 16, 8);
+			if (offset && (offset % ARCHIVE_ALIGNMENT || \
+				       offset > archive->file_length || \
+				       length > archive->file_length - offset)) {
+				return "member file out of bounds";
+			}
+		}
+	}
+
+	for (i = 0; i < archive->symbol_count; i++) {
+		record = index_member(archive, archive->member_count) + i * ARCHIVE_SYMBOL_LENGTH;
+		if (get_number(record, 4) + get_number(record + 4, 4) > strings_length || \
+		    get_number(record + 8, 4) >= archive->member_count) {
+			return "symbol out of bounds";
+		}
+	}
+
+	/* a lookup stops at an empty slot, a full table never stops */
+	if (archive->symbol_count >= archive->slot_count) {
+		return "symbol table is full";
+	}
+
+	slots = index_member(archive, archive->member_count) + \
+		archive->symbol_count * ARCHIVE_SYMBOL_LENGTH;
+	for (i = 0; i < archive->slot_count; i++) {
+		slot = get_number(slots + i * ARCHIVE_SLOT_LENGTH, ARCHIVE_SLOT_LENGTH);
+		if (slot > archive->symbol_count) {
+			return "slot out of bounds";
+		}
+		used += slot != 0;
+	}
+
+	/* the slots may repeat a symbol, so they're counted too */
+	if (used >= archive->slot_count) {
+		return "symbol table is full";
+	}
+
+	return NULL;
+}
+
+/************************************************
+ * NAME: archive_open
+ * PARAMS: archive - the archive to fill
+ * 	   filename - the archive file
+ * 	   error - set to an error message on a
+ * 	   	   malformed archive, NULL if the
+ * 	   	   system failed and errno is set
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: validate the header and map the
+ * 		index, the member files are mapped
+ * 		on demand
+ ***********************************************/
+int archive_open(archive_t *archive, const char *filename, const char **error)
+{
+	unsigned char header[ARCHIVE_HEADER_LENGTH];
+	unsigned long strings_length;
+	struct stat st;
+	void *map;
+
+	*error = NULL;
+	archive->index = NULL;
+	archive->fd = open(filename, O_RDONLY);
+	if (archive->fd < 0) {
+		return 1;
+	}
+
+	if (fstat(archive->fd, &st) || \
+	    read(archive->fd, header, sizeof(header)) != sizeof(header) || \
+	    memcmp(header, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH)) {
+		*error = "not an archive";
+		archive_close(archive);
+		return 1;
+	}
+
+	archive->file_length = st.st_size;
+	archive->member_count = get_number(header + HEADER_MEMBERS, 4);
+	archive->symbol_count = get_number(header + HEADER_SYMBOLS, 4);
+	archive->slot_count = get_number(header + HEADER_SLOTS, 4);
+	archive->index_length = get_number(header + HEADER_INDEX_LENGTH, 8);
+	strings_length = get_number(header + HEADER_STRINGS, 4);
+
+	/* the counts are 32 bit, so the sum can't overflow */
+	if (archive->slot_count < MIN_SLOTS || \
+	    (archive->slot_count & (archive->slot_count - 1)) || \
+	    archive->symbol_count > archive->slot_count || \
+	    archive->index_length > archive->file_length || \
+	    archive->index_length != ARCHIVE_HEADER_LENGTH + \
+				     archive->member_count * ARCHIVE_MEMBER_LENGTH + \
+				     archive->symbol_count * ARCHIVE_SYMBOL_LENGTH + \
+				     archive->slot_count * ARCHIVE_SLOT_LENGTH + \
+				     strings_length) {
+		*error = "malformed archive header";
+		archive_close(archive);
+		return 1;
+	}
+
+	map = mmap(NULL, archive->index_length, PROT_READ, MAP_PRIVATE, archive->fd, 0);
+	if (MAP_FAILED == map) {
+		archive_close(archive);
+		return 1;
+	}
+	archive->index = map;
+
+	if ((*error = check_index(archive, strings_length))) {
+		archive_close(archive);
+		return 1;
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: archive_close
+ * PARAMS: archive - an open archive
+ ***********************************************/
+void archive_close(archive_t *archive)
+{
+	if (archive->index) {
+		munmap((void *)archive->index, archive->index_length);
+		archive->index = NULL;
+	}
+	if (archive->fd >= 0) {
+		close(archive->fd);
+		archive->fd = -1;
+	}
+}
+
+/************************************************
+ * NAME: archive_member_name
+ * PARAMS: archive - an open archive
+ * 	   member - the member index
+ * 	   length - the name length
+ * RETURN VALUE: the member name, not null 
+ * 		 terminated
+ ***********************************************/
+const char *archive_member_name(const archive_t *archive, unsigned long member, unsigned long *length)
+{
+	const unsigned char *record = index_member(archive, member);
+
+	*length = get_number(record + 4, 4);
+	return index_strings(archive) + get_number(record, 4);
+}
+
+/************************************************
+ * NAME: archive_member_length
+ * PARAMS: archive - an open archive
+ * 	   member - the member index
+ * 	   file - the member file
+ * RETURN VALUE: the file length, 0 if the member
+ * 		 doesn't have it
+ ***********************************************/
+unsigned long archive_member_length(const archive_t *archive, unsigned long member, archive_file_t file)
+{
+	return get_number(index_member(archive, member) + 16 + file * 16, 8);
+}
+
+/************************************************
+ * NAME: archive_find_member
+ * PARAMS: archive - an open archive
+ * 	   name - the member name
+ * 	   member - the member index, if found
+ * RETURN VALUE: 1 if not found, 0 on success
+ ***********************************************/
+int archive_find_member(const archive_t *archive, const char *name, unsigned long *member)
+{
+	unsigned long name_length = strlen(name);
+	unsigned long length;
+	const char *member_name;
+	unsigned long i;
+
+	for (i = 0; i < archive->member_count; i++) {
+		member_name = archive_member_name(archive, i, &length);
+		if (length == name_length && memcmp(member_name, name, length) == 0) {
+			*member = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/************************************************
+ * NAME: archive_find_symbol
+ * PARAMS: archive - an open archive
+ * 	   name - the symbol name
+ * 	   member - the member exporting it
+ * 	   address - the symbol address
+ * RETURN VALUE: 1 if not found, 0 on success
+ ***********************************************/
+int archive_find_symbol(const archive_t *archive,
+			const char *name,
+			unsigned long *member,
+			unsigned long *address)
+{
+	const unsigned char *symbol_records = index_member(archive, archive->member_count);
+	const unsigned char *slots = symbol_records + archive->symbol_count * ARCHIVE_SYMBOL_LENGTH;
+	const unsigned char *symbol;
+	unsigned long length = strlen(name);
+	unsigned long slot;
+	unsigned long symbol_index;
+
+	if (0 == archive->symbol_count) {
+		return 1;
+	}
+
+	slot = find_slot(archive->index,
+			 archive->member_count,
+			 archive->symbol_count,
+			 archive->slot_count,
+			 name,
+			 length);
+	symbol_index = get_number(slots + slot * ARCHIVE_SLOT_LENGTH, ARCHIVE_SLOT_LENGTH);
+	if (0 == symbol_index) {
+		return 1;
+	}
+
+	symbol = symbol_records + (symbol_index - 1) * ARCHIVE_SYMBOL_LENGTH;
+	*member = get_number(symbol + 8, 4);
+	*address = get_number(symbol + 12, 4);
+	return 0;
+}
+
+/************************************************
+ * NAME: archive_map
+ * PARAMS: archive - an open archive
+ * 	   member - the member index
+ * 	   file - the member file
+ * 	   view - the mapped file
+ * RETURN VALUE: 1 on error or if the member
+ * 		 doesn't have the file, 0 on 
+ * 		 success
+ ***********************************************/
+int archive_map(const archive_t *archive,
+		unsigned long member,
+		archive_file_t file,
+		archive_view_t *view)
+{
+	const unsigned char *record = index_member(archive, member);
+	unsigned long offset = get_number(record + 8 + file * 16, 8);
+	void *map;
+
+	view->map = NULL;
+	view->map_length = 0;
+	view->data = "";
+	view->length = get_number(record + 16 + file * 16, 8);
+	if (0 == offset) {
+		return 1;
+	}
+
+	/* an empty file has nothing to map */
+	if (0 == view->length) {
+		return 0;
+	}
+
+	map = mmap(NULL, view->length, PROT_READ, MAP_PRIVATE, archive->fd, offset);
+	if (MAP_FAILED == map) {
+		return 1;
+	}
+
+	view->map = map;
+	view->map_length = view->length;
+	view->data = map;
+	return 0;
+}
+
+/************************************************
+ * NAME: archive_unmap
+ * PARAMS: view - a mapped file
+ ***********************************************/
+void archive_unmap(archive_view_t *view)
+{
+	if (view->map) {
+		munmap(view->map, view->map_length);
+		view->map = NULL;
+	}
+}
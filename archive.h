@@ -0,0 +1,48 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+/* the files of an archive member */
+typedef enum {
+	ARCHIVE_OB,
+	ARCHIVE_ENT,
+	ARCHIVE_EXT
+} archive_file_t;
+
+#define ARCHIVE_FILES (3)
+
+/* an open archive, only the header and the index are mapped */
+typedef struct {
+	int fd;
+	const unsigned char *index;
+	unsigned long index_length;
+	unsigned long member_count;
+	unsigned long symbol_count;
+	unsigned long slot_count;
+	unsigned long file_length;
+} archive_t;
+
+/* a mapped file of a member */
+typedef struct {
+	void *map;
+	unsigned long map_length;
+	const char *data;
+	unsigned long length;
+} archive_view_t;
+
+int archive_create(const char *filename, char *members[], int count);
+int archive_open(archive_t *archive, const char *filename, const char **error);
+void archive_close(archive_t *archive);
+const char *archive_member_name(const archive_t *archive, unsigned long member, unsigned long *length);
+unsigned long archive_member_length(const archive_t *archive, unsigned long member, archive_file_t file);
+int archive_find_member(const archive_t *archive, const char *name, unsigned long *member);
+int archive_find_symbol(const archive_t *archive,
+			const char *name,
+			unsigned long *member,
+			unsigned long *address);
+int archive_map(const archive_t *archive,
+		unsigned long member,
+		archive_file_t file,
+		archive_view_t *view);
+void archive_unmap(archive_view_t *view);
+
+#endif /* end of include guard: ARCHIVE_H */
@@ -0,0 +1,187 @@
+#include <stdlib.h> /* for malloc and free */
+#include <string.h> /* for memcpy */
+
+#include "arena.h"
+
+/* =============================================
+ * =============================================
+ * Note: an arena hands out memory from a list
+ * of chunks. a reset only rewinds to the first
+ * chunk, so once the arena grew to fit the 
+ * biggest file no more chunks are allocated.
+ * a pinned arena (pins above zero) still has
+ * memory in use by another thread, like an 
+ * asynchronous write, and is not reset before 
+ * it is unpinned.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+/* allocations are aligned for any type */
+typedef union {
+	long l;
+	double d;
+	void *p;
+} arena_align_t;
+
+#define ALIGN(size) (((size) + sizeof(arena_align_t) - 1) / sizeof(arena_align_t) * sizeof(arena_align_t))
+#define CHUNK_DATA(chunk) ((char *)(chunk) + ALIGN(sizeof(arena_chunk_t)))
+
+/************************************************
+ * NAME: arena_init
+ * PARAMS: arena - the arena to init
+ * DESCRIPTION: init an empty arena
+ ***********************************************/
+void arena_init(arena_t *arena)
+{
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->used = 0;
+	arena->in_use = 0;
+	arena->high_water = 0;
+	arena->chunks = 0;
+	arena->last = NULL;
+	arena->pins = 0;
+}
+
+/************************************************
+ * NAME: arena_free
+ * PARAMS: arena - the arena to free
+ * DESCRIPTION: release all the arena chunks
+ ***********************************************/
+void arena_free(arena_t *arena)
+{
+	arena_chunk_t *next;
+
+	for (; arena->first; arena->first = next) {
+		next = arena->first->next;
+		free(arena->first);
+	}
+	arena_init(arena);
+}
+
+/************************************************
+ * NAME: arena_reset
+ * PARAMS: arena - the arena to reset
+ * DESCRIPTION: release all the allocations at 
+ * 		once, the chunks are kept for reuse
+ ***********************************************/
+void arena_reset(arena_t *arena)
+{
+	arena->current = arena->first;
+	arena->used = 0;
+	arena->in_use = 0;
+	arena->last = NULL;
+}
+
+/************************************************
+ * NAME: next_chunk
+ * PARAMS: arena - the arena
+ * 	   size - the allocation that must fit
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: move to a kept chunk or allocate
+ * 		a new one, each new chunk is at 
+ * 		least twice the size of the last
+ ***********************************************/
+static int next_chunk(arena_t *arena, unsigned long size)
+{
+	arena_chunk_t *chunk = arena->current ? arena->current->next : arena->first;
+	unsigned long chunk_size = MIN_CHUNK_SIZE;
+	arena_chunk_t *last;
+
+	/* reuse the chunks kept from earlier files */
+	for (; chunk; chunk = chunk->next) {
+		arena->current = chunk;
+		arena->used = 0;
+		if (size <= chunk->size) {
+			return 0;
+		}
+	}
+
+	for (last = arena->current; last && last->next; last = last->next);
+	if (last && chunk_size < last->size * 2) {
+		chunk_size = last->size * 2;
+	}
+	while (chunk_size < size) {
+		chunk_size *= 2;
+	}
+
+	chunk = malloc(ALIGN(sizeof(arena_chunk_t)) + chunk_size);
+	if (NULL == chunk) {
+		return 1;
+	}
+	chunk->next = NULL;
+	chunk->size = chunk_size;
+	if (last) {
+		last->next = chunk;
+	} else {
+		arena->first = chunk;
+	}
+
+	arena->current = chunk;
+	arena->used = 0;
+	arena->chunks++;
+	return 0;
+}
+
+/************************************************
+ * NAME: arena_alloc
+ * PARAMS: arena - the arena
+ * 	   size - the allocation size
+ * RETURN VALUE: the allocated memory, NULL on 
+ * 		 error
+ ***********************************************/
+void *arena_alloc(arena_t *arena, unsigned long size)
+{
+	size = ALIGN(size ? size : 1);
+
+	if ((NULL == arena->current || arena->used + size > arena->current->size) && \
+	    next_chunk(arena, size)) {
+		return NULL;
+	}
+
+	arena->last = CHUNK_DATA(arena->current) + arena->used;
+	arena->used += size;
+	arena->in_use += size;
+	if (arena->in_use > arena->high_water) {
+		arena->high_water = arena->in_use;
+	}
+	return arena->last;
+}
+
+/************************************************
+ * NAME: arena_grow
+ * PARAMS: arena - the arena
+ * 	   data - an allocation, NULL for none
+ * 	   size - its size
+ * 	   new_size - the size it should grow to
+ * RETURN VALUE: the grown allocation, NULL on 
+ * 		 error
+ * DESCRIPTION: grow an allocation, in place if 
+ * 		it is the last one and its chunk has
+ * 		room, else by copying it
+ ***********************************************/
+void *arena_grow(arena_t *arena, void *data, unsigned long size, unsigned long new_size)
+{
+	unsigned long grow;
+	void *grown;
+
+	if (data && data == arena->last) {
+		grow = ALIGN(new_size) - ALIGN(size);
+		if (arena->used + grow <= arena->current->size) {
+			arena->used += grow;
+			arena->in_use += grow;
+			if (arena->in_use > arena->high_water) {
+				arena->high_water = arena->in_use;
+			}
+			return data;
+		}
+	}
+
+	grown = arena_alloc(arena, new_size);
+	if (grown && data) {
+		memcpy(grown, data, size);
+	}
+	return grown;
+}
@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/* a chunk of arena memory, the memory follows the header */
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	unsigned long size;
+} arena_chunk_t;
+
+/* a bump allocator for the memory of a single source
+ * file, everything is released at once by arena_reset
+ * and the chunks are reused by the next file */
+typedef struct {
+	arena_chunk_t *first;
+	arena_chunk_t *current;
+	unsigned long used; /* bytes used in the current chunk */
+	unsigned long in_use; /* bytes allocated since the last reset */
+	unsigned long high_water; /* the most bytes ever in use */
+	unsigned long chunks; /* number of chunks allocated */
+	void *last; /* the last allocation, it can grow in place */
+	unsigned int pins; /* users that must finish before a reset */
+} arena_t;
+
+void arena_init(arena_t *arena);
+void arena_free(arena_t *arena);
+void arena_reset(arena_t *arena);
+void *arena_alloc(arena_t *arena, unsigned long size);
+void *arena_grow(arena_t *arena, void *data, unsigned long size, unsigned long new_size);
+
+#endif /* end of include guard: ARENA_H */
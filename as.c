@@ -1,45 +1,502 @@
 #include <stdio.h> /* for fopen, fclose, fgets */
 #include <stdlib.h> /* for EXIT_SUCCESS */
 #include <string.h> /* for strncpy and strncat */
-#include <ctype.h> /* for isspace */
+#include <ctype.h> /* for isspace and toupper */
 
 #include "consts.h"
 #include "types.h"
 #include "table.h"
 #include "parse.h"
 #include "output.h"
+#include "io.h"
+#include "watch.h"
+#include "datafile.h"
+#include "optimize.h"
+#include "outline.h"
+#include "trace.h"
+#include "arena.h"
+#include "link.h"
+#include "lsp.h"
+#include "define.h"
+#include "gc.h"
+#include "pipeline.h"
+#include "symfile.h"
+#include "mapfile.h"
 
 /**************************************
- * NAME: process_assembly_file 
+ * NAME: build_source_filename 
+ * PARAMS: actual_source_filename - output
+ * 	   buffer of MAX_FILENAME_LENGTH bytes
+ * 	   source_filename - the source filename 
+ *         without the .as extention
+ *************************************/
+static void build_source_filename(char *actual_source_filename, const char *source_filename)
+{
+	/* actual_source_filename <- source_filename + ".as" */
+	strncpy(actual_source_filename, source_filename, MAX_FILENAME_LENGTH);
+	strncat(actual_source_filename, ".as", MAX_FILENAME_LENGTH - strlen(source_filename));
+}
+
+/* command line options */
+static int watch_mode = 0;
+static int optimize = 0;
+static int outline = 0;
+static int gc_unused_data = 0;
+static int pipelined = 0;
+static unsigned long memory_limit = 0; /* 0 for no limit */
+static const char *trace_filename = NULL;
+static int arena_stats = 0;
+static int link_check = 0;
+static int lsp_mode = 0;
+static int strings_pooled = 0;
+static const char *symbols_filename = NULL; /* labels every source starts with */
+static const char *precompiled_filename = NULL; /* symbol file to create */
+
+/* a source uses the arena of its slot from its prefetch 
+ * until its outputs are written, the slot is reused 
+ * UNIT_ARENAS sources later */
+#define UNIT_ARENAS (IO_PREFETCH_DEPTH + 2)
+static arena_t unit_arenas[UNIT_ARENAS];
+static unsigned long units_started = 0;
+
+/**************************************
+ * NAME: start_unit
+ * RETURN VALUE: the arena of the next 
+ * 		 source
+ * DESCRIPTION: reset the next arena slot
+ * 		once the writes of its last
+ * 		source are done
+ *************************************/
+static arena_t *start_unit(void)
+{
+	arena_t *arena = &unit_arenas[units_started++ % UNIT_ARENAS];
+
+	io_wait_arena(arena);
+	arena_reset(arena);
+	return arena;
+}
+
+/**************************************
+ * NAME: use_arena
+ * PARAMS: arena - the arena of the 
+ * 		   source to assemble
+ *************************************/
+static void use_arena(arena_t *arena)
+{
+	parse_set_arena(arena);
+	output_set_arena(arena);
+}
+
+/**************************************
+ * NAME: process_optimized_file 
+ * PARAMS: actual_source_filename - the 
+ * 	   source filename
+ *	   source_filename - the source 
+ *	   filename without the .as extention
+ * DESCRIPTION: collect the instructions of
+ * 		the second pass, optimize them,
+ * 		outline them or drop the unused
+ * 		data and only then output them
+ *************************************/
+static int process_optimized_file(char *actual_source_filename, const char *source_filename)
+{
+	unsigned long saved;
+
+	optimize_reset();
+	if (parse_first_pass(actual_source_filename) || parse_second_pass(optimize_add)) {
+		return 1;
+	}
+
+	if (optimize) {
+		trace_begin("optimize", source_filename);
+		if (optimize_program(&saved)) {
+			trace_end();
+			fprintf(stderr, "%s: out of memory\n", source_filename);
+			return 1;
+		}
+		trace_end();
+		printf("%s: optimization saved %lu words\n", actual_source_filename, saved);
+	}
+
+	if (outline) {
+		trace_begin("outline", source_filename);
+		if (outline_program(&saved)) {
+			trace_end();
+			fprintf(stderr, "%s: out of memory\n", source_filename);
+			return 1;
+		}
+		trace_end();
+		printf("%s: outlining saved %lu words\n", actual_source_filename, saved);
+	}
+
+	if (gc_unused_data) {
+		trace_begin("gc_data", source_filename);
+		if (gc_data(&saved)) {
+			trace_end();
+			fprintf(stderr, "%s: out of memory\n", source_filename);
+			return 1;
+		}
+		trace_end();
+		printf("%s: gc-data removed %lu words\n", actual_source_filename, saved);
+	}
+
+	if (output_open(source_filename)) {
+		return 1;
+	}
+	trace_begin("output_code", source_filename);
+	optimize_replay(output_full_instruction);
+	trace_end();
+	return output_close(0);
+}
+
+/**************************************
+ * NAME: discard_instruction
+ * PARAMS: instruction - an instruction 
+ * 	   of the second pass
+ *************************************/
+static void discard_instruction(full_instruction_t *instruction)
+{
+}
+
+/**************************************
+ * NAME: precompile_symbols 
+ * PARAMS: source_filename - the source 
+ * 	   filename without the .as 
+ * 	   extention
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: parse a source that only
+ * 		declares labels and write 
+ * 		its labels table to a symbol
+ * 		file
+ *************************************/
+static int precompile_symbols(const char *source_filename)
+{
+	char actual_source_filename[MAX_FILENAME_LENGTH];
+
+	build_source_filename(actual_source_filename, source_filename);
+	if (parse_first_pass(actual_source_filename) || parse_second_pass(discard_instruction)) {
+		return 1;
+	}
+	return symfile_write(precompiled_filename);
+}
+
+/**************************************
+ * NAME: assemble_file 
  * PARAMS: source_filename - the source filename 
  *         without the .as extention
  *************************************/
-static int process_assembly_file(const char * source_filename)
+static int assemble_file(const char * source_filename)
 {
 	/* filename with .as extention */
 	char actual_source_filename[MAX_FILENAME_LENGTH];
 
-	/* actual_source_filename <- source_filename + ".as" */
-	strncpy(actual_source_filename, source_filename, MAX_FILENAME_LENGTH);
-	strncat(actual_source_filename, ".as", MAX_FILENAME_LENGTH - strlen(source_filename));
+	build_source_filename(actual_source_filename, source_filename);
+
+	if (optimize || outline || gc_unused_data) {
+		return process_optimized_file(actual_source_filename, source_filename);
+	}
+
+	/* the second pass, the encoding and the writing on 
+	 * threads of their own */
+	if (pipelined) {
+		return pipeline_assemble(actual_source_filename, source_filename);
+	}
+
+	/* run the first pass, if succeedes the output files are 
+	 * created and the instructions are encoded while the
+	 * second pass parses them */
+	if (parse_first_pass(actual_source_filename)) {
+		return 1;
+	}
+	if (output_open(source_filename)) {
+		parse_release();
+		return 1;
+	}
+
+	return output_close(parse_second_pass(output_full_instruction));
+}
+
+/**************************************
+ * NAME: process_assembly_file 
+ * PARAMS: source_filename - the source filename 
+ *         without the .as extention
+ *************************************/
+static int process_assembly_file(const char * source_filename)
+{
+	int rc;
+
+	trace_begin("assemble", source_filename);
+	rc = assemble_file(source_filename);
+	trace_end();
+
+	/* only a source that assembled publishes its symbols, 
+	 * watch mode publishes the symbols it keeps */
+	if (link_check && !watch_mode && 0 == rc) {
+		link_set_file(source_filename);
+		loop_labels(link_add_label);
+	}
 
-	/* try to parse file, if succeedes create output files */
-	return parse_file(actual_source_filename) || output(source_filename);
+	return rc;
+}
+
+/***************************************
+ * NAME: process_watched_file
+ * PARAMS: source_filename - the source 
+ *         filename without the .as 
+ *         extention
+ * DESCRIPTION: reassemble a changed 
+ * 		source in the next arena
+ **************************************/
+static int process_watched_file(const char *source_filename)
+{
+	use_arena(start_unit());
+	return process_assembly_file(source_filename);
+}
+
+/***************************************
+ * NAME: publish_symbol
+ * PARAMS: source_filename - the source 
+ * 	   of the label
+ * 	   label - a label kept by watch mode
+ **************************************/
+static void publish_symbol(const char *source_filename, label_t *label)
+{
+	link_set_file(source_filename);
+	link_add_label(label);
+}
+
+/***************************************
+ * NAME: check_watched_links
+ * DESCRIPTION: check the entries and 
+ * 		externs across the symbol 
+ * 		tables kept by watch mode
+ **************************************/
+static void check_watched_links(void)
+{
+	link_release();
+	watch_loop_symbols(publish_symbol);
+	link_report();
+}
+
+/***************************************
+ * NAME: report_arenas
+ * DESCRIPTION: print the arena high-water 
+ * 		mark and the chunks allocated
+ **************************************/
+static void report_arenas(void)
+{
+	unsigned long high_water = 0;
+	unsigned long chunks = 0;
+	int i;
+
+	for (i = 0; i < UNIT_ARENAS; i++) {
+		if (unit_arenas[i].high_water > high_water) {
+			high_water = unit_arenas[i].high_water;
+		}
+		chunks += unit_arenas[i].chunks;
+	}
+
+	printf("arena high-water: %lu bytes per source, %lu chunks allocated\n", high_water, chunks);
+}
+
+/***************************************
+ * NAME: parse_memory_limit
+ * PARAMS: value - a byte count with an
+ * 		   optional K, M or G suffix
+ * RETURN VALUE: the limit in bytes, 0 on
+ * 		 error or if it's too small to 
+ * 		 bound the memory
+ **************************************/
+static unsigned long parse_memory_limit(const char *value)
+{
+	char *end;
+	unsigned long bytes = strtoul(value, &end, 10);
+
+	switch (toupper((unsigned char)*end)) {
+		case 'G':
+			bytes *= 1024;
+		case 'M': /* FALLTHROUGH */
+			bytes *= 1024;
+		case 'K': /* FALLTHROUGH */
+			bytes *= 1024;
+			end++;
+			break;
+	}
+
+	return *end == '\0' && bytes >= MIN_MEMORY_LIMIT ? bytes : 0;
+}
+
+/***************************************
+ * NAME: parse_options
+ * PARAMS: argc, argv - the command line
+ * RETURN VALUE: index of the first source
+ * DESCRIPTION: parse the options before the
+ * 		sources, exits on unknown options
+ **************************************/
+static int parse_options(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "--watch") == 0) {
+			watch_mode = 1;
+		} else if (strncmp(argv[i], "--trace=", strlen("--trace=")) == 0) {
+			trace_filename = argv[i] + strlen("--trace=");
+		} else if (strcmp(argv[i], "--arena-stats") == 0) {
+			arena_stats = 1;
+		} else if (strcmp(argv[i], "--link-check") == 0) {
+			link_check = 1;
+		} else if (strcmp(argv[i], "--lsp") == 0) {
+			lsp_mode = 1;
+		} else if (strcmp(argv[i], "-O") == 0) {
+			optimize = 1;
+		} else if (strcmp(argv[i], "--outline") == 0) {
+			outline = 1;
+		} else if (strcmp(argv[i], "--map") == 0) {
+			output_add_emitter(&mapfile_emitter);
+		} else if (strcmp(argv[i], "--pipeline") == 0) {
+			pipelined = 1;
+		} else if (strcmp(argv[i], "--gc-data") == 0) {
+			gc_unused_data = 1;
+		} else if (strcmp(argv[i], "--pool-strings") == 0) {
+			strings_pooled = 1;
+			parse_set_string_pool(1);
+		} else if (strncmp(argv[i], "--symbols=", strlen("--symbols=")) == 0) {
+			symbols_filename = argv[i] + strlen("--symbols=");
+		} else if (strncmp(argv[i], "--precompile-symbols=", strlen("--precompile-symbols=")) == 0) {
+			precompiled_filename = argv[i] + strlen("--precompile-symbols=");
+		} else if (strncmp(argv[i], "--max-memory=", strlen("--max-memory=")) == 0) {
+			memory_limit = parse_memory_limit(argv[i] + strlen("--max-memory="));
+			if (0 == memory_limit) {
+				fprintf(stderr, "invalid memory limit: %s (at least %luK)\n", 
+					argv[i], 
+					(unsigned long)MIN_MEMORY_LIMIT / 1024);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			fprintf(stderr, "unknown option: %s\n", argv[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* pooled strings share their words, they can't be cut into blocks */
+	if (gc_unused_data && strings_pooled) {
+		fprintf(stderr, "--gc-data can't be used with --pool-strings\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* a symbol file is the table of a single source */
+	if (precompiled_filename && argc - i != 1) {
+		fprintf(stderr, "--precompile-symbols takes a single source\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return i;
 }
 
 /***************************************
  * NAME: main
  **************************************/
-int main(int argc, const char *argv[])
+int main(int argc, char *argv[])
 {
+	char actual_source_filename[MAX_FILENAME_LENGTH];
+	int first = parse_options(argc, argv);
+	/* a bounded run streams each source instead of reading ahead */
+	int batch = argc - first > 1 && 0 == memory_limit;
+	int prefetched = first;
 	int i;
 	int rc = 0;
 
-	for (i = 1; i < argc; i++) {
+	if (trace_filename && trace_open(trace_filename)) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (symbols_filename && symfile_load(symbols_filename)) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (precompiled_filename) {
+		rc = precompile_symbols(argv[first]);
+		symfile_release();
+		rc |= trace_close();
+		exit(rc ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	for (i = 0; i < UNIT_ARENAS; i++) {
+		arena_init(&unit_arenas[i]);
+	}
+
+	/* in watch mode outputs are written only when they change */
+	if (watch_mode) {
+		output_set_writer(watch_write);
+	}
+
+	/* half of the memory limit is for the data section and 
+	 * the rest is shared by the three output files */
+	if (memory_limit) {
+		parse_set_memory_limit(memory_limit / 2);
+		output_set_spill_limit(memory_limit / 6);
+	}
+
+	/* in batch mode the upcoming sources are read and the
+	 * finished outputs are written while assembling */
+	if (batch) {
+		io_init();
+	}
+
+	/* in language server mode the sources come from the editor */
+	if (lsp_mode) {
+		rc |= lsp_serve();
+	}
+
+	/* watch mode assembles the sources it watches */
+	for (i = watch_mode ? argc : first; i < argc; i++) {
+		for (; batch && prefetched < argc && prefetched <= i + IO_PREFETCH_DEPTH; prefetched++) {
+			build_source_filename(actual_source_filename, argv[prefetched]);
+			io_prefetch(actual_source_filename, start_unit());
+		}
+
+		/* the sources are started in order so their arenas 
+		 * are found by their index */
+		if (!batch) {
+			start_unit();
+		}
+		use_arena(&unit_arenas[(i - first) % UNIT_ARENAS]);
+
 		/* using bitwise or to collect any error */
 		rc |= process_assembly_file(argv[i]);
 	}
 
+	if (batch) {
+		rc |= io_shutdown();
+	}
+
+	/* the entries and externs are checked across all the sources */
+	if (link_check && !watch_mode) {
+		rc |= link_report();
+		link_release();
+	}
+
+	if (watch_mode) {
+		rc |= watch_sources(argv + first, 
+				    argc - first, 
+				    process_watched_file, 
+				    link_check ? check_watched_links : NULL);
+	}
+
+	if (arena_stats) {
+		report_arenas();
+	}
+
+	for (i = 0; i < UNIT_ARENAS; i++) {
+		arena_free(&unit_arenas[i]);
+	}
+	datafile_release();
+	define_release();
+	gc_release();
+	symfile_release();
+	rc |= trace_close();
+
 	/* return exit code compatible with stdlib */
 	exit(rc ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,236 @@
+#include <stdio.h> /* for fopen, fwrite and printf */
+#include <stdlib.h> /* for EXIT_SUCCESS */
+#include <string.h> /* for strcmp and strncpy */
+
+#include "consts.h"
+#include "archive.h"
+
+/* =============================================
+ * =============================================
+ * asar - pack the outputs of the assembler into
+ * an object archive with an indexed symbol table:
+ *
+ *   asar c archive object...   create an archive
+ *   asar t archive             list the members
+ *   asar x archive [object...] extract members
+ *   asar s archive symbol...   find the members
+ *                              exporting symbols
+ *
+ * objects are given without the .ob extention,
+ * their .ent and .ext files are packed when 
+ * present. the symbol table is built from the
+ * .ent files, a symbol is printed with its 
+ * member and its base 4 address like in the 
+ * .ent file.
+ * ==============================================
+ * ============================================*/
+
+#define ADDRESS_DIGITS (10)
+
+static const char *extentions[ARCHIVE_FILES] = {".ob", ".ent", ".ext"};
+
+/************************************************
+ * NAME: open_archive
+ * PARAMS: archive - the archive to fill
+ * 	   filename - the archive file
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int open_archive(archive_t *archive, const char *filename)
+{
+	const char *error;
+
+	if (archive_open(archive, filename, &error)) {
+		if (error) {
+			fprintf(stderr, "%s: %s\n", filename, error);
+		} else {
+			perror(filename);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: list_members
+ * PARAMS: filename - the archive
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int list_members(const char *filename)
+{
+	archive_t archive;
+	const char *name;
+	unsigned long length;
+	unsigned long i;
+	int j;
+
+	if (open_archive(&archive, filename)) {
+		return 1;
+	}
+
+	for (i = 0; i < archive.member_count; i++) {
+		name = archive_member_name(&archive, i, &length);
+		printf("%.*s", (int)length, name);
+		for (j = 0; j < ARCHIVE_FILES; j++) {
+			printf("\t%lu", archive_member_length(&archive, i, j));
+		}
+		printf("\n");
+	}
+
+	archive_close(&archive);
+	return 0;
+}
+
+/************************************************
+ * NAME: extract_member
+ * PARAMS: archive - an open archive
+ * 	   member - the member index
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write the files of a member to 
+ * 		the current directory
+ ***********************************************/
+static int extract_member(const archive_t *archive, unsigned long member)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	archive_view_t view;
+	const char *name;
+	unsigned long length;
+	FILE *fp;
+	int failed = 0;
+	int j;
+
+	name = archive_member_name(archive, member, &length);
+	for (j = 0; j < ARCHIVE_FILES && !failed; j++) {
+		if (archive_map(archive, member, j, &view)) {
+			continue;
+		}
+
+		sprintf(filename, "%.*s%s",
+			(int)(length < MAX_FILENAME_LENGTH - 5 ? length : MAX_FILENAME_LENGTH - 5),
+			name, extentions[j]);
+		if (NULL == (fp = fopen(filename, "wb"))) {
+			perror(filename);
+			failed = 1;
+		} else {
+			failed = fwrite(view.data, 1, view.length, fp) != view.length;
+			if (fclose(fp) || failed) {
+				perror(filename);
+				failed = 1;
+			}
+		}
+		archive_unmap(&view);
+	}
+
+	return failed;
+}
+
+/************************************************
+ * NAME: extract_members
+ * PARAMS: filename - the archive
+ * 	   names - the members to extract, all
+ * 	   	   members if none are given
+ * 	   count - number of names
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int extract_members(const char *filename, char *names[], int count)
+{
+	archive_t archive;
+	unsigned long member;
+	int rc = 0;
+	int i;
+
+	if (open_archive(&archive, filename)) {
+		return 1;
+	}
+
+	if (0 == count) {
+		for (member = 0; member < archive.member_count; member++) {
+			rc |= extract_member(&archive, member);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (archive_find_member(&archive, names[i], &member)) {
+			fprintf(stderr, "%s: no member %s\n", filename, names[i]);
+			rc = 1;
+			continue;
+		}
+		rc |= extract_member(&archive, member);
+	}
+
+	archive_close(&archive);
+	return rc;
+}
+
+/************************************************
+ * NAME: find_symbols
+ * PARAMS: filename - the archive
+ * 	   names - the symbols to find
+ * 	   count - number of names
+ * RETURN VALUE: 1 if a symbol wasn't found or
+ * 		 on error, 0 on success
+ ***********************************************/
+static int find_symbols(const char *filename, char *names[], int count)
+{
+	char digits[ADDRESS_DIGITS + 1];
+	archive_t archive;
+	const char *member_name;
+	unsigned long length;
+	unsigned long member;
+	unsigned long address;
+	int rc = 0;
+	int i;
+	int j;
+
+	if (open_archive(&archive, filename)) {
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (archive_find_symbol(&archive, names[i], &member, &address)) {
+			fprintf(stderr, "%s: symbol %s isn't exported\n", filename, names[i]);
+			rc = 1;
+			continue;
+		}
+
+		for (j = ADDRESS_DIGITS - 1; j >= 0; j--, address /= 4) {
+			digits[j] = '0' + address % 4;
+		}
+		digits[ADDRESS_DIGITS] = '\0';
+
+		member_name = archive_member_name(&archive, member, &length);
+		printf("%s\t%.*s\t%s\n", names[i], (int)length, member_name, digits);
+	}
+
+	archive_close(&archive);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	if (argc < 3 || strlen(argv[1]) != 1) {
+		fprintf(stderr, "usage: %s c|t|x|s archive [name...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	switch (argv[1][0]) {
+	case 'c':
+		rc = archive_create(argv[2], argv + 3, argc - 3);
+		break;
+	case 't':
+		rc = list_members(argv[2]);
+		break;
+	case 'x':
+		rc = extract_members(argv[2], argv + 3, argc - 3);
+		break;
+	case 's':
+		rc = find_symbols(argv[2], argv + 3, argc - 3);
+		break;
+	default:
+		fprintf(stderr, "unknown command %s\n", argv[1]);
+		rc = 1;
+	}
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,784 @@
+#ifndef ASSEMBLE_HPP
+#define ASSEMBLE_HPP
+
+#include <array> /* for std::array */
+#include <cstddef> /* for std::size_t */
+#include <limits> /* for std::numeric_limits */
+#include <string_view> /* for std::string_view */
+
+#include "consts.h"
+#include "types.h"
+#include "isa.def"
+
+/* =============================================
+ * =============================================
+ * Note: a C++17 front end that assembles a
+ * source held in a string literal inside a
+ * constant expression:
+ *
+ *   constexpr auto program = AS_ASSEMBLE(
+ *   	"MAIN:\tmov/0\t#5, r1\n"
+ *   	"\tstop/0\n");
+ *
+ * program.words holds the words of the .ob file
+ * in order, the code and then the data, and
+ * program.linkage the linker letter of every
+ * word. it follows the parser in parse.c rule
+ * for rule, the instructions and the address
+ * modes come from isa.def and the instruction
+ * word layout from consts.h, so the words are
+ * the ones the assembler writes.
+ * assemble_check.cpp compares them to an .ob
+ * file of as (make check-assemble).
+ *
+ * an error throws as::assembly_error, which in
+ * a constant expression is a compile error
+ * pointing at the failing rule. .incbin and
+ * .datafile read files and are errors here.
+ * labels are searched one by one like in
+ * table.c, a program of more than a couple of
+ * hundred lines needs a higher 
+ * -fconstexpr-ops-limit
+ * ==============================================
+ * ============================================*/
+
+namespace as {
+
+struct assembly_error {
+	const char *gripe;
+	std::size_t linenumber;
+};
+
+template <std::size_t Words>
+struct program {
+	std::array<unsigned long, Words> words{}; /* the code and then the data */
+	std::array<char, Words> linkage{}; /* ABSOLUTE_LINKAGE etc. */
+	std::size_t code_length = 0;
+	std::size_t data_length = 0;
+};
+
+namespace detail {
+
+constexpr unsigned long word_mask = 0xfffff;
+
+struct isa_instruction {
+	std::string_view name;
+	int opcode;
+	unsigned int operands;
+	int src_modes;
+	int dest_modes;
+};
+
+#define AS_ISA_INSTRUCTION(name, opcode, operands, src_modes, dest_modes) \
+	isa_instruction{#name, (opcode), (operands), (src_modes), (dest_modes)},
+
+/* available instructions, in opcode order */
+inline constexpr isa_instruction instructions[] = {
+	ISA_INSTRUCTIONS(AS_ISA_INSTRUCTION)
+};
+
+#undef AS_ISA_INSTRUCTION
+
+#define AS_MODE_CODE(slot, mode, code, words) if ((slot) == (mode)) { return (code); }
+
+/************************************************
+ * NAME: mode_code
+ * PARAMS: mode - an address mode
+ * RETURN VALUE: the address mode field value
+ ***********************************************/
+constexpr unsigned long mode_code(int mode)
+{
+	ISA_ADDRESS_MODES(AS_MODE_CODE, mode)
+	return 0;
+}
+
+#undef AS_MODE_CODE
+
+constexpr bool is_blank(char c) { return c == ' ' || c == '\t'; }
+constexpr bool is_space(char c) { return is_blank(c) || (c >= '\n' && c <= '\r'); }
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+constexpr bool is_alnum(char c) { return is_alpha(c) || is_digit(c); }
+
+struct label {
+	std::string_view name;
+	label_type_t type = REGULAR;
+	label_section_t section = CODE;
+	std::size_t address = 0;
+	bool has_address = false;
+};
+
+enum index_kind { INDEX_IMMEDIATE, INDEX_REGISTER, INDEX_LABEL };
+
+struct operand {
+	int mode = NO_ADDRESS;
+	long immediate = 0;
+	int reg = 0;
+	std::string_view name;
+	index_kind index = INDEX_REGISTER;
+	long index_immediate = 0;
+	std::string_view index_name;
+};
+
+struct constant {
+	std::string_view name;
+	long value = 0;
+};
+
+enum pass_t { FIRST_PASS, SECOND_PASS };
+
+/* the state of a single assembly, see parse.c for the rules */
+class assembler {
+public:
+	constexpr assembler(std::string_view source, unsigned long *words, char *linkage)
+		: source(source), words(words), linkage(linkage)
+	{
+	}
+
+	/************************************************
+	 * NAME: first_pass
+	 * DESCRIPTION: install the labels and count the
+	 * 		code and data words
+	 ***********************************************/
+	constexpr void first_pass()
+	{
+		run(FIRST_PASS);
+		code_length = code_index;
+		data_length = data_index;
+	}
+
+	/************************************************
+	 * NAME: second_pass
+	 * DESCRIPTION: encode the code and the data
+	 ***********************************************/
+	constexpr void second_pass()
+	{
+		run(SECOND_PASS);
+	}
+
+	std::size_t code_length = 0;
+	std::size_t data_length = 0;
+
+private:
+	/* operand slots, ISA_SOURCE and ISA_DESTINATION of isa.h */
+	static constexpr int ISA_SOURCE_SLOT = 0;
+	static constexpr int ISA_DESTINATION_SLOT = 1;
+
+	std::string_view source;
+	unsigned long *words; /* NULL to count only */
+	char *linkage;
+	pass_t pass = FIRST_PASS;
+	std::string_view line;
+	std::size_t cursor = 0; /* in line */
+	std::size_t linenumber = 0;
+	std::array<label, MAX_LABELS> labels{};
+	std::size_t label_count = 0;
+	std::array<constant, MAX_LABELS> constants{};
+	std::size_t constant_count = 0;
+	bool undefined_allowed = false; /* constants may be defined after their use */
+	std::size_t code_index = 0;
+	std::size_t data_index = 0;
+	std::string_view label_definition;
+	bool label_defined = false;
+
+	/* a throw is not a constant expression, so a failed
+	 * check is a compile error */
+	constexpr void check(bool ok, const char *gripe) const
+	{
+		if (!ok) {
+			throw assembly_error{gripe, linenumber};
+		}
+	}
+
+	constexpr char peek(std::size_t offset = 0) const
+	{
+		return cursor + offset < line.size() ? line[cursor + offset] : '\0';
+	}
+
+	constexpr void expect(std::string_view s)
+	{
+		check(line.substr(cursor, s.size()) == s, "expected token");
+		cursor += s.size();
+	}
+
+	constexpr void whitespace()
+	{
+		while (is_blank(peek())) {
+			cursor++;
+		}
+	}
+
+	constexpr void whitespace_must()
+	{
+		check(is_blank(peek()), "expected whitespace");
+		whitespace();
+	}
+
+	constexpr void end_of_line()
+	{
+		whitespace();
+		check(peek() == '\0', "garbage in end of line");
+	}
+
+	constexpr void put(std::size_t index, long word, char link)
+	{
+		if (words) {
+			words[index] = static_cast<unsigned long>(word) & word_mask;
+			linkage[index] = link;
+		}
+	}
+
+	/* lookup_label matches a label that starts with the name,
+	 * compared by hand to keep the evaluation cheap */
+	constexpr label *lookup(std::string_view name)
+	{
+		std::size_t j = 0;
+
+		for (std::size_t i = 0; i < label_count; i++) {
+			if (labels[i].name.size() < name.size()) {
+				continue;
+			}
+			for (j = 0; j < name.size() && labels[i].name[j] == name[j]; j++)
+				;
+			if (j == name.size()) {
+				return &labels[i];
+			}
+		}
+		return nullptr;
+	}
+
+	constexpr label *install(std::string_view name)
+	{
+		check(label_count < MAX_LABELS, "too many labels defined");
+		check(!lookup(name), "label already defined");
+		labels[label_count].name = name;
+		return &labels[label_count++];
+	}
+
+	constexpr std::string_view parse_label()
+	{
+		std::size_t begin = cursor;
+
+		check(is_alpha(peek()), "label must start with alphabetic character");
+		while (is_alnum(peek())) {
+			cursor++;
+		}
+		check(cursor - begin <= MAX_LABEL_LENGTH, "label too long");
+		return line.substr(begin, cursor - begin);
+	}
+
+	constexpr std::string_view parse_label_use()
+	{
+		std::string_view name = parse_label();
+
+		check(pass == FIRST_PASS || lookup(name), "label that isn't defined is used");
+		return name;
+	}
+
+	/* scan_number of datafile.c */
+	constexpr long scan_number()
+	{
+		unsigned long magnitude = 0;
+		bool negative = peek() == '-';
+
+		if (peek() == '-' || peek() == '+') {
+			cursor++;
+		}
+		check(is_digit(peek()), "expected number");
+		for (; is_digit(peek()); cursor++) {
+			check(magnitude <= (static_cast<unsigned long>(std::numeric_limits<long>::max()) - (peek() - '0')) / 10,
+			      "long overflow or underflow");
+			magnitude = magnitude * 10 + (peek() - '0');
+		}
+		return negative ? -static_cast<long>(magnitude) : static_cast<long>(magnitude);
+	}
+
+	/* define.c hashes the constants, here they are searched one by one */
+	constexpr const constant *lookup_constant(std::string_view name) const
+	{
+		for (std::size_t i = 0; i < constant_count; i++) {
+			if (constants[i].name == name) {
+				return &constants[i];
+			}
+		}
+		return nullptr;
+	}
+
+	constexpr bool is_constant() const
+	{
+		std::size_t length = 0;
+
+		if (!is_alpha(peek())) {
+			return false;
+		}
+		while (is_alnum(peek(length))) {
+			length++;
+		}
+		return length <= MAX_LABEL_LENGTH && lookup_constant(line.substr(cursor, length));
+	}
+
+	constexpr long expression_primary()
+	{
+		whitespace();
+		if (peek() == '-' || peek() == '+') {
+			bool negative = line[cursor++] == '-';
+			long x = expression_primary();
+
+			return negative ? static_cast<long>(0UL - static_cast<unsigned long>(x)) : x;
+		} else if (peek() == '(') {
+			expect("(");
+			long x = expression(0);
+			whitespace();
+			expect(")");
+			return x;
+		} else if (is_alpha(peek())) {
+			const constant *c = lookup_constant(parse_label());
+
+			check(c || undefined_allowed, "constant isn't defined");
+			return c ? c->value : 0;
+		}
+		return scan_number();
+	}
+
+	/* the binary operators of parse.c, from the lowest precedence */
+	static constexpr int EXPRESSION_LEVELS = 5;
+
+	static constexpr int operator_level(std::string_view token)
+	{
+		return token == "|" ? 0 : token == "&" ? 1 :
+		       token == "<<" || token == ">>" ? 2 :
+		       token == "+" || token == "-" ? 3 : 4;
+	}
+
+	constexpr long apply_operator(std::string_view token, long x, long y) const
+	{
+		unsigned long ux = static_cast<unsigned long>(x);
+		unsigned long uy = static_cast<unsigned long>(y);
+
+		switch (token[0]) {
+			case '|': return x | y;
+			case '&': return x & y;
+			case '+': return static_cast<long>(ux + uy);
+			case '-': return static_cast<long>(ux - uy);
+			case '*': return static_cast<long>(ux * uy);
+			case '/':
+				check(y != 0 && !(x == std::numeric_limits<long>::min() && y == -1),
+				      "invalid division");
+				return x / y;
+			default:
+				check(y >= 0 && y < std::numeric_limits<unsigned long>::digits, "invalid shift");
+				return token[0] == '<' ? static_cast<long>(ux << y) : x >> y;
+		}
+	}
+
+	constexpr long expression(int level)
+	{
+		constexpr std::string_view tokens[] = {"|", "&", "<<", ">>", "+", "-", "*", "/"};
+		std::string_view token;
+		long x = 0;
+
+		if (level == EXPRESSION_LEVELS) {
+			return expression_primary();
+		}
+
+		x = expression(level + 1);
+		for (;;) {
+			whitespace();
+			token = {};
+			for (std::string_view candidate : tokens) {
+				if (operator_level(candidate) == level && line.substr(cursor, candidate.size()) == candidate) {
+					token = candidate;
+					break;
+				}
+			}
+			if (token.empty()) {
+				return x;
+			}
+			cursor += token.size();
+			x = apply_operator(token, x, expression(level + 1));
+		}
+	}
+
+	constexpr void define_directive()
+	{
+		std::string_view name;
+
+		check(!label_defined, "a constant can't have a label");
+		name = parse_label();
+		check(!lookup_constant(name), "constant already defined");
+		whitespace();
+		expect("=");
+		long value = expression(0);
+		check(constant_count < MAX_LABELS, "out of memory");
+		constants[constant_count++] = constant{name, value};
+	}
+
+	constexpr void install_label_definition(label_section_t section)
+	{
+		label *l = lookup(label_definition);
+
+		if (l) {
+			check(l->type != EXTERNAL, "label declared as external cannot be defined");
+			check(!l->has_address, "label already defined");
+		} else {
+			l = install(label_definition);
+			l->type = REGULAR;
+		}
+
+		l->section = section;
+		l->address = section == CODE ? code_index : data_index;
+		l->has_address = true;
+	}
+
+	constexpr void install_label_declaration(label_type_t type)
+	{
+		std::string_view name = parse_label();
+		label *l = lookup(name);
+
+		check(!l || l->type == REGULAR, "label already declared");
+		l = install(name);
+		l->has_address = false;
+		l->type = type;
+	}
+
+	constexpr void data_directive()
+	{
+		long value = 0;
+
+		if (pass == FIRST_PASS && label_defined) {
+			install_label_definition(DATA);
+		}
+
+		for (;;) {
+			value = expression(0);
+			put(code_length + data_index++, value, ABSOLUTE_LINKAGE);
+			whitespace();
+			if (peek() != ',') {
+				break;
+			}
+			cursor++;
+		}
+	}
+
+	constexpr void string_directive()
+	{
+		expect("\"");
+		if (pass == FIRST_PASS && label_defined) {
+			install_label_definition(DATA);
+		}
+
+		for (; peek() != '\0' && peek() != '"'; cursor++) {
+			put(code_length + data_index++, peek(), ABSOLUTE_LINKAGE);
+		}
+		expect("\"");
+		put(code_length + data_index++, 0, ABSOLUTE_LINKAGE);
+	}
+
+	/* the second pass only lays out the data again */
+	constexpr void directive()
+	{
+		constexpr std::string_view names[] = {
+			"datafile", "data", "incbin", "string", "entry", "extern", "define"
+		};
+		std::string_view name;
+
+		expect(".");
+		for (std::string_view candidate : names) {
+			if (line.substr(cursor, candidate.size()) == candidate) {
+				name = candidate;
+				break;
+			}
+		}
+		check(!name.empty(), "no such directive");
+
+		cursor += name.size();
+		whitespace_must();
+		if (name == "data") {
+			data_directive();
+		} else if (name == "string") {
+			string_directive();
+		} else if (pass == SECOND_PASS) {
+			return;
+		} else if (name == "entry") {
+			install_label_declaration(ENTRY);
+		} else if (name == "extern") {
+			install_label_declaration(EXTERNAL);
+		} else if (name == "define") {
+			define_directive();
+		} else {
+			check(false, "files can't be read in a constant expression");
+		}
+
+		if (pass == FIRST_PASS) {
+			end_of_line();
+		}
+	}
+
+	constexpr int parse_register()
+	{
+		expect("r");
+		return line[cursor++] - '0';
+	}
+
+	constexpr bool is_register() const
+	{
+		return peek() == 'r' && peek(1) >= '0' && peek(1) <= '7';
+	}
+
+	constexpr operand parse_operand(const isa_instruction &instruction, int slot)
+	{
+		operand result;
+
+		if (peek() == '#') {
+			code_index++;
+			result.mode = IMMEDIATE_ADDRESS;
+			expect("#");
+			result.immediate = expression(0);
+		} else if (is_register()) {
+			result.mode = DIRECT_REGISTER_ADDRESS;
+			result.reg = parse_register();
+		} else {
+			code_index++;
+			result.name = parse_label_use();
+			whitespace();
+			if (peek() == '{') {
+				result.mode = INDEX_ADDRESS;
+				expect("{");
+				if (is_register()) {
+					result.index = INDEX_REGISTER;
+					result.reg = parse_register();
+				} else if (is_digit(peek()) || peek() == '-' || peek() == '+' || \
+					   peek() == '(' || is_constant()) {
+					result.index = INDEX_IMMEDIATE;
+					code_index++;
+					result.index_immediate = expression(0);
+				} else if (is_alpha(peek())) {
+					result.index = INDEX_LABEL;
+					result.index_name = parse_label_use();
+					code_index++;
+				} else {
+					check(false, "invalid index addersing");
+				}
+				expect("}");
+			} else {
+				result.mode = DIRECT_ADDRESS;
+			}
+		}
+
+		check(result.mode & (slot == ISA_SOURCE_SLOT ? instruction.src_modes : instruction.dest_modes),
+		      "address mode not allowed for this instruction");
+		return result;
+	}
+
+	constexpr void put_label(std::string_view name, std::size_t &out)
+	{
+		const label *l = lookup(name);
+
+		if (l->type == EXTERNAL) {
+			put(out++, 0, EXTERNAL_LINKAGE);
+		} else {
+			put(out++,
+			    l->address + START_OFFSET + (l->section == DATA ? code_length : 0),
+			    RELOCATBLE_LINKAGE);
+		}
+	}
+
+	constexpr void put_operand(const operand &o, std::size_t &out)
+	{
+		if (o.mode == IMMEDIATE_ADDRESS) {
+			put(out++, o.immediate, ABSOLUTE_LINKAGE);
+		} else if (o.mode == DIRECT_ADDRESS || o.mode == INDEX_ADDRESS) {
+			put_label(o.name, out);
+			if (o.mode == INDEX_ADDRESS && o.index == INDEX_IMMEDIATE) {
+				put(out++, o.index_immediate, ABSOLUTE_LINKAGE);
+			} else if (o.mode == INDEX_ADDRESS && o.index == INDEX_LABEL) {
+				put_label(o.index_name, out);
+			}
+		}
+	}
+
+	static constexpr int operand_register(const operand &o)
+	{
+		return o.mode == DIRECT_REGISTER_ADDRESS || \
+		       (o.mode == INDEX_ADDRESS && o.index == INDEX_REGISTER) ? o.reg : 0;
+	}
+
+	constexpr void instruction()
+	{
+		const isa_instruction *found = nullptr;
+		std::size_t begin = cursor;
+		std::size_t start = code_index;
+		std::string_view name;
+		operand src;
+		operand dest;
+		int type = 0;
+		int comb = 0;
+
+		if (pass == FIRST_PASS && label_defined) {
+			install_label_definition(CODE);
+		}
+		undefined_allowed = pass == FIRST_PASS;
+
+		/* a mnemonic is made of alphabetic characters only */
+		while (is_alpha(peek())) {
+			cursor++;
+		}
+		name = line.substr(begin, cursor - begin);
+		for (const isa_instruction &candidate : instructions) {
+			if (name.size() < INSTRUCTION_NAME_LENGTH && candidate.name == name) {
+				found = &candidate;
+			}
+		}
+		if (!found) {
+			cursor = begin;
+			check(false, "invalid instruction");
+		}
+
+		/* /0 or /1/comb/comb */
+		expect("/");
+		if (peek() == '1') {
+			type = 1;
+			expect("1");
+			expect("/");
+			check(peek() == '0' || peek() == '1', "expected 0 or 1");
+			comb += (line[cursor++] - '0') * 2;
+			expect("/");
+			check(peek() == '0' || peek() == '1', "expected 0 or 1");
+			comb += line[cursor++] - '0';
+		} else if (peek() == '0') {
+			cursor++;
+		} else {
+			check(false, "expected 0 or 1");
+		}
+
+		code_index++;
+		if (found->operands == 2) {
+			whitespace_must();
+			src = parse_operand(*found, ISA_SOURCE_SLOT);
+			whitespace();
+			expect(",");
+			whitespace();
+			dest = parse_operand(*found, ISA_DESTINATION_SLOT);
+		} else if (found->operands == 1) {
+			whitespace_must();
+			dest = parse_operand(*found, ISA_DESTINATION_SLOT);
+		}
+
+		if (pass == SECOND_PASS) {
+			put(start,
+			    (static_cast<long>(comb) << COMB_OFFSET) | \
+			    (static_cast<long>(operand_register(dest)) << DEST_REGISTER_OFFSET) | \
+			    static_cast<long>(mode_code(dest.mode) << DEST_ADDRESS_MODE_OFFSET) | \
+			    (static_cast<long>(operand_register(src)) << SRC_REGISTER_OFFSET) | \
+			    static_cast<long>(mode_code(src.mode) << SRC_ADDRESS_MODE_OFFSET) | \
+			    (static_cast<long>(found->opcode) << OPCODE_OFFSET) | \
+			    (static_cast<long>(type) << TYPE_OFFSET),
+			    ABSOLUTE_LINKAGE);
+			start++;
+			if (found->operands == 2) {
+				put_operand(src, start);
+			}
+			put_operand(dest, start);
+		}
+	}
+
+	constexpr void action_line()
+	{
+		label_defined = false;
+		undefined_allowed = false;
+		if (line.find(':') != std::string_view::npos) {
+			label_defined = true;
+			label_definition = parse_label();
+			expect(":");
+			whitespace_must();
+		} else {
+			whitespace();
+		}
+
+		if (peek() == '.') {
+			directive();
+		} else {
+			instruction();
+			end_of_line();
+		}
+	}
+
+	constexpr bool is_empty() const
+	{
+		for (char c : line) {
+			if (!is_blank(c)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	constexpr void run(pass_t which)
+	{
+		std::size_t offset = 0;
+		std::size_t newline = 0;
+
+		pass = which;
+		code_index = 0;
+		data_index = 0;
+		for (linenumber = 1; offset < source.size(); linenumber++) {
+			newline = source.find('\n', offset);
+			if (newline == std::string_view::npos) {
+				newline = source.size();
+			}
+			line = source.substr(offset, newline - offset);
+			offset = newline + 1;
+			cursor = 0;
+
+			if (!line.empty() && line[0] != ';' && !is_empty()) {
+				action_line();
+			}
+		}
+	}
+};
+
+} /* namespace detail */
+
+/************************************************
+ * NAME: program_words
+ * PARAMS: source - the assembly source
+ * RETURN VALUE: number of words the source
+ * 		 assembles to
+ ***********************************************/
+constexpr std::size_t program_words(std::string_view source)
+{
+	detail::assembler assembler(source, nullptr, nullptr);
+
+	assembler.first_pass();
+	return assembler.code_length + assembler.data_length;
+}
+
+/************************************************
+ * NAME: assemble
+ * PARAMS: source - the assembly source
+ * RETURN VALUE: the assembled program, Words
+ * 		 must be program_words(source)
+ ***********************************************/
+template <std::size_t Words>
+constexpr program<Words> assemble(std::string_view source)
+{
+	program<Words> result;
+	detail::assembler assembler(source, result.words.data(), result.linkage.data());
+
+	assembler.first_pass();
+	if (assembler.code_length + assembler.data_length != Words) {
+		throw assembly_error{"program size doesn't match", 0};
+	}
+	assembler.second_pass();
+
+	result.code_length = assembler.code_length;
+	result.data_length = assembler.data_length;
+	return result;
+}
+
+} /* namespace as */
+
+/* assemble a string literal, the size is found by a first pass */
+#define AS_ASSEMBLE(source) (::as::assemble< ::as::program_words(source)>(source))
+
+#endif /* end of include guard: ASSEMBLE_HPP */
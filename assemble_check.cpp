@@ -0,0 +1,131 @@
+#include <string_view> /* for std::string_view */
+
+#include "assemble.hpp"
+
+/* =============================================
+ * =============================================
+ * Note: checks at compile time that assemble.hpp
+ * encodes a source the way the assembler does.
+ * the expected words are the .ob file that as
+ * writes for the same source, pasted as is, so
+ * a change to parse.c or isa.def that isn't
+ * followed in assemble.hpp fails to compile.
+ * nothing of this translation unit is linked.
+ * ==============================================
+ * ============================================*/
+
+namespace {
+
+/* a define, every address mode, a combined
+ * instruction, negative numbers, entries and
+ * externals, strings and data */
+constexpr auto checked = AS_ASSEMBLE(
+	".define SIZE = 2 * 3\n"
+	"\t.entry\tMAIN\n"
+	"\t.extern\tOUT\n"
+	"MAIN:\tmov/0\t#SIZE, r1\n"
+	"\tlea/0\tSTR{LEN}, r2\n"
+	"\tmov/1/1/0\tSTR{-1}, LEN{r3}\n"
+	"\tadd/0\tSTR{2}, OUT\n"
+	"\tcmp/0\tr1, #-4\n"
+	"\tjsr/0\tOUT\n"
+	"\trts/0\n"
+	"\tstop/0\n"
+	"STR:\t.string\t\"ab\"\n"
+	"LEN:\t.data\t2, -7\n");
+
+/* the .ob file as writes for the source above */
+constexpr std::string_view expected =
+	"103\t11\n"
+	"1210\t0000001210\ta\n"
+	"1211\t0000000012\ta\n"
+	"1212\t0012201220\ta\n"
+	"1213\t0000001313\tr\n"
+	"1220\t0000001322\tr\n"
+	"1221\t0100201032\ta\n"
+	"1222\t0000001313\tr\n"
+	"1223\t3333333333\ta\n"
+	"1230\t0000001322\tr\n"
+	"1231\t0002200200\ta\n"
+	"1232\t0000001313\tr\n"
+	"1233\t0000000002\ta\n"
+	"1300\t0000000000\te\n"
+	"1301\t0001302000\ta\n"
+	"1302\t3333333330\ta\n"
+	"1303\t0031000200\ta\n"
+	"1310\t0000000000\te\n"
+	"1311\t0032000000\ta\n"
+	"1312\t0033000000\ta\n"
+	"1313\t0000001201\n"
+	"1320\t0000001202\n"
+	"1321\t0000000000\n"
+	"1322\t0000000002\n"
+	"1323\t3333333321\n";
+
+/************************************************
+ * NAME: base4
+ * PARAMS: text - the text to scan
+ * 	   cursor - moved past the number and the
+ * 	   	    blank after it
+ * RETURN VALUE: the base 4 number at the cursor
+ ***********************************************/
+constexpr unsigned long base4(std::string_view text, std::size_t &cursor)
+{
+	unsigned long value = 0;
+
+	for (; cursor < text.size() && text[cursor] >= '0' && text[cursor] <= '3'; cursor++) {
+		value = value * 4 + (text[cursor] - '0');
+	}
+	if (cursor < text.size() && text[cursor] == '\t') {
+		cursor++;
+	}
+	return value;
+}
+
+/************************************************
+ * NAME: matches
+ * PARAMS: program - the assembled program
+ * 	   object - the .ob file
+ * RETURN VALUE: true if the program has the
+ * 		 lengths, addresses, words and
+ * 		 linker letters of the file
+ ***********************************************/
+template <std::size_t Words>
+constexpr bool matches(const as::program<Words> &program, std::string_view object)
+{
+	std::size_t cursor = 0;
+	char linkage = ABSOLUTE_LINKAGE;
+	std::size_t i = 0;
+
+	if (base4(object, cursor) != program.code_length || \
+	    base4(object, cursor) != program.data_length) {
+		return false;
+	}
+	cursor++;
+
+	for (i = 0; i < Words; i++) {
+		if (base4(object, cursor) != START_OFFSET + i || \
+		    base4(object, cursor) != program.words[i]) {
+			return false;
+		}
+
+		/* the data words have no linker letter */
+		linkage = ABSOLUTE_LINKAGE;
+		if (object[cursor] != '\n') {
+			linkage = object[cursor++];
+		}
+		if (i < program.code_length && linkage != program.linkage[i]) {
+			return false;
+		}
+		cursor++;
+	}
+
+	return cursor == object.size();
+}
+
+static_assert(checked.code_length == 19 && checked.data_length == 5,
+	      "assemble.hpp counts the words differently than as");
+static_assert(matches(checked, expected),
+	      "assemble.hpp encodes differently than as");
+
+} /* namespace */
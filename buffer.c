@@ -0,0 +1,171 @@
+#include <stdio.h> /* for tmpfile, fopen and fwrite */
+#include <stdlib.h> /* for realloc and free */
+#include <string.h> /* for memcpy */
+
+#include "buffer.h"
+#include "arena.h"
+
+#define MIN_CAPACITY (4096)
+#define COPY_CHUNK_LENGTH (65536)
+
+/************************************************
+ * NAME: buffer_init
+ * PARAMS: buffer - the buffer to init
+ * DESCRIPTION: init an empty buffer
+ ***********************************************/
+void buffer_init(buffer_t *buffer)
+{
+	buffer->data = NULL;
+	buffer->length = 0;
+	buffer->capacity = 0;
+	buffer->spill_limit = 0;
+	buffer->spill = NULL;
+	buffer->arena = NULL;
+}
+
+/************************************************
+ * NAME: buffer_free
+ * PARAMS: buffer - the buffer to free
+ * DESCRIPTION: release the buffer memory
+ ***********************************************/
+void buffer_free(buffer_t *buffer)
+{
+	/* arena memory is released by resetting the arena */
+	if (NULL == buffer->arena) {
+		free(buffer->data);
+	}
+	if (buffer->spill) {
+		fclose(buffer->spill);
+	}
+	buffer_init(buffer);
+}
+
+/************************************************
+ * NAME: buffer_set_spill_limit
+ * PARAMS: buffer - the buffer
+ * 	   bytes - bytes to keep in memory, 0 for
+ * 	           no limit
+ * DESCRIPTION: bound the buffer memory, once the
+ * 		limit is reached the buffered bytes
+ * 		are moved to a temporary file
+ ***********************************************/
+void buffer_set_spill_limit(buffer_t *buffer, unsigned long bytes)
+{
+	buffer->spill_limit = bytes;
+}
+
+/************************************************
+ * NAME: buffer_set_arena
+ * PARAMS: buffer - an empty buffer
+ * 	   arena - the arena to grow the buffer in,
+ * 	           NULL to use malloc
+ ***********************************************/
+void buffer_set_arena(buffer_t *buffer, arena_t *arena)
+{
+	buffer->arena = arena;
+}
+
+/************************************************
+ * NAME: buffer_spill
+ * PARAMS: buffer - the buffer to spill
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: move the buffered bytes to the end
+ * 		of the temporary file
+ ***********************************************/
+static int buffer_spill(buffer_t *buffer)
+{
+	if (NULL == buffer->spill && NULL == (buffer->spill = tmpfile())) {
+		return 1;
+	}
+
+	if (fwrite(buffer->data, 1, buffer->length, buffer->spill) != buffer->length) {
+		return 1;
+	}
+
+	buffer->length = 0;
+	return 0;
+}
+
+/************************************************
+ * NAME: buffer_append
+ * PARAMS: buffer - the buffer to append to
+ * 	   data - the bytes to append
+ * 	   length - number of bytes
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+int buffer_append(buffer_t *buffer, const char *data, unsigned long length)
+{
+	unsigned long capacity = buffer->capacity ? buffer->capacity : MIN_CAPACITY;
+	char *grown;
+
+	if (buffer->spill_limit && \
+	    buffer->length && \
+	    buffer->length + length > buffer->spill_limit && \
+	    buffer_spill(buffer)) {
+		return 1;
+	}
+
+	if (buffer->length + length > buffer->capacity) {
+		while (capacity < buffer->length + length) {
+			capacity *= 2;
+		}
+
+		if (buffer->arena) {
+			grown = arena_grow(buffer->arena, buffer->data, buffer->capacity, capacity);
+		} else {
+			grown = realloc(buffer->data, capacity);
+		}
+		if (NULL == grown) {
+			return 1;
+		}
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	return 0;
+}
+
+/************************************************
+ * NAME: buffer_write_file
+ * PARAMS: buffer - the buffer to write
+ * 	   filename - the file to create
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write the spilled bytes followed by
+ * 		the buffered bytes to a file
+ ***********************************************/
+int buffer_write_file(buffer_t *buffer, const char *filename)
+{
+	char chunk[COPY_CHUNK_LENGTH];
+	unsigned long length;
+	FILE *file = fopen(filename, "w");
+	int rc = 0;
+
+	if (NULL == file) {
+		perror(filename);
+		return 1;
+	}
+
+	if (buffer->spill) {
+		rewind(buffer->spill);
+		while ((length = fread(chunk, 1, sizeof(chunk), buffer->spill))) {
+			if (fwrite(chunk, 1, length, file) != length) {
+				rc = 1;
+				break;
+			}
+		}
+		rc |= ferror(buffer->spill) != 0;
+	}
+
+	if (buffer->length && fwrite(buffer->data, 1, buffer->length, file) != buffer->length) {
+		rc = 1;
+	}
+
+	if (fclose(file) || rc) {
+		perror(filename);
+		return 1;
+	}
+
+	return 0;
+}
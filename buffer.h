@@ -0,0 +1,27 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdio.h> /* for FILE */
+
+#include "arena.h"
+
+/* a growable byte buffer output files are built in.
+ * with a spill limit the older bytes are moved to a
+ * temporary file */
+typedef struct {
+	char *data;
+	unsigned long length;
+	unsigned long capacity;
+	unsigned long spill_limit; /* bytes kept in memory, 0 for no limit */
+	FILE *spill;
+	arena_t *arena; /* the data is grown in an arena, NULL for malloc */
+} buffer_t;
+
+void buffer_init(buffer_t *buffer);
+void buffer_free(buffer_t *buffer);
+void buffer_set_spill_limit(buffer_t *buffer, unsigned long bytes);
+void buffer_set_arena(buffer_t *buffer, arena_t *arena);
+int buffer_append(buffer_t *buffer, const char *data, unsigned long length);
+int buffer_write_file(buffer_t *buffer, const char *filename);
+
+#endif /* end of include guard: BUFFER_H */
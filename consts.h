@@ -9,11 +9,17 @@
 #define MAX_LABEL_LENGTH (30)
 #define INSTRUCTION_NAME_LENGTH (5)
 
-#define DATA_SECTION_MAX_LENGTH (1000)
-#define CODE_SECTION_MAX_LENGTH (1000)
 
 #define MAX_DIRECTIVE_NAME_LENGTH (32)
 
+#define PARSE_DATA_CHUNK_LENGTH (256)
+#define OUTPUT_DATA_CHUNK_LENGTH (256)
+#define OUTPUT_STREAM_CHUNK_LENGTH (64 * 1024)
+/* each of the three outputs keeps at least a stream chunk */
+#define MIN_MEMORY_LIMIT (6 * OUTPUT_STREAM_CHUNK_LENGTH)
+#define MAX_OUTPUT_LINE_LENGTH (MAX_LABEL_LENGTH + 32)
+#define MAX_EMITTERS (8)
+
 #define COMB_OFFSET (0)
 #define DEST_REGISTER_OFFSET (2)
 #define DEST_ADDRESS_MODE_OFFSET (5)
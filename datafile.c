@@ -0,0 +1,373 @@
+#define _POSIX_C_SOURCE 200809L /* for mmap, fstat and st_mtim */
+
+#include <stdio.h> /* for sprintf */
+#include <stdlib.h> /* for malloc and free */
+#include <string.h> /* for strcmp, strncpy, strrchr and strerror */
+#include <limits.h> /* for LONG_MAX */
+#include <errno.h> /* for errno */
+#include <fcntl.h> /* for open */
+#include <unistd.h> /* for close */
+#include <sys/stat.h> /* for fstat */
+#include <sys/mman.h> /* for mmap */
+
+#include "datafile.h"
+#include "consts.h"
+#include "image.h"
+
+/* =============================================
+ * =============================================
+ * Note: data files are mapped, converted to 
+ * words once and cached for the rest of the 
+ * run, so sources sharing a table don't read it
+ * again. an entry is reloaded only if the file
+ * changed since it was loaded (watch mode), by
+ * its size and its modification time to the
+ * nanosecond, so a file rewritten within the
+ * same second is noticed too.
+ *
+ * a relative filename is relative to the 
+ * directory of the source that includes it, 
+ * not to the working directory.
+ * ==============================================
+ * ============================================*/
+
+#define MAX_DATAFILE_ERROR_LENGTH (MAX_FILENAME_LENGTH + 64)
+#define DATAFILE_CHUNK_LENGTH (256)
+
+typedef struct cached_datafile {
+	char filename[MAX_FILENAME_LENGTH];
+	datafile_format_t format;
+	dev_t device; /* identify the loaded version of the file */
+	ino_t inode;
+	off_t size;
+	struct timespec modified;
+	word_image_t words;
+	struct cached_datafile *next;
+} cached_datafile_t;
+
+static cached_datafile_t *cached_datafiles = NULL;
+static char datafile_error[MAX_DATAFILE_ERROR_LENGTH];
+
+/************************************************
+ * NAME: scan_number
+ * PARAMS: cursor - the text to scan, moved past
+ * 		    the number or to the error
+ * 	   end - the end of the text
+ * 	   value - the scanned number
+ * RETURN VALUE: SCAN_NUMBER_OK on success, 
+ * 		 SCAN_NUMBER_MISSING if there is no
+ * 		 number and SCAN_NUMBER_OVERFLOW if 
+ * 		 it doesn't fit a long
+ * DESCRIPTION: scan a signed decimal number
+ ***********************************************/
+int scan_number(const char **cursor, const char *end, long *value)
+{
+	const char *p = *cursor;
+	unsigned long magnitude = 0;
+	unsigned int digit;
+	int negative;
+
+	negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+
+	if (p == end || (unsigned int)(*p - '0') > 9) {
+		*cursor = p;
+		return SCAN_NUMBER_MISSING;
+	}
+
+	for (; p < end && (digit = (unsigned int)(*p - '0')) <= 9; p++) {
+		if (magnitude > ((unsigned long)LONG_MAX - digit) / 10) {
+			*cursor = p;
+			return SCAN_NUMBER_OVERFLOW;
+		}
+		magnitude = magnitude * 10 + digit;
+	}
+
+	*value = negative ? -(long)magnitude : (long)magnitude;
+	*cursor = p;
+	return SCAN_NUMBER_OK;
+}
+
+/************************************************
+ * NAME: convert_binary
+ * PARAMS: datafile - the entry to fill
+ * 	   bytes - the file contents
+ * 	   size - the file size
+ * RETURN VALUE: NULL on success, the error 
+ * 		 otherwise
+ * DESCRIPTION: convert every byte to a word
+ ***********************************************/
+static const char *convert_binary(cached_datafile_t *datafile,
+				  const unsigned char *bytes,
+				  unsigned long size)
+{
+	long chunk[DATAFILE_CHUNK_LENGTH];
+	unsigned long count;
+	unsigned long i;
+
+	for (; size; size -= count, bytes += count) {
+		count = size < DATAFILE_CHUNK_LENGTH ? size : DATAFILE_CHUNK_LENGTH;
+		for (i = 0; i < count; i++) {
+			chunk[i] = bytes[i];
+		}
+		if (image_append_words(&datafile->words, chunk, count)) {
+			return "out of memory";
+		}
+	}
+	return NULL;
+}
+
+/************************************************
+ * NAME: convert_csv
+ * PARAMS: datafile - the entry to fill
+ * 	   text - the file contents
+ * 	   size - the file size
+ * RETURN VALUE: NULL on success, the error 
+ * 		 otherwise
+ * DESCRIPTION: convert lines of comma separated
+ * 		numbers, blank lines are skipped
+ ***********************************************/
+static const char *convert_csv(cached_datafile_t *datafile,
+			       const char *text,
+			       unsigned long size)
+{
+	long chunk[DATAFILE_CHUNK_LENGTH];
+	unsigned long count = 0;
+	const char *p = text;
+	const char *end = text + size;
+	unsigned long line = 1;
+	int expect_number = 0;
+	int rc;
+
+	while (p < end) {
+		rc = SCAN_NUMBER_OK;
+		if (*p == ' ' || *p == '\t' || *p == '\r') {
+			p++;
+		} else if (*p == '\n' && !expect_number) {
+			line++;
+			p++;
+		} else if ((rc = scan_number(&p, end, &chunk[count])) == SCAN_NUMBER_OK) {
+			if (++count == DATAFILE_CHUNK_LENGTH) {
+				if (image_append_words(&datafile->words, chunk, count)) {
+					return "out of memory";
+				}
+				count = 0;
+			}
+
+			/* skip blanks to a comma or the end of the line */
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+				p++;
+			}
+			expect_number = p < end && *p == ',';
+			if (expect_number) {
+				p++;
+			} else if (p < end && *p != '\n') {
+				rc = SCAN_NUMBER_MISSING;
+			}
+		}
+
+		if (rc != SCAN_NUMBER_OK) {
+			sprintf(datafile_error,
+				"%.*s:%lu: %s",
+				MAX_FILENAME_LENGTH,
+				datafile->filename,
+				line,
+				rc == SCAN_NUMBER_OVERFLOW ? "long overflow or underflow" : "expected number");
+			return datafile_error;
+		}
+	}
+
+	if (expect_number) {
+		sprintf(datafile_error, "%.*s:%lu: expected number", MAX_FILENAME_LENGTH, datafile->filename, line);
+		return datafile_error;
+	}
+
+	if (image_append_words(&datafile->words, chunk, count)) {
+		return "out of memory";
+	}
+	return NULL;
+}
+
+/************************************************
+ * NAME: convert_datafile
+ * PARAMS: datafile - the entry to fill
+ * 	   fd - the opened file
+ * RETURN VALUE: NULL on success, the error 
+ * 		 otherwise
+ * DESCRIPTION: map the file and convert it to 
+ * 		words
+ ***********************************************/
+static const char *convert_datafile(cached_datafile_t *datafile, int fd)
+{
+	unsigned long size = datafile->size;
+	const char *error;
+	void *text;
+
+	image_reset(&datafile->words);
+
+	/* an empty file can't be mapped */
+	if (0 == size) {
+		return NULL;
+	}
+
+	text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == text) {
+		return strerror(errno);
+	}
+
+	if (datafile->format == DATAFILE_BINARY) {
+		error = convert_binary(datafile, text, size);
+	} else {
+		error = convert_csv(datafile, text, size);
+	}
+
+	munmap(text, size);
+	return error;
+}
+
+/************************************************
+ * NAME: lookup_datafile
+ * PARAMS: filename - the data file
+ * 	   format - the file format
+ * RETURN VALUE: the cache entry, NULL if the 
+ * 		 file wasn't loaded before
+ ***********************************************/
+static cached_datafile_t *lookup_datafile(const char *filename, datafile_format_t format)
+{
+	cached_datafile_t *datafile;
+
+	for (datafile = cached_datafiles; datafile; datafile = datafile->next) {
+		if (datafile->format == format && strcmp(datafile->filename, filename) == 0) {
+			return datafile;
+		}
+	}
+	return NULL;
+}
+
+/************************************************
+ * NAME: resolve_filename
+ * PARAMS: resolved - the resolved filename
+ * 	   filename - the data file
+ * 	   source_filename - the source that 
+ * 	   		     includes it
+ * RETURN VALUE: 1 if it's too long, 0 on 
+ * 		 success
+ * DESCRIPTION: put the directory of the source
+ * 		before a relative filename
+ ***********************************************/
+static int resolve_filename(char resolved[MAX_FILENAME_LENGTH],
+			    const char *filename,
+			    const char *source_filename)
+{
+	const char *slash = source_filename ? strrchr(source_filename, '/') : NULL;
+	unsigned long directory_length = 0;
+
+	if (slash && filename[0] != '/') {
+		directory_length = slash - source_filename + 1;
+	}
+
+	if (directory_length + strlen(filename) >= MAX_FILENAME_LENGTH) {
+		return 1;
+	}
+
+	strncpy(resolved, source_filename ? source_filename : "", directory_length);
+	strcpy(resolved + directory_length, filename);
+	return 0;
+}
+
+/************************************************
+ * NAME: datafile_load
+ * PARAMS: filename - the data file
+ * 	   source_filename - the source that
+ * 	   		     includes it, NULL
+ * 	   		     for none
+ * 	   format - the file format
+ * 	   words - the loaded words, owned by the
+ * 	           cache
+ * 	   error - the error message on error
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: load a data file, a file already
+ * 		loaded this run is not read again
+ * 		unless it was changed
+ ***********************************************/
+int datafile_load(const char *filename,
+		  const char *source_filename,
+		  datafile_format_t format,
+		  const word_image_t **words,
+		  const char **error)
+{
+	char resolved[MAX_FILENAME_LENGTH];
+	cached_datafile_t *datafile;
+	struct stat status;
+	int fd;
+
+	if (resolve_filename(resolved, filename, source_filename)) {
+		*error = "filename too long";
+		return 1;
+	}
+
+	datafile = lookup_datafile(resolved, format);
+	fd = open(resolved, O_RDONLY);
+	if (-1 == fd || fstat(fd, &status)) {
+		*error = strerror(errno);
+		if (-1 != fd) {
+			close(fd);
+		}
+		return 1;
+	}
+
+	if (NULL == datafile) {
+		datafile = malloc(sizeof(*datafile));
+		if (NULL == datafile) {
+			close(fd);
+			*error = "out of memory";
+			return 1;
+		}
+		strcpy(datafile->filename, resolved);
+		datafile->format = format;
+		image_init(&datafile->words);
+		datafile->size = -1; /* never matches a real file */
+		datafile->next = cached_datafiles;
+		cached_datafiles = datafile;
+	}
+
+	/* convert the file only if it is new or was changed */
+	if (datafile->device != status.st_dev || \
+	    datafile->inode != status.st_ino || \
+	    datafile->size != status.st_size || \
+	    datafile->modified.tv_sec != status.st_mtim.tv_sec || \
+	    datafile->modified.tv_nsec != status.st_mtim.tv_nsec) {
+		datafile->device = status.st_dev;
+		datafile->inode = status.st_ino;
+		datafile->size = status.st_size;
+		datafile->modified = status.st_mtim;
+
+		if ((*error = convert_datafile(datafile, fd))) {
+			/* load it again next time */
+			datafile->size = -1;
+			close(fd);
+			return 1;
+		}
+	}
+
+	close(fd);
+	*words = &datafile->words;
+	return 0;
+}
+
+/************************************************
+ * NAME: datafile_release
+ * DESCRIPTION: release all the cached data files
+ ***********************************************/
+void datafile_release(void)
+{
+	cached_datafile_t *next;
+
+	for (; cached_datafiles; cached_datafiles = next) {
+		next = cached_datafiles->next;
+		image_free(&cached_datafiles->words);
+		free(cached_datafiles);
+	}
+}
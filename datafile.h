@@ -0,0 +1,25 @@
+#ifndef DATAFILE_H
+#define DATAFILE_H
+
+#include "image.h"
+
+/* the formats a data file can be loaded from */
+typedef enum {
+	DATAFILE_BINARY, /* every byte is a word */
+	DATAFILE_CSV /* signed decimal numbers separated by commas */
+} datafile_format_t;
+
+/* results of scan_number */
+#define SCAN_NUMBER_OK (0)
+#define SCAN_NUMBER_MISSING (1)
+#define SCAN_NUMBER_OVERFLOW (2)
+
+int scan_number(const char **cursor, const char *end, long *value);
+int datafile_load(const char *filename,
+		  const char *source_filename,
+		  datafile_format_t format,
+		  const word_image_t **words,
+		  const char **error);
+void datafile_release(void);
+
+#endif /* end of include guard: DATAFILE_H */
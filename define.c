@@ -0,0 +1,148 @@
+#include <stdlib.h> /* for realloc and free */
+#include <string.h> /* for strncpy */
+
+#include "consts.h"
+#include "define.h"
+#include "hash.h"
+
+/* =============================================
+ * =============================================
+ * Note: the constants of .define directives are
+ * kept in a hash table of their own, so folding
+ * a constant into an immediate costs a single
+ * probe instead of a scan of the label table.
+ * the table is emptied for every source.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_DEFINE_CAPACITY (32)
+
+typedef struct {
+	char name[MAX_LABEL_LENGTH + 1];
+	long value;
+} constant_t;
+
+/* internal global variables */
+static constant_t *constants = NULL;
+static unsigned long constant_count = 0;
+static unsigned long constant_capacity = 0;
+
+static const char *constant_name(unsigned long entry);
+static name_table_t constant_index = NAME_TABLE(constant_name);
+
+/* a table of the caller used instead, NULL for none */
+static const long *(*redirected_lookup)(const char *name) = NULL;
+static int (*redirected_install)(const char *name, long value) = NULL;
+
+/************************************************
+ * NAME: constant_name
+ * PARAMS: entry - the constant index
+ * RETURN VALUE: the constant name
+ ***********************************************/
+static const char *constant_name(unsigned long entry)
+{
+	return constants[entry].name;
+}
+
+/************************************************
+ * NAME: define_redirect
+ * PARAMS: lookup - finds a constant, NULL if it
+ * 		    isn't defined
+ * 	   install - adds a constant, 1 if it
+ * 	   	     can't
+ * DESCRIPTION: keep the constants in a table of
+ * 		the caller instead, NULL for both
+ * 		to go back to the hash table
+ ***********************************************/
+void define_redirect(const long *(*lookup)(const char *name),
+		     int (*install)(const char *name, long value))
+{
+	redirected_lookup = lookup;
+	redirected_install = install;
+}
+
+/************************************************
+ * NAME: define_reset
+ * DESCRIPTION: forget all constants but keep the
+ * 		allocated memory for the next 
+ * 		source
+ ***********************************************/
+void define_reset(void)
+{
+	name_table_reset(&constant_index);
+	constant_count = 0;
+}
+
+/************************************************
+ * NAME: define_install
+ * PARAMS: name - the constant name, not yet 
+ * 		  defined
+ * 	   value - the constant value
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+int define_install(const char *name, long value)
+{
+	unsigned long capacity = constant_capacity ? constant_capacity * 2 : MIN_DEFINE_CAPACITY;
+	constant_t *grown;
+
+	if (redirected_install) {
+		return redirected_install(name, value);
+	}
+
+	if (constant_count == constant_capacity) {
+		grown = realloc(constants, capacity * sizeof(*constants));
+		if (NULL == grown) {
+			return 1;
+		}
+		constants = grown;
+		constant_capacity = capacity;
+	}
+
+	strncpy(constants[constant_count].name, name, MAX_LABEL_LENGTH);
+	constants[constant_count].name[MAX_LABEL_LENGTH] = '\0';
+	constants[constant_count].value = value;
+	if (name_table_add(&constant_index, constants[constant_count].name)) {
+		return 1;
+	}
+	constant_count++;
+	return 0;
+}
+
+/************************************************
+ * NAME: define_lookup
+ * PARAMS: name - the constant name
+ * RETURN VALUE: the constant value, NULL if it
+ * 		 isn't defined
+ ***********************************************/
+const long *define_lookup(const char *name)
+{
+	unsigned long entry;
+
+	if (redirected_lookup) {
+		return redirected_lookup(name);
+	}
+
+	entry = name_table_find(&constant_index, name);
+	return entry ? &constants[entry - 1].value : NULL;
+}
+
+/************************************************
+ * NAME: define_count
+ * RETURN VALUE: number of constants defined
+ ***********************************************/
+unsigned long define_count(void)
+{
+	return constant_count;
+}
+
+/************************************************
+ * NAME: define_release
+ * DESCRIPTION: free the constants table
+ ***********************************************/
+void define_release(void)
+{
+	free(constants);
+	name_table_release(&constant_index);
+	constants = NULL;
+	constant_count = constant_capacity = 0;
+}
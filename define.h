@@ -0,0 +1,12 @@
+#ifndef DEFINE_H
+#define DEFINE_H
+
+void define_reset(void);
+int define_install(const char *name, long value);
+const long *define_lookup(const char *name);
+unsigned long define_count(void);
+void define_release(void);
+void define_redirect(const long *(*lookup)(const char *name),
+		     int (*install)(const char *name, long value));
+
+#endif /* end of include guard: DEFINE_H */
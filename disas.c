@@ -0,0 +1,456 @@
+#include <stdio.h> /* for fopen, fread and printf */
+#include <stdlib.h> /* for malloc, qsort and bsearch */
+#include <string.h> /* for strcmp and strncpy */
+
+#include "consts.h"
+#include "types.h"
+#include "isa.h"
+#include "objfile.h"
+
+/* =============================================
+ * =============================================
+ * disas - disassemble an object file created by
+ * the assembler:
+ *
+ *   disas [-j threads] file...
+ *
+ * file is given without the .ob extention, the
+ * .ent and .ext files are used when present to
+ * restore the label names.
+ *
+ * Note: an index operand with register r0 can't
+ * be told apart from an index operand with an
+ * extra word, a zero register field is always
+ * decoded as an extra word.
+ * ==============================================
+ * ============================================*/
+
+#define MAX_THREADS (64)
+
+typedef struct {
+	char name[MAX_LABEL_LENGTH + 1];
+	unsigned long address;
+} symbol_t;
+
+typedef struct {
+	symbol_t *symbols;
+	unsigned long count;
+} symbol_table_t;
+
+/* value of a base 4 digit character or -1 */
+static signed char base4_digits[256];
+
+/* disassembled object */
+static objfile_t object;
+static unsigned char *targets; /* addresses needing a label */
+static symbol_table_t entries;
+static symbol_table_t externals;
+
+/************************************************
+ * NAME: init_base4_digits
+ * DESCRIPTION: fill the base 4 digits table
+ ***********************************************/
+static void init_base4_digits(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		base4_digits[i] = -1;
+	}
+	for (i = 0; i < 4; i++) {
+		base4_digits['0' + i] = i;
+	}
+}
+
+/************************************************
+ * NAME: parse_base4
+ * PARAMS: p - the text to parse
+ * 	   end - end of the text
+ * 	   value - the parsed number
+ * RETURN VALUE: the character after the number
+ * 		 or NULL if there is no number
+ ***********************************************/
+static const char *parse_base4(const char *p, const char *end, unsigned long *value)
+{
+	const char *begin = p;
+	signed char digit;
+
+	*value = 0;
+	while (p < end && (digit = base4_digits[(unsigned char)*p]) >= 0) {
+		*value = (*value << 2) | digit;
+		p++;
+	}
+
+	return p == begin ? NULL : p;
+}
+
+/************************************************
+ * NAME: read_file
+ * PARAMS: filename - the file to read
+ * 	   length - the file length
+ * RETURN VALUE: the file contents or NULL on
+ * 		 error
+ ***********************************************/
+static char *read_file(const char *filename, unsigned long *length)
+{
+	FILE *fp = fopen(filename, "rb");
+	char *text;
+	long size;
+
+	if (NULL == fp) {
+		return NULL;
+	}
+
+	if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+		fclose(fp);
+		return NULL;
+	}
+
+	text = malloc(size + 1);
+	if (NULL == text || fread(text, 1, size, fp) != (unsigned long)size) {
+		free(text);
+		fclose(fp);
+		return NULL;
+	}
+	text[size] = '\0';
+
+	fclose(fp);
+	*length = size;
+	return text;
+}
+
+/************************************************
+ * NAME: compare_symbols
+ * DESCRIPTION: compare symbols by address for
+ * 		qsort and bsearch
+ ***********************************************/
+static int compare_symbols(const void *a, const void *b)
+{
+	unsigned long first = ((const symbol_t *)a)->address;
+	unsigned long second = ((const symbol_t *)b)->address;
+
+	return first < second ? -1 : first > second;
+}
+
+/************************************************
+ * NAME: load_symbols
+ * PARAMS: filename - an .ent or .ext file
+ * 	   table - the loaded symbols
+ * DESCRIPTION: load name \t address lines of a
+ * 		symbol file sorted by address, a
+ * 		missing file has no symbols
+ ***********************************************/
+static void load_symbols(const char *filename, symbol_table_t *table)
+{
+	unsigned long length;
+	unsigned long count = 0;
+	char *text = read_file(filename, &length);
+	char *p;
+	char *name;
+	const char *number;
+
+	table->symbols = NULL;
+	table->count = 0;
+	if (NULL == text) {
+		return;
+	}
+
+	for (p = text; *p; p++) {
+		count += *p == '\n';
+	}
+	table->symbols = malloc((count + 1) * sizeof(symbol_t));
+	if (NULL == table->symbols) {
+		free(text);
+		return;
+	}
+
+	for (p = text; *p; p++) {
+		name = p;
+		while (*p && *p != '\t' && *p != '\n') {
+			p++;
+		}
+		if (*p != '\t' || p - name > MAX_LABEL_LENGTH) {
+			fprintf(stderr, "%s: malformed line\n", filename);
+			break;
+		}
+		*p++ = '\0';
+		strcpy(table->symbols[table->count].name, name);
+		number = p;
+		p = (char *)parse_base4(number, number + strlen(number), &table->symbols[table->count].address);
+		if (NULL == p) {
+			fprintf(stderr, "%s: malformed line\n", filename);
+			break;
+		}
+		table->count++;
+		while (*p && *p != '\n') {
+			p++;
+		}
+		if (!*p) {
+			break;
+		}
+	}
+
+	qsort(table->symbols, table->count, sizeof(symbol_t), compare_symbols);
+	free(text);
+}
+
+/************************************************
+ * NAME: find_symbol
+ * PARAMS: table - the symbols to search
+ * 	   address - the symbol address
+ * RETURN VALUE: the symbol name or NULL
+ ***********************************************/
+static const char *find_symbol(const symbol_table_t *table, unsigned long address)
+{
+	symbol_t key;
+	symbol_t *symbol;
+
+	key.address = address;
+	symbol = bsearch(&key, table->symbols, table->count, sizeof(symbol_t), compare_symbols);
+	return symbol ? symbol->name : NULL;
+}
+
+/************************************************
+ * NAME: sign_extend
+ * PARAMS: word - a 20 bit word
+ * RETURN VALUE: the word as a signed number
+ ***********************************************/
+static long sign_extend(unsigned long word)
+{
+	return (word & 0x80000) ? (long)word - 0x100000 : (long)word;
+}
+
+/************************************************
+ * NAME: print_address_word
+ * PARAMS: index - index of an operand word
+ * DESCRIPTION: print a word that holds an
+ * 		address as a label
+ ***********************************************/
+static void print_address_word(unsigned long index)
+{
+	const char *name;
+	unsigned long address = image_get(&object.words, index);
+
+	if (objfile_linkage(&object, index) == EXTERNAL_LINKAGE) {
+		name = find_symbol(&externals, index + START_OFFSET);
+		fputs(name ? name : "?", stdout);
+	} else if (objfile_linkage(&object, index) == RELOCATBLE_LINKAGE) {
+		name = find_symbol(&entries, address);
+		if (name) {
+			fputs(name, stdout);
+		} else {
+			printf("L%lu", address);
+		}
+	} else {
+		printf("%ld", sign_extend(address));
+	}
+}
+
+/************************************************
+ * NAME: mark_address_word
+ * PARAMS: index - index of an operand word
+ * DESCRIPTION: mark the target of a relocatable
+ * 		word that has no entry name
+ ***********************************************/
+static void mark_address_word(unsigned long index)
+{
+	unsigned long address = image_get(&object.words, index) - START_OFFSET;
+
+	if (objfile_linkage(&object, index) == RELOCATBLE_LINKAGE && \
+	    address < object.code_length + object.data_length && \
+	    NULL == find_symbol(&entries, image_get(&object.words, index))) {
+		targets[address] = 1;
+	}
+}
+
+/************************************************
+ * NAME: decode_operand
+ * PARAMS: mode - the operand address mode
+ * 	   reg - the operand register field
+ * 	   pc - index of the next operand word
+ * 	   print - print the operand or only mark
+ * 	           its targets
+ * RETURN VALUE: index of the word after the
+ * 		 operand
+ ***********************************************/
+static unsigned long decode_operand(address_mode_t mode, int reg, unsigned long pc, int print)
+{
+	void (*address_word)(unsigned long) = print ? print_address_word : mark_address_word;
+
+	switch (mode) {
+		case IMMEDIATE_ADDRESS:
+			if (print) {
+				printf("#%ld", sign_extend(image_get(&object.words, pc)));
+			}
+			return pc + 1;
+		case DIRECT_ADDRESS:
+			address_word(pc);
+			return pc + 1;
+		case INDEX_ADDRESS:
+			address_word(pc++);
+			if (print) {
+				putchar('{');
+			}
+			if (reg) {
+				if (print) {
+					printf("r%d", reg);
+				}
+			} else {
+				address_word(pc++);
+			}
+			if (print) {
+				putchar('}');
+			}
+			return pc;
+		case DIRECT_REGISTER_ADDRESS:
+			if (print) {
+				printf("r%d", reg);
+			}
+			return pc;
+		case NO_ADDRESS:
+			break;
+	}
+	return pc;
+}
+
+/************************************************
+ * NAME: disassemble
+ * PARAMS: print - print the instructions or only
+ * 		   mark label targets
+ * DESCRIPTION: decode the code section and then
+ * 		the data section
+ ***********************************************/
+static void disassemble(int print)
+{
+	decoded_instruction_t decoded;
+	unsigned long pc;
+	unsigned long next;
+	unsigned long word;
+	const char *name;
+
+	for (pc = 0; pc < object.code_length + object.data_length; pc = next) {
+		if (print) {
+			name = find_symbol(&entries, pc + START_OFFSET);
+			if (name) {
+				printf("%s:", name);
+			} else if (targets[pc]) {
+				printf("L%lu:", pc + START_OFFSET);
+			}
+			printf("\t");
+		}
+
+		next = pc + 1;
+		word = image_get(&object.words, pc);
+		if (pc >= object.code_length) {
+			if (print) {
+				printf(".data\t%ld\n", sign_extend(word));
+			}
+			continue;
+		}
+
+		if (objfile_linkage(&object, pc) != ABSOLUTE_LINKAGE || isa_decode(word, &decoded)) {
+			if (print) {
+				printf(".word\t%lu\t; invalid instruction\n", word);
+			}
+			continue;
+		}
+
+		if (print) {
+			printf("%s/%d", decoded.instruction->name, decoded.type);
+			if (decoded.type) {
+				printf("/%d/%d", decoded.comb >> 1, decoded.comb & 1);
+			}
+			if (decoded.instruction->num_opernads) {
+				putchar('\t');
+			}
+		}
+		next = decode_operand(decoded.src_address_mode, decoded.src_register, next, print);
+		if (print && decoded.instruction->num_opernads == 2) {
+			fputs(", ", stdout);
+		}
+		next = decode_operand(decoded.dest_address_mode, decoded.dest_register, next, print);
+		if (print) {
+			putchar('\n');
+		}
+	}
+}
+
+/************************************************
+ * NAME: disassemble_file
+ * PARAMS: source_filename - the object filename
+ * 			     without extention
+ * 	   threads - number of parsing threads
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int disassemble_file(const char *source_filename, int threads)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	objfile_error_t error;
+
+	strncpy(filename, source_filename, MAX_FILENAME_LENGTH);
+	strncat(filename, ".ob", MAX_FILENAME_LENGTH - strlen(source_filename));
+	if (objfile_load(filename, threads, &object, &error)) {
+		if (error.line) {
+			fprintf(stderr, "%s:%lu:%lu: error: %s\n",
+				filename, error.line, error.column, error.message);
+		} else if (error.message) {
+			fprintf(stderr, "%s: %s\n", filename, error.message);
+		} else {
+			perror("couldn't read object file");
+		}
+		objfile_free(&object);
+		return 1;
+	}
+
+	targets = calloc(object.code_length + object.data_length + 1, 1);
+	if (NULL == targets) {
+		perror("couldn't allocate object");
+		exit(EXIT_FAILURE);
+	}
+
+	strncpy(filename, source_filename, MAX_FILENAME_LENGTH);
+	strncat(filename, ".ent", MAX_FILENAME_LENGTH - strlen(source_filename));
+	load_symbols(filename, &entries);
+	strncpy(filename, source_filename, MAX_FILENAME_LENGTH);
+	strncat(filename, ".ext", MAX_FILENAME_LENGTH - strlen(source_filename));
+	load_symbols(filename, &externals);
+
+	/* first find the addresses that need labels, then print */
+	disassemble(0);
+	disassemble(1);
+
+	objfile_free(&object);
+	free(targets);
+	free(entries.symbols);
+	free(externals.symbols);
+	return 0;
+}
+
+/***************************************
+ * NAME: main
+ **************************************/
+int main(int argc, char *argv[])
+{
+	static char output_buffer[1 << 16];
+	int threads = 1;
+	int rc = 0;
+	int i = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+		threads = atoi(argv[2]);
+		if (threads < 1 || threads > MAX_THREADS) {
+			fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+			return EXIT_FAILURE;
+		}
+		i = 3;
+	}
+
+	setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+	init_base4_digits();
+
+	for (; i < argc; i++) {
+		rc |= disassemble_file(argv[i], threads);
+	}
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
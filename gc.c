@@ -0,0 +1,417 @@
+#include <stdlib.h> /* for realloc, free and qsort */
+
+#include "gc.h"
+#include "types.h"
+#include "table.h"
+#include "image.h"
+#include "optimize.h"
+
+/* =============================================
+ * =============================================
+ * Note: with --gc-data the data section is cut
+ * into blocks at the data labels, a block runs
+ * from its label to the next one. the operands
+ * of the program collected by the second pass
+ * are the references: a block is kept if a
+ * label of it is used by an operand or is an
+ * entry, the rest are removed and the data 
+ * labels are moved down.
+ *
+ * an index can reach past its label, an index
+ * by a number keeps the blocks from the label
+ * to the one it lands in, so the distance
+ * between them doesn't change. an index by a 
+ * register or a label, or by a number that 
+ * lands outside of the data, keeps every block
+ * from the label to the end of the data.
+ * data before the first label is always kept.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_BLOCK_CAPACITY (64)
+#define GC_CHUNK_LENGTH (256)
+
+typedef struct {
+	unsigned long start; /* address of the block in the data section */
+	unsigned long new_start;
+	int used;
+} data_block_t;
+
+/* global variables declared in parse.c */
+extern unsigned int data_index;
+extern word_image_t data_section;
+
+/* internal global variables */
+static label_t **data_labels = NULL; /* sorted by address */
+static unsigned long label_count = 0;
+static unsigned long label_capacity = 0;
+static data_block_t *blocks = NULL;
+static unsigned long block_count = 0;
+static unsigned long block_capacity = 0;
+static unsigned long tail_block; /* this block and the ones after it are kept */
+static word_image_t kept_section; /* the compacted data, swapped with data_section */
+static int gc_failed = 0;
+
+/************************************************
+ * NAME: collect_label
+ * PARAMS: label - a label of the source
+ * DESCRIPTION: keep the labels of the data 
+ * 		section, used with loop_labels
+ ***********************************************/
+static void collect_label(label_t *label)
+{
+	unsigned long capacity = label_capacity ? label_capacity * 2 : MIN_BLOCK_CAPACITY;
+	label_t **grown;
+
+	if (!label->has_address || label->section != DATA || gc_failed) {
+		return;
+	}
+
+	if (label_count == label_capacity) {
+		grown = realloc(data_labels, capacity * sizeof(*data_labels));
+		if (NULL == grown) {
+			gc_failed = 1;
+			return;
+		}
+		data_labels = grown;
+		label_capacity = capacity;
+	}
+
+	data_labels[label_count++] = label;
+}
+
+/************************************************
+ * NAME: compare_labels
+ * PARAMS: a, b - the labels to compare
+ * RETURN VALUE: <0, 0 or >0 by address
+ ***********************************************/
+static int compare_labels(const void *a, const void *b)
+{
+	const label_t *x = *(label_t * const *)a;
+	const label_t *y = *(label_t * const *)b;
+
+	return (x->address > y->address) - (x->address < y->address);
+}
+
+/************************************************
+ * NAME: build_blocks
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: cut the data section at the 
+ * 		sorted data labels
+ ***********************************************/
+static int build_blocks(void)
+{
+	unsigned long capacity;
+	data_block_t *grown;
+	unsigned long i;
+
+	block_count = 0;
+	for (i = 0; i < label_count; i++) {
+		if (block_count && blocks[block_count - 1].start == (unsigned long)data_labels[i]->address) {
+			continue;
+		}
+
+		if (block_count == block_capacity) {
+			capacity = block_capacity ? block_capacity * 2 : MIN_BLOCK_CAPACITY;
+			grown = realloc(blocks, capacity * sizeof(*blocks));
+			if (NULL == grown) {
+				return 1;
+			}
+			blocks = grown;
+			block_capacity = capacity;
+		}
+
+		blocks[block_count].start = data_labels[i]->address;
+		blocks[block_count].used = 0;
+		block_count++;
+	}
+
+	tail_block = block_count;
+	return 0;
+}
+
+/************************************************
+ * NAME: find_block
+ * PARAMS: address - an address in the data 
+ * 		     section
+ * RETURN VALUE: index of the block holding the
+ * 		 address, block_count if it is 
+ * 		 outside of every block
+ ***********************************************/
+static unsigned long find_block(long address)
+{
+	unsigned long low = 0;
+	unsigned long high = block_count;
+	unsigned long middle;
+
+	if (0 == block_count || address < (long)blocks[0].start || address >= (long)data_index) {
+		return block_count;
+	}
+
+	/* find the last block that starts at or before the address */
+	while (high - low > 1) {
+		middle = (low + high) / 2;
+		if (blocks[middle].start <= (unsigned long)address) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+/************************************************
+ * NAME: mark_address
+ * PARAMS: address - a referenced data address
+ ***********************************************/
+static void mark_address(long address)
+{
+	unsigned long block = find_block(address);
+
+	if (block < block_count) {
+		blocks[block].used = 1;
+	}
+}
+
+/************************************************
+ * NAME: mark_index
+ * PARAMS: address - address of the label
+ * 	   index - the number it is indexed by
+ * DESCRIPTION: mark the blocks from the label 
+ * 		to the word the index lands on, so
+ * 		the distance between them is kept.
+ * 		outside of the data every block
+ * 		from the label on is kept
+ ***********************************************/
+static void mark_index(long address, long index)
+{
+	unsigned long first = find_block(address);
+	unsigned long last = find_block(address + index);
+	unsigned long swapped;
+
+	if (first == block_count) {
+		return;
+	}
+
+	if (address + index >= (long)data_index || address + index < 0) {
+		if (first < tail_block) {
+			tail_block = first;
+		}
+		return;
+	}
+
+	/* the data before the first label is always kept */
+	if (last == block_count) {
+		last = 0;
+	}
+
+	if (last < first) {
+		swapped = first;
+		first = last;
+		last = swapped;
+	}
+
+	for (; first <= last; first++) {
+		blocks[first].used = 1;
+	}
+}
+
+/************************************************
+ * NAME: data_label
+ * PARAMS: name - a label used by an operand
+ * RETURN VALUE: the label if it is a data 
+ * 		 label, NULL otherwise
+ ***********************************************/
+static label_t *data_label(char *name)
+{
+	label_t *label = lookup_label(name);
+
+	return label && label->has_address && label->section == DATA ? label : NULL;
+}
+
+/************************************************
+ * NAME: mark_operand
+ * PARAMS: operand - an operand of the program
+ * DESCRIPTION: mark the blocks the operand can
+ * 		reach
+ ***********************************************/
+static void mark_operand(operand_t *operand)
+{
+	label_t *label;
+	unsigned long block;
+
+	if (operand->type != DIRECT_ADDRESS && operand->type != INDEX_ADDRESS) {
+		return;
+	}
+
+	/* the address of an index label is a value */
+	if (operand->type == INDEX_ADDRESS && \
+	    operand->index_type == LABEL && \
+	    (label = data_label(operand->index.label))) {
+		mark_address(label->address);
+	}
+
+	label = data_label(operand->value.label);
+	if (NULL == label) {
+		return;
+	}
+
+	mark_address(label->address);
+	if (operand->type == INDEX_ADDRESS) {
+		if (operand->index_type == IMMEDIATE) {
+			mark_index(label->address, operand->index.immediate);
+		} else if ((block = find_block(label->address)) < tail_block) {
+			tail_block = block;
+		}
+	}
+}
+
+/************************************************
+ * NAME: mark_instruction
+ * PARAMS: full_instruction - an instruction of 
+ * 			      the program
+ * DESCRIPTION: mark the blocks referenced by 
+ * 		the operands, used with 
+ * 		optimize_replay
+ ***********************************************/
+static void mark_instruction(full_instruction_t *full_instruction)
+{
+	mark_operand(&full_instruction->src_operand);
+	mark_operand(&full_instruction->dest_operand);
+}
+
+/************************************************
+ * NAME: copy_words
+ * PARAMS: start - the first word to copy
+ * 	   end - the word after the last one
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: append a range of the data 
+ * 		section to the kept words
+ ***********************************************/
+static int copy_words(unsigned long start, unsigned long end)
+{
+	unsigned long words[GC_CHUNK_LENGTH];
+	long values[GC_CHUNK_LENGTH];
+	unsigned long count;
+	unsigned long i;
+
+	for (; start < end; start += count) {
+		if (image_read_words(&data_section, start,
+				     end - start < GC_CHUNK_LENGTH ? end - start : GC_CHUNK_LENGTH,
+				     words, &count) || 0 == count) {
+			return 1;
+		}
+		for (i = 0; i < count; i++) {
+			values[i] = (long)words[i];
+		}
+		if (image_append_words(&kept_section, values, count)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: compact
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: copy the used blocks to the kept
+ * 		words and swap them with the data
+ * 		section
+ ***********************************************/
+static int compact(void)
+{
+	word_image_t swapped;
+	unsigned long end;
+	unsigned long i;
+
+	image_reset(&kept_section);
+	kept_section.spill_limit = data_section.spill_limit;
+
+	if (copy_words(0, block_count ? blocks[0].start : data_index)) {
+		return 1;
+	}
+
+	for (i = 0; i < block_count; i++) {
+		end = i + 1 < block_count ? blocks[i + 1].start : data_index;
+		blocks[i].new_start = kept_section.length;
+		if (blocks[i].used && copy_words(blocks[i].start, end)) {
+			return 1;
+		}
+	}
+
+	swapped = data_section;
+	data_section = kept_section;
+	kept_section = swapped;
+	return 0;
+}
+
+/************************************************
+ * NAME: gc_data
+ * PARAMS: removed - number of data words removed
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: remove the data blocks that the
+ * 		program collected by the second 
+ * 		pass never references, move the 
+ * 		data labels and update the data 
+ * 		length
+ ***********************************************/
+int gc_data(unsigned long *removed)
+{
+	unsigned long block;
+	unsigned long i;
+
+	label_count = 0;
+	gc_failed = 0;
+	loop_labels(collect_label);
+	if (gc_failed) {
+		return 1;
+	}
+
+	qsort(data_labels, label_count, sizeof(*data_labels), compare_labels);
+	if (build_blocks()) {
+		return 1;
+	}
+
+	for (i = 0; i < label_count; i++) {
+		if (data_labels[i]->type == ENTRY) {
+			mark_address(data_labels[i]->address);
+		}
+	}
+	optimize_replay(mark_instruction);
+	for (i = tail_block; i < block_count; i++) {
+		blocks[i].used = 1;
+	}
+
+	if (compact()) {
+		return 1;
+	}
+
+	/* a label of a removed block moves with it, no operand uses it */
+	for (i = 0; i < label_count; i++) {
+		if ((block = find_block(data_labels[i]->address)) < block_count) {
+			data_labels[i]->address = blocks[block].new_start;
+		}
+	}
+
+	*removed = data_index - data_section.length;
+	data_index = data_section.length;
+	return 0;
+}
+
+/************************************************
+ * NAME: gc_release
+ * DESCRIPTION: free the blocks and the kept 
+ * 		words
+ ***********************************************/
+void gc_release(void)
+{
+	free(data_labels);
+	free(blocks);
+	image_free(&kept_section);
+	data_labels = NULL;
+	blocks = NULL;
+	label_count = label_capacity = 0;
+	block_count = block_capacity = 0;
+}
@@ -0,0 +1,7 @@
+#ifndef GC_H
+#define GC_H
+
+int gc_data(unsigned long *removed);
+void gc_release(void);
+
+#endif /* end of include guard: GC_H */
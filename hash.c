@@ -0,0 +1,181 @@
+#include <stdlib.h> /* for calloc and free */
+#include <string.h> /* for strncmp and memset */
+
+#include "hash.h"
+#include "consts.h"
+
+/* =============================================
+ * =============================================
+ * Note: names are hashed with FNV-1a, the same
+ * hash the archive index is written with.
+ * a name table keeps the numbers of the names in
+ * open addressed slots with the load factor at
+ * most a half. a slot stamped with an older
+ * generation is free, so a reset only starts a
+ * new generation and keeps the slots for the
+ * next source
+ * ==============================================
+ * ============================================*/
+
+#define MIN_SLOTS (64)
+
+/************************************************
+ * NAME: hash_bytes
+ * PARAMS: hash - the hash so far, HASH_SEED to
+ * 		  start with
+ * 	   bytes - the bytes to add
+ * 	   length - number of bytes
+ * RETURN VALUE: FNV-1a hash of the bytes
+ ***********************************************/
+unsigned long hash_bytes(unsigned long hash, const void *bytes, size_t length)
+{
+	const unsigned char *p = bytes;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash = ((hash ^ p[i]) * 16777619UL) & 0xffffffffUL;
+	}
+	return hash;
+}
+
+/************************************************
+ * NAME: hash_name
+ * PARAMS: name - a label or constant name
+ * RETURN VALUE: FNV-1a hash of the name, up to
+ * 		 MAX_LABEL_LENGTH characters
+ ***********************************************/
+unsigned long hash_name(const char *name)
+{
+	size_t length = 0;
+
+	while (length < MAX_LABEL_LENGTH && name[length]) {
+		length++;
+	}
+	return hash_bytes(HASH_SEED, name, length);
+}
+
+/************************************************
+ * NAME: find_slot
+ * PARAMS: table - the name table
+ * 	   name - the name
+ * RETURN VALUE: the slot of the name, or the
+ * 		 free slot it would take
+ ***********************************************/
+static unsigned long find_slot(const name_table_t *table, const char *name)
+{
+	unsigned long mask = table->slot_count - 1;
+	const name_slot_t *slot;
+	unsigned long i;
+
+	for (i = hash_name(name) & mask; ; i = (i + 1) & mask) {
+		slot = &table->slots[i];
+		if (slot->generation != table->generation || \
+		    strncmp(table->name_of(slot->entry), name, MAX_LABEL_LENGTH) == 0) {
+			return i;
+		}
+	}
+}
+
+/************************************************
+ * NAME: rehash
+ * PARAMS: table - the name table
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: double the slots and insert all
+ * 		the names again
+ ***********************************************/
+static int rehash(name_table_t *table)
+{
+	unsigned long count = table->slot_count ? table->slot_count * 2 : MIN_SLOTS;
+	name_slot_t *grown = calloc(count, sizeof(*grown));
+	unsigned long slot;
+	unsigned long i;
+
+	if (NULL == grown) {
+		return 1;
+	}
+
+	free(table->slots);
+	table->slots = grown;
+	table->slot_count = count;
+	table->generation = 1;
+	for (i = 0; i < table->count; i++) {
+		slot = find_slot(table, table->name_of(i));
+		grown[slot].entry = i;
+		grown[slot].generation = table->generation;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: name_table_find
+ * PARAMS: table - the name table
+ * 	   name - the name
+ * RETURN VALUE: the number of the name + 1, 0 if
+ * 		 it wasn't added
+ ***********************************************/
+unsigned long name_table_find(const name_table_t *table, const char *name)
+{
+	unsigned long slot;
+
+	if (0 == table->count) {
+		return 0;
+	}
+
+	slot = find_slot(table, name);
+	if (table->slots[slot].generation != table->generation) {
+		return 0;
+	}
+	return table->slots[slot].entry + 1;
+}
+
+/************************************************
+ * NAME: name_table_add
+ * PARAMS: table - the name table
+ * 	   name - a name not added yet, the name
+ * 	   	  of the next number
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+int name_table_add(name_table_t *table, const char *name)
+{
+	unsigned long slot;
+
+	if (2 * (table->count + 1) > table->slot_count && rehash(table)) {
+		return 1;
+	}
+
+	slot = find_slot(table, name);
+	table->slots[slot].entry = table->count++;
+	table->slots[slot].generation = table->generation;
+	return 0;
+}
+
+/************************************************
+ * NAME: name_table_reset
+ * PARAMS: table - the name table
+ * DESCRIPTION: forget all names but keep the
+ * 		slots
+ ***********************************************/
+void name_table_reset(name_table_t *table)
+{
+	table->count = 0;
+	if (0 == ++table->generation && table->slots) {
+		/* the stamps wrapped around, a stale one could match */
+		memset(table->slots, 0, table->slot_count * sizeof(*table->slots));
+	}
+	if (0 == table->generation) {
+		table->generation = 1;
+	}
+}
+
+/************************************************
+ * NAME: name_table_release
+ * PARAMS: table - the name table
+ * DESCRIPTION: free the slots
+ ***********************************************/
+void name_table_release(name_table_t *table)
+{
+	free(table->slots);
+	table->slots = NULL;
+	table->slot_count = table->count = 0;
+	table->generation = 1;
+}
@@ -0,0 +1,35 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h> /* for size_t */
+
+#define HASH_SEED (2166136261UL)
+
+/* a slot of a name table */
+typedef struct {
+	unsigned long entry; /* the number of the name */
+	unsigned long generation; /* free unless it is the current one */
+} name_slot_t;
+
+/* an open addressed index of names kept by the
+ * caller, numbered from 0 in the order they were
+ * added. name_of gives the name of a number */
+typedef struct {
+	const char *(*name_of)(unsigned long entry);
+	name_slot_t *slots;
+	unsigned long slot_count;
+	unsigned long count; /* names added since the last reset */
+	unsigned long generation;
+} name_table_t;
+
+/* an initializer of an empty name table */
+#define NAME_TABLE(name_of) {(name_of), NULL, 0, 0, 1}
+
+unsigned long hash_bytes(unsigned long hash, const void *bytes, size_t length);
+unsigned long hash_name(const char *name);
+unsigned long name_table_find(const name_table_t *table, const char *name);
+int name_table_add(name_table_t *table, const char *name);
+void name_table_reset(name_table_t *table);
+void name_table_release(name_table_t *table);
+
+#endif /* end of include guard: HASH_H */
@@ -0,0 +1,476 @@
+#include <stdio.h> /* for tmpfile, fread, fwrite and fflush */
+#include <stdlib.h> /* for realloc and free */
+#include <string.h> /* for memmove, memcpy and memset */
+
+#include "image.h"
+
+/* =============================================
+ * Note: words are packed in pairs, each pair
+ * takes five bytes:
+ * byte 0-1 and the low nibble of byte 2 hold the
+ * even word, the high nibble of byte 2 and bytes
+ * 3-4 hold the odd word
+ * a spilled image keeps the same layout in its
+ * temporary file, only whole pairs are spilled
+ * ============================================*/
+
+#define MIN_CAPACITY (64)
+#define SPILL_READ_PAIRS (64)
+#define COPY_CHUNK_LENGTH (256)
+
+/************************************************
+ * NAME: pair_offset
+ * PARAMS: index - the word index
+ * RETURN VALUE: byte offset of the word's pair
+ ***********************************************/
+static unsigned long pair_offset(unsigned long index)
+{
+	return (index >> 1) * IMAGE_PAIR_BYTES;
+}
+
+/************************************************
+ * NAME: store_word
+ * PARAMS: bytes - the image bytes
+ * 	   index - the word index
+ * 	   word - the word to store
+ * DESCRIPTION: store a word at a given index
+ ***********************************************/
+static void store_word(unsigned char *bytes, unsigned long index, unsigned long word)
+{
+	unsigned char *p = bytes + pair_offset(index);
+
+	word &= WORD_MASK;
+	if (index & 1) {
+		p[2] = (p[2] & 0x0f) | ((word & 0x0f) << 4);
+		p[3] = (word >> 4) & 0xff;
+		p[4] = (word >> 12) & 0xff;
+	} else {
+		p[0] = word & 0xff;
+		p[1] = (word >> 8) & 0xff;
+		p[2] = (p[2] & 0xf0) | ((word >> 16) & 0x0f);
+	}
+}
+
+/************************************************
+ * NAME: load_word
+ * PARAMS: bytes - the image bytes
+ * 	   index - the word index
+ * RETURN VALUE: the word at the given index
+ ***********************************************/
+static unsigned long load_word(const unsigned char *bytes, unsigned long index)
+{
+	const unsigned char *p = bytes + pair_offset(index);
+
+	if (index & 1) {
+		return (p[2] >> 4) |
+		       ((unsigned long)p[3] << 4) |
+		       ((unsigned long)p[4] << 12);
+	}
+	return p[0] |
+	       ((unsigned long)p[1] << 8) |
+	       ((unsigned long)(p[2] & 0x0f) << 16);
+}
+
+/************************************************
+ * NAME: image_spill
+ * PARAMS: image - the image to spill
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: move all whole pairs in memory to
+ * 		the end of the temporary file
+ ***********************************************/
+static int image_spill(word_image_t *image)
+{
+	unsigned long count = (image->length - image->base) & ~1UL;
+
+	if (NULL == image->spill && NULL == (image->spill = tmpfile())) {
+		return 1;
+	}
+
+	/* writes are buffered, a full disk shows at the flush */
+	if (fseek(image->spill, pair_offset(image->base), SEEK_SET) || \
+	    fwrite(image->bytes, 1, pair_offset(count), image->spill) != pair_offset(count) || \
+	    fflush(image->spill) || \
+	    ferror(image->spill)) {
+		return 1;
+	}
+
+	/* keep the half filled pair in memory */
+	if ((image->length - image->base) & 1) {
+		memmove(image->bytes, image->bytes + pair_offset(count), IMAGE_PAIR_BYTES);
+	}
+	image->base += count;
+	return 0;
+}
+
+/************************************************
+ * NAME: image_reserve
+ * PARAMS: image - the image to grow
+ * 	   count - number of words to make room
+ * 	           for
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: make sure there is room for count
+ * 		more words in the image
+ ***********************************************/
+static int image_reserve(word_image_t *image, unsigned long count)
+{
+	unsigned long capacity = image->capacity ? image->capacity : MIN_CAPACITY;
+	unsigned char *bytes;
+
+	if (image->spill_limit && \
+	    image->length - image->base + count > image->spill_limit && \
+	    image->length - image->base >= 2 && \
+	    image_spill(image)) {
+		return 1;
+	}
+
+	if (image->length - image->base + count <= image->capacity) {
+		return 0;
+	}
+
+	while (capacity < image->length - image->base + count) {
+		capacity *= 2;
+	}
+
+	/* capacity is always even so pairs are never split */
+	bytes = realloc(image->bytes, pair_offset(capacity));
+	if (NULL == bytes) {
+		return 1;
+	}
+
+	image->bytes = bytes;
+	image->capacity = capacity;
+	return 0;
+}
+
+/************************************************
+ * NAME: load_spilled_words
+ * PARAMS: image - the image
+ * 	   start - index of the first word
+ * 	   count - number of words, all spilled
+ * 	   words - output buffer for the words
+ * 	   read - number of words read
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: read words back from the
+ * 		temporary file
+ ***********************************************/
+static int load_spilled_words(const word_image_t *image,
+			      unsigned long start,
+			      unsigned long count,
+			      unsigned long *words,
+			      unsigned long *read)
+{
+	unsigned char bytes[SPILL_READ_PAIRS * IMAGE_PAIR_BYTES];
+	unsigned long first = start & ~1UL;
+	unsigned long pairs;
+	unsigned long i;
+
+	/* read whole pairs into a small window */
+	pairs = (start + count - first + 1) / 2;
+	if (pairs > SPILL_READ_PAIRS) {
+		pairs = SPILL_READ_PAIRS;
+		count = first + 2 * pairs - start;
+	}
+
+	if (fseek(image->spill, pair_offset(first), SEEK_SET) || \
+	    fread(bytes, IMAGE_PAIR_BYTES, pairs, image->spill) != pairs) {
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		words[i] = load_word(bytes, start + i - first);
+	}
+	*read = count;
+	return 0;
+}
+
+/************************************************
+ * NAME: image_init
+ * PARAMS: image - the image to init
+ * DESCRIPTION: init an empty image
+ ***********************************************/
+void image_init(word_image_t *image)
+{
+	image->bytes = NULL;
+	image->length = 0;
+	image->capacity = 0;
+	image->base = 0;
+	image->spill_limit = 0;
+	image->spill = NULL;
+}
+
+/************************************************
+ * NAME: image_free
+ * PARAMS: image - the image to free
+ * DESCRIPTION: release the image memory
+ ***********************************************/
+void image_free(word_image_t *image)
+{
+	free(image->bytes);
+	if (image->spill) {
+		fclose(image->spill);
+	}
+	image_init(image);
+}
+
+/************************************************
+ * NAME: image_reset
+ * PARAMS: image - the image to reset
+ * DESCRIPTION: empty the image but keep the
+ * 		allocated memory for reuse
+ ***********************************************/
+void image_reset(word_image_t *image)
+{
+	/* the temporary file is reused from its start */
+	image->length = 0;
+	image->base = 0;
+}
+
+/************************************************
+ * NAME: image_resize
+ * PARAMS: image - an image without a spill 
+ * 		   limit
+ * 	   length - the new number of words
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: set the length of the image, the
+ * 		added words are zero so they can 
+ * 		be filled with image_set in any 
+ * 		order
+ ***********************************************/
+int image_resize(word_image_t *image, unsigned long length)
+{
+	if (length > image->length) {
+		if (image_reserve(image, length - image->length)) {
+			return 1;
+		}
+		/* keep the first word of a half filled pair */
+		if (image->length & 1) {
+			store_word(image->bytes, image->length, 0);
+		}
+		memset(image->bytes + pair_offset(image->length + 1), 0,
+		       pair_offset(image->capacity) - pair_offset(image->length + 1));
+	}
+	image->length = length;
+	return 0;
+}
+
+/************************************************
+ * NAME: image_set_spill_limit
+ * PARAMS: image - the image
+ * 	   words - number of words to keep in 
+ * 	           memory, 0 for no limit
+ * DESCRIPTION: bound the image memory, older
+ * 		words are spilled to a temporary
+ * 		file and read back when needed
+ ***********************************************/
+void image_set_spill_limit(word_image_t *image, unsigned long words)
+{
+	/* whole pairs are spilled */
+	image->spill_limit = words ? (words + 3) & ~1UL : 0;
+}
+
+/************************************************
+ * NAME: image_append
+ * PARAMS: image - the image to append to
+ * 	   word - the word to append, only 20 bits
+ * 	          are kept
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+int image_append(word_image_t *image, long word)
+{
+	if (image_reserve(image, 1)) {
+		return 1;
+	}
+
+	store_word(image->bytes, image->length++ - image->base, word);
+	return 0;
+}
+
+/************************************************
+ * NAME: image_append_words
+ * PARAMS: image - the image to append to
+ * 	   words - the words to append
+ * 	   count - number of words
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: append many words at once, whole
+ * 		pairs are written directly
+ ***********************************************/
+int image_append_words(word_image_t *image, const long *words, unsigned long count)
+{
+	unsigned char *p;
+	unsigned long first;
+	unsigned long second;
+
+	/* a bounded image is filled a word at a time */
+	if (image->spill_limit) {
+		for (; count; count--) {
+			if (image_append(image, *words++)) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (image_reserve(image, count)) {
+		return 1;
+	}
+
+	/* complete a half filled pair */
+	if (count && (image->length & 1)) {
+		store_word(image->bytes, image->length++, *words++);
+		count--;
+	}
+
+	p = image->bytes + pair_offset(image->length);
+	for (; count >= 2; count -= 2, words += 2, p += IMAGE_PAIR_BYTES) {
+		first = *words & WORD_MASK;
+		second = words[1] & WORD_MASK;
+		p[0] = first & 0xff;
+		p[1] = (first >> 8) & 0xff;
+		p[2] = ((first >> 16) & 0x0f) | ((second & 0x0f) << 4);
+		p[3] = (second >> 4) & 0xff;
+		p[4] = (second >> 12) & 0xff;
+		image->length += 2;
+	}
+
+	if (count) {
+		store_word(image->bytes, image->length++, *words);
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: image_append_image
+ * PARAMS: image - the image to append to
+ * 	   source - the words to append
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: append all the words of another
+ * 		image, the packed bytes are copied 
+ * 		when the pairs line up
+ ***********************************************/
+int image_append_image(word_image_t *image, const word_image_t *source)
+{
+	unsigned long words[COPY_CHUNK_LENGTH];
+	long chunk[COPY_CHUNK_LENGTH];
+	unsigned long start;
+	unsigned long count;
+	unsigned long i;
+
+	if (0 == source->length) {
+		return 0;
+	}
+
+	if (!image->spill_limit && 0 == source->base && !(image->length & 1)) {
+		if (image_reserve(image, source->length)) {
+			return 1;
+		}
+		memcpy(image->bytes + pair_offset(image->length), 
+		       source->bytes, 
+		       pair_offset(source->length + 1));
+		image->length += source->length;
+		return 0;
+	}
+
+	for (start = 0; start < source->length; start += count) {
+		if (image_read_words(source, start, COPY_CHUNK_LENGTH, words, &count)) {
+			return 1;
+		}
+		for (i = 0; i < count; i++) {
+			chunk[i] = words[i];
+		}
+		if (image_append_words(image, chunk, count)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: image_get
+ * PARAMS: image - the image
+ * 	   index - the word index
+ * RETURN VALUE: the word at the given index
+ ***********************************************/
+unsigned long image_get(const word_image_t *image, unsigned long index)
+{
+	unsigned long word = 0;
+	unsigned long read;
+
+	if (index < image->base) {
+		load_spilled_words(image, index, 1, &word, &read);
+		return word;
+	}
+	return load_word(image->bytes, index - image->base);
+}
+
+/************************************************
+ * NAME: image_set
+ * PARAMS: image - the image
+ * 	   index - the word index
+ * 	   word - the new word value
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: overwrite an existing word
+ ***********************************************/
+int image_set(word_image_t *image, unsigned long index, long word)
+{
+	unsigned char pair[IMAGE_PAIR_BYTES];
+
+	if (index >= image->base) {
+		store_word(image->bytes, index - image->base, word);
+		return 0;
+	}
+
+	/* rewrite the spilled pair */
+	if (fseek(image->spill, pair_offset(index), SEEK_SET) || \
+	    fread(pair, 1, IMAGE_PAIR_BYTES, image->spill) != IMAGE_PAIR_BYTES) {
+		return 1;
+	}
+	store_word(pair, index & 1, word);
+	return fseek(image->spill, pair_offset(index), SEEK_SET) || \
+	       fwrite(pair, 1, IMAGE_PAIR_BYTES, image->spill) != IMAGE_PAIR_BYTES || \
+	       fflush(image->spill) || \
+	       ferror(image->spill);
+}
+
+/************************************************
+ * NAME: image_read_words
+ * PARAMS: image - the image
+ * 	   start - index of the first word to read
+ * 	   count - maximum number of words to read
+ * 	   words - output buffer for the words
+ * 	   read - number of words read, 0 past
+ * 	   	  the end of the image
+ * RETURN VALUE: 1 if the temporary file can't
+ * 		 be read, 0 on success
+ * DESCRIPTION: unpack a range of words at once
+ ***********************************************/
+int image_read_words(const word_image_t *image,
+		     unsigned long start,
+		     unsigned long count,
+		     unsigned long *words,
+		     unsigned long *read)
+{
+	unsigned long i;
+
+	*read = 0;
+	if (start >= image->length) {
+		return 0;
+	}
+	if (count > image->length - start) {
+		count = image->length - start;
+	}
+
+	if (start < image->base) {
+		if (count > image->base - start) {
+			count = image->base - start;
+		}
+		return load_spilled_words(image, start, count, words, read);
+	}
+
+	for (i = 0; i < count; i++) {
+		words[i] = load_word(image->bytes, start + i - image->base);
+	}
+
+	*read = count;
+	return 0;
+}
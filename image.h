@@ -0,0 +1,41 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h> /* for FILE */
+
+/* a machine word is 20 bits wide */
+#define WORD_MASK (0xfffff)
+
+/* two 20 bit words are packed into five bytes */
+#define IMAGE_PAIR_BYTES (5)
+
+/* a growable image of 20 bit machine words stored
+ * densely, used for the code and data sections.
+ * with a spill limit the words before base are 
+ * kept in a temporary file */
+typedef struct {
+	unsigned char *bytes;
+	unsigned long length; /* number of words in the image */
+	unsigned long capacity; /* number of words allocated */
+	unsigned long base; /* index of the first word in memory */
+	unsigned long spill_limit; /* words kept in memory, 0 for no limit */
+	FILE *spill;
+} word_image_t;
+
+void image_init(word_image_t *image);
+void image_free(word_image_t *image);
+void image_reset(word_image_t *image);
+int image_resize(word_image_t *image, unsigned long length);
+void image_set_spill_limit(word_image_t *image, unsigned long words);
+int image_append(word_image_t *image, long word);
+int image_append_words(word_image_t *image, const long *words, unsigned long count);
+int image_append_image(word_image_t *image, const word_image_t *source);
+unsigned long image_get(const word_image_t *image, unsigned long index);
+int image_set(word_image_t *image, unsigned long index, long word);
+int image_read_words(const word_image_t *image,
+		     unsigned long start,
+		     unsigned long count,
+		     unsigned long *words,
+		     unsigned long *read);
+
+#endif /* end of include guard: IMAGE_H */
@@ -0,0 +1,857 @@
+#define _DEFAULT_SOURCE /* for syscall */
+
+#include <stdio.h> /* for fprintf */
+#include <stdlib.h> /* for malloc and free */
+#include <string.h> /* for strncpy and strerror */
+#include <errno.h> /* for errno */
+#include <fcntl.h> /* for open */
+#include <unistd.h> /* for read, write and close */
+#include <sys/stat.h> /* for fstat */
+#include <sys/uio.h> /* for struct iovec */
+#include <pthread.h> /* for the thread pool backend */
+#ifndef NO_IO_URING
+#include <sys/mman.h> /* for mmap */
+#include <sys/syscall.h> /* for the io_uring system calls */
+#include <linux/io_uring.h>
+#endif
+
+#include "io.h"
+#include "consts.h"
+#include "arena.h"
+#include "trace.h"
+
+/* =============================================
+ * =============================================
+ * Note: batch I/O reads the upcoming sources
+ * and writes the finished outputs while other
+ * files are assembled. io_uring is used when
+ * the kernel supports it, otherwise a pool of
+ * threads does blocking I/O. without io_init
+ * every request is done synchronously.
+ * build with -DNO_IO_URING to use only the
+ * thread pool.
+ * ==============================================
+ * ============================================*/
+
+#define IO_QUEUE_DEPTH (64)
+#define IO_THREADS (4)
+
+typedef enum {
+	IO_READ,
+	IO_WRITE
+} io_type_t;
+
+typedef struct io_request {
+	io_type_t type;
+	char filename[MAX_FILENAME_LENGTH];
+	int fd;
+	char *data;
+	unsigned long length;
+	unsigned long done; /* bytes transfered so far */
+	int error; /* errno of a failed request */
+	int completed;
+	struct iovec iov;
+	struct io_request *next; /* link of the prefetched reads */
+	struct io_request *queue_next; /* link of the thread pool queue */
+	arena_t *arena; /* holds the request and its data, NULL for malloc */
+} io_request_t;
+
+static enum {
+	SYNC_BACKEND,
+	URING_BACKEND,
+	THREAD_BACKEND
+} backend = SYNC_BACKEND;
+
+/* prefetched reads not taken by io_read yet */
+static io_request_t *reads = NULL;
+/* writes that are not completed yet */
+static unsigned int pending_writes = 0;
+static int write_failed = 0;
+
+/* thread pool backend */
+static pthread_t workers[IO_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t completed = PTHREAD_COND_INITIALIZER;
+static io_request_t *queue_head = NULL;
+static io_request_t *queue_tail = NULL;
+static int stopping = 0;
+
+#ifndef NO_IO_URING
+/* io_uring backend */
+static struct {
+	int fd;
+	unsigned int entries;
+	unsigned int in_flight;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} ring;
+#endif
+
+/************************************************
+ * NAME: new_request
+ * PARAMS: type - the request type
+ * 	   filename - the file to read or write
+ * 	   arena - the arena to allocate in, NULL
+ * 	           for malloc
+ * RETURN VALUE: a new request or NULL
+ ***********************************************/
+static io_request_t *new_request(io_type_t type, const char *filename, arena_t *arena)
+{
+	io_request_t *request = arena ? 
+				arena_alloc(arena, sizeof(io_request_t)) : 
+				malloc(sizeof(io_request_t));
+
+	if (NULL == request) {
+		return NULL;
+	}
+
+	request->type = type;
+	strncpy(request->filename, filename, MAX_FILENAME_LENGTH - 1);
+	request->filename[MAX_FILENAME_LENGTH - 1] = '\0';
+	request->fd = -1;
+	request->data = NULL;
+	request->length = 0;
+	request->done = 0;
+	request->error = 0;
+	request->completed = 0;
+	request->next = NULL;
+	request->arena = arena;
+	return request;
+}
+
+/************************************************
+ * NAME: open_request
+ * PARAMS: request - the request to open
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: open the request file, a read
+ * 		request also gets a buffer of the
+ * 		file size
+ ***********************************************/
+static int open_request(io_request_t *request)
+{
+	struct stat st;
+
+	if (request->type == IO_WRITE) {
+		request->fd = open(request->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (request->fd < 0) {
+			request->error = errno;
+			return 1;
+		}
+		return 0;
+	}
+
+	request->fd = open(request->filename, O_RDONLY);
+	if (request->fd < 0) {
+		request->error = errno;
+		return 1;
+	}
+
+	if (fstat(request->fd, &st)) {
+		request->error = errno;
+		return 1;
+	}
+
+	request->length = st.st_size;
+	/* the arena of a prefetched read is used only by this thread
+	 * until the read completes */
+	if (request->arena) {
+		request->data = arena_alloc(request->arena, request->length + 1);
+	} else {
+		request->data = malloc(request->length + 1);
+	}
+	if (NULL == request->data) {
+		request->error = ENOMEM;
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: finish_request
+ * PARAMS: request - the request to finish
+ * DESCRIPTION: close the request file and mark
+ * 		it completed. a completed write is
+ * 		released or unpins its arena
+ ***********************************************/
+static void finish_request(io_request_t *request)
+{
+	if (request->fd >= 0) {
+		close(request->fd);
+		request->fd = -1;
+	}
+
+	if (request->type == IO_READ) {
+		request->completed = 1;
+		return;
+	}
+
+	if (request->error) {
+		fprintf(stderr, "%s: %s\n", request->filename, strerror(request->error));
+		write_failed = 1;
+	}
+	pending_writes--;
+	if (request->arena) {
+		request->arena->pins--;
+	} else {
+		free(request->data);
+		free(request);
+	}
+}
+
+/************************************************
+ * NAME: perform_request
+ * PARAMS: request - the request to perform
+ * DESCRIPTION: perform a request with blocking
+ * 		system calls
+ ***********************************************/
+static void perform_request(io_request_t *request)
+{
+	long n;
+
+	if (open_request(request)) {
+		return;
+	}
+
+	while (request->done < request->length) {
+		if (request->type == IO_READ) {
+			n = read(request->fd, request->data + request->done, request->length - request->done);
+		} else {
+			n = write(request->fd, request->data + request->done, request->length - request->done);
+		}
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			request->error = errno;
+			return;
+		} else if (n == 0) {
+			/* the file was truncated while reading */
+			request->length = request->done;
+		}
+		request->done += n;
+	}
+}
+
+/************************************************
+ * NAME: transfer_request
+ * PARAMS: request - the request to perform
+ * DESCRIPTION: perform a request with blocking
+ * 		system calls on the calling thread
+ ***********************************************/
+static void transfer_request(io_request_t *request)
+{
+	trace_begin(request->type == IO_READ ? "read" : "write", request->filename);
+	perform_request(request);
+	trace_end();
+}
+
+/************************************************
+ * NAME: worker
+ * DESCRIPTION: a thread pool worker, performs
+ * 		queued requests until stopped
+ ***********************************************/
+static void *worker(void *unused)
+{
+	io_request_t *request;
+
+	trace_thread_name("io worker");
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (NULL == queue_head && !stopping) {
+			pthread_cond_wait(&queued, &lock);
+		}
+		request = queue_head;
+		if (NULL == request) {
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		queue_head = request->queue_next;
+		if (NULL == queue_head) {
+			queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&lock);
+
+		transfer_request(request);
+
+		pthread_mutex_lock(&lock);
+		finish_request(request);
+		pthread_cond_broadcast(&completed);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/************************************************
+ * NAME: thread_submit
+ * PARAMS: request - the request to queue
+ ***********************************************/
+static void thread_submit(io_request_t *request)
+{
+	pthread_mutex_lock(&lock);
+	if (request->type == IO_WRITE) {
+		pending_writes++;
+		if (request->arena) {
+			request->arena->pins++;
+		}
+	}
+	request->queue_next = NULL;
+	if (queue_tail) {
+		queue_tail->queue_next = request;
+	} else {
+		queue_head = request;
+	}
+	queue_tail = request;
+	pthread_cond_signal(&queued);
+	pthread_mutex_unlock(&lock);
+}
+
+/************************************************
+ * NAME: thread_init
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: start the thread pool
+ ***********************************************/
+static int thread_init(void)
+{
+	int i;
+
+	stopping = 0;
+	for (i = 0; i < IO_THREADS; i++) {
+		if (pthread_create(&workers[i], NULL, worker, NULL)) {
+			break;
+		}
+	}
+
+	/* a partial pool is still fine */
+	return i == 0;
+}
+
+/************************************************
+ * NAME: thread_shutdown
+ * DESCRIPTION: wait for all queued requests and
+ * 		stop the thread pool
+ ***********************************************/
+static void thread_shutdown(void)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_broadcast(&queued);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < IO_THREADS; i++) {
+		pthread_join(workers[i], NULL);
+	}
+}
+
+#ifndef NO_IO_URING
+/************************************************
+ * NAME: uring_enter
+ * PARAMS: submit - number of entries to submit
+ * 	   wait - number of completions to wait for
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int uring_enter(unsigned int submit, unsigned int wait)
+{
+	long rc;
+
+	do {
+		rc = syscall(__NR_io_uring_enter, ring.fd, submit, wait,
+			     wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	return rc < 0;
+}
+
+static void uring_reap(int wait);
+
+/************************************************
+ * NAME: uring_submit
+ * PARAMS: request - an opened request
+ * DESCRIPTION: submit the rest of a request
+ * 		transfer to the ring
+ ***********************************************/
+static void uring_submit(io_request_t *request)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+	unsigned int index;
+
+	while (ring.in_flight >= ring.entries) {
+		uring_reap(1);
+	}
+
+	request->iov.iov_base = request->data + request->done;
+	request->iov.iov_len = request->length - request->done;
+
+	tail = *ring.sq_tail;
+	index = tail & *ring.sq_mask;
+	sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = request->type == IO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = request->fd;
+	sqe->addr = (unsigned long)&request->iov;
+	sqe->len = 1;
+	sqe->off = request->done;
+	sqe->user_data = (unsigned long)request;
+	ring.sq_array[index] = index;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring.in_flight++;
+
+	if (uring_enter(1, 0)) {
+		/* the entry wasn't consumed, do the transfer here */
+		__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+		ring.in_flight--;
+		transfer_request(request);
+		finish_request(request);
+	}
+}
+
+/************************************************
+ * NAME: uring_complete
+ * PARAMS: request - the completed request
+ * 	   result - the transfer result
+ * DESCRIPTION: handle a completion, a short
+ * 		transfer is resubmitted and an 
+ * 		empty write fails with EIO
+ ***********************************************/
+static void uring_complete(io_request_t *request, int result)
+{
+	if (result == -EINTR || result == -EAGAIN) {
+		uring_submit(request);
+		return;
+	} else if (result < 0) {
+		request->error = -result;
+	} else if (result == 0 && request->type == IO_READ) {
+		/* the file was truncated while reading */
+		request->length = request->done;
+	} else if (result == 0) {
+		/* an empty request isn't submitted, a write that 
+		 * makes no progress would be resubmitted forever */
+		request->error = EIO;
+	} else {
+		request->done += result;
+		if (request->done < request->length) {
+			uring_submit(request);
+			return;
+		}
+	}
+
+	finish_request(request);
+}
+
+/************************************************
+ * NAME: uring_reap
+ * PARAMS: wait - wait for at least one completion
+ * DESCRIPTION: handle all available completions
+ ***********************************************/
+static void uring_reap(int wait)
+{
+	struct io_uring_cqe *cqe;
+	io_request_t *request;
+	unsigned int head;
+	int result;
+
+	if (wait && uring_enter(0, 1)) {
+		return;
+	}
+
+	head = *ring.cq_head;
+	while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		request = (io_request_t *)(unsigned long)cqe->user_data;
+		result = cqe->res;
+		__atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+		ring.in_flight--;
+		uring_complete(request, result);
+	}
+}
+
+/************************************************
+ * NAME: uring_start
+ * PARAMS: request - a new request
+ * DESCRIPTION: open a request and submit it, an
+ * 		empty or failed request completes
+ * 		at once
+ ***********************************************/
+static void uring_start(io_request_t *request)
+{
+	if (open_request(request) || request->length == 0) {
+		finish_request(request);
+		return;
+	}
+
+	uring_submit(request);
+}
+
+/************************************************
+ * NAME: uring_init
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: set up the ring, fails on kernels
+ * 		without io_uring
+ ***********************************************/
+static int uring_init(void)
+{
+	struct io_uring_params params;
+	char *sq;
+	char *cq;
+
+	memset(&params, 0, sizeof(params));
+	ring.fd = syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &params);
+	if (ring.fd < 0) {
+		return 1;
+	}
+
+	ring.entries = params.sq_entries;
+	ring.in_flight = 0;
+	ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_ring_size > ring.sq_ring_size) {
+			ring.sq_ring_size = ring.cq_ring_size;
+		}
+		ring.cq_ring_size = ring.sq_ring_size;
+	}
+
+	ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, ring.fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring.sq_ring) {
+		close(ring.fd);
+		return 1;
+	}
+
+	ring.cq_ring = ring.sq_ring;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, ring.fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring.cq_ring) {
+			munmap(ring.sq_ring, ring.sq_ring_size);
+			close(ring.fd);
+			return 1;
+		}
+	}
+
+	ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, ring.fd, IORING_OFF_SQES);
+	if (MAP_FAILED == (void *)ring.sqes) {
+		if (ring.cq_ring != ring.sq_ring) {
+			munmap(ring.cq_ring, ring.cq_ring_size);
+		}
+		munmap(ring.sq_ring, ring.sq_ring_size);
+		close(ring.fd);
+		return 1;
+	}
+
+	sq = ring.sq_ring;
+	cq = ring.cq_ring;
+	ring.sq_head = (unsigned int *)(sq + params.sq_off.head);
+	ring.sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring.sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring.sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring.cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring.cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring.cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return 0;
+}
+
+/************************************************
+ * NAME: uring_shutdown
+ * DESCRIPTION: release the ring
+ ***********************************************/
+static void uring_shutdown(void)
+{
+	munmap(ring.sqes, ring.sqes_size);
+	if (ring.cq_ring != ring.sq_ring) {
+		munmap(ring.cq_ring, ring.cq_ring_size);
+	}
+	munmap(ring.sq_ring, ring.sq_ring_size);
+	close(ring.fd);
+}
+#endif
+
+/************************************************
+ * NAME: submit
+ * PARAMS: request - a new request
+ * DESCRIPTION: start a request on the current
+ * 		backend
+ ***********************************************/
+static void submit(io_request_t *request)
+{
+	/* the thread pool counts its writes under its lock */
+	if (request->type == IO_WRITE && backend != THREAD_BACKEND) {
+		pending_writes++;
+		if (request->arena) {
+			request->arena->pins++;
+		}
+	}
+
+	switch (backend) {
+		case URING_BACKEND:
+#ifndef NO_IO_URING
+			uring_start(request);
+#endif
+			break;
+		case THREAD_BACKEND:
+			thread_submit(request);
+			break;
+		case SYNC_BACKEND:
+			transfer_request(request);
+			finish_request(request);
+			break;
+	}
+}
+
+/************************************************
+ * NAME: wait_request
+ * PARAMS: request - a submitted read request
+ * DESCRIPTION: wait for a read to complete
+ ***********************************************/
+static void wait_request(io_request_t *request)
+{
+	trace_begin("wait_read", request->filename);
+	switch (backend) {
+		case URING_BACKEND:
+#ifndef NO_IO_URING
+			while (!request->completed) {
+				uring_reap(1);
+			}
+#endif
+			break;
+		case THREAD_BACKEND:
+			pthread_mutex_lock(&lock);
+			while (!request->completed) {
+				pthread_cond_wait(&completed, &lock);
+			}
+			pthread_mutex_unlock(&lock);
+			break;
+		case SYNC_BACKEND:
+			break;
+	}
+	trace_end();
+}
+
+/* exported functions */
+
+/************************************************
+ * NAME: io_init
+ * RETURN VALUE: 1 if only synchronous I/O is
+ * 		 available, 0 otherwise
+ * DESCRIPTION: start the batch I/O backend
+ ***********************************************/
+int io_init(void)
+{
+#ifndef NO_IO_URING
+	if (!uring_init()) {
+		backend = URING_BACKEND;
+		return 0;
+	}
+#endif
+	if (!thread_init()) {
+		backend = THREAD_BACKEND;
+		return 0;
+	}
+
+	backend = SYNC_BACKEND;
+	return 1;
+}
+
+/************************************************
+ * NAME: io_shutdown
+ * RETURN VALUE: 1 if a write failed, 0 otherwise
+ * DESCRIPTION: wait for all pending requests and
+ * 		stop the batch I/O backend
+ ***********************************************/
+int io_shutdown(void)
+{
+	io_request_t *request;
+
+	/* drop reads nobody asked for */
+	while (reads) {
+		request = reads;
+		reads = reads->next;
+		wait_request(request);
+		if (NULL == request->arena) {
+			free(request->data);
+			free(request);
+		}
+	}
+
+	switch (backend) {
+		case URING_BACKEND:
+#ifndef NO_IO_URING
+			while (pending_writes) {
+				uring_reap(1);
+			}
+			uring_shutdown();
+#endif
+			break;
+		case THREAD_BACKEND:
+			thread_shutdown();
+			break;
+		case SYNC_BACKEND:
+			break;
+	}
+
+	backend = SYNC_BACKEND;
+	return write_failed;
+}
+
+/************************************************
+ * NAME: io_wait_arena
+ * PARAMS: arena - an arena used for writes
+ * DESCRIPTION: wait for all the writes from an 
+ * 		arena so it can be reset
+ ***********************************************/
+void io_wait_arena(arena_t *arena)
+{
+	switch (backend) {
+		case URING_BACKEND:
+#ifndef NO_IO_URING
+			while (arena->pins) {
+				uring_reap(1);
+			}
+#endif
+			break;
+		case THREAD_BACKEND:
+			pthread_mutex_lock(&lock);
+			while (arena->pins) {
+				pthread_cond_wait(&completed, &lock);
+			}
+			pthread_mutex_unlock(&lock);
+			break;
+		case SYNC_BACKEND:
+			break;
+	}
+}
+
+/************************************************
+ * NAME: io_prefetch
+ * PARAMS: filename - a file that will be read
+ * 	   arena - the arena to read it to, NULL
+ * 	           for malloc
+ * DESCRIPTION: start reading a file, a no-op
+ * 		without a batch I/O backend
+ ***********************************************/
+void io_prefetch(const char *filename, arena_t *arena)
+{
+	io_request_t *request;
+
+	if (backend == SYNC_BACKEND) {
+		return;
+	}
+
+	request = new_request(IO_READ, filename, arena);
+	if (NULL == request) {
+		return;
+	}
+
+	/* the list is only used by the main thread */
+	request->next = reads;
+	reads = request;
+	submit(request);
+}
+
+/************************************************
+ * NAME: io_read
+ * PARAMS: filename - the file to read
+ * 	   length - the read length
+ * 	   arena - the arena to read to, NULL for
+ * 	           malloc
+ * RETURN VALUE: the file contents which should be
+ * 		 released with free unless in an 
+ * 		 arena, or NULL with errno set on 
+ * 		 error
+ * DESCRIPTION: read a whole file, waiting for it
+ * 		if it was prefetched. a prefetched
+ * 		file is in the arena it was 
+ * 		prefetched to
+ ***********************************************/
+char *io_read(const char *filename, unsigned long *length, arena_t *arena)
+{
+	io_request_t **link;
+	io_request_t *request = NULL;
+	char *data;
+
+	for (link = &reads; *link; link = &(*link)->next) {
+		if (strcmp((*link)->filename, filename) == 0) {
+			request = *link;
+			*link = request->next;
+			break;
+		}
+	}
+
+	if (NULL == request) {
+		request = new_request(IO_READ, filename, arena);
+		if (NULL == request) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		transfer_request(request);
+		finish_request(request);
+	} else {
+		wait_request(request);
+	}
+
+	data = request->data;
+	*length = request->length;
+	if (request->error) {
+		if (NULL == request->arena) {
+			free(data);
+		}
+		data = NULL;
+		errno = request->error;
+	}
+
+	if (NULL == request->arena) {
+		free(request);
+	}
+	return data;
+}
+
+/************************************************
+ * NAME: io_write
+ * PARAMS: filename - the file to write
+ * 	   data - the contents, released with free
+ * 	          once written unless in an arena
+ * 	   length - the contents length
+ * 	   arena - the arena holding the contents,
+ * 	           pinned until they are written,
+ * 	           NULL for malloc
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write a whole file, in batch mode
+ * 		errors are reported by io_shutdown
+ ***********************************************/
+int io_write(const char *filename, char *data, unsigned long length, arena_t *arena)
+{
+	io_request_t *request = new_request(IO_WRITE, filename, arena);
+	int failed = write_failed;
+
+	if (NULL == request) {
+		if (NULL == arena) {
+			free(data);
+		}
+		return 1;
+	}
+
+	request->data = data;
+	request->length = length;
+	submit(request);
+
+	/* a synchronous write reports its error at once */
+	return backend == SYNC_BACKEND && write_failed != failed;
+}
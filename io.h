@@ -0,0 +1,16 @@
+#ifndef IO_H
+#define IO_H
+
+#include "arena.h"
+
+/* number of upcoming sources read ahead in batch mode */
+#define IO_PREFETCH_DEPTH (4)
+
+int io_init(void);
+int io_shutdown(void);
+void io_wait_arena(arena_t *arena);
+void io_prefetch(const char *filename, arena_t *arena);
+char *io_read(const char *filename, unsigned long *length, arena_t *arena);
+int io_write(const char *filename, char *data, unsigned long length, arena_t *arena);
+
+#endif /* end of include guard: IO_H */
@@ -0,0 +1,219 @@
+#include <string.h> /* for strncmp */
+
+#include "isa.h"
+#include "consts.h"
+#include "types.h"
+
+/* =============================================
+ * =============================================
+ * Note: all tables in this file are generated
+ * from isa.def at compile time. tables indexed
+ * by an address mode have ISA_MODE_SLOTS
+ * entries so the mode bit itself is the index
+ * ==============================================
+ * ============================================*/
+
+#define FIELD_MASK(width) ((1UL << (width)) - 1)
+
+/* expand a function-like macro for every address mode slot */
+#define ISA_MODE_TABLE(F, a) { \
+	F(0, a), F(1, a), F(2, a), F(3, a), F(4, a), F(5, a), \
+	F(6, a), F(7, a), F(8, a), F(9, a), F(10, a), F(11, a), \
+	F(12, a), F(13, a), F(14, a), F(15, a), F(16, a) }
+
+/* properties of a single address mode slot */
+#define ISA_IS_MODE_TERM(slot, mode, code, words) || ((slot) == (mode))
+#define ISA_IS_MODE(slot) (0 ISA_ADDRESS_MODES(ISA_IS_MODE_TERM, slot))
+#define ISA_MODE_CODE_TERM(slot, mode, code, words) + ((slot) == (mode) ? (code) : 0)
+#define ISA_MODE_CODE(slot) (0 ISA_ADDRESS_MODES(ISA_MODE_CODE_TERM, slot))
+#define ISA_MODE_WORDS_TERM(slot, mode, code, words) + ((slot) == (mode) ? (words) : 0)
+#define ISA_MODE_WORDS(slot) (0 ISA_ADDRESS_MODES(ISA_MODE_WORDS_TERM, slot))
+#define ISA_CODE_MODE_TERM(c, mode, code, words) + ((c) == (code) && (mode) != NO_ADDRESS ? (mode) : 0)
+#define ISA_CODE_MODE(c) (0 ISA_ADDRESS_MODES(ISA_CODE_MODE_TERM, c))
+
+/* table entries generators */
+#define ISA_ALLOWED(slot, modes) (ISA_IS_MODE(slot) && ((slot) & (modes)) != 0)
+#define ISA_MODE_FIELD(slot, offset) (ISA_MODE_CODE(slot) << (offset))
+#define ISA_WORDS(slot, unused) ISA_MODE_WORDS(slot)
+#define ISA_INSTRUCTION_ENTRY(name, opcode, operands, src_modes, dest_modes) \
+	{#name, (src_modes), (dest_modes), (operands), (opcode)},
+#define ISA_ALLOWED_ROW(name, opcode, operands, src_modes, dest_modes) \
+	{ISA_MODE_TABLE(ISA_ALLOWED, src_modes), ISA_MODE_TABLE(ISA_ALLOWED, dest_modes)},
+#define ISA_DECLARE_INDEX(name, opcode, operands, src_modes, dest_modes) ISA_INDEX_##name,
+#define ISA_CHECK_ORDER(name, opcode, operands, src_modes, dest_modes) \
+	typedef char isa_order_check_##name[(int)OPCODE_##name == (int)ISA_INDEX_##name ? 1 : -1];
+
+/* instructions are indexed by their opcode so isa.def must
+ * list them in opcode order */
+enum {
+	ISA_INSTRUCTIONS(ISA_DECLARE_INDEX)
+	ISA_INSTRUCTIONS_COUNT
+};
+ISA_INSTRUCTIONS(ISA_CHECK_ORDER)
+
+/* available instructions */
+static instruction_t instructions[] = {
+	ISA_INSTRUCTIONS(ISA_INSTRUCTION_ENTRY)
+};
+
+/* the address modes allowed for every opcode and operand slot */
+static const unsigned char allowed_modes[ISA_OPCODES][2][ISA_MODE_SLOTS] = {
+	ISA_INSTRUCTIONS(ISA_ALLOWED_ROW)
+};
+
+/* the address mode fields of an instruction word, per operand slot */
+static const unsigned long mode_fields[2][ISA_MODE_SLOTS] = {
+	ISA_MODE_TABLE(ISA_MODE_FIELD, SRC_ADDRESS_MODE_OFFSET),
+	ISA_MODE_TABLE(ISA_MODE_FIELD, DEST_ADDRESS_MODE_OFFSET)
+};
+
+/* the extra words an operand takes by its address mode */
+static const unsigned char mode_words[ISA_MODE_SLOTS] =
+	ISA_MODE_TABLE(ISA_WORDS, 0);
+
+/* the address mode of an encoded address mode field */
+static const address_mode_t code_modes[FIELD_MASK(ADDRESS_MODE_WIDTH) + 1] = {
+	ISA_CODE_MODE(0), ISA_CODE_MODE(1), ISA_CODE_MODE(2), ISA_CODE_MODE(3)
+};
+
+/************************************************
+ * NAME: isa_lookup
+ * PARAMS: name - the mnemonic, not necessarily
+ * 		  null terminated
+ * 	   length - the mnemonic length
+ * RETURN VALUE: the instruction or NULL if there
+ * 		 is no such instruction
+ * DESCRIPTION: recognize an instruction mnemonic
+ ***********************************************/
+instruction_t *isa_lookup(const char *name, size_t length)
+{
+	int i;
+
+	if (length >= INSTRUCTION_NAME_LENGTH) {
+		return NULL;
+	}
+
+	for (i = 0; i < ISA_OPCODES; i++) {
+		if (instructions[i].name[length] == '\0' && \
+		    strncmp(instructions[i].name, name, length) == 0) {
+			return &instructions[i];
+		}
+	}
+
+	return NULL;
+}
+
+/************************************************
+ * NAME: isa_instruction
+ * PARAMS: opcode - the instruction opcode
+ * RETURN VALUE: the instruction with the given
+ * 		 opcode
+ ***********************************************/
+instruction_t *isa_instruction(int opcode)
+{
+	return &instructions[opcode & FIELD_MASK(OPCODE_WIDTH)];
+}
+
+/************************************************
+ * NAME: isa_mode_allowed
+ * PARAMS: instruction - the instruction
+ * 	   slot - ISA_SOURCE or ISA_DESTINATION
+ * 	   mode - the address mode
+ * RETURN VALUE: 1 if the address mode is allowed
+ * 		 for the operand, 0 otherwise
+ ***********************************************/
+int isa_mode_allowed(const instruction_t *instruction, int slot, address_mode_t mode)
+{
+	return allowed_modes[instruction->opcode][slot][mode];
+}
+
+/************************************************
+ * NAME: isa_operand_words
+ * PARAMS: operand - the operand
+ * RETURN VALUE: number of extra words the operand
+ * 		 takes after the instruction word
+ ***********************************************/
+int isa_operand_words(const operand_t *operand)
+{
+	return mode_words[operand->type] + \
+	       (operand->type == INDEX_ADDRESS && operand->index_type != REGISTER);
+}
+
+/************************************************
+ * NAME: isa_instruction_words
+ * PARAMS: full_instruction - the instruction
+ * RETURN VALUE: number of words the instruction
+ * 		 takes including its operands
+ ***********************************************/
+int isa_instruction_words(const full_instruction_t *full_instruction)
+{
+	return 1 + \
+	       isa_operand_words(&full_instruction->src_operand) + \
+	       isa_operand_words(&full_instruction->dest_operand);
+}
+
+/************************************************
+ * NAME: operand_register
+ * PARAMS: operand - the operand
+ * RETURN VALUE: the register encoded in the
+ * 		 operand register field
+ ***********************************************/
+static int operand_register(const operand_t *operand)
+{
+	if (operand->type == DIRECT_REGISTER_ADDRESS) {
+		return operand->value.reg;
+	} else if (operand->type == INDEX_ADDRESS && operand->index_type == REGISTER) {
+		return operand->index.reg;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: isa_encode
+ * PARAMS: full_instruction - the instruction to
+ * 			      encode
+ * RETURN VALUE: the instruction word
+ ***********************************************/
+unsigned long isa_encode(const full_instruction_t *full_instruction)
+{
+	return ((unsigned long)full_instruction->comb << COMB_OFFSET) | \
+	       ((unsigned long)operand_register(&full_instruction->dest_operand) << DEST_REGISTER_OFFSET) | \
+	       mode_fields[ISA_DESTINATION][full_instruction->dest_operand.type] | \
+	       ((unsigned long)operand_register(&full_instruction->src_operand) << SRC_REGISTER_OFFSET) | \
+	       mode_fields[ISA_SOURCE][full_instruction->src_operand.type] | \
+	       ((unsigned long)full_instruction->instruction->opcode << OPCODE_OFFSET) | \
+	       ((unsigned long)full_instruction->type << TYPE_OFFSET);
+}
+
+/************************************************
+ * NAME: isa_decode
+ * PARAMS: word - the instruction word
+ * 	   decoded - the decoded instruction
+ * RETURN VALUE: 1 if the word isn't a valid
+ * 		 instruction, 0 otherwise
+ * DESCRIPTION: decode an instruction word. an
+ * 		absent operand is decoded as
+ * 		NO_ADDRESS
+ ***********************************************/
+int isa_decode(unsigned long word, decoded_instruction_t *decoded)
+{
+	instruction_t *instruction = isa_instruction(word >> OPCODE_OFFSET);
+
+	decoded->instruction = instruction;
+	decoded->type = (word >> TYPE_OFFSET) & FIELD_MASK(TYPE_WIDTH);
+	decoded->comb = (word >> COMB_OFFSET) & FIELD_MASK(COMB_WIDTH);
+	decoded->src_register = (word >> SRC_REGISTER_OFFSET) & FIELD_MASK(REGISTER_WIDTH);
+	decoded->dest_register = (word >> DEST_REGISTER_OFFSET) & FIELD_MASK(REGISTER_WIDTH);
+	decoded->src_address_mode = instruction->num_opernads < 2 ? NO_ADDRESS : \
+		code_modes[(word >> SRC_ADDRESS_MODE_OFFSET) & FIELD_MASK(ADDRESS_MODE_WIDTH)];
+	decoded->dest_address_mode = instruction->num_opernads < 1 ? NO_ADDRESS : \
+		code_modes[(word >> DEST_ADDRESS_MODE_OFFSET) & FIELD_MASK(ADDRESS_MODE_WIDTH)];
+
+	/* bits above the type field aren't used */
+	if (word >> (TYPE_OFFSET + TYPE_WIDTH)) {
+		return 1;
+	}
+
+	return !isa_mode_allowed(instruction, ISA_SOURCE, decoded->src_address_mode) || \
+	       !isa_mode_allowed(instruction, ISA_DESTINATION, decoded->dest_address_mode);
+}
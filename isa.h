@@ -0,0 +1,32 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stddef.h> /* for size_t */
+
+#include "types.h"
+#include "isa.def"
+
+#define ISA_DECLARE_OPCODE(name, opcode, operands, src_modes, dest_modes) OPCODE_##name = (opcode),
+
+/* the opcodes of all instructions, OPCODE_mov etc. */
+enum {
+	ISA_INSTRUCTIONS(ISA_DECLARE_OPCODE)
+	ISA_OPCODES
+};
+
+/* number of entries in a table indexed by an address mode */
+#define ISA_MODE_SLOTS (DIRECT_REGISTER_ADDRESS + 1)
+
+/* operand slots of an instruction */
+#define ISA_SOURCE (0)
+#define ISA_DESTINATION (1)
+
+instruction_t *isa_lookup(const char *name, size_t length);
+instruction_t *isa_instruction(int opcode);
+int isa_mode_allowed(const instruction_t *instruction, int slot, address_mode_t mode);
+int isa_operand_words(const operand_t *operand);
+int isa_instruction_words(const full_instruction_t *full_instruction);
+unsigned long isa_encode(const full_instruction_t *full_instruction);
+int isa_decode(unsigned long word, decoded_instruction_t *decoded);
+
+#endif /* end of include guard: ISA_H */
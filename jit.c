@@ -0,0 +1,1073 @@
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS */
+
+#include <stdlib.h> /* for calloc and free */
+#include <string.h> /* for memcpy and memset */
+#include <stddef.h> /* for offsetof */
+#include <sys/mman.h> /* for mmap */
+
+#include "jit.h"
+#include "machine.h"
+#include "consts.h"
+#include "types.h"
+#include "isa.h"
+
+/* =============================================
+ * =============================================
+ * Note: the jit translates basic blocks of the 
+ * machine to x86-64 code in executable pages.
+ * a block ends at a jump, at stop or after 
+ * MAX_BLOCK_INSTRUCTIONS, and is entered through
+ * a trampoline that keeps the machine in rbx, 
+ * its memory in r12 and the code map in r13.
+ *
+ * - a block exit to a known address is a jump 
+ *   to a stub that returns to jit_run, which 
+ *   translates the target and patches the jump 
+ *   to it, so hot paths run block to block.
+ * - a jump to a computed address looks the 
+ *   block up in the blocks table.
+ * - a block takes its instructions from the 
+ *   budget on entry and gives back the ones it
+ *   didn't run when it leaves early. with less
+ *   budget than instructions jit_run interprets.
+ * - every word a block was translated from is 
+ *   marked in the code map, a write to a marked
+ *   word leaves the block after the instruction
+ *   and all translations are dropped, so self 
+ *   modifying programs run like interpreted.
+ * - type 1 instructions, red and prn call the 
+ *   interpreter for the one instruction.
+ * ==============================================
+ * ============================================*/
+
+#if defined(__x86_64__)
+
+#define JIT_CODE_BYTES (16 * 1024 * 1024)
+#define MAX_BLOCK_INSTRUCTIONS (64)
+#define MAX_INSTRUCTION_BYTES (192)
+#define MAX_BLOCK_BYTES (MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_BYTES + 256)
+#define MAX_BLOCKS (MACHINE_WORDS)
+
+/* statuses of a block exit, after the machine statuses */
+#define JIT_CHAIN (100) /* link chain_site to the block at pc */
+#define JIT_DISPATCH (101) /* no block at pc yet */
+#define JIT_BUDGET (102) /* interpret the block at pc */
+#define JIT_MODIFIED (103) /* a translated word was written */
+
+/* x86-64 registers */
+#define EAX (0)
+#define ECX (1)
+#define EDX (2)
+
+/* condition codes of jcc */
+#define NO_CONDITION (-1)
+#define CONDITION_AE (0x3)
+#define CONDITION_E (0x4)
+#define CONDITION_NE (0x5)
+#define CONDITION_B (0x2)
+#define CONDITION_GE (0xd)
+
+/* opcode extensions of the 0x81 group */
+#define ALU_ADD (0)
+#define ALU_AND (4)
+#define ALU_SUB (5)
+#define ALU_CMP (7)
+
+#define FIELD(name) ((unsigned long)offsetof(machine_t, name))
+#define REGISTER_FIELD(reg) (FIELD(registers) + (reg) * sizeof(unsigned int))
+
+/* an operand decoded at translation */
+typedef struct {
+	address_mode_t mode;
+	int reg; /* the register, or the index of a dynamic operand */
+	int dynamic; /* indexed by a register */
+	unsigned int address; /* or the base of a dynamic operand, or the immediate */
+} jit_operand_t;
+
+typedef struct {
+	unsigned int pc;
+	unsigned int next;
+	decoded_instruction_t decoded;
+	jit_operand_t source;
+	jit_operand_t destination;
+} jit_instruction_t;
+
+static unsigned char *code = NULL;
+static unsigned long code_used;
+static unsigned long code_start; /* after the trampolines */
+static unsigned char *leave_code;
+static int (*enter)(machine_t *machine, unsigned char *block);
+static unsigned char *code_map = NULL;
+static unsigned char **blocks = NULL;
+static unsigned int *block_starts = NULL; /* translated blocks, to drop them */
+static unsigned int *block_ends = NULL;
+static unsigned long block_count;
+static int flushed; /* translations were dropped since the last check */
+
+/************************************************
+ * NAME: emit_byte
+ * PARAMS: byte - a byte of code
+ ***********************************************/
+static void emit_byte(int byte)
+{
+	code[code_used++] = byte;
+}
+
+/************************************************
+ * NAME: emit_bytes
+ * PARAMS: bytes - code bytes
+ * 	   count - number of bytes
+ ***********************************************/
+static void emit_bytes(const unsigned char *bytes, int count)
+{
+	memcpy(code + code_used, bytes, count);
+	code_used += count;
+}
+
+/************************************************
+ * NAME: emit_u32
+ * PARAMS: value - a little endian 32 bit value
+ ***********************************************/
+static void emit_u32(unsigned long value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		emit_byte((value >> (8 * i)) & 0xff);
+	}
+}
+
+/************************************************
+ * NAME: emit_load_field
+ * PARAMS: host - the register to load
+ * 	   offset - the field of the machine
+ * DESCRIPTION: mov host, [rbx + offset]
+ ***********************************************/
+static void emit_load_field(int host, unsigned long offset)
+{
+	emit_byte(0x8b);
+	emit_byte(0x80 | host << 3 | 3);
+	emit_u32(offset);
+}
+
+/************************************************
+ * NAME: emit_store_field
+ * PARAMS: offset - the field of the machine
+ * 	   host - the register to store
+ * DESCRIPTION: mov [rbx + offset], host
+ ***********************************************/
+static void emit_store_field(unsigned long offset, int host)
+{
+	emit_byte(0x89);
+	emit_byte(0x80 | host << 3 | 3);
+	emit_u32(offset);
+}
+
+/************************************************
+ * NAME: emit_store_field_constant
+ * PARAMS: offset - the field of the machine
+ * 	   value - the value to store
+ * DESCRIPTION: mov dword [rbx + offset], value
+ ***********************************************/
+static void emit_store_field_constant(unsigned long offset, unsigned long value)
+{
+	emit_byte(0xc7);
+	emit_byte(0x83);
+	emit_u32(offset);
+	emit_u32(value);
+}
+
+/************************************************
+ * NAME: emit_budget
+ * PARAMS: extension - ALU_ADD, ALU_SUB or ALU_CMP
+ * 	   count - number of instructions
+ * DESCRIPTION: op qword [rbx + budget], count
+ ***********************************************/
+static void emit_budget(int extension, unsigned long count)
+{
+	emit_byte(0x48);
+	emit_byte(0x81);
+	emit_byte(0x80 | extension << 3 | 3);
+	emit_u32(FIELD(budget));
+	emit_u32(count);
+}
+
+/************************************************
+ * NAME: emit_load_word
+ * PARAMS: host - the register to load
+ * 	   address - a machine address
+ * DESCRIPTION: mov host, [r12 + address * 4]
+ ***********************************************/
+static void emit_load_word(int host, unsigned long address)
+{
+	emit_byte(0x41);
+	emit_byte(0x8b);
+	emit_byte(0x84 | host << 3);
+	emit_byte(0x24);
+	emit_u32(address * sizeof(unsigned int));
+}
+
+/************************************************
+ * NAME: emit_store_word
+ * PARAMS: address - a machine address
+ * 	   host - the register to store
+ * DESCRIPTION: mov [r12 + address * 4], host
+ ***********************************************/
+static void emit_store_word(unsigned long address, int host)
+{
+	emit_byte(0x41);
+	emit_byte(0x89);
+	emit_byte(0x84 | host << 3);
+	emit_byte(0x24);
+	emit_u32(address * sizeof(unsigned int));
+}
+
+/************************************************
+ * NAME: emit_indexed_word
+ * PARAMS: opcode - 0x8b to load, 0x89 to store
+ * 	   host - the register to load or store
+ * DESCRIPTION: mov between host and the word at
+ * 		[r12 + rcx * 4]
+ ***********************************************/
+static void emit_indexed_word(int opcode, int host)
+{
+	emit_byte(0x41);
+	emit_byte(opcode);
+	emit_byte(0x04 | host << 3);
+	emit_byte(0x8c);
+}
+
+/************************************************
+ * NAME: emit_alu_constant
+ * PARAMS: extension - the operation
+ * 	   host - the register to operate on
+ * 	   value - the constant
+ * DESCRIPTION: op host, value
+ ***********************************************/
+static void emit_alu_constant(int extension, int host, unsigned long value)
+{
+	emit_byte(0x81);
+	emit_byte(0xc0 | extension << 3 | host);
+	emit_u32(value);
+}
+
+/************************************************
+ * NAME: emit_alu
+ * PARAMS: opcode - 0x01 add, 0x29 sub, 0x89 mov
+ * 	   destination - the register to operate on
+ * 	   source - the other register
+ * DESCRIPTION: op destination, source
+ ***********************************************/
+static void emit_alu(int opcode, int destination, int source)
+{
+	emit_byte(opcode);
+	emit_byte(0xc0 | source << 3 | destination);
+}
+
+/************************************************
+ * NAME: emit_move_constant
+ * PARAMS: host - the register to set
+ * 	   value - the constant
+ * DESCRIPTION: mov host, value
+ ***********************************************/
+static void emit_move_constant(int host, unsigned long value)
+{
+	emit_byte(0xb8 + host);
+	emit_u32(value);
+}
+
+/************************************************
+ * NAME: emit_move_pointer
+ * PARAMS: pointer - the bytes of a pointer
+ * DESCRIPTION: mov rax, pointer
+ ***********************************************/
+static void emit_move_pointer(const unsigned char *pointer)
+{
+	emit_byte(0x48);
+	emit_byte(0xb8);
+	emit_bytes(pointer, 8);
+}
+
+/************************************************
+ * NAME: emit_jump
+ * PARAMS: condition - a condition code or 
+ * 		       NO_CONDITION
+ * RETURN VALUE: offset of the rel32 field
+ * DESCRIPTION: jmp or jcc, the target is 
+ * 		patched later
+ ***********************************************/
+static unsigned long emit_jump(int condition)
+{
+	if (condition == NO_CONDITION) {
+		emit_byte(0xe9);
+	} else {
+		emit_byte(0x0f);
+		emit_byte(0x80 | condition);
+	}
+	emit_u32(0);
+	return code_used - 4;
+}
+
+/************************************************
+ * NAME: patch_jump
+ * PARAMS: field - offset of a rel32 field
+ * 	   target - the code the jump goes to
+ ***********************************************/
+static void patch_jump(unsigned long field, const unsigned char *target)
+{
+	unsigned long rel = (unsigned long)(target - (code + field + 4));
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		code[field + i] = (rel >> (8 * i)) & 0xff;
+	}
+}
+
+/************************************************
+ * NAME: emit_exit
+ * PARAMS: pc - the pc to leave with
+ * 	   refund - instructions of the block 
+ * 	   	    that didn't run
+ * 	   status - the exit status
+ * DESCRIPTION: leave the block to jit_run
+ ***********************************************/
+static void emit_exit(unsigned int pc, unsigned long refund, int status)
+{
+	if (refund) {
+		emit_budget(ALU_ADD, refund);
+	}
+	emit_store_field_constant(FIELD(pc), pc);
+	emit_move_constant(EAX, status);
+	patch_jump(emit_jump(NO_CONDITION), leave_code);
+}
+
+/************************************************
+ * NAME: emit_chain
+ * PARAMS: target - a machine address
+ * DESCRIPTION: jump to the block at target, if
+ * 		it isn't translated yet the jump 
+ * 		goes to a stub that asks jit_run 
+ * 		to link it
+ ***********************************************/
+static void emit_chain(unsigned int target)
+{
+	unsigned long site = emit_jump(NO_CONDITION);
+	unsigned char *pointer = code + site;
+	unsigned char bytes[8];
+
+	if (blocks[target]) {
+		patch_jump(site, blocks[target]);
+		return;
+	}
+
+	patch_jump(site, code + code_used);
+	memcpy(bytes, &pointer, sizeof(bytes));
+	emit_move_pointer(bytes);
+	/* mov [rbx + chain_site], rax */
+	emit_byte(0x48);
+	emit_store_field(FIELD(chain_site), EAX);
+	emit_exit(target, 0, JIT_CHAIN);
+}
+
+/************************************************
+ * NAME: emit_dispatch
+ * DESCRIPTION: jump to the block at the address
+ * 		in ecx
+ ***********************************************/
+static void emit_dispatch(void)
+{
+	static const unsigned char lookup[] = {
+		0x48, 0x8b, 0x04, 0xc8, /* mov rax, [rax + rcx * 8] */
+		0x48, 0x85, 0xc0 /* test rax, rax */
+	};
+	unsigned char bytes[8];
+	unsigned long missing;
+
+	emit_store_field(FIELD(pc), ECX);
+	memcpy(bytes, &blocks, sizeof(bytes));
+	emit_move_pointer(bytes);
+	emit_bytes(lookup, sizeof(lookup));
+	missing = emit_jump(CONDITION_E);
+	emit_byte(0xff); /* jmp rax */
+	emit_byte(0xe0);
+
+	patch_jump(missing, code + code_used);
+	emit_move_constant(EAX, JIT_DISPATCH);
+	patch_jump(emit_jump(NO_CONDITION), leave_code);
+}
+
+/************************************************
+ * NAME: emit_address
+ * PARAMS: operand - a dynamic operand
+ * DESCRIPTION: ecx = the operand address
+ ***********************************************/
+static void emit_address(const jit_operand_t *operand)
+{
+	emit_load_field(ECX, REGISTER_FIELD(operand->reg));
+	emit_alu_constant(ALU_ADD, ECX, operand->address);
+	emit_alu_constant(ALU_AND, ECX, WORD_MASK);
+}
+
+/************************************************
+ * NAME: emit_read
+ * PARAMS: host - the register to load
+ * 	   operand - the operand to read
+ * DESCRIPTION: load an operand value, ecx is 
+ * 		the address of a dynamic operand
+ ***********************************************/
+static void emit_read(int host, const jit_operand_t *operand)
+{
+	switch (operand->mode) {
+		case IMMEDIATE_ADDRESS:
+			emit_move_constant(host, operand->address);
+			break;
+		case DIRECT_REGISTER_ADDRESS:
+			emit_load_field(host, REGISTER_FIELD(operand->reg));
+			break;
+		case DIRECT_ADDRESS:
+		case INDEX_ADDRESS: /* FALLTHROUGH */
+			if (operand->dynamic) {
+				emit_address(operand);
+				emit_indexed_word(0x8b, host);
+			} else {
+				emit_load_word(host, operand->address);
+			}
+			break;
+		case NO_ADDRESS:
+			break;
+	}
+}
+
+/************************************************
+ * NAME: emit_effective_address
+ * PARAMS: host - the register to set
+ * 	   operand - the operand
+ * DESCRIPTION: load the address of a memory 
+ * 		operand or the value of a register
+ ***********************************************/
+static void emit_effective_address(int host, const jit_operand_t *operand)
+{
+	if (operand->mode == DIRECT_REGISTER_ADDRESS) {
+		emit_load_field(host, REGISTER_FIELD(operand->reg));
+	} else if (operand->dynamic) {
+		emit_address(operand);
+		if (host != ECX) {
+			emit_alu(0x89, host, ECX);
+		}
+	} else {
+		emit_move_constant(host, operand->address);
+	}
+}
+
+/************************************************
+ * NAME: emit_write
+ * PARAMS: instruction - the instruction
+ * 	   refund - instructions after it in the
+ * 	   	    block
+ * DESCRIPTION: write eax to the destination, 
+ * 		ecx is its address if it is 
+ * 		dynamic. leave the block if the
+ * 		word was translated
+ ***********************************************/
+static void emit_write(const jit_instruction_t *instruction, unsigned long refund)
+{
+	static const unsigned char check_indexed[] = {
+		0x41, 0x80, 0x7c, 0x0d, 0x00, 0x00 /* cmp byte [r13 + rcx], 0 */
+	};
+	const jit_operand_t *operand = &instruction->destination;
+	unsigned long unchanged;
+
+	if (operand->mode == DIRECT_REGISTER_ADDRESS) {
+		emit_store_field(REGISTER_FIELD(operand->reg), EAX);
+		return;
+	}
+
+	if (operand->dynamic) {
+		emit_indexed_word(0x89, EAX);
+		emit_bytes(check_indexed, sizeof(check_indexed));
+	} else {
+		emit_store_word(operand->address, EAX);
+		/* cmp byte [r13 + address], 0 */
+		emit_byte(0x41);
+		emit_byte(0x80);
+		emit_byte(0xbd);
+		emit_u32(operand->address);
+		emit_byte(0x00);
+	}
+
+	unchanged = emit_jump(CONDITION_E);
+	emit_exit(instruction->next, refund, JIT_MODIFIED);
+	patch_jump(unchanged, code + code_used);
+}
+
+/************************************************
+ * NAME: emit_target
+ * PARAMS: instruction - a jump
+ * DESCRIPTION: go to the jump destination
+ ***********************************************/
+static void emit_target(const jit_instruction_t *instruction)
+{
+	const jit_operand_t *operand = &instruction->destination;
+
+	if (operand->mode == DIRECT_REGISTER_ADDRESS || operand->dynamic) {
+		emit_effective_address(ECX, operand);
+		emit_dispatch();
+	} else {
+		emit_chain(operand->address);
+	}
+}
+
+/************************************************
+ * NAME: jit_helper
+ * PARAMS: machine - the machine
+ * 	   pc - the instruction to interpret
+ * 	   refund - instructions after it in the
+ * 	   	    block
+ * RETURN VALUE: 0 to go on with the block, or
+ * 		 the status to leave with
+ ***********************************************/
+static int jit_helper(machine_t *machine, unsigned int pc, unsigned int refund)
+{
+	machine_status_t status;
+
+	machine->pc = pc;
+	status = machine_execute(machine);
+	if (status == MACHINE_RUNNING && !machine->modified) {
+		return 0;
+	}
+
+	machine->budget += refund + (status != MACHINE_RUNNING && status != MACHINE_STOPPED);
+	return status == MACHINE_RUNNING ? JIT_MODIFIED : (int)status;
+}
+
+/************************************************
+ * NAME: emit_helper
+ * PARAMS: instruction - the instruction
+ * 	   refund - instructions after it in the
+ * 	   	    block
+ * DESCRIPTION: interpret the instruction
+ ***********************************************/
+static void emit_helper(const jit_instruction_t *instruction, unsigned long refund)
+{
+	int (*helper)(machine_t *, unsigned int, unsigned int) = jit_helper;
+	unsigned char bytes[8];
+
+	emit_byte(0x48); /* mov rdi, rbx */
+	emit_byte(0x89);
+	emit_byte(0xdf);
+	emit_byte(0xbe); /* mov esi, pc */
+	emit_u32(instruction->pc);
+	emit_move_constant(EDX, refund);
+	memcpy(bytes, &helper, sizeof(bytes));
+	emit_move_pointer(bytes);
+	emit_byte(0xff); /* call rax */
+	emit_byte(0xd0);
+	emit_byte(0x85); /* test eax, eax */
+	emit_byte(0xc0);
+	patch_jump(emit_jump(CONDITION_NE), leave_code);
+}
+
+/************************************************
+ * NAME: is_native
+ * PARAMS: decoded - a decoded instruction
+ * RETURN VALUE: 1 if the instruction is 
+ * 		 translated, 0 if it is interpreted
+ ***********************************************/
+static int is_native(const decoded_instruction_t *decoded)
+{
+	switch (decoded->instruction->opcode) {
+		case OPCODE_red:
+		case OPCODE_prn: /* FALLTHROUGH */
+			return 0;
+		case OPCODE_mov:
+		case OPCODE_cmp:
+		case OPCODE_add:
+		case OPCODE_sub:
+		case OPCODE_not:
+		case OPCODE_clr:
+		case OPCODE_inc:
+		case OPCODE_dec: /* FALLTHROUGH */
+			return 0 == decoded->type;
+	}
+	return 1;
+}
+
+/************************************************
+ * NAME: emit_instruction
+ * PARAMS: instruction - the instruction
+ * 	   refund - instructions after it in the
+ * 	   	    block
+ ***********************************************/
+static void emit_instruction(const jit_instruction_t *instruction, unsigned long refund)
+{
+	const jit_operand_t *destination = &instruction->destination;
+	unsigned long skip;
+
+	if (!is_native(&instruction->decoded)) {
+		emit_helper(instruction, refund);
+		return;
+	}
+
+	switch (instruction->decoded.instruction->opcode) {
+		case OPCODE_mov:
+		case OPCODE_lea: /* FALLTHROUGH */
+			if (instruction->decoded.instruction->opcode == OPCODE_mov) {
+				emit_read(EAX, &instruction->source);
+			} else {
+				emit_effective_address(EAX, &instruction->source);
+			}
+			if (destination->dynamic) {
+				emit_address(destination);
+			}
+			emit_write(instruction, refund);
+			break;
+		case OPCODE_cmp:
+			emit_read(EDX, &instruction->source);
+			emit_read(EAX, destination);
+			emit_alu(0x29, EDX, EAX);
+			emit_alu_constant(ALU_AND, EDX, WORD_MASK);
+			emit_store_field(FIELD(result), EDX);
+			break;
+		case OPCODE_add:
+		case OPCODE_sub:
+		case OPCODE_not:
+		case OPCODE_clr:
+		case OPCODE_inc:
+		case OPCODE_dec: /* FALLTHROUGH */
+			switch (instruction->decoded.instruction->opcode) {
+				case OPCODE_add:
+					emit_read(EDX, &instruction->source);
+					emit_read(EAX, destination);
+					emit_alu(0x01, EAX, EDX);
+					break;
+				case OPCODE_sub:
+					emit_read(EDX, &instruction->source);
+					emit_read(EAX, destination);
+					emit_alu(0x29, EAX, EDX);
+					break;
+				case OPCODE_not:
+					emit_read(EAX, destination);
+					emit_byte(0xf7);
+					emit_byte(0xd0);
+					break;
+				case OPCODE_clr:
+					if (destination->dynamic) {
+						emit_address(destination);
+					}
+					emit_move_constant(EAX, 0);
+					break;
+				case OPCODE_inc:
+					emit_read(EAX, destination);
+					emit_alu_constant(ALU_ADD, EAX, 1);
+					break;
+				case OPCODE_dec:
+					emit_read(EAX, destination);
+					emit_alu_constant(ALU_SUB, EAX, 1);
+					break;
+			}
+			emit_alu_constant(ALU_AND, EAX, WORD_MASK);
+			emit_store_field(FIELD(result), EAX);
+			emit_write(instruction, refund);
+			break;
+		case OPCODE_jmp:
+			emit_target(instruction);
+			break;
+		case OPCODE_bne:
+			emit_load_field(EAX, FIELD(result));
+			emit_byte(0x85); /* test eax, eax */
+			emit_byte(0xc0);
+			skip = emit_jump(CONDITION_E);
+			emit_target(instruction);
+			patch_jump(skip, code + code_used);
+			emit_chain(instruction->next);
+			break;
+		case OPCODE_jsr:
+			emit_load_field(EAX, FIELD(sp));
+			emit_alu_constant(ALU_CMP, EAX, MACHINE_STACK);
+			skip = emit_jump(CONDITION_B);
+			emit_exit(instruction->pc, refund + 1, MACHINE_STACK_OVERFLOW);
+			patch_jump(skip, code + code_used);
+			/* mov dword [rbx + stack + rax * 4], next */
+			emit_byte(0xc7);
+			emit_byte(0x84);
+			emit_byte(0x83);
+			emit_u32(FIELD(stack));
+			emit_u32(instruction->next);
+			emit_alu_constant(ALU_ADD, EAX, 1);
+			emit_store_field(FIELD(sp), EAX);
+			emit_target(instruction);
+			break;
+		case OPCODE_rts:
+			emit_load_field(EAX, FIELD(sp));
+			emit_byte(0x85); /* test eax, eax */
+			emit_byte(0xc0);
+			skip = emit_jump(CONDITION_NE);
+			emit_exit(instruction->pc, refund + 1, MACHINE_STACK_UNDERFLOW);
+			patch_jump(skip, code + code_used);
+			emit_alu_constant(ALU_SUB, EAX, 1);
+			emit_store_field(FIELD(sp), EAX);
+			/* mov ecx, [rbx + stack + rax * 4] */
+			emit_byte(0x8b);
+			emit_byte(0x8c);
+			emit_byte(0x83);
+			emit_u32(FIELD(stack));
+			emit_dispatch();
+			break;
+		case OPCODE_stop:
+			emit_exit(instruction->next, refund, MACHINE_STOPPED);
+			break;
+	}
+}
+
+/************************************************
+ * NAME: decode_operand
+ * PARAMS: machine - the machine
+ * 	   mode - the operand address mode
+ * 	   reg - the operand register field
+ * 	   pc - the next operand word, moved past
+ * 	        the operand words
+ * 	   operand - the decoded operand
+ * DESCRIPTION: decode an operand like the 
+ * 		interpreter and mark its words
+ ***********************************************/
+static void decode_operand(const machine_t *machine,
+			   address_mode_t mode,
+			   int reg,
+			   unsigned int *pc,
+			   jit_operand_t *operand)
+{
+	const unsigned int *memory = machine->memory;
+
+	operand->mode = mode;
+	operand->reg = reg;
+	operand->dynamic = 0;
+	operand->address = 0;
+	switch (mode) {
+		case IMMEDIATE_ADDRESS:
+		case DIRECT_ADDRESS: /* FALLTHROUGH */
+			operand->address = memory[*pc];
+			*pc = (*pc + 1) & WORD_MASK;
+			break;
+		case INDEX_ADDRESS:
+			operand->address = memory[*pc];
+			*pc = (*pc + 1) & WORD_MASK;
+			if (reg) {
+				operand->dynamic = 1;
+			} else {
+				operand->address = (operand->address + memory[*pc]) & WORD_MASK;
+				*pc = (*pc + 1) & WORD_MASK;
+			}
+			break;
+		case DIRECT_REGISTER_ADDRESS:
+		case NO_ADDRESS: /* FALLTHROUGH */
+			break;
+	}
+}
+
+/************************************************
+ * NAME: ends_block
+ * PARAMS: decoded - a decoded instruction
+ * RETURN VALUE: 1 if the block ends after it
+ ***********************************************/
+static int ends_block(const decoded_instruction_t *decoded)
+{
+	switch (decoded->instruction->opcode) {
+		case OPCODE_jmp:
+		case OPCODE_bne:
+		case OPCODE_jsr:
+		case OPCODE_rts:
+		case OPCODE_stop: /* FALLTHROUGH */
+			return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: flush
+ * DESCRIPTION: drop all translations
+ ***********************************************/
+static void flush(void)
+{
+	unsigned long i;
+	unsigned int pc;
+
+	for (i = 0; i < block_count; i++) {
+		blocks[block_starts[i]] = NULL;
+		for (pc = block_starts[i]; pc != block_ends[i]; pc = (pc + 1) & WORD_MASK) {
+			code_map[pc] = 0;
+		}
+	}
+	block_count = 0;
+	code_used = code_start;
+	flushed = 1;
+}
+
+/************************************************
+ * NAME: translate
+ * PARAMS: machine - the machine
+ * 	   pc - the block address
+ * RETURN VALUE: the block, NULL if the first 
+ * 		 instruction is invalid
+ ***********************************************/
+static unsigned char *translate(const machine_t *machine, unsigned int pc)
+{
+	jit_instruction_t instructions[MAX_BLOCK_INSTRUCTIONS];
+	jit_instruction_t *instruction;
+	unsigned char *block;
+	unsigned long skip;
+	int count;
+	int i;
+	unsigned int next = pc;
+
+	for (count = 0; count < MAX_BLOCK_INSTRUCTIONS; count++) {
+		instruction = &instructions[count];
+		if (isa_decode(machine->memory[next], &instruction->decoded)) {
+			break;
+		}
+		instruction->pc = next;
+		next = (next + 1) & WORD_MASK;
+		decode_operand(machine,
+			       instruction->decoded.src_address_mode,
+			       instruction->decoded.src_register,
+			       &next,
+			       &instruction->source);
+		decode_operand(machine,
+			       instruction->decoded.dest_address_mode,
+			       instruction->decoded.dest_register,
+			       &next,
+			       &instruction->destination);
+		instruction->next = next;
+		if (ends_block(&instruction->decoded)) {
+			count++;
+			break;
+		}
+	}
+
+	if (0 == count) {
+		return NULL;
+	}
+
+	if (code_used + MAX_BLOCK_BYTES > JIT_CODE_BYTES || block_count == MAX_BLOCKS) {
+		flush();
+	}
+
+	block = code + code_used;
+	block_starts[block_count] = pc;
+	block_ends[block_count] = next;
+	block_count++;
+	blocks[pc] = block;
+	for (; pc != next; pc = (pc + 1) & WORD_MASK) {
+		code_map[pc] = 1;
+	}
+
+	/* take the instructions from the budget, or interpret */
+	emit_budget(ALU_CMP, count);
+	skip = emit_jump(CONDITION_GE);
+	emit_exit(instructions[0].pc, 0, JIT_BUDGET);
+	patch_jump(skip, code + code_used);
+	emit_budget(ALU_SUB, count);
+
+	for (i = 0; i < count; i++) {
+		emit_instruction(&instructions[i], count - 1 - i);
+	}
+	if (!ends_block(&instructions[count - 1].decoded)) {
+		emit_chain(instructions[count - 1].next);
+	}
+
+	return block;
+}
+
+/************************************************
+ * NAME: step
+ * PARAMS: machine - the machine
+ * RETURN VALUE: the status of the instruction
+ * DESCRIPTION: interpret a single instruction
+ ***********************************************/
+static machine_status_t step(machine_t *machine)
+{
+	machine_status_t status = machine_execute(machine);
+
+	if (status == MACHINE_RUNNING || status == MACHINE_STOPPED) {
+		machine->budget--;
+	}
+	if (machine->modified) {
+		flush();
+		machine->modified = 0;
+	}
+	return status;
+}
+
+/************************************************
+ * NAME: jit_init
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: map the code pages and emit the
+ * 		trampolines
+ ***********************************************/
+int jit_init(void)
+{
+	static const unsigned char enter_code[] = {
+		0x53, /* push rbx */
+		0x41, 0x54, /* push r12 */
+		0x41, 0x55, /* push r13 */
+		0x48, 0x89, 0xfb /* mov rbx, rdi */
+	};
+	static const unsigned char leave_bytes[] = {
+		0x41, 0x5d, /* pop r13 */
+		0x41, 0x5c, /* pop r12 */
+		0x5b, /* pop rbx */
+		0xc3 /* ret */
+	};
+	void *map;
+
+	map = mmap(NULL, JIT_CODE_BYTES, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code_map = calloc(MACHINE_WORDS, 1);
+	blocks = calloc(MACHINE_WORDS, sizeof(*blocks));
+	block_starts = malloc(MAX_BLOCKS * sizeof(*block_starts));
+	block_ends = malloc(MAX_BLOCKS * sizeof(*block_ends));
+	if (MAP_FAILED == map || !code_map || !blocks || !block_starts || !block_ends) {
+		if (MAP_FAILED != map) {
+			munmap(map, JIT_CODE_BYTES);
+		}
+		code = NULL;
+		jit_release();
+		return 1;
+	}
+	code = map;
+	code_used = 0;
+	block_count = 0;
+
+	leave_code = code;
+	emit_bytes(leave_bytes, sizeof(leave_bytes));
+
+	map = code + code_used;
+	memcpy(&enter, &map, sizeof(enter));
+	emit_bytes(enter_code, sizeof(enter_code));
+	/* mov r12, [rbx + memory] and mov r13, [rbx + code_map] */
+	emit_byte(0x4c);
+	emit_load_field(4, FIELD(memory));
+	emit_byte(0x4c);
+	emit_load_field(5, FIELD(code_map));
+	emit_byte(0xff); /* jmp rsi */
+	emit_byte(0xe6);
+
+	code_start = code_used;
+	return 0;
+}
+
+/************************************************
+ * NAME: jit_run
+ * PARAMS: machine - the machine
+ * RETURN VALUE: why the machine stopped
+ * DESCRIPTION: run translated blocks until the 
+ * 		machine stops, faults or runs out
+ * 		of budget, like machine_run. the
+ * 		memory may have changed since the
+ * 		last run, it is translated again
+ ***********************************************/
+machine_status_t jit_run(machine_t *machine)
+{
+	unsigned char *block;
+	unsigned char *site;
+	int status = MACHINE_RUNNING;
+
+	machine->code_map = code_map;
+	machine->modified = 0;
+	machine->chain_site = NULL;
+	flush();
+
+	while (status == MACHINE_RUNNING) {
+		if (machine->budget <= 0) {
+			status = MACHINE_OUT_OF_STEPS;
+			break;
+		}
+
+		block = blocks[machine->pc];
+		if (NULL == block) {
+			flushed = 0;
+			block = translate(machine, machine->pc);
+		}
+		if (NULL == block) {
+			status = step(machine);
+			continue;
+		}
+
+		status = enter(machine, block);
+		switch (status) {
+			case JIT_CHAIN:
+				site = machine->chain_site;
+				machine->chain_site = NULL;
+				flushed = 0;
+				block = blocks[machine->pc] ? blocks[machine->pc] : translate(machine, machine->pc);
+				if (block && !flushed) {
+					patch_jump(site - code, block);
+				}
+				status = MACHINE_RUNNING;
+				break;
+			case JIT_DISPATCH:
+				status = MACHINE_RUNNING;
+				break;
+			case JIT_BUDGET:
+				status = machine->budget > 0 ? step(machine) : MACHINE_OUT_OF_STEPS;
+				break;
+			case JIT_MODIFIED:
+				flush();
+				machine->modified = 0;
+				status = MACHINE_RUNNING;
+				break;
+		}
+	}
+
+	machine->code_map = NULL;
+	return status;
+}
+
+/************************************************
+ * NAME: jit_release
+ * DESCRIPTION: unmap the code and free the 
+ * 		tables
+ ***********************************************/
+void jit_release(void)
+{
+	if (code) {
+		munmap(code, JIT_CODE_BYTES);
+		code = NULL;
+	}
+	free(code_map);
+	free(blocks);
+	free(block_starts);
+	free(block_ends);
+	code_map = NULL;
+	blocks = NULL;
+	block_starts = NULL;
+	block_ends = NULL;
+}
+
+#else
+
+/************************************************
+ * NAME: jit_init
+ * RETURN VALUE: 1, the jit translates to x86-64
+ ***********************************************/
+int jit_init(void)
+{
+	return 1;
+}
+
+/************************************************
+ * NAME: jit_run
+ * PARAMS: machine - the machine
+ * RETURN VALUE: why the machine stopped
+ ***********************************************/
+machine_status_t jit_run(machine_t *machine)
+{
+	return machine_run(machine);
+}
+
+/************************************************
+ * NAME: jit_release
+ ***********************************************/
+void jit_release(void)
+{
+}
+
+#endif
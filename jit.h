@@ -0,0 +1,10 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "machine.h"
+
+int jit_init(void);
+machine_status_t jit_run(machine_t *machine);
+void jit_release(void);
+
+#endif /* end of include guard: JIT_H */
@@ -0,0 +1,202 @@
+#include <stdio.h> /* for fprintf */
+#include <stdlib.h> /* for realloc and free */
+#include <string.h> /* for strncpy */
+
+#include "link.h"
+#include "hash.h"
+
+/* =============================================
+ * =============================================
+ * Note: the entries and externs of every source
+ * in the batch are published into one index.
+ * a symbol is hashed once when it is published,
+ * the occurrences point at their symbol, so the
+ * report is a single pass over the occurrences
+ * ==============================================
+ * ============================================*/
+
+#define MIN_LINK_CAPACITY (64)
+
+typedef struct {
+	char name[MAX_LABEL_LENGTH];
+	unsigned long entries; /* number of sources exporting it */
+	const char *exported_by; /* the first of them */
+} link_symbol_t;
+
+typedef struct {
+	unsigned long symbol; /* index in link_symbols */
+	label_type_t type;
+	const char *filename;
+} link_occurrence_t;
+
+/* internal global variables */
+static link_symbol_t *link_symbols = NULL;
+static unsigned long symbol_count = 0;
+static unsigned long symbol_capacity = 0;
+
+static link_occurrence_t *occurrences = NULL;
+static unsigned long occurrence_count = 0;
+static unsigned long occurrence_capacity = 0;
+
+static const char *symbol_name(unsigned long entry);
+static name_table_t symbol_index = NAME_TABLE(symbol_name);
+
+static const char *current_filename = NULL;
+static int out_of_memory = 0;
+
+/************************************************
+ * NAME: symbol_name
+ * PARAMS: entry - the index in link_symbols
+ * RETURN VALUE: the symbol name
+ ***********************************************/
+static const char *symbol_name(unsigned long entry)
+{
+	return link_symbols[entry].name;
+}
+
+/************************************************
+ * NAME: find_symbol
+ * PARAMS: name - the symbol name
+ * 	   symbol - the index of the symbol
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: find a symbol, a new one is added
+ * 		if it isn't in the index yet
+ ***********************************************/
+static int find_symbol(const char *name, unsigned long *symbol)
+{
+	unsigned long capacity = symbol_capacity ? symbol_capacity * 2 : MIN_LINK_CAPACITY;
+	link_symbol_t *grown;
+	unsigned long entry = name_table_find(&symbol_index, name);
+
+	if (entry) {
+		*symbol = entry - 1;
+		return 0;
+	}
+
+	if (symbol_count == symbol_capacity) {
+		grown = realloc(link_symbols, capacity * sizeof(*link_symbols));
+		if (NULL == grown) {
+			return 1;
+		}
+		link_symbols = grown;
+		symbol_capacity = capacity;
+	}
+
+	strncpy(link_symbols[symbol_count].name, name, MAX_LABEL_LENGTH);
+	link_symbols[symbol_count].entries = 0;
+	link_symbols[symbol_count].exported_by = NULL;
+	if (name_table_add(&symbol_index, link_symbols[symbol_count].name)) {
+		return 1;
+	}
+	*symbol = symbol_count++;
+	return 0;
+}
+
+/************************************************
+ * NAME: link_set_file
+ * PARAMS: filename - the source whose labels 
+ * 		      are published next, must 
+ * 		      live until link_report
+ ***********************************************/
+void link_set_file(const char *filename)
+{
+	current_filename = filename;
+}
+
+/************************************************
+ * NAME: link_add_label
+ * PARAMS: label - a label of the current source
+ * DESCRIPTION: publish an entry or extern label,
+ * 		regular labels are ignored. used 
+ * 		with loop_labels
+ ***********************************************/
+void link_add_label(label_t *label)
+{
+	unsigned long capacity = occurrence_capacity ? occurrence_capacity * 2 : MIN_LINK_CAPACITY;
+	link_occurrence_t *grown;
+	link_symbol_t *symbol;
+	unsigned long index;
+
+	if (REGULAR == label->type || out_of_memory) {
+		return;
+	}
+
+	if (occurrence_count == occurrence_capacity) {
+		grown = realloc(occurrences, capacity * sizeof(*occurrences));
+		if (NULL == grown) {
+			out_of_memory = 1;
+			return;
+		}
+		occurrences = grown;
+		occurrence_capacity = capacity;
+	}
+
+	if (find_symbol(label->name, &index)) {
+		out_of_memory = 1;
+		return;
+	}
+
+	symbol = &link_symbols[index];
+	if (ENTRY == label->type && 0 == symbol->entries++) {
+		symbol->exported_by = current_filename;
+	}
+
+	occurrences[occurrence_count].symbol = index;
+	occurrences[occurrence_count].type = label->type;
+	occurrences[occurrence_count].filename = current_filename;
+	occurrence_count++;
+}
+
+/************************************************
+ * NAME: link_report
+ * RETURN VALUE: 1 if a symbol is unresolved or
+ * 		 exported twice, 0 otherwise
+ * DESCRIPTION: check the published symbols of 
+ * 		the whole batch
+ ***********************************************/
+int link_report(void)
+{
+	link_occurrence_t *occurrence;
+	link_symbol_t *symbol;
+	int failed = 0;
+	unsigned long i;
+
+	if (out_of_memory) {
+		fprintf(stderr, "link check: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < occurrence_count; i++) {
+		occurrence = &occurrences[i];
+		symbol = &link_symbols[occurrence->symbol];
+
+		if (EXTERNAL == occurrence->type && 0 == symbol->entries) {
+			fprintf(stderr, "%s: unresolved external symbol: %.*s\n", 
+				occurrence->filename, MAX_LABEL_LENGTH, symbol->name);
+			failed = 1;
+		} else if (ENTRY == occurrence->type && \
+			   occurrence->filename != symbol->exported_by) {
+			fprintf(stderr, "%s: entry symbol already exported by %s: %.*s\n", 
+				occurrence->filename, symbol->exported_by, 
+				MAX_LABEL_LENGTH, symbol->name);
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
+
+/************************************************
+ * NAME: link_release
+ * DESCRIPTION: free the symbol index
+ ***********************************************/
+void link_release(void)
+{
+	free(link_symbols);
+	free(occurrences);
+	name_table_release(&symbol_index);
+	link_symbols = NULL;
+	occurrences = NULL;
+	symbol_count = symbol_capacity = 0;
+	occurrence_count = occurrence_capacity = 0;
+}
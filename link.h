@@ -0,0 +1,11 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "types.h"
+
+void link_set_file(const char *filename);
+void link_add_label(label_t *label);
+int link_report(void);
+void link_release(void);
+
+#endif /* end of include guard: LINK_H */
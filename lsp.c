@@ -0,0 +1,2054 @@
+#include <stdio.h> /* for fgets, fread and printf */
+#include <stdlib.h> /* for malloc, calloc, realloc, free and strtol */
+#include <string.h> /* for strlen, strncmp, strcpy, memcpy, memmove and memset */
+#include <ctype.h> /* for isalnum, isspace and isxdigit */
+
+#include "lsp.h"
+#include "consts.h"
+#include "types.h"
+#include "table.h"
+#include "define.h"
+#include "parse.h"
+#include "output.h"
+#include "buffer.h"
+#include "hash.h"
+
+/* =============================================
+ * =============================================
+ * Note: the server speaks JSON-RPC over stdin
+ * and stdout. every open document is kept in
+ * memory as its lines, edited in place as the
+ * editor sends incremental changes.
+ * every line keeps what its passes found: the
+ * errors of each pass, its code words and the
+ * names it looked up or installed. the
+ * labels and constants of a document are kept
+ * in a symbol table of its own that the parser
+ * is redirected to, and every symbol links the
+ * lines that refer to it.
+ * like a full pass, the first pass of a line
+ * sees only what the lines before it installed.
+ * after an edit the changed lines are parsed
+ * again, then the lines after them that refer
+ * to a symbol whose first declaration or
+ * definition changed. the second pass runs on
+ * the lines whose symbols changed once the
+ * first pass has no errors, and the address of
+ * a line is summed up from the code words when
+ * it is asked for.
+ * labels are matched by their whole name.
+ * positions are counted in bytes, sources are
+ * expected to be plain ASCII
+ * ==============================================
+ * ============================================*/
+
+#define MAX_HEADER_LENGTH (256)
+#define MIN_SYMBOL_BUCKETS (64)
+#define MAX_TOUCHED_SYMBOLS (8)
+#define NO_HORIZON ((unsigned long)-1)
+
+#define JSON_RPC_METHOD_NOT_FOUND (-32601)
+#define JSON_RPC_INVALID_REQUEST (-32600)
+
+typedef enum {
+	FIRST_PASS,
+	SECOND_PASS,
+	PASSES
+} pass_t;
+
+typedef struct source_line source_line_t;
+typedef struct symbol symbol_t;
+
+/* a symbol a line looked up or installed, in the
+ * list of the line and in the uses of the symbol */
+typedef struct reference {
+	source_line_t *line;
+	symbol_t *symbol;
+	int installed; /* the line declares or defines the symbol */
+	label_type_t type; /* of an installed label */
+	int defined; /* an installed label has an address */
+	long value; /* of an installed constant */
+	struct reference *next;
+	struct reference *next_use;
+	struct reference *previous_use;
+} reference_t;
+
+struct symbol {
+	char name[MAX_LABEL_LENGTH + 1];
+	int constant; /* defined by .define, not a label */
+	reference_t *uses;
+	reference_t *first; /* the first line installing it */
+	reference_t *first_definition; /* the first line giving it an address */
+	label_t label; /* as the parsed line sees it */
+	long value; /* as the parsed line sees it */
+	symbol_t *next; /* in its bucket */
+};
+
+typedef struct line_error {
+	unsigned int column;
+	char *gripe;
+	struct line_error *next;
+} line_error_t;
+
+struct source_line {
+	char *text; /* with its newline, terminated */
+	unsigned long length;
+	unsigned long index; /* the line number - 1 */
+	unsigned int words; /* code words of the line */
+	unsigned int address; /* set below addresses_known */
+	int dirty; /* the first pass must run again */
+	int stale; /* the second pass must run again */
+	int failed[PASSES];
+	line_error_t *errors[PASSES]; /* in the order they were found */
+	reference_t *references;
+};
+
+typedef struct document {
+	char *uri;
+	source_line_t **lines;
+	unsigned long line_count;
+	unsigned long line_capacity;
+	symbol_t **buckets;
+	unsigned long bucket_count;
+	unsigned long symbol_count;
+	unsigned long failed_lines[PASSES];
+	unsigned long dirty_from; /* the dirty lines are in [dirty_from, dirty_to) */
+	unsigned long dirty_to;
+	unsigned long stale_from; /* the stale lines are in [stale_from, stale_to) */
+	unsigned long stale_to;
+	unsigned long addresses_known;
+	int broken; /* memory ran out while parsing */
+	int lost; /* an edit couldn't be applied */
+	struct document *next;
+} document_t;
+
+/* a symbol the parsed line installs, as it was before */
+typedef struct {
+	symbol_t *symbol;
+	source_line_t *first;
+	label_type_t type;
+	source_line_t *first_definition;
+	long value;
+} snapshot_t;
+
+/* internal global variables */
+static document_t *documents = NULL;
+static document_t *parsed_document = NULL; /* the parser is redirected to its symbols */
+static source_line_t *parsed_line = NULL;
+static pass_t parsed_pass = FIRST_PASS;
+static unsigned long horizon = NO_HORIZON; /* the lines from it on aren't seen */
+static snapshot_t touched[MAX_TOUCHED_SYMBOLS];
+static int touched_count = 0;
+static int out_of_memory = 0;
+static buffer_t diagnostics; /* JSON array of the errors of a document */
+static buffer_t reply;
+
+extern unsigned int code_index;
+
+/************************************************
+ * NAME: skip_whitespace
+ * PARAMS: json - the JSON text
+ * RETURN VALUE: the first non whitespace
+ ***********************************************/
+static const char *skip_whitespace(const char *json)
+{
+	while (isspace((unsigned char)*json)) {
+		json++;
+	}
+	return json;
+}
+
+/************************************************
+ * NAME: skip_value
+ * PARAMS: json - a JSON value
+ * RETURN VALUE: the text after the value, NULL if
+ * 		 it is malformed
+ ***********************************************/
+static const char *skip_value(const char *json)
+{
+	int depth = 0;
+
+	json = skip_whitespace(json);
+	do {
+		switch (*json) {
+			case '\0':
+				return NULL;
+			case '"':
+				for (json++; *json != '"'; json++) {
+					if (*json == '\0' || (*json == '\\' && *++json == '\0')) {
+						return NULL;
+					}
+				}
+				json++;
+				break;
+			case '{': /* FALLTHROUGH */
+			case '[':
+				depth++;
+				json++;
+				break;
+			case '}': /* FALLTHROUGH */
+			case ']':
+				depth--;
+				json++;
+				break;
+			default:
+				/* a number, a literal or a separator */
+				json++;
+				while (depth == 0 && *json && !strchr(",:}] \t\r\n", *json)) {
+					json++;
+				}
+				break;
+		}
+	} while (depth > 0);
+
+	return depth == 0 ? json : NULL;
+}
+
+/************************************************
+ * NAME: json_member
+ * PARAMS: object - a JSON object, may be NULL
+ * 	   key - the member name
+ * RETURN VALUE: the member value, NULL if there
+ * 		 is no such member
+ ***********************************************/
+static const char *json_member(const char *object, const char *key)
+{
+	unsigned long length = strlen(key);
+	const char *name;
+	int found;
+
+	if (NULL == object || *(object = skip_whitespace(object)) != '{') {
+		return NULL;
+	}
+
+	for (object = skip_whitespace(object + 1); *object == '"'; ) {
+		name = object + 1;
+		if (NULL == (object = skip_value(object))) {
+			return NULL;
+		}
+		/* the name is between the quotes */
+		found = (unsigned long)(object - name) == length + 1 && \
+			strncmp(name, key, length) == 0;
+		object = skip_whitespace(object);
+		if (*object++ != ':') {
+			return NULL;
+		}
+		if (found) {
+			return skip_whitespace(object);
+		}
+		if (NULL == (object = skip_value(object))) {
+			return NULL;
+		}
+		object = skip_whitespace(object);
+		if (*object == ',') {
+			object = skip_whitespace(object + 1);
+		}
+	}
+
+	return NULL;
+}
+
+/************************************************
+ * NAME: json_long
+ * PARAMS: value - a JSON number, may be NULL
+ * RETURN VALUE: the number, -1 if it is missing
+ ***********************************************/
+static long json_long(const char *value)
+{
+	return value ? strtol(value, NULL, 10) : -1;
+}
+
+/************************************************
+ * NAME: parse_hex4
+ * PARAMS: text - four hex digits
+ * RETURN VALUE: their value, 0 if they are not
+ * 		 all hex digits
+ ***********************************************/
+static unsigned long parse_hex4(const char *text)
+{
+	unsigned long value = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)text[i])) {
+			return 0;
+		}
+		value = value * 16 + (isdigit((unsigned char)text[i]) ?
+				      text[i] - '0' :
+				      tolower((unsigned char)text[i]) - 'a' + 10);
+	}
+	return value;
+}
+
+/************************************************
+ * NAME: append_utf8
+ * PARAMS: text - the output text
+ * 	   code - a code point
+ * RETURN VALUE: the text after the encoded code
+ ***********************************************/
+static char *append_utf8(char *text, unsigned long code)
+{
+	if (code < 0x80) {
+		*text++ = code;
+	} else if (code < 0x800) {
+		*text++ = 0xc0 | (code >> 6);
+		*text++ = 0x80 | (code & 0x3f);
+	} else if (code < 0x10000) {
+		*text++ = 0xe0 | (code >> 12);
+		*text++ = 0x80 | ((code >> 6) & 0x3f);
+		*text++ = 0x80 | (code & 0x3f);
+	} else {
+		*text++ = 0xf0 | (code >> 18);
+		*text++ = 0x80 | ((code >> 12) & 0x3f);
+		*text++ = 0x80 | ((code >> 6) & 0x3f);
+		*text++ = 0x80 | (code & 0x3f);
+	}
+	return text;
+}
+
+/************************************************
+ * NAME: json_string
+ * PARAMS: value - a JSON string, may be NULL
+ * 	   length - the decoded length
+ * RETURN VALUE: the decoded string, NULL on error.
+ * 		 must be freed
+ ***********************************************/
+static char *json_string(const char *value, unsigned long *length)
+{
+	const char *end = value ? skip_value(value) : NULL;
+	unsigned long code;
+	unsigned long low;
+	char *string;
+	char *out;
+
+	if (NULL == end || *value != '"') {
+		return NULL;
+	}
+
+	/* the decoded string is never longer than the escaped one */
+	if (NULL == (out = string = malloc(end - value))) {
+		return NULL;
+	}
+
+	for (value++; value < end - 1; value++) {
+		if (*value != '\\') {
+			*out++ = *value;
+			continue;
+		}
+
+		switch (*++value) {
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u':
+				if (end - 1 - value < 5) {
+					break;
+				}
+				code = parse_hex4(value + 1);
+				value += 4;
+				/* a surrogate pair is a single code point */
+				if (code >= 0xd800 && code < 0xdc00 && \
+				    end - 1 - value >= 7 && \
+				    value[1] == '\\' && value[2] == 'u') {
+					low = parse_hex4(value + 3);
+					if (low >= 0xdc00 && low < 0xe000) {
+						code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+						value += 6;
+					}
+				}
+				out = append_utf8(out, code);
+				break;
+			default:
+				*out++ = *value;
+				break;
+		}
+	}
+
+	*out = '\0';
+	*length = out - string;
+	return string;
+}
+
+/************************************************
+ * NAME: append_text
+ * PARAMS: buffer - the buffer to append to
+ * 	   text - a terminated string
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int append_text(buffer_t *buffer, const char *text)
+{
+	return buffer_append(buffer, text, strlen(text));
+}
+
+/************************************************
+ * NAME: append_json_string
+ * PARAMS: buffer - the buffer to append to
+ * 	   text - the string to quote
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int append_json_string(buffer_t *buffer, const char *text)
+{
+	char escape[8];
+	int failed = append_text(buffer, "\"");
+
+	for (; *text && !failed; text++) {
+		if (*text == '"' || *text == '\\') {
+			sprintf(escape, "\\%c", *text);
+			failed = append_text(buffer, escape);
+		} else if ((unsigned char)*text < 0x20) {
+			sprintf(escape, "\\u%04x", (unsigned char)*text);
+			failed = append_text(buffer, escape);
+		} else {
+			failed = buffer_append(buffer, text, 1);
+		}
+	}
+
+	return failed || append_text(buffer, "\"");
+}
+
+/************************************************
+ * NAME: send_message
+ * PARAMS: message - the JSON message
+ * DESCRIPTION: write a message with its header
+ ***********************************************/
+static void send_message(buffer_t *message)
+{
+	printf("Content-Length: %lu\r\n\r\n", message->length);
+	fwrite(message->data, 1, message->length, stdout);
+	fflush(stdout);
+}
+
+/************************************************
+ * NAME: append_id
+ * PARAMS: buffer - the reply
+ * 	   id - the request id as raw JSON, NULL
+ * 	        if the request had none
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int append_id(buffer_t *buffer, const char *id)
+{
+	if (NULL == id) {
+		return append_text(buffer, "null");
+	}
+	return buffer_append(buffer, id, skip_value(id) - id);
+}
+
+/************************************************
+ * NAME: send_result
+ * PARAMS: id - the request id as raw JSON
+ * 	   result - the result as raw JSON
+ ***********************************************/
+static void send_result(const char *id, const char *result)
+{
+	reply.length = 0;
+	append_text(&reply, "{\"jsonrpc\":\"2.0\",\"id\":");
+	append_id(&reply, id);
+	append_text(&reply, ",\"result\":");
+	append_text(&reply, result);
+	append_text(&reply, "}");
+	send_message(&reply);
+}
+
+/************************************************
+ * NAME: send_error
+ * PARAMS: id - the request id as raw JSON, NULL
+ * 	        if it couldn't be read
+ * 	   code - the JSON-RPC error code
+ * 	   gripe - the error message
+ ***********************************************/
+static void send_error(const char *id, int code, const char *gripe)
+{
+	char number[32];
+
+	sprintf(number, "%d", code);
+	reply.length = 0;
+	append_text(&reply, "{\"jsonrpc\":\"2.0\",\"id\":");
+	append_id(&reply, id);
+	append_text(&reply, ",\"error\":{\"code\":");
+	append_text(&reply, number);
+	append_text(&reply, ",\"message\":");
+	append_json_string(&reply, gripe);
+	append_text(&reply, "}}");
+	send_message(&reply);
+}
+
+/************************************************
+ * NAME: add_diagnostic
+ * PARAMS: linenumber - the line of the error
+ * 	   column - the column of the error
+ * 	   gripe - the error message
+ * DESCRIPTION: append an error to the array of
+ * 		diagnostics
+ ***********************************************/
+static void add_diagnostic(unsigned long linenumber, unsigned int column, const char *gripe)
+{
+	char range[128];
+
+	sprintf(range,
+		"%s{\"range\":{\"start\":{\"line\":%lu,\"character\":%u}," \
+		"\"end\":{\"line\":%lu,\"character\":%u}}," \
+		"\"severity\":1,\"source\":\"as\",\"message\":",
+		diagnostics.length > 1 ? "," : "",
+		linenumber - 1, column, linenumber - 1, column + 1);
+	append_text(&diagnostics, range);
+	append_json_string(&diagnostics, gripe);
+	append_text(&diagnostics, "}");
+}
+
+/************************************************
+ * NAME: keep_error
+ * PARAMS: linenumber - the line of the error
+ * 	   column - the column of the error
+ * 	   gripe - the error message
+ * DESCRIPTION: keep an error of the pass on the
+ * 		parsed line, used as the parser
+ * 		error handler
+ ***********************************************/
+static void keep_error(unsigned int linenumber, unsigned int column, const char *gripe)
+{
+	line_error_t **link = &parsed_line->errors[parsed_pass];
+	line_error_t *error = malloc(sizeof(*error));
+
+	(void)linenumber;
+	if (NULL == error || NULL == (error->gripe = malloc(strlen(gripe) + 1))) {
+		free(error);
+		out_of_memory = 1;
+		return;
+	}
+	strcpy(error->gripe, gripe);
+	error->column = column;
+	error->next = NULL;
+
+	while (*link) {
+		link = &(*link)->next;
+	}
+	*link = error;
+}
+
+/************************************************
+ * NAME: find_symbol
+ * PARAMS: document - the document
+ * 	   name - the symbol name
+ * 	   constant - 1 for a constant, 0 for a
+ * 	   	      label
+ * RETURN VALUE: the symbol, NULL if no line
+ * 		 refers to it
+ ***********************************************/
+static symbol_t *find_symbol(document_t *document, const char *name, int constant)
+{
+	symbol_t *symbol;
+
+	if (0 == document->bucket_count) {
+		return NULL;
+	}
+
+	for (symbol = document->buckets[hash_name(name) & (document->bucket_count - 1)];
+	     symbol;
+	     symbol = symbol->next) {
+		if (symbol->constant == constant && strncmp(symbol->name, name, MAX_LABEL_LENGTH) == 0) {
+			break;
+		}
+	}
+	return symbol;
+}
+
+/************************************************
+ * NAME: grow_buckets
+ * PARAMS: document - the document
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: double the buckets of the symbol
+ * 		table and hash the symbols again
+ ***********************************************/
+static int grow_buckets(document_t *document)
+{
+	unsigned long count = document->bucket_count ? document->bucket_count * 2 : MIN_SYMBOL_BUCKETS;
+	symbol_t **buckets = calloc(count, sizeof(*buckets));
+	symbol_t *symbol;
+	symbol_t *next;
+	unsigned long bucket;
+	unsigned long i;
+
+	if (NULL == buckets) {
+		return 1;
+	}
+
+	for (i = 0; i < document->bucket_count; i++) {
+		for (symbol = document->buckets[i]; symbol; symbol = next) {
+			next = symbol->next;
+			bucket = hash_name(symbol->name) & (count - 1);
+			symbol->next = buckets[bucket];
+			buckets[bucket] = symbol;
+		}
+	}
+
+	free(document->buckets);
+	document->buckets = buckets;
+	document->bucket_count = count;
+	return 0;
+}
+
+/************************************************
+ * NAME: add_symbol
+ * PARAMS: document - the document
+ * 	   name - the symbol name
+ * 	   constant - 1 for a constant, 0 for a
+ * 	   	      label
+ * RETURN VALUE: the new symbol, NULL if memory
+ * 		 ran out
+ ***********************************************/
+static symbol_t *add_symbol(document_t *document, const char *name, int constant)
+{
+	symbol_t *symbol;
+	unsigned long bucket;
+
+	/* keep a symbol per bucket at most on average */
+	if (document->symbol_count >= document->bucket_count && grow_buckets(document)) {
+		return NULL;
+	}
+
+	symbol = malloc(sizeof(*symbol));
+	if (NULL == symbol) {
+		return NULL;
+	}
+
+	strncpy(symbol->name, name, MAX_LABEL_LENGTH);
+	symbol->name[MAX_LABEL_LENGTH] = '\0';
+	symbol->constant = constant;
+	symbol->uses = NULL;
+	symbol->first = NULL;
+	symbol->first_definition = NULL;
+	memset(&symbol->label, 0, sizeof(symbol->label));
+	symbol->value = 0;
+
+	bucket = hash_name(symbol->name) & (document->bucket_count - 1);
+	symbol->next = document->buckets[bucket];
+	document->buckets[bucket] = symbol;
+	document->symbol_count++;
+	return symbol;
+}
+
+/************************************************
+ * NAME: free_symbol
+ * PARAMS: document - the document
+ * 	   symbol - a symbol no line refers to
+ ***********************************************/
+static void free_symbol(document_t *document, symbol_t *symbol)
+{
+	symbol_t **link = &document->buckets[hash_name(symbol->name) & (document->bucket_count - 1)];
+
+	while (*link != symbol) {
+		link = &(*link)->next;
+	}
+	*link = symbol->next;
+	document->symbol_count--;
+	free(symbol);
+}
+
+/************************************************
+ * NAME: free_symbols
+ * PARAMS: document - the document
+ * DESCRIPTION: empty the symbol table of the
+ * 		document
+ ***********************************************/
+static void free_symbols(document_t *document)
+{
+	symbol_t *symbol;
+	unsigned long i;
+
+	for (i = 0; i < document->bucket_count; i++) {
+		while ((symbol = document->buckets[i])) {
+			document->buckets[i] = symbol->next;
+			free(symbol);
+		}
+	}
+
+	free(document->buckets);
+	document->buckets = NULL;
+	document->bucket_count = 0;
+	document->symbol_count = 0;
+}
+
+/************************************************
+ * NAME: use_symbol
+ * PARAMS: name - the symbol name
+ * 	   constant - 1 for a constant, 0 for a
+ * 	   	      label
+ * RETURN VALUE: the reference of the parsed line
+ * 		 to the symbol, NULL if memory ran
+ * 		 out
+ ***********************************************/
+static reference_t *use_symbol(const char *name, int constant)
+{
+	symbol_t *symbol = find_symbol(parsed_document, name, constant);
+	reference_t *reference;
+
+	if (NULL == symbol) {
+		symbol = add_symbol(parsed_document, name, constant);
+		if (NULL == symbol) {
+			out_of_memory = 1;
+			return NULL;
+		}
+	}
+
+	for (reference = parsed_line->references; reference; reference = reference->next) {
+		if (reference->symbol == symbol) {
+			return reference;
+		}
+	}
+
+	reference = malloc(sizeof(*reference));
+	if (NULL == reference) {
+		if (NULL == symbol->uses) {
+			free_symbol(parsed_document, symbol);
+		}
+		out_of_memory = 1;
+		return NULL;
+	}
+
+	reference->line = parsed_line;
+	reference->symbol = symbol;
+	reference->installed = 0;
+	reference->type = REGULAR;
+	reference->defined = 0;
+	reference->value = 0;
+	reference->next = parsed_line->references;
+	parsed_line->references = reference;
+	reference->previous_use = NULL;
+	reference->next_use = symbol->uses;
+	if (symbol->uses) {
+		symbol->uses->previous_use = reference;
+	}
+	symbol->uses = reference;
+
+	/* the parser sets it if the line installs the label */
+	symbol->label.line = 0;
+	return reference;
+}
+
+/************************************************
+ * NAME: is_seen
+ * PARAMS: reference - a reference, or NULL
+ * RETURN VALUE: 1 if the parsed line sees what
+ * 		 the reference installs, 0 otherwise
+ ***********************************************/
+static int is_seen(reference_t *reference)
+{
+	return reference && reference->line->index < horizon;
+}
+
+/************************************************
+ * NAME: install_reference
+ * PARAMS: reference - a reference that declares
+ * 		       or defines its symbol
+ * DESCRIPTION: keep the first lines that install
+ * 		the symbol
+ ***********************************************/
+static void install_reference(reference_t *reference)
+{
+	symbol_t *symbol = reference->symbol;
+	unsigned long index = reference->line->index;
+
+	reference->installed = 1;
+	if (NULL == symbol->first || index < symbol->first->line->index) {
+		symbol->first = reference;
+	}
+	if (reference->defined && \
+	    (NULL == symbol->first_definition || index < symbol->first_definition->line->index)) {
+		symbol->first_definition = reference;
+	}
+}
+
+/************************************************
+ * NAME: find_firsts
+ * PARAMS: symbol - the symbol
+ * DESCRIPTION: find the first lines that install
+ * 		the symbol again
+ ***********************************************/
+static void find_firsts(symbol_t *symbol)
+{
+	reference_t *reference;
+
+	symbol->first = NULL;
+	symbol->first_definition = NULL;
+	for (reference = symbol->uses; reference; reference = reference->next_use) {
+		if (reference->installed) {
+			install_reference(reference);
+		}
+	}
+}
+
+/************************************************
+ * NAME: drop_reference
+ * PARAMS: reference - the reference
+ * DESCRIPTION: remove the reference from the
+ * 		uses of its symbol
+ ***********************************************/
+static void drop_reference(reference_t *reference)
+{
+	symbol_t *symbol = reference->symbol;
+
+	if (reference->previous_use) {
+		reference->previous_use->next_use = reference->next_use;
+	} else {
+		symbol->uses = reference->next_use;
+	}
+	if (reference->next_use) {
+		reference->next_use->previous_use = reference->previous_use;
+	}
+
+	if (symbol->first == reference || symbol->first_definition == reference) {
+		find_firsts(symbol);
+	}
+}
+
+/************************************************
+ * NAME: free_references
+ * PARAMS: reference - the references of a line
+ ***********************************************/
+static void free_references(reference_t *reference)
+{
+	reference_t *next;
+
+	for (; reference; reference = next) {
+		next = reference->next;
+		free(reference);
+	}
+}
+
+/************************************************
+ * NAME: mark_dirty
+ * PARAMS: document - the document
+ * 	   line - a line whose first pass must run
+ * 	   	  again
+ ***********************************************/
+static void mark_dirty(document_t *document, source_line_t *line)
+{
+	if (line->dirty) {
+		return;
+	}
+
+	line->dirty = 1;
+	if (document->dirty_from >= document->dirty_to) {
+		document->dirty_from = line->index;
+		document->dirty_to = line->index + 1;
+	} else if (line->index < document->dirty_from) {
+		document->dirty_from = line->index;
+	} else if (line->index >= document->dirty_to) {
+		document->dirty_to = line->index + 1;
+	}
+}
+
+/************************************************
+ * NAME: mark_stale
+ * PARAMS: document - the document
+ * 	   line - a line whose second pass must run
+ * 	   	  again
+ ***********************************************/
+static void mark_stale(document_t *document, source_line_t *line)
+{
+	if (line->stale) {
+		return;
+	}
+
+	line->stale = 1;
+	if (document->stale_from >= document->stale_to) {
+		document->stale_from = line->index;
+		document->stale_to = line->index + 1;
+	} else if (line->index < document->stale_from) {
+		document->stale_from = line->index;
+	} else if (line->index >= document->stale_to) {
+		document->stale_to = line->index + 1;
+	}
+}
+
+/************************************************
+ * NAME: mark_dependents
+ * PARAMS: document - the document
+ * 	   symbol - a symbol that changed
+ * 	   index - the line that changed it
+ * DESCRIPTION: run the second pass again on the
+ * 		lines that refer to the symbol, and
+ * 		the first pass on those after the
+ * 		line
+ ***********************************************/
+static void mark_dependents(document_t *document, symbol_t *symbol, unsigned long index)
+{
+	reference_t *reference;
+
+	for (reference = symbol->uses; reference; reference = reference->next_use) {
+		mark_stale(document, reference->line);
+		if (reference->line->index > index) {
+			mark_dirty(document, reference->line);
+		}
+	}
+}
+
+/************************************************
+ * NAME: take_snapshot
+ * PARAMS: symbol - the symbol
+ * 	   snapshot - filled with what the lines
+ * 	   	      see of the symbol
+ ***********************************************/
+static void take_snapshot(symbol_t *symbol, snapshot_t *snapshot)
+{
+	snapshot->symbol = symbol;
+	snapshot->first = symbol->first ? symbol->first->line : NULL;
+	snapshot->type = symbol->first ? symbol->first->type : REGULAR;
+	snapshot->first_definition = symbol->first_definition ? symbol->first_definition->line : NULL;
+	snapshot->value = symbol->first ? symbol->first->value : 0;
+}
+
+/************************************************
+ * NAME: has_changed
+ * PARAMS: snapshot - a snapshot of a symbol
+ * RETURN VALUE: 1 if the lines see the symbol
+ * 		 differently now, 0 otherwise
+ ***********************************************/
+static int has_changed(const snapshot_t *snapshot)
+{
+	snapshot_t now;
+
+	take_snapshot(snapshot->symbol, &now);
+	return now.first != snapshot->first || \
+	       now.type != snapshot->type || \
+	       now.first_definition != snapshot->first_definition || \
+	       now.value != snapshot->value;
+}
+
+/************************************************
+ * NAME: touch
+ * PARAMS: symbol - a symbol the parsed line
+ * 		    installs
+ * DESCRIPTION: keep how the symbol was before
+ * 		the line installed it again
+ ***********************************************/
+static void touch(symbol_t *symbol)
+{
+	int i;
+
+	for (i = 0; i < touched_count; i++) {
+		if (touched[i].symbol == symbol) {
+			return;
+		}
+	}
+
+	/* a line installs a symbol or two, if it ever
+	 * installs more anything might change */
+	if (MAX_TOUCHED_SYMBOLS == touched_count) {
+		mark_dependents(parsed_document, symbol, parsed_line->index);
+		return;
+	}
+	take_snapshot(symbol, &touched[touched_count++]);
+}
+
+/************************************************
+ * NAME: release_references
+ * PARAMS: document - the document
+ * 	   index - the line of the references
+ * 	   references - the references the line
+ * 	   		doesn't have anymore
+ * DESCRIPTION: free the references, and mark the
+ * 		lines that see a touched symbol
+ * 		differently now
+ ***********************************************/
+static void release_references(document_t *document, unsigned long index, reference_t *references)
+{
+	reference_t *reference;
+	reference_t *next;
+	int i;
+
+	for (reference = references; reference; reference = reference->next) {
+		drop_reference(reference);
+	}
+
+	for (i = 0; i < touched_count; i++) {
+		if (has_changed(&touched[i])) {
+			mark_dependents(document, touched[i].symbol, index);
+		}
+	}
+
+	for (reference = references; reference; reference = next) {
+		next = reference->next;
+		if (NULL == reference->symbol->uses) {
+			free_symbol(document, reference->symbol);
+		}
+		free(reference);
+	}
+}
+
+/************************************************
+ * NAME: lookup_line_label
+ * PARAMS: name - the label name
+ * RETURN VALUE: the label as the parsed line sees
+ * 		 it, NULL if it doesn't
+ * DESCRIPTION: the labels table lookup while the
+ * 		lsp parses a line
+ ***********************************************/
+static label_t *lookup_line_label(char *name)
+{
+	reference_t *reference = use_symbol(name, 0);
+	symbol_t *symbol;
+
+	if (NULL == reference) {
+		return NULL;
+	}
+	symbol = reference->symbol;
+
+	/* the line installed it already */
+	if (FIRST_PASS == parsed_pass && symbol->label.line == parsed_line->index + 1) {
+		return &symbol->label;
+	}
+
+	if (!is_seen(symbol->first)) {
+		return NULL;
+	}
+
+	memcpy(symbol->label.name, symbol->name, MAX_LABEL_LENGTH);
+	symbol->label.type = symbol->first->type;
+	symbol->label.has_address = is_seen(symbol->first_definition);
+	symbol->label.address = 0;
+	symbol->label.line = 0;
+	return &symbol->label;
+}
+
+/************************************************
+ * NAME: install_line_label
+ * PARAMS: name - the label name
+ * RETURN VALUE: the label to fill, NULL if memory
+ * 		 ran out
+ * DESCRIPTION: the labels table install while the
+ * 		lsp parses a line, the label is kept
+ * 		when the line is parsed
+ ***********************************************/
+static label_t *install_line_label(char *name)
+{
+	reference_t *reference = use_symbol(name, 0);
+
+	if (NULL == reference) {
+		return NULL;
+	}
+
+	memset(&reference->symbol->label, 0, sizeof(reference->symbol->label));
+	return &reference->symbol->label;
+}
+
+/************************************************
+ * NAME: lookup_line_constant
+ * PARAMS: name - the constant name
+ * RETURN VALUE: the value the parsed line sees,
+ * 		 NULL if it doesn't
+ ***********************************************/
+static const long *lookup_line_constant(const char *name)
+{
+	reference_t *reference = use_symbol(name, 1);
+
+	if (NULL == reference || !is_seen(reference->symbol->first)) {
+		return NULL;
+	}
+
+	reference->symbol->value = reference->symbol->first->value;
+	return &reference->symbol->value;
+}
+
+/************************************************
+ * NAME: install_line_constant
+ * PARAMS: name - the constant name
+ * 	   value - its value
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int install_line_constant(const char *name, long value)
+{
+	reference_t *reference = use_symbol(name, 1);
+
+	if (NULL == reference) {
+		return 1;
+	}
+
+	touch(reference->symbol);
+	reference->defined = 1;
+	reference->value = value;
+	install_reference(reference);
+	return 0;
+}
+
+/************************************************
+ * NAME: keep_installed_labels
+ * PARAMS: line - the parsed line
+ * DESCRIPTION: turn the labels the line filled
+ * 		into declarations and definitions
+ ***********************************************/
+static void keep_installed_labels(source_line_t *line)
+{
+	reference_t *reference;
+	symbol_t *symbol;
+
+	for (reference = line->references; reference; reference = reference->next) {
+		symbol = reference->symbol;
+		if (symbol->constant || symbol->label.line != line->index + 1) {
+			continue;
+		}
+
+		touch(symbol);
+		reference->type = symbol->label.type;
+		reference->defined = symbol->label.has_address;
+		install_reference(reference);
+	}
+}
+
+/************************************************
+ * NAME: skip_instruction
+ * PARAMS: full_instruction - a parsed instruction
+ * DESCRIPTION: the second pass emitter, the words
+ * 		of the line are counted already
+ ***********************************************/
+static void skip_instruction(full_instruction_t *full_instruction)
+{
+	(void)full_instruction;
+}
+
+/************************************************
+ * NAME: document_filename
+ * PARAMS: document - the document
+ * RETURN VALUE: the path of the document, data
+ * 		 files are found next to it
+ ***********************************************/
+static char *document_filename(document_t *document)
+{
+	if (strncmp(document->uri, "file://", strlen("file://")) == 0) {
+		return document->uri + strlen("file://");
+	}
+	return document->uri;
+}
+
+/************************************************
+ * NAME: forget_errors
+ * PARAMS: document - the document
+ * 	   line - the line
+ * 	   pass - the pass whose errors go
+ ***********************************************/
+static void forget_errors(document_t *document, source_line_t *line, pass_t pass)
+{
+	line_error_t *error;
+
+	if (line->failed[pass]) {
+		document->failed_lines[pass]--;
+	}
+	line->failed[pass] = 0;
+
+	while ((error = line->errors[pass])) {
+		line->errors[pass] = error->next;
+		free(error->gripe);
+		free(error);
+	}
+}
+
+/************************************************
+ * NAME: keep_failure
+ * PARAMS: document - the document
+ * 	   line - the line
+ * 	   pass - the pass that failed on it
+ ***********************************************/
+static void keep_failure(document_t *document, source_line_t *line, pass_t pass)
+{
+	line->failed[pass] = 1;
+	document->failed_lines[pass]++;
+}
+
+/************************************************
+ * NAME: parse_first_pass_line
+ * PARAMS: document - the document
+ * 	   line - a dirty line
+ * DESCRIPTION: run the first pass on the line
+ * 		again, and mark the lines that see
+ * 		what it installs differently now
+ ***********************************************/
+static void parse_first_pass_line(document_t *document, source_line_t *line)
+{
+	reference_t *previous = line->references;
+	reference_t *reference;
+
+	parsed_line = line;
+	parsed_pass = FIRST_PASS;
+	horizon = line->index;
+
+	/* what the line installed the last time */
+	touched_count = 0;
+	for (reference = previous; reference; reference = reference->next) {
+		if (reference->installed) {
+			touch(reference->symbol);
+		}
+	}
+
+	forget_errors(document, line, FIRST_PASS);
+	forget_errors(document, line, SECOND_PASS);
+	line->references = NULL;
+	if (parse_source_line(document_filename(document), line->text, line->index + 1, NULL)) {
+		keep_failure(document, line, FIRST_PASS);
+	}
+	keep_installed_labels(line);
+	release_references(document, line->index, previous);
+
+	/* the addresses after the line move */
+	if (line->words != code_index) {
+		line->words = code_index;
+		if (document->addresses_known > line->index + 1) {
+			document->addresses_known = line->index + 1;
+		}
+	}
+
+	line->dirty = 0;
+	mark_stale(document, line);
+}
+
+/************************************************
+ * NAME: parse_second_pass_line
+ * PARAMS: document - the document
+ * 	   line - a stale line
+ ***********************************************/
+static void parse_second_pass_line(document_t *document, source_line_t *line)
+{
+	parsed_line = line;
+	parsed_pass = SECOND_PASS;
+	horizon = NO_HORIZON;
+
+	forget_errors(document, line, SECOND_PASS);
+	if (parse_source_line(document_filename(document), line->text, line->index + 1, skip_instruction)) {
+		keep_failure(document, line, SECOND_PASS);
+	}
+	line->stale = 0;
+}
+
+/************************************************
+ * NAME: update_document
+ * PARAMS: document - the edited document
+ * DESCRIPTION: run the first pass on the dirty
+ * 		lines, then the second pass on the
+ * 		stale ones if the first found no
+ * 		errors
+ ***********************************************/
+static void update_document(document_t *document)
+{
+	unsigned long i;
+
+	parsed_document = document;
+	out_of_memory = 0;
+
+	/* a line only makes lines after it dirty */
+	for (i = document->dirty_from; i < document->dirty_to; i++) {
+		if (document->lines[i]->dirty) {
+			parse_first_pass_line(document, document->lines[i]);
+		}
+	}
+	document->dirty_from = document->dirty_to = 0;
+
+	if (0 == document->failed_lines[FIRST_PASS]) {
+		for (i = document->stale_from; i < document->stale_to; i++) {
+			if (document->lines[i]->stale) {
+				parse_second_pass_line(document, document->lines[i]);
+			}
+		}
+		document->stale_from = document->stale_to = 0;
+	}
+
+	document->broken = out_of_memory;
+	parsed_document = NULL;
+	parsed_line = NULL;
+}
+
+/************************************************
+ * NAME: free_line
+ * PARAMS: document - the document
+ * 	   line - a line whose references are
+ * 	   	  dropped already
+ ***********************************************/
+static void free_line(document_t *document, source_line_t *line)
+{
+	free_references(line->references);
+	forget_errors(document, line, FIRST_PASS);
+	forget_errors(document, line, SECOND_PASS);
+	free(line->text);
+	free(line);
+}
+
+/************************************************
+ * NAME: forget_line
+ * PARAMS: document - the document
+ * 	   line - a line removed by an edit
+ * DESCRIPTION: free the line, and mark the lines
+ * 		that saw what it installed
+ ***********************************************/
+static void forget_line(document_t *document, source_line_t *line)
+{
+	reference_t *reference;
+
+	parsed_document = document;
+	parsed_line = line;
+	touched_count = 0;
+	for (reference = line->references; reference; reference = reference->next) {
+		if (reference->installed) {
+			touch(reference->symbol);
+		}
+	}
+
+	release_references(document, line->index, line->references);
+	line->references = NULL;
+	free_line(document, line);
+	parsed_document = NULL;
+	parsed_line = NULL;
+}
+
+/************************************************
+ * NAME: clear_document
+ * PARAMS: document - the document
+ * DESCRIPTION: free all the lines and symbols of
+ * 		the document
+ ***********************************************/
+static void clear_document(document_t *document)
+{
+	unsigned long i;
+
+	for (i = 0; i < document->line_count; i++) {
+		free_line(document, document->lines[i]);
+	}
+	document->line_count = 0;
+	free_symbols(document);
+
+	document->dirty_from = document->dirty_to = 0;
+	document->stale_from = document->stale_to = 0;
+	document->addresses_known = 0;
+	document->broken = 0;
+	document->lost = 0;
+}
+
+/************************************************
+ * NAME: restart_document
+ * PARAMS: document - the document
+ * DESCRIPTION: forget what was parsed and make
+ * 		every line dirty
+ ***********************************************/
+static void restart_document(document_t *document)
+{
+	source_line_t *line;
+	unsigned long i;
+
+	free_symbols(document);
+	for (i = 0; i < document->line_count; i++) {
+		line = document->lines[i];
+		free_references(line->references);
+		line->references = NULL;
+		forget_errors(document, line, FIRST_PASS);
+		forget_errors(document, line, SECOND_PASS);
+		line->dirty = 0;
+		mark_dirty(document, line);
+	}
+	document->addresses_known = 0;
+	document->broken = 0;
+}
+
+/************************************************
+ * NAME: new_line
+ * PARAMS: text - the text of the line
+ * 	   length - its length
+ * RETURN VALUE: a dirty line, NULL if memory ran
+ * 		 out
+ ***********************************************/
+static source_line_t *new_line(const char *text, unsigned long length)
+{
+	source_line_t *line = malloc(sizeof(*line));
+	pass_t pass;
+
+	if (NULL == line) {
+		return NULL;
+	}
+
+	line->text = malloc(length + 1);
+	if (NULL == line->text) {
+		free(line);
+		return NULL;
+	}
+	memcpy(line->text, text, length);
+	line->text[length] = '\0';
+	line->length = length;
+
+	line->index = 0;
+	line->words = 0;
+	line->address = 0;
+	line->dirty = 0;
+	line->stale = 0;
+	for (pass = FIRST_PASS; pass < PASSES; pass++) {
+		line->failed[pass] = 0;
+		line->errors[pass] = NULL;
+	}
+	line->references = NULL;
+	return line;
+}
+
+/************************************************
+ * NAME: reserve_lines
+ * PARAMS: document - the document
+ * 	   count - the lines it will have
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int reserve_lines(document_t *document, unsigned long count)
+{
+	unsigned long capacity = document->line_capacity ? document->line_capacity : MAX_LINES;
+	source_line_t **grown;
+
+	while (capacity < count) {
+		capacity *= 2;
+	}
+	if (capacity > document->line_capacity) {
+		grown = realloc(document->lines, capacity * sizeof(*document->lines));
+		if (NULL == grown) {
+			return 1;
+		}
+		document->lines = grown;
+		document->line_capacity = capacity;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: replace_lines
+ * PARAMS: document - the document
+ * 	   first - the first line to replace
+ * 	   count - the lines to replace
+ * 	   text - the text of the new lines, it
+ * 	   	  ends with a newline unless the
+ * 	   	  lines end the document
+ * 	   length - the length of the text
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: replace lines of the document and
+ * 		mark the new lines dirty
+ ***********************************************/
+static int replace_lines(document_t *document,
+			 unsigned long first,
+			 unsigned long count,
+			 const char *text,
+			 unsigned long length)
+{
+	unsigned long added = first + count == document->line_count;
+	unsigned long kept;
+	unsigned long start;
+	unsigned long end;
+	unsigned long i;
+	source_line_t **lines;
+	source_line_t *line;
+
+	/* the text after the last newline is a line
+	 * only at the end of the document */
+	for (i = 0; i < length; i++) {
+		added += text[i] == '\n';
+	}
+
+	/* all the memory is taken before the document changes */
+	lines = malloc(added * sizeof(*lines));
+	if (NULL == lines || reserve_lines(document, document->line_count - count + added)) {
+		free(lines);
+		return 1;
+	}
+	for (i = 0, start = 0; i < added; i++, start = end) {
+		for (end = start; end < length && text[end] != '\n'; end++)
+			;
+		end += end < length;
+
+		lines[i] = new_line(text + start, end - start);
+		if (NULL == lines[i]) {
+			while (i-- > 0) {
+				free_line(document, lines[i]);
+			}
+			free(lines);
+			return 1;
+		}
+	}
+
+	/* the lines kept by the edit keep what they
+	 * installed, a line edited back and forth
+	 * makes no other line dirty */
+	kept = count < added ? count : added;
+	for (i = 0; i < kept; i++) {
+		line = document->lines[first + i];
+		free(line->text);
+		line->text = lines[i]->text;
+		line->length = lines[i]->length;
+		free(lines[i]);
+	}
+	for (i = kept; i < count; i++) {
+		forget_line(document, document->lines[first + i]);
+	}
+
+	memmove(document->lines + first + added,
+		document->lines + first + count,
+		(document->line_count - first - count) * sizeof(*document->lines));
+	for (i = kept; i < added; i++) {
+		document->lines[first + i] = lines[i];
+	}
+	document->line_count = document->line_count - count + added;
+	free(lines);
+
+	/* the lines after the edit moved, and the
+	 * marks on them with them */
+	if (count != added) {
+		for (i = first; i < document->line_count; i++) {
+			document->lines[i]->index = i;
+		}
+		if (document->dirty_from < document->dirty_to && document->dirty_to > first) {
+			document->dirty_from = document->dirty_from < first ? document->dirty_from : first;
+			document->dirty_to = document->line_count;
+		}
+		if (document->stale_from < document->stale_to && document->stale_to > first) {
+			document->stale_from = document->stale_from < first ? document->stale_from : first;
+			document->stale_to = document->line_count;
+		}
+	}
+
+	for (i = first; i < first + added; i++) {
+		mark_dirty(document, document->lines[i]);
+	}
+	if (document->addresses_known > first) {
+		document->addresses_known = first;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: line_address
+ * PARAMS: document - the document
+ * 	   index - the line
+ * RETURN VALUE: the code address of the line
+ * DESCRIPTION: sum up the words of the lines up
+ * 		to it from the first line whose
+ * 		address isn't known
+ ***********************************************/
+static unsigned int line_address(document_t *document, unsigned long index)
+{
+	source_line_t *line;
+	source_line_t *previous;
+	unsigned long i;
+
+	for (i = document->addresses_known; i <= index; i++) {
+		line = document->lines[i];
+		if (0 == i) {
+			line->address = START_OFFSET;
+		} else {
+			previous = document->lines[i - 1];
+			line->address = previous->address + previous->words;
+		}
+	}
+	if (document->addresses_known <= index) {
+		document->addresses_known = index + 1;
+	}
+
+	return document->lines[index]->address;
+}
+
+/************************************************
+ * NAME: publish_diagnostics
+ * PARAMS: document - the document
+ * 	   errors - the JSON array of errors
+ ***********************************************/
+static void publish_diagnostics(document_t *document, const char *errors)
+{
+	reply.length = 0;
+	append_text(&reply, "{\"jsonrpc\":\"2.0\",\"method\":" \
+			    "\"textDocument/publishDiagnostics\"," \
+			    "\"params\":{\"uri\":");
+	append_json_string(&reply, document->uri);
+	append_text(&reply, ",\"diagnostics\":");
+	buffer_append(&reply, errors, strlen(errors));
+	append_text(&reply, "}}");
+	send_message(&reply);
+}
+
+/************************************************
+ * NAME: refresh_document
+ * PARAMS: document - the edited document
+ * DESCRIPTION: parse the lines the edit affects
+ * 		and publish the errors of the
+ * 		document, those of the first pass if
+ * 		it has any
+ ***********************************************/
+static void refresh_document(document_t *document)
+{
+	pass_t pass;
+	source_line_t *line;
+	line_error_t *error;
+	unsigned long found;
+	unsigned long i;
+
+	if (!document->lost) {
+		if (document->broken) {
+			restart_document(document);
+		}
+		update_document(document);
+	}
+
+	diagnostics.length = 0;
+	append_text(&diagnostics, "[");
+
+	if (document->lost || document->broken) {
+		add_diagnostic(1, 0, "out of memory");
+	} else {
+		pass = document->failed_lines[FIRST_PASS] ? FIRST_PASS : SECOND_PASS;
+		for (i = 0, found = 0; i < document->line_count && found < document->failed_lines[pass]; i++) {
+			line = document->lines[i];
+			for (error = line->errors[pass]; error; error = error->next) {
+				add_diagnostic(i + 1, error->column, error->gripe);
+			}
+			found += line->failed[pass];
+		}
+	}
+
+	append_text(&diagnostics, "]");
+	buffer_append(&diagnostics, "", 1);
+	publish_diagnostics(document, diagnostics.data);
+}
+
+/************************************************
+ * NAME: find_document
+ * PARAMS: params - the request params
+ * RETURN VALUE: the document of the request, NULL
+ * 		 if it isn't open
+ ***********************************************/
+static document_t *find_document(const char *params)
+{
+	unsigned long length;
+	char *uri = json_string(json_member(json_member(params, "textDocument"), "uri"), &length);
+	document_t *document;
+
+	if (NULL == uri) {
+		return NULL;
+	}
+
+	for (document = documents; document; document = document->next) {
+		if (strcmp(document->uri, uri) == 0) {
+			break;
+		}
+	}
+
+	free(uri);
+	return document;
+}
+
+/************************************************
+ * NAME: free_document
+ * PARAMS: document - a closed document
+ ***********************************************/
+static void free_document(document_t *document)
+{
+	clear_document(document);
+	free(document->lines);
+	free(document->uri);
+	free(document);
+}
+
+/************************************************
+ * NAME: text_position
+ * PARAMS: document - the document, it has lines
+ * 	   position - a JSON position
+ * 	   line - the line of the position
+ * 	   character - the character of the
+ * 	   	       position, clipped to its line
+ ***********************************************/
+static void text_position(document_t *document,
+			  const char *position,
+			  unsigned long *line,
+			  unsigned long *character)
+{
+	long at_line = json_long(json_member(position, "line"));
+	long at_character = json_long(json_member(position, "character"));
+	source_line_t *source;
+	unsigned long width;
+
+	*line = at_line > 0 ? (unsigned long)at_line : 0;
+	*character = at_character > 0 ? (unsigned long)at_character : 0;
+
+	/* a position past the last line is the end of the text */
+	if (*line >= document->line_count) {
+		*line = document->line_count - 1;
+		*character = document->lines[*line]->length;
+	}
+
+	source = document->lines[*line];
+	width = source->length;
+	if (width > 0 && source->text[width - 1] == '\n') {
+		width--;
+	}
+	if (*character > width) {
+		*character = width;
+	}
+}
+
+/************************************************
+ * NAME: apply_change
+ * PARAMS: document - the document to edit
+ * 	   change - a JSON content change
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: replace the lines of a range of
+ * 		the document, or all of them if
+ * 		there is no range
+ ***********************************************/
+static int apply_change(document_t *document, const char *change)
+{
+	const char *range = json_member(change, "range");
+	unsigned long length;
+	unsigned long first;
+	unsigned long last;
+	unsigned long start;
+	unsigned long end;
+	unsigned long region_length;
+	char *text = json_string(json_member(change, "text"), &length);
+	char *region;
+	int failed;
+
+	if (NULL == text) {
+		return 1;
+	}
+
+	if (NULL == range) {
+		clear_document(document);
+		failed = replace_lines(document, 0, 0, text, length);
+		free(text);
+		return failed;
+	}
+
+	/* an edit on a document that missed one
+	 * can't be placed */
+	if (document->lost) {
+		free(text);
+		return 1;
+	}
+
+	text_position(document, json_member(range, "start"), &first, &start);
+	text_position(document, json_member(range, "end"), &last, &end);
+	if (last < first || (last == first && end < start)) {
+		last = first;
+		end = start;
+	}
+
+	/* the lines of the range become the text with
+	 * what is left of them around it */
+	region_length = start + length + document->lines[last]->length - end;
+	region = malloc(region_length + 1);
+	if (NULL == region) {
+		free(text);
+		return 1;
+	}
+	memcpy(region, document->lines[first]->text, start);
+	memcpy(region + start, text, length);
+	memcpy(region + start + length,
+	       document->lines[last]->text + end,
+	       document->lines[last]->length - end);
+
+	failed = replace_lines(document, first, last - first + 1, region, region_length);
+	free(region);
+	free(text);
+	return failed;
+}
+
+/************************************************
+ * NAME: did_open
+ * PARAMS: params - the notification params
+ ***********************************************/
+static void did_open(const char *params)
+{
+	const char *item = json_member(params, "textDocument");
+	unsigned long length;
+	document_t *document = find_document(params);
+
+	if (NULL == document) {
+		document = calloc(1, sizeof(*document));
+		if (NULL == document) {
+			return;
+		}
+		document->uri = json_string(json_member(item, "uri"), &length);
+		if (NULL == document->uri) {
+			free(document);
+			return;
+		}
+		document->next = documents;
+		documents = document;
+	}
+
+	/* the whole text is a change without a range */
+	if (apply_change(document, item)) {
+		document->lost = 1;
+	}
+	refresh_document(document);
+}
+
+/************************************************
+ * NAME: did_change
+ * PARAMS: params - the notification params
+ ***********************************************/
+static void did_change(const char *params)
+{
+	document_t *document = find_document(params);
+	const char *change = json_member(params, "contentChanges");
+
+	if (NULL == document || NULL == change || *change != '[') {
+		return;
+	}
+
+	/* the changes are applied one after the other */
+	for (change = skip_whitespace(change + 1); *change == '{'; ) {
+		if (apply_change(document, change)) {
+			document->lost = 1;
+		}
+		if (NULL == (change = skip_value(change))) {
+			break;
+		}
+		change = skip_whitespace(change);
+		if (*change == ',') {
+			change = skip_whitespace(change + 1);
+		}
+	}
+
+	refresh_document(document);
+}
+
+/************************************************
+ * NAME: did_close
+ * PARAMS: params - the notification params
+ ***********************************************/
+static void did_close(const char *params)
+{
+	document_t *document = find_document(params);
+	document_t **link;
+
+	if (NULL == document) {
+		return;
+	}
+
+	for (link = &documents; *link != document; link = &(*link)->next)
+		;
+	*link = document->next;
+
+	publish_diagnostics(document, "[]");
+	free_document(document);
+}
+
+/************************************************
+ * NAME: definition
+ * PARAMS: id - the request id
+ * 	   params - the request params
+ * DESCRIPTION: find the line a label is defined
+ * 		on, or declared on if it is external
+ ***********************************************/
+static void definition(const char *id, const char *params)
+{
+	document_t *document = find_document(params);
+	char name[MAX_LABEL_LENGTH];
+	char result[128];
+	const char *text;
+	unsigned long line;
+	unsigned long start;
+	unsigned long end;
+	symbol_t *symbol;
+	reference_t *target;
+
+	if (NULL == document || document->lost) {
+		send_result(id, "null");
+		return;
+	}
+
+	/* the label around the position */
+	text_position(document, json_member(params, "position"), &line, &start);
+	text = document->lines[line]->text;
+	end = start;
+	while (start > 0 && isalnum((unsigned char)text[start - 1])) {
+		start--;
+	}
+	while (isalnum((unsigned char)text[end])) {
+		end++;
+	}
+
+	if (start == end || end - start >= MAX_LABEL_LENGTH) {
+		send_result(id, "null");
+		return;
+	}
+	memcpy(name, text + start, end - start);
+	name[end - start] = '\0';
+
+	symbol = find_symbol(document, name, 0);
+	target = NULL;
+	if (symbol) {
+		target = symbol->first_definition ? symbol->first_definition : symbol->first;
+	}
+	if (NULL == target) {
+		send_result(id, "null");
+		return;
+	}
+
+	reply.length = 0;
+	append_text(&reply, "{\"jsonrpc\":\"2.0\",\"id\":");
+	append_id(&reply, id);
+	append_text(&reply, ",\"result\":{\"uri\":");
+	append_json_string(&reply, document->uri);
+	sprintf(result,
+		",\"range\":{\"start\":{\"line\":%lu,\"character\":0}," \
+		"\"end\":{\"line\":%lu,\"character\":%lu}}}}",
+		target->line->index, target->line->index, (unsigned long)strlen(symbol->name));
+	append_text(&reply, result);
+	send_message(&reply);
+}
+
+/************************************************
+ * NAME: hover
+ * PARAMS: id - the request id
+ * 	   params - the request params
+ * DESCRIPTION: show the address of the
+ * 		instruction on the line, in the
+ * 		base 4 of the object file
+ ***********************************************/
+static void hover(const char *id, const char *params)
+{
+	document_t *document = find_document(params);
+	long line = json_long(json_member(json_member(params, "position"), "line"));
+	source_line_t *source;
+	char result[64];
+
+	/* only a document both passes accept has addresses */
+	if (NULL == document || document->lost || document->broken || \
+	    document->failed_lines[FIRST_PASS] || \
+	    line < 0 || (unsigned long)line >= document->line_count) {
+		send_result(id, "null");
+		return;
+	}
+
+	source = document->lines[line];
+	if (0 == source->words || source->failed[SECOND_PASS]) {
+		send_result(id, "null");
+		return;
+	}
+
+	sprintf(result, "{\"contents\":\"address %04u\"}", convert(line_address(document, line)));
+	send_result(id, result);
+}
+
+/************************************************
+ * NAME: read_message
+ * RETURN VALUE: the next message body, NULL at
+ * 		 the end of the input. must be freed
+ ***********************************************/
+static char *read_message(void)
+{
+	char header[MAX_HEADER_LENGTH];
+	unsigned long length = 0;
+	char *body;
+
+	while (fgets(header, sizeof(header), stdin)) {
+		if (strncmp(header, "Content-Length:", strlen("Content-Length:")) == 0) {
+			length = strtoul(header + strlen("Content-Length:"), NULL, 10);
+		} else if (strcmp(header, "\r\n") == 0 || strcmp(header, "\n") == 0) {
+			break;
+		}
+	}
+
+	if (feof(stdin) || NULL == (body = malloc(length + 1))) {
+		return NULL;
+	}
+
+	if (fread(body, 1, length, stdin) != length) {
+		free(body);
+		return NULL;
+	}
+	body[length] = '\0';
+	return body;
+}
+
+/************************************************
+ * NAME: is_request
+ * PARAMS: method - the method of a message
+ * RETURN VALUE: 1 if the method expects a 
+ * 		 reply, 0 otherwise
+ ***********************************************/
+static int is_request(const char *method)
+{
+	return strcmp(method, "initialize") == 0 || \
+	       strcmp(method, "shutdown") == 0 || \
+	       strcmp(method, "textDocument/definition") == 0 || \
+	       strcmp(method, "textDocument/hover") == 0;
+}
+
+/************************************************
+ * NAME: lsp_serve
+ * RETURN VALUE: 1 on error, 0 if the editor shut
+ * 		 the server down
+ * DESCRIPTION: serve the editor on stdin and
+ * 		stdout until it exits
+ ***********************************************/
+int lsp_serve(void)
+{
+	int shut_down = 0;
+	const char *params;
+	const char *id;
+	char *message;
+	char *method;
+	unsigned long length;
+	document_t *document;
+
+	buffer_init(&diagnostics);
+	buffer_init(&reply);
+	/* nothing but the protocol may be written to stdout */
+	parse_set_string_pool(0);
+	parse_set_arena(NULL);
+	parse_set_error_handler(keep_error);
+	redirect_labels(lookup_line_label, install_line_label);
+	define_redirect(lookup_line_constant, install_line_constant);
+
+	while ((message = read_message())) {
+		method = json_string(json_member(message, "method"), &length);
+		params = json_member(message, "params");
+		id = json_member(message, "id");
+
+		if (NULL == method) {
+			if (id) {
+				send_error(id, JSON_RPC_INVALID_REQUEST, "missing method");
+			}
+		} else if (NULL == id && is_request(method)) {
+			/* a reply can't name a request without an id */
+			send_error(NULL, JSON_RPC_INVALID_REQUEST, "missing id");
+		} else if (strcmp(method, "exit") == 0) {
+			free(method);
+			free(message);
+			break;
+		} else if (strcmp(method, "initialize") == 0) {
+			send_result(id, "{\"capabilities\":{\"textDocumentSync\":2," \
+					"\"definitionProvider\":true,\"hoverProvider\":true}}");
+		} else if (strcmp(method, "shutdown") == 0) {
+			shut_down = 1;
+			send_result(id, "null");
+		} else if (strcmp(method, "textDocument/didOpen") == 0) {
+			did_open(params);
+		} else if (strcmp(method, "textDocument/didChange") == 0) {
+			did_change(params);
+		} else if (strcmp(method, "textDocument/didClose") == 0) {
+			did_close(params);
+		} else if (strcmp(method, "textDocument/definition") == 0) {
+			definition(id, params);
+		} else if (strcmp(method, "textDocument/hover") == 0) {
+			hover(id, params);
+		} else if (id) {
+			/* notifications that aren't handled are ignored */
+			send_error(id, JSON_RPC_METHOD_NOT_FOUND, "method not found");
+		}
+
+		free(method);
+		free(message);
+	}
+
+	parse_set_error_handler(NULL);
+	redirect_labels(NULL, NULL);
+	define_redirect(NULL, NULL);
+	while ((document = documents)) {
+		documents = document->next;
+		free_document(document);
+	}
+	buffer_free(&diagnostics);
+	buffer_free(&reply);
+
+	return !shut_down;
+}
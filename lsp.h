@@ -0,0 +1,6 @@
+#ifndef LSP_H
+#define LSP_H
+
+int lsp_serve(void);
+
+#endif /* end of include guard: LSP_H */
@@ -0,0 +1,386 @@
+#include <stdio.h> /* for fscanf and fprintf */
+#include <stdlib.h> /* for calloc and free */
+#include <string.h> /* for memset */
+
+#include "machine.h"
+#include "consts.h"
+#include "types.h"
+#include "isa.h"
+#include "image.h"
+#include "objfile.h"
+
+/* =============================================
+ * =============================================
+ * Note: the reference interpreter of the machine
+ * the assembler encodes for. jit.c must match it
+ * instruction by instruction:
+ *
+ * - an operand word follows the instruction, the
+ *   source operand words before the destination
+ *   ones. an index operand is a base word and an
+ *   index that is its register, or another word
+ *   when the register field is 0 (like disas).
+ *   addresses and values wrap at 20 bits.
+ * - cmp, add, sub, not, clr, inc and dec keep 
+ *   their result, bne jumps unless it is zero.
+ *   cmp computes source - destination.
+ * - type 1 operates on 10 bit halves, the comb
+ *   bits pick the source and the destination 
+ *   halves, 0 for the high half and 1 for the low
+ *   half. lea and jumps use whole addresses.
+ * - jsr and rts use a return stack outside the
+ *   memory, red reads a decimal number (0 at the
+ *   end of the input) and prn prints one.
+ * - a step is an executed instruction, a fault
+ *   leaves the machine as it was before it.
+ * ==============================================
+ * ============================================*/
+
+#define HALF_WIDTH (10)
+#define HALF_MASK ((1U << HALF_WIDTH) - 1)
+
+typedef struct {
+	address_mode_t mode;
+	unsigned int address; /* the value of an immediate, the 
+				 number of a register */
+} machine_operand_t;
+
+/************************************************
+ * NAME: fetch_operand
+ * PARAMS: machine - the machine
+ * 	   mode - the operand address mode
+ * 	   reg - the operand register field
+ * 	   pc - the next operand word, moved past
+ * 	        the operand words
+ * 	   operand - the decoded operand
+ ***********************************************/
+static void fetch_operand(const machine_t *machine,
+			  address_mode_t mode,
+			  int reg,
+			  unsigned int *pc,
+			  machine_operand_t *operand)
+{
+	const unsigned int *memory = machine->memory;
+	unsigned int base;
+
+	operand->mode = mode;
+	operand->address = 0;
+	switch (mode) {
+		case IMMEDIATE_ADDRESS:
+		case DIRECT_ADDRESS: /* FALLTHROUGH */
+			operand->address = memory[*pc];
+			*pc = (*pc + 1) & WORD_MASK;
+			break;
+		case INDEX_ADDRESS:
+			base = memory[*pc];
+			*pc = (*pc + 1) & WORD_MASK;
+			if (reg) {
+				operand->address = (base + machine->registers[reg]) & WORD_MASK;
+			} else {
+				operand->address = (base + memory[*pc]) & WORD_MASK;
+				*pc = (*pc + 1) & WORD_MASK;
+			}
+			break;
+		case DIRECT_REGISTER_ADDRESS:
+			operand->address = reg;
+			break;
+		case NO_ADDRESS:
+			break;
+	}
+}
+
+/************************************************
+ * NAME: read_operand
+ * PARAMS: machine - the machine
+ * 	   operand - the operand to read
+ * RETURN VALUE: the operand value
+ ***********************************************/
+static unsigned int read_operand(const machine_t *machine, const machine_operand_t *operand)
+{
+	switch (operand->mode) {
+		case IMMEDIATE_ADDRESS:
+			return operand->address & WORD_MASK;
+		case DIRECT_REGISTER_ADDRESS:
+			return machine->registers[operand->address];
+		case DIRECT_ADDRESS:
+		case INDEX_ADDRESS: /* FALLTHROUGH */
+			return machine->memory[operand->address];
+		case NO_ADDRESS:
+			break;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: write_operand
+ * PARAMS: machine - the machine
+ * 	   operand - a register or memory operand
+ * 	   value - the value to write
+ ***********************************************/
+static void write_operand(machine_t *machine, const machine_operand_t *operand, unsigned int value)
+{
+	value &= WORD_MASK;
+	if (operand->mode == DIRECT_REGISTER_ADDRESS) {
+		machine->registers[operand->address] = value;
+		return;
+	}
+
+	machine->memory[operand->address] = value;
+	if (machine->code_map && machine->code_map[operand->address]) {
+		machine->modified = 1;
+	}
+}
+
+/************************************************
+ * NAME: effective_address
+ * PARAMS: machine - the machine
+ * 	   operand - the operand
+ * RETURN VALUE: the address of a memory operand
+ * 		 or the value of a register
+ ***********************************************/
+static unsigned int effective_address(const machine_t *machine, const machine_operand_t *operand)
+{
+	return operand->mode == DIRECT_REGISTER_ADDRESS ? \
+	       machine->registers[operand->address] : operand->address;
+}
+
+/************************************************
+ * NAME: get_half
+ * PARAMS: value - a word
+ * 	   low - pick the low half
+ * RETURN VALUE: a 10 bit half of the word
+ ***********************************************/
+static unsigned int get_half(unsigned int value, int low)
+{
+	return (value >> (low ? 0 : HALF_WIDTH)) & HALF_MASK;
+}
+
+/************************************************
+ * NAME: set_half
+ * PARAMS: value - a word
+ * 	   low - set the low half
+ * 	   half - the new half
+ * RETURN VALUE: the word with the half replaced
+ ***********************************************/
+static unsigned int set_half(unsigned int value, int low, unsigned int half)
+{
+	int shift = low ? 0 : HALF_WIDTH;
+
+	return (value & ~(HALF_MASK << shift)) | ((half & HALF_MASK) << shift);
+}
+
+/************************************************
+ * NAME: read_number
+ * PARAMS: machine - the machine
+ * RETURN VALUE: the next number of the input, 0
+ * 		 at its end
+ ***********************************************/
+static unsigned int read_number(machine_t *machine)
+{
+	long value;
+
+	if (NULL == machine->input || fscanf(machine->input, "%ld", &value) != 1) {
+		return 0;
+	}
+	return (unsigned int)value;
+}
+
+/************************************************
+ * NAME: machine_init
+ * PARAMS: machine - the machine to init
+ * 	   input - read by red, NULL for no input
+ * 	   output - written by prn
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+int machine_init(machine_t *machine, FILE *input, FILE *output)
+{
+	memset(machine, 0, sizeof(*machine));
+	machine->memory = calloc(MACHINE_WORDS, sizeof(*machine->memory));
+	machine->pc = START_OFFSET;
+	machine->result = 1;
+	machine->input = input;
+	machine->output = output;
+	return NULL == machine->memory;
+}
+
+/************************************************
+ * NAME: machine_load
+ * PARAMS: machine - the machine
+ * 	   object - a loaded .ob file
+ * DESCRIPTION: copy the code and the data from
+ * 		START_OFFSET, external words are 0
+ ***********************************************/
+void machine_load(machine_t *machine, const objfile_t *object)
+{
+	unsigned long length = object->code_length + object->data_length;
+	unsigned long i;
+
+	for (i = 0; i < length && START_OFFSET + i < MACHINE_WORDS; i++) {
+		machine->memory[START_OFFSET + i] = image_get(&object->words, i);
+	}
+	machine->pc = START_OFFSET;
+}
+
+/************************************************
+ * NAME: machine_execute
+ * PARAMS: machine - the machine
+ * RETURN VALUE: MACHINE_RUNNING, MACHINE_STOPPED
+ * 		 or the fault
+ * DESCRIPTION: execute the instruction at pc, 
+ * 		the budget isn't used
+ ***********************************************/
+machine_status_t machine_execute(machine_t *machine)
+{
+	decoded_instruction_t decoded;
+	machine_operand_t source;
+	machine_operand_t destination;
+	unsigned int next = (machine->pc + 1) & WORD_MASK;
+	unsigned int mask;
+	unsigned int value = 0;
+	unsigned int target = 0;
+	int opcode;
+	int half;
+
+	if (isa_decode(machine->memory[machine->pc], &decoded)) {
+		return MACHINE_INVALID_INSTRUCTION;
+	}
+	fetch_operand(machine, decoded.src_address_mode, decoded.src_register, &next, &source);
+	fetch_operand(machine, decoded.dest_address_mode, decoded.dest_register, &next, &destination);
+
+	opcode = decoded.instruction->opcode;
+	half = decoded.type != 0;
+	mask = half ? HALF_MASK : WORD_MASK;
+
+	/* the operand values, or their halves */
+	if (decoded.src_address_mode != NO_ADDRESS) {
+		value = read_operand(machine, &source);
+		if (half) {
+			value = get_half(value, decoded.comb >> 1);
+		}
+	}
+	if (decoded.dest_address_mode != NO_ADDRESS) {
+		target = read_operand(machine, &destination);
+		if (half) {
+			target = get_half(target, decoded.comb & 1);
+		}
+	}
+
+	switch (opcode) {
+		case OPCODE_mov:
+			target = value;
+			break;
+		case OPCODE_cmp:
+			machine->result = (value - target) & mask;
+			break;
+		case OPCODE_add:
+			machine->result = target = (target + value) & mask;
+			break;
+		case OPCODE_sub:
+			machine->result = target = (target - value) & mask;
+			break;
+		case OPCODE_not:
+			machine->result = target = ~target & mask;
+			break;
+		case OPCODE_clr:
+			machine->result = target = 0;
+			break;
+		case OPCODE_inc:
+			machine->result = target = (target + 1) & mask;
+			break;
+		case OPCODE_dec:
+			machine->result = target = (target - 1) & mask;
+			break;
+		case OPCODE_red:
+			target = read_number(machine) & mask;
+			break;
+		case OPCODE_prn:
+			fprintf(machine->output, "%ld\n", 
+				(target & ((mask + 1) >> 1)) ? (long)target - (long)mask - 1 : (long)target);
+			break;
+		case OPCODE_lea:
+			/* the whole address is written */
+			half = 0;
+			target = effective_address(machine, &source);
+			break;
+		case OPCODE_jmp:
+			next = effective_address(machine, &destination) & WORD_MASK;
+			break;
+		case OPCODE_bne:
+			if (machine->result) {
+				next = effective_address(machine, &destination) & WORD_MASK;
+			}
+			break;
+		case OPCODE_jsr:
+			if (machine->sp == MACHINE_STACK) {
+				return MACHINE_STACK_OVERFLOW;
+			}
+			machine->stack[machine->sp++] = next;
+			next = effective_address(machine, &destination) & WORD_MASK;
+			break;
+		case OPCODE_rts:
+			if (0 == machine->sp) {
+				return MACHINE_STACK_UNDERFLOW;
+			}
+			next = machine->stack[--machine->sp];
+			break;
+		case OPCODE_stop:
+			machine->pc = next;
+			return MACHINE_STOPPED;
+	}
+
+	/* write back the instructions with a result */
+	switch (opcode) {
+		case OPCODE_mov:
+		case OPCODE_add:
+		case OPCODE_sub:
+		case OPCODE_not:
+		case OPCODE_clr:
+		case OPCODE_inc:
+		case OPCODE_dec:
+		case OPCODE_red:
+		case OPCODE_lea:
+			if (half) {
+				target = set_half(read_operand(machine, &destination), decoded.comb & 1, target);
+			}
+			write_operand(machine, &destination, target);
+			break;
+	}
+
+	machine->pc = next;
+	return MACHINE_RUNNING;
+}
+
+/************************************************
+ * NAME: machine_run
+ * PARAMS: machine - the machine
+ * RETURN VALUE: why the machine stopped
+ * DESCRIPTION: interpret instructions until the
+ * 		machine stops, faults or runs out
+ * 		of budget
+ ***********************************************/
+machine_status_t machine_run(machine_t *machine)
+{
+	machine_status_t status;
+
+	do {
+		if (machine->budget <= 0) {
+			return MACHINE_OUT_OF_STEPS;
+		}
+		status = machine_execute(machine);
+		if (status == MACHINE_RUNNING || status == MACHINE_STOPPED) {
+			machine->budget--;
+		}
+	} while (status == MACHINE_RUNNING);
+
+	return status;
+}
+
+/************************************************
+ * NAME: machine_free
+ * PARAMS: machine - the machine
+ ***********************************************/
+void machine_free(machine_t *machine)
+{
+	free(machine->memory);
+	machine->memory = NULL;
+}
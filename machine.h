@@ -0,0 +1,46 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdio.h> /* for FILE */
+
+#include "isa.h"
+#include "objfile.h"
+
+/* every 20 bit address is a word of memory */
+#define MACHINE_WORDS (WORD_MASK + 1)
+#define MACHINE_REGISTERS (1 << REGISTER_WIDTH)
+#define MACHINE_STACK (1024)
+
+/* why a machine stopped running */
+typedef enum {
+	MACHINE_RUNNING,
+	MACHINE_STOPPED,
+	MACHINE_INVALID_INSTRUCTION,
+	MACHINE_STACK_OVERFLOW,
+	MACHINE_STACK_UNDERFLOW,
+	MACHINE_OUT_OF_STEPS
+} machine_status_t;
+
+/* the state of the machine, the words are 20 bit */
+typedef struct {
+	unsigned int registers[MACHINE_REGISTERS];
+	unsigned int pc;
+	unsigned int result; /* of the last computation, zero sets Z */
+	unsigned int sp;
+	unsigned int stack[MACHINE_STACK]; /* return addresses of jsr */
+	unsigned int *memory;
+	long budget; /* instructions left to run */
+	const unsigned char *code_map; /* words a translation depends on, or NULL */
+	int modified; /* a word of code_map was written */
+	void *chain_site; /* jump of a translation to link, see jit.c */
+	FILE *input; /* read by red */
+	FILE *output; /* written by prn */
+} machine_t;
+
+int machine_init(machine_t *machine, FILE *input, FILE *output);
+void machine_load(machine_t *machine, const objfile_t *object);
+machine_status_t machine_execute(machine_t *machine);
+machine_status_t machine_run(machine_t *machine);
+void machine_free(machine_t *machine);
+
+#endif /* end of include guard: MACHINE_H */
@@ -0,0 +1,191 @@
+#include <stdio.h> /* for sprintf */
+#include <stdlib.h> /* for realloc, qsort and free */
+#include <string.h> /* for strncpy and strncat */
+
+#include "mapfile.h"
+#include "consts.h"
+#include "types.h"
+#include "output.h"
+#include "buffer.h"
+
+/* =============================================
+ * =============================================
+ * Note: a map file lists the sections and then
+ * the labels sorted by address, externals last:
+ *
+ *   code  start  length
+ *   data  start  length
+ *   name  address  code|data|external [entry]
+ *
+ * numbers are base 4 like in the other output
+ * files. the map is built from the events of 
+ * the output pass, the words are ignored.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_MAP_CAPACITY (64)
+
+typedef struct {
+	const label_t *label;
+	unsigned long address;
+} map_label_t;
+
+static const char *map_source_filename;
+static unsigned long map_code_words;
+static unsigned long map_data_words;
+static map_label_t *map_labels = NULL;
+static unsigned long map_label_count = 0;
+static unsigned long map_label_capacity = 0;
+static int map_failed;
+
+/************************************************
+ * NAME: map_open
+ * PARAMS: source_filename - the filename to 
+ * 			     output 
+ * 	   code_words - length of the code
+ * 	   data_words - length of the data
+ * RETURN VALUE: 0
+ ***********************************************/
+static int map_open(const char *source_filename, unsigned long code_words, unsigned long data_words)
+{
+	map_source_filename = source_filename;
+	map_code_words = code_words;
+	map_data_words = data_words;
+	map_label_count = 0;
+	map_failed = 0;
+	return 0;
+}
+
+/************************************************
+ * NAME: map_code_word
+ * DESCRIPTION: the words aren't mapped
+ ***********************************************/
+static void map_code_word(unsigned long address, unsigned long word, linker_data_t linker_data)
+{
+}
+
+/************************************************
+ * NAME: map_data_word
+ * DESCRIPTION: the words aren't mapped
+ ***********************************************/
+static void map_data_word(unsigned long address, unsigned long word)
+{
+}
+
+/************************************************
+ * NAME: map_extern_use
+ * DESCRIPTION: the uses are in the .ext file
+ ***********************************************/
+static void map_extern_use(const char *name, unsigned long address)
+{
+}
+
+/************************************************
+ * NAME: map_label
+ * PARAMS: label - a label of the table
+ * 	   address - the label address
+ * DESCRIPTION: collect a label, the table is 
+ * 		kept until the map is closed
+ ***********************************************/
+static void map_label(const label_t *label, unsigned long address)
+{
+	unsigned long capacity = map_label_capacity ? map_label_capacity * 2 : MIN_MAP_CAPACITY;
+	map_label_t *grown;
+
+	if (map_label_count == map_label_capacity) {
+		grown = realloc(map_labels, capacity * sizeof(*map_labels));
+		if (NULL == grown) {
+			map_failed = 1;
+			return;
+		}
+		map_labels = grown;
+		map_label_capacity = capacity;
+	}
+
+	map_labels[map_label_count].label = label;
+	map_labels[map_label_count].address = address;
+	map_label_count++;
+}
+
+/************************************************
+ * NAME: compare_map_labels
+ * DESCRIPTION: order labels by address for 
+ * 		qsort, externals last
+ ***********************************************/
+static int compare_map_labels(const void *a, const void *b)
+{
+	const map_label_t *first = a;
+	const map_label_t *second = b;
+	int first_external = first->label->type == EXTERNAL;
+	int second_external = second->label->type == EXTERNAL;
+
+	if (first_external != second_external) {
+		return first_external - second_external;
+	}
+	return first->address < second->address ? -1 : first->address > second->address;
+}
+
+/************************************************
+ * NAME: map_close
+ * PARAMS: failed - discard the map
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: sort the labels and write the 
+ * 		map file
+ ***********************************************/
+static int map_close(int failed)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	char line[MAX_OUTPUT_LINE_LENGTH];
+	const map_label_t *entry;
+	const char *section;
+	buffer_t buffer;
+	unsigned long i;
+
+	if (failed) {
+		return 1;
+	}
+	if (map_failed) {
+		fprintf(stderr, "%s: out of memory\n", map_source_filename);
+		return 1;
+	}
+
+	qsort(map_labels, map_label_count, sizeof(*map_labels), compare_map_labels);
+
+	buffer_init(&buffer);
+	sprintf(line, "code\t%04u\t%u\n", convert(START_OFFSET), convert(map_code_words));
+	failed = buffer_append(&buffer, line, strlen(line));
+	sprintf(line, "data\t%04u\t%u\n", convert(START_OFFSET + map_code_words), convert(map_data_words));
+	failed |= buffer_append(&buffer, line, strlen(line));
+
+	for (i = 0; i < map_label_count && !failed; i++) {
+		entry = &map_labels[i];
+		section = entry->label->type == EXTERNAL ? "external" : \
+			  entry->label->section == DATA ? "data" : "code";
+		sprintf(line, "%.*s\t%04u\t%s%s\n",
+			MAX_LABEL_LENGTH, entry->label->name,
+			convert(entry->address),
+			section,
+			entry->label->type == ENTRY ? "\tentry" : "");
+		failed = buffer_append(&buffer, line, strlen(line));
+	}
+
+	if (failed) {
+		fprintf(stderr, "%s: out of memory\n", map_source_filename);
+	} else {
+		strncpy(filename, map_source_filename, MAX_FILENAME_LENGTH);
+		strncat(filename, ".map", MAX_FILENAME_LENGTH - strlen(map_source_filename));
+		failed = buffer_write_file(&buffer, filename);
+	}
+
+	buffer_free(&buffer);
+	return failed;
+}
+
+const output_emitter_t mapfile_emitter = {
+	map_open,
+	map_code_word,
+	map_data_word,
+	map_extern_use,
+	map_label,
+	map_close
+};
@@ -0,0 +1,9 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include "output.h"
+
+/* writes a .map file of the sections and the labels */
+extern const output_emitter_t mapfile_emitter;
+
+#endif /* end of include guard: MAPFILE_H */
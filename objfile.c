@@ -0,0 +1,508 @@
+#define _POSIX_C_SOURCE 200112L /* for mmap and fstat */
+
+#include <stdlib.h> /* for calloc and free */
+#include <string.h> /* for memset */
+#include <fcntl.h> /* for open */
+#include <unistd.h> /* for close */
+#include <pthread.h> /* for the parallel mode */
+#include <sys/stat.h> /* for fstat */
+#include <sys/mman.h> /* for mmap */
+
+#include "objfile.h"
+#include "consts.h"
+#include "types.h"
+#include "image.h"
+
+/* =============================================
+ * =============================================
+ * Note: an .ob file is a header line of the 
+ * code and data lengths followed by a line per
+ * word, in address order:
+ *
+ *   address \t word \t linkage \n   code word
+ *   address \t word \n              data word
+ *
+ * numbers are base 4 and a word has exactly 10
+ * digits. the file is mapped and the digits are
+ * decoded a pair at a time with a table lookup.
+ * since every line holds its address the lines
+ * can be split to chunks decoded in parallel, a 
+ * chunk starts at an address that is a multiple
+ * of 8 so no two threads write the same byte of
+ * the image or of the bitmaps.
+ * ==============================================
+ * ============================================*/
+
+#define MAX_THREADS (64)
+#define WORD_DIGITS (10)
+#define CHUNK_ALIGNMENT (8) /* words of a bitmap byte */
+#define INVALID_DIGITS (0xff)
+
+typedef struct {
+	const char *begin; /* first line to decode */
+	const char *end; /* one past the last line */
+	unsigned long first; /* index of the first word */
+	unsigned long last; /* one past the last word */
+	objfile_t *object;
+	const char *error; /* where the chunk is malformed */
+	const char *message;
+	pthread_t thread;
+} chunk_t;
+
+/* value of a base 4 digit, or INVALID_DIGITS */
+static unsigned char digits[256];
+/* value of two base 4 digits, indexed by the 
+ * first digit character << 8 | the second */
+static unsigned char digit_pairs[256 * 256];
+static pthread_once_t digits_once = PTHREAD_ONCE_INIT;
+
+/************************************************
+ * NAME: init_digits
+ * DESCRIPTION: fill the digit tables
+ ***********************************************/
+static void init_digits(void)
+{
+	int i;
+	int j;
+
+	memset(digits, INVALID_DIGITS, sizeof(digits));
+	memset(digit_pairs, INVALID_DIGITS, sizeof(digit_pairs));
+	for (i = 0; i < 4; i++) {
+		digits['0' + i] = i;
+		for (j = 0; j < 4; j++) {
+			digit_pairs[('0' + i) << 8 | ('0' + j)] = i << 2 | j;
+		}
+	}
+}
+
+/************************************************
+ * NAME: decode_number
+ * PARAMS: p - the text to decode
+ * 	   end - end of the text
+ * 	   value - the decoded number
+ * RETURN VALUE: the character after the number
+ * 		 or NULL if there is no number or it
+ * 		 has more than 10 digits
+ ***********************************************/
+static const char *decode_number(const char *p, const char *end, unsigned long *value)
+{
+	const char *begin = p;
+	unsigned char pair;
+
+	*value = 0;
+	while (end - p >= 2 && \
+	       (pair = digit_pairs[(unsigned char)p[0] << 8 | (unsigned char)p[1]]) != INVALID_DIGITS) {
+		*value = (*value << 4) | pair;
+		p += 2;
+	}
+	if (p < end && digits[(unsigned char)*p] != INVALID_DIGITS) {
+		*value = (*value << 2) | digits[(unsigned char)*p++];
+	}
+
+	return p == begin || p - begin > WORD_DIGITS ? NULL : p;
+}
+
+/************************************************
+ * NAME: decode_word
+ * PARAMS: p - the text to decode, at least 10 
+ * 	       characters
+ * 	   value - the decoded word
+ * RETURN VALUE: 1 if a character isn't a digit,
+ * 		 0 on success
+ ***********************************************/
+static int decode_word(const unsigned char *p, unsigned long *value)
+{
+	unsigned char a = digit_pairs[p[0] << 8 | p[1]];
+	unsigned char b = digit_pairs[p[2] << 8 | p[3]];
+	unsigned char c = digit_pairs[p[4] << 8 | p[5]];
+	unsigned char d = digit_pairs[p[6] << 8 | p[7]];
+	unsigned char e = digit_pairs[p[8] << 8 | p[9]];
+
+	*value = (unsigned long)a << 16 | (unsigned long)b << 12 | c << 8 | d << 4 | e;
+	return ((a | b | c | d | e) & 0xf0) != 0;
+}
+
+/************************************************
+ * NAME: mark
+ * PARAMS: bitmap - a bitmap of the words
+ * 	   index - the word to mark
+ ***********************************************/
+static void mark(unsigned char *bitmap, unsigned long index)
+{
+	bitmap[index >> 3] |= 1 << (index & 7);
+}
+
+/************************************************
+ * NAME: fail
+ * PARAMS: chunk - the chunk being decoded
+ * 	   error - where the chunk is malformed
+ * 	   message - what is wrong
+ * RETURN VALUE: 1
+ ***********************************************/
+static int fail(chunk_t *chunk, const char *error, const char *message)
+{
+	chunk->error = error;
+	chunk->message = message;
+	return 1;
+}
+
+/************************************************
+ * NAME: decode_lines
+ * PARAMS: chunk - the lines to decode
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: decode the lines of a chunk, the
+ * 		addresses must follow each other
+ * 		from the first word of the chunk
+ ***********************************************/
+static int decode_lines(chunk_t *chunk)
+{
+	objfile_t *object = chunk->object;
+	const char *p = chunk->begin;
+	const char *end = chunk->end;
+	const char *number;
+	unsigned long index = chunk->first;
+	unsigned long address;
+	unsigned long word;
+
+	for (; p < end; index++) {
+		number = p;
+		if (NULL == (p = decode_number(p, end, &address))) {
+			return fail(chunk, number, "expected a base 4 address");
+		}
+		if (address != index + START_OFFSET || index >= chunk->last) {
+			return fail(chunk, number, "address out of order");
+		}
+		if (p == end || *p != '\t') {
+			return fail(chunk, p, "expected a tab");
+		}
+		p++;
+
+		if (end - p < WORD_DIGITS || decode_word((const unsigned char *)p, &word) || \
+		    (p + WORD_DIGITS < end && digits[(unsigned char)p[WORD_DIGITS]] != INVALID_DIGITS)) {
+			return fail(chunk, p, "expected a word of 10 base 4 digits");
+		}
+		if (image_set(&object->words, index, word)) {
+			return fail(chunk, p, "couldn't store the word");
+		}
+		p += WORD_DIGITS;
+
+		if (index < object->code_length) {
+			if (p == end || *p != '\t') {
+				return fail(chunk, p, "expected a tab before the linkage");
+			}
+			if (++p == end) {
+				return fail(chunk, p, "expected a linkage");
+			}
+			switch (*p++) {
+				case ABSOLUTE_LINKAGE:
+					break;
+				case RELOCATBLE_LINKAGE:
+					mark(object->relocations, index);
+					break;
+				case EXTERNAL_LINKAGE:
+					mark(object->externals, index);
+					break;
+				default:
+					return fail(chunk, p - 1, "invalid linkage");
+			}
+		}
+
+		if (p == end || *p != '\n') {
+			return fail(chunk, p, "expected the end of the line");
+		}
+		p++;
+	}
+
+	if (index != chunk->last) {
+		return fail(chunk, end, "missing words");
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: decode_lines_thread
+ * PARAMS: chunk - the lines to decode
+ * DESCRIPTION: thread entry of decode_lines
+ ***********************************************/
+static void *decode_lines_thread(void *chunk)
+{
+	decode_lines(chunk);
+	return NULL;
+}
+
+/************************************************
+ * NAME: find_chunk_start
+ * PARAMS: p - a position in the lines
+ * 	   end - end of the lines
+ * 	   after - the chunk has to start after
+ * 	   	   this word
+ * 	   first - the first word of the chunk
+ * RETURN VALUE: the first line at or after p 
+ * 		 whose address is aligned, or end
+ ***********************************************/
+static const char *find_chunk_start(const char *p, const char *end, unsigned long after, unsigned long *first)
+{
+	unsigned long address;
+
+	while (p < end && p[-1] != '\n') {
+		p++;
+	}
+	for (; p < end; p++) {
+		if (decode_number(p, end, &address) && \
+		    address >= START_OFFSET && \
+		    address - START_OFFSET > after && \
+		    (address - START_OFFSET) % CHUNK_ALIGNMENT == 0) {
+			*first = address - START_OFFSET;
+			return p;
+		}
+		while (p < end && *p != '\n') {
+			p++;
+		}
+	}
+	return end;
+}
+
+/************************************************
+ * NAME: decode_chunks
+ * PARAMS: object - the object being loaded
+ * 	   p - the first line after the header
+ * 	   end - end of the lines
+ * 	   threads - number of decoding threads
+ * 	   chunks - the chunks, the first error 
+ * 	   	    is kept in chunks[0]
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int decode_chunks(objfile_t *object, const char *p, const char *end, int threads, chunk_t *chunks)
+{
+	unsigned long length = object->code_length + object->data_length;
+	int count;
+	int i;
+
+	/* split the lines to chunks of about the same size */
+	chunks[0].begin = p;
+	chunks[0].first = 0;
+	for (count = 1; count < threads; count++) {
+		chunks[count].begin = find_chunk_start(p + (end - p) / threads * count,
+						       end,
+						       chunks[count - 1].first,
+						       &chunks[count].first);
+		if (chunks[count].begin == end || chunks[count].first >= length) {
+			break;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		chunks[i].end = i == count - 1 ? end : chunks[i + 1].begin;
+		chunks[i].last = i == count - 1 ? length : chunks[i + 1].first;
+		chunks[i].object = object;
+		chunks[i].error = NULL;
+	}
+
+	if (count == 1) {
+		return decode_lines(&chunks[0]);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&chunks[i].thread, NULL, decode_lines_thread, &chunks[i])) {
+			while (i--) {
+				pthread_join(chunks[i].thread, NULL);
+			}
+			return fail(&chunks[0], NULL, "couldn't create a thread");
+		}
+	}
+	for (i = 0; i < count; i++) {
+		pthread_join(chunks[i].thread, NULL);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (chunks[i].error) {
+			chunks[0] = chunks[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: locate
+ * PARAMS: text - the object file text
+ * 	   at - where the text is malformed
+ * 	   message - what is wrong
+ * 	   error - the error to fill
+ * RETURN VALUE: 1
+ ***********************************************/
+static int locate(const char *text, const char *at, const char *message, objfile_error_t *error)
+{
+	const char *line = text;
+
+	error->line = 1;
+	for (; text < at; text++) {
+		if (*text == '\n') {
+			error->line++;
+			line = text + 1;
+		}
+	}
+	error->column = at - line + 1;
+	error->message = message;
+	return 1;
+}
+
+/************************************************
+ * NAME: decode_object
+ * PARAMS: text - the object file text
+ * 	   length - the text length
+ * 	   threads - number of decoding threads
+ * 	   object - the object to fill
+ * 	   error - where the text is malformed
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int decode_object(const char *text,
+			 unsigned long length,
+			 int threads,
+			 objfile_t *object,
+			 objfile_error_t *error)
+{
+	chunk_t chunks[MAX_THREADS];
+	const char *end = text + length;
+	const char *field;
+	const char *p;
+	unsigned long words;
+
+	/* the header holds the code and data lengths */
+	if (NULL == (p = decode_number(text, end, &object->code_length))) {
+		return locate(text, text, "expected the code length", error);
+	}
+	if (p == end || *p != '\t') {
+		return locate(text, p, "expected a tab", error);
+	}
+	field = p + 1;
+	if (NULL == (p = decode_number(field, end, &object->data_length))) {
+		return locate(text, field, "expected the data length", error);
+	}
+	if (p == end || *p != '\n') {
+		return locate(text, p, "expected the end of the line", error);
+	}
+	p++;
+
+	words = object->code_length + object->data_length;
+	object->relocations = calloc(words / 8 + 1, 1);
+	object->externals = calloc(words / 8 + 1, 1);
+	if (NULL == object->relocations || NULL == object->externals || \
+	    image_resize(&object->words, words)) {
+		error->line = 0;
+		error->column = 0;
+		error->message = "out of memory";
+		return 1;
+	}
+
+	if (threads < 1) {
+		threads = 1;
+	} else if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+
+	if (decode_chunks(object, p, end, threads, chunks)) {
+		if (NULL == chunks[0].error) {
+			error->line = 0;
+			error->column = 0;
+			error->message = chunks[0].message;
+			return 1;
+		}
+		return locate(text, chunks[0].error, chunks[0].message, error);
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: objfile_load
+ * PARAMS: filename - the .ob file
+ * 	   threads - number of decoding threads,
+ * 	   	     1 to decode on the caller
+ * 	   object - the loaded object
+ * 	   error - set on error
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: map an .ob file and decode it to
+ * 		a packed word image, free the 
+ * 		object with objfile_free also on
+ * 		error
+ ***********************************************/
+int objfile_load(const char *filename, int threads, objfile_t *object, objfile_error_t *error)
+{
+	struct stat st;
+	void *map;
+	int failed;
+	int fd;
+
+	image_init(&object->words);
+	object->relocations = NULL;
+	object->externals = NULL;
+	object->code_length = 0;
+	object->data_length = 0;
+	error->line = 0;
+	error->column = 0;
+	error->message = NULL;
+
+	pthread_once(&digits_once, init_digits);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return 1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		return 1;
+	}
+
+	/* an empty file can't be mapped */
+	if (0 == st.st_size) {
+		close(fd);
+		error->line = 1;
+		error->column = 1;
+		error->message = "expected the code length";
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		return 1;
+	}
+
+	failed = decode_object(map, st.st_size, threads, object, error);
+	munmap(map, st.st_size);
+	return failed;
+}
+
+/************************************************
+ * NAME: objfile_linkage
+ * PARAMS: object - a loaded object
+ * 	   index - the word index
+ * RETURN VALUE: the linkage of the word, 
+ * 		 OBJFILE_DATA_LINKAGE for data
+ ***********************************************/
+int objfile_linkage(const objfile_t *object, unsigned long index)
+{
+	if (index >= object->code_length) {
+		return OBJFILE_DATA_LINKAGE;
+	}
+	if (object->relocations[index >> 3] & (1 << (index & 7))) {
+		return RELOCATBLE_LINKAGE;
+	}
+	if (object->externals[index >> 3] & (1 << (index & 7))) {
+		return EXTERNAL_LINKAGE;
+	}
+	return ABSOLUTE_LINKAGE;
+}
+
+/************************************************
+ * NAME: objfile_free
+ * PARAMS: object - a loaded object
+ ***********************************************/
+void objfile_free(objfile_t *object)
+{
+	image_free(&object->words);
+	free(object->relocations);
+	free(object->externals);
+	object->relocations = NULL;
+	object->externals = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef OBJFILE_H
+#define OBJFILE_H
+
+#include "image.h"
+
+/* linkage of a data word, code words have 
+ * the linkage of their .ob line */
+#define OBJFILE_DATA_LINKAGE ('d')
+
+/* a loaded .ob file, word i is at address 
+ * START_OFFSET + i */
+typedef struct {
+	word_image_t words;
+	unsigned char *relocations; /* bitmap of relocatable words */
+	unsigned char *externals; /* bitmap of external words */
+	unsigned long code_length;
+	unsigned long data_length;
+} objfile_t;
+
+/* where an .ob file is malformed. line 0 if it
+ * couldn't be loaded, then the message is NULL 
+ * when errno is set */
+typedef struct {
+	unsigned long line;
+	unsigned long column;
+	const char *message;
+} objfile_error_t;
+
+int objfile_load(const char *filename, int threads, objfile_t *object, objfile_error_t *error);
+int objfile_linkage(const objfile_t *object, unsigned long index);
+void objfile_free(objfile_t *object);
+
+#endif /* end of include guard: OBJFILE_H */
@@ -0,0 +1,446 @@
+#include <stdlib.h> /* for realloc */
+#include <string.h> /* for strcmp */
+
+#include "optimize.h"
+#include "types.h"
+#include "table.h"
+#include "isa.h"
+
+/* =============================================
+ * =============================================
+ * Note: with -O the second pass collects the
+ * instructions instead of encoding them, the
+ * peephole rules below run over the whole 
+ * program and the code labels are moved to the
+ * new addresses before the program is encoded.
+ *
+ * the condition flag is assumed to be set by 
+ * the arithmetic instructions and read only by
+ * bne, so an instruction that only sets the 
+ * flag is dead when the next instruction sets
+ * it again or stops the program.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_PROGRAM_CAPACITY (256)
+
+typedef struct {
+	full_instruction_t full_instruction;
+	unsigned long address; /* the address before the optimization */
+	unsigned long new_address;
+	int removed;
+} program_instruction_t;
+
+/* global variables declared in parse.c */
+extern unsigned int code_index;
+
+/* internal global variables */
+static program_instruction_t *program = NULL;
+static unsigned long program_length = 0; /* number of instructions */
+static unsigned long program_capacity = 0;
+static unsigned long program_words = 0; /* the code length before the optimization */
+static unsigned long optimized_words = 0;
+static int program_failed = 0;
+
+/************************************************
+ * NAME: optimize_reset
+ * DESCRIPTION: empty the program but keep the 
+ * 		allocated memory for reuse
+ ***********************************************/
+void optimize_reset(void)
+{
+	program_length = 0;
+	program_words = 0;
+	program_failed = 0;
+}
+
+/************************************************
+ * NAME: optimize_add
+ * PARAMS: full_instruction - the instruction to
+ * 			      add
+ * DESCRIPTION: add an instruction to the program,
+ * 		used as the second pass emitter
+ ***********************************************/
+void optimize_add(full_instruction_t *full_instruction)
+{
+	unsigned long capacity = program_capacity ? program_capacity * 2 : MIN_PROGRAM_CAPACITY;
+	program_instruction_t *grown;
+	program_instruction_t *instruction;
+
+	if (program_length == program_capacity) {
+		grown = realloc(program, capacity * sizeof(*program));
+		if (NULL == grown) {
+			program_failed = 1;
+			return;
+		}
+		program = grown;
+		program_capacity = capacity;
+	}
+
+	instruction = &program[program_length++];
+	instruction->full_instruction = *full_instruction;
+	instruction->address = program_words;
+	instruction->removed = 0;
+	program_words += isa_instruction_words(full_instruction);
+}
+
+/************************************************
+ * NAME: same_operand
+ * PARAMS: a, b - the operands to compare
+ * RETURN VALUE: 1 if both operands are the same
+ * 		 location
+ ***********************************************/
+static int same_operand(const operand_t *a, const operand_t *b)
+{
+	if (a->type != b->type) {
+		return 0;
+	}
+
+	switch (a->type) {
+		case DIRECT_REGISTER_ADDRESS:
+			return a->value.reg == b->value.reg;
+		case DIRECT_ADDRESS:
+			return strcmp(a->value.label, b->value.label) == 0;
+		case INDEX_ADDRESS:
+			if (strcmp(a->value.label, b->value.label) || a->index_type != b->index_type) {
+				return 0;
+			}
+			switch (a->index_type) {
+				case IMMEDIATE:
+					return a->index.immediate == b->index.immediate;
+				case REGISTER:
+					return a->index.reg == b->index.reg;
+				case LABEL:
+					return strcmp(a->index.label, b->index.label) == 0;
+			}
+			return 0;
+		default:
+			return 0;
+	}
+}
+
+/************************************************
+ * NAME: sets_flag
+ * PARAMS: full_instruction - the instruction
+ * RETURN VALUE: 1 if the instruction sets the 
+ * 		 flag without reading it
+ ***********************************************/
+static int sets_flag(const full_instruction_t *full_instruction)
+{
+	switch (full_instruction->instruction->opcode) {
+		case OPCODE_cmp:
+		case OPCODE_add:
+		case OPCODE_sub:
+		case OPCODE_not:
+		case OPCODE_clr:
+		case OPCODE_inc:
+		case OPCODE_dec:
+			return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: next_instruction
+ * PARAMS: i - index of an instruction
+ * RETURN VALUE: the next instruction that isn't
+ * 		 removed, NULL at the end
+ ***********************************************/
+static program_instruction_t *next_instruction(unsigned long i)
+{
+	for (i++; i < program_length; i++) {
+		if (!program[i].removed) {
+			return &program[i];
+		}
+	}
+	return NULL;
+}
+
+/************************************************
+ * NAME: flag_is_dead
+ * PARAMS: i - index of an instruction
+ * RETURN VALUE: 1 if the flag set by the 
+ * 		 instruction is never read
+ ***********************************************/
+static int flag_is_dead(unsigned long i)
+{
+	program_instruction_t *next = next_instruction(i);
+
+	return next && \
+	       (sets_flag(&next->full_instruction) || \
+	        next->full_instruction.instruction->opcode == OPCODE_stop);
+}
+
+/************************************************
+ * NAME: simplify_operand
+ * PARAMS: full_instruction - the instruction
+ * 	   operand - its operand
+ * 	   slot - ISA_SOURCE or ISA_DESTINATION
+ * DESCRIPTION: replace an index by zero with a 
+ * 		direct address, saving a word
+ ***********************************************/
+static void simplify_operand(full_instruction_t *full_instruction, operand_t *operand, int slot)
+{
+	if (operand->type == INDEX_ADDRESS && \
+	    operand->index_type == IMMEDIATE && \
+	    operand->index.immediate == 0 && \
+	    isa_mode_allowed(full_instruction->instruction, slot, DIRECT_ADDRESS)) {
+		operand->type = DIRECT_ADDRESS;
+	}
+}
+
+/************************************************
+ * NAME: is_redundant
+ * PARAMS: i - index of an instruction
+ * RETURN VALUE: 1 if the instruction can be 
+ * 		 removed
+ ***********************************************/
+static int is_redundant(unsigned long i)
+{
+	full_instruction_t *full_instruction = &program[i].full_instruction;
+	operand_t *src = &full_instruction->src_operand;
+
+	switch (full_instruction->instruction->opcode) {
+		case OPCODE_mov:
+			/* a word or the same half moved to itself */
+			return (full_instruction->comb == 0 || full_instruction->comb == 3) && \
+			       same_operand(src, &full_instruction->dest_operand);
+		case OPCODE_add:
+		case OPCODE_sub:
+			return src->type == IMMEDIATE_ADDRESS && \
+			       src->value.immediate == 0 && \
+			       flag_is_dead(i);
+		case OPCODE_cmp:
+			return flag_is_dead(i);
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: relocate
+ * PARAMS: address - an address before the 
+ * 		     optimization
+ * RETURN VALUE: the address after the 
+ * 		 optimization
+ * DESCRIPTION: an address of a removed 
+ * 		instruction moves to the next 
+ * 		instruction left
+ ***********************************************/
+static unsigned long relocate(unsigned long address)
+{
+	unsigned long low = 0;
+	unsigned long high = program_length;
+	unsigned long middle;
+
+	/* find the first instruction at or after the address */
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (program[middle].address < address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low < program_length ? program[low].new_address : optimized_words;
+}
+
+/************************************************
+ * NAME: layout
+ * DESCRIPTION: assign the new addresses, a 
+ * 		removed instruction gets the address
+ * 		of the next instruction left
+ ***********************************************/
+static void layout(void)
+{
+	unsigned long i;
+
+	optimized_words = 0;
+	for (i = 0; i < program_length; i++) {
+		program[i].new_address = optimized_words;
+		if (!program[i].removed) {
+			optimized_words += isa_instruction_words(&program[i].full_instruction);
+		}
+	}
+}
+
+/************************************************
+ * NAME: jumps_to_next
+ * PARAMS: i - index of an instruction
+ * RETURN VALUE: 1 if the instruction is a jmp to
+ * 		 the instruction right after it
+ ***********************************************/
+static int jumps_to_next(unsigned long i)
+{
+	full_instruction_t *full_instruction = &program[i].full_instruction;
+	label_t *label;
+
+	if (full_instruction->instruction->opcode != OPCODE_jmp || \
+	    full_instruction->dest_operand.type != DIRECT_ADDRESS) {
+		return 0;
+	}
+
+	label = lookup_label(full_instruction->dest_operand.value.label);
+	return label && \
+	       label->type != EXTERNAL && \
+	       label->section == CODE && \
+	       relocate(label->address) == program[i].new_address + isa_instruction_words(full_instruction);
+}
+
+/************************************************
+ * NAME: relocate_label
+ * PARAMS: label - the label to relocate
+ * DESCRIPTION: move a code label to its address 
+ * 		after the optimization
+ ***********************************************/
+static void relocate_label(label_t *label)
+{
+	if (label->has_address && label->section == CODE) {
+		label->address = relocate(label->address);
+	}
+}
+
+/************************************************
+ * NAME: relocate_program
+ * DESCRIPTION: move the code labels to the new
+ * 		addresses, update the code length 
+ * 		and drop the removed instructions,
+ * 		so another pass starts from the
+ * 		optimized program
+ ***********************************************/
+static void relocate_program(void)
+{
+	unsigned long length = 0;
+	unsigned long i;
+
+	layout();
+	loop_labels(relocate_label);
+	code_index = optimized_words;
+
+	for (i = 0; i < program_length; i++) {
+		if (!program[i].removed) {
+			program[length] = program[i];
+			program[length].address = program[i].new_address;
+			length++;
+		}
+	}
+	program_length = length;
+	program_words = optimized_words;
+}
+
+/************************************************
+ * NAME: optimize_program
+ * PARAMS: saved - number of code words saved
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: run the peephole rules over the
+ * 		program collected by the second 
+ * 		pass, relocate the code labels and
+ * 		update the code length
+ ***********************************************/
+int optimize_program(unsigned long *saved)
+{
+	unsigned long i;
+	int changed;
+
+	if (program_failed) {
+		return 1;
+	}
+
+	for (i = 0; i < program_length; i++) {
+		simplify_operand(&program[i].full_instruction,
+				 &program[i].full_instruction.src_operand,
+				 ISA_SOURCE);
+		simplify_operand(&program[i].full_instruction,
+				 &program[i].full_instruction.dest_operand,
+				 ISA_DESTINATION);
+	}
+
+	/* the flag is live or dead depending on the instructions
+	 * after, so the program is walked backwards */
+	for (i = program_length; i > 0; i--) {
+		program[i - 1].removed = is_redundant(i - 1);
+	}
+
+	/* removing a jump can make the previous one jump to the
+	 * next instruction too */
+	do {
+		layout();
+		changed = 0;
+		for (i = 0; i < program_length; i++) {
+			if (!program[i].removed && jumps_to_next(i)) {
+				program[i].removed = 1;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	*saved = program_words - optimized_words;
+	relocate_program();
+	return 0;
+}
+
+/************************************************
+ * NAME: optimize_replay
+ * PARAMS: emit - invoked with every instruction
+ * 		  left
+ * DESCRIPTION: pass the optimized program to the
+ * 		output
+ ***********************************************/
+void optimize_replay(void (*emit)(full_instruction_t *))
+{
+	unsigned long i;
+
+	for (i = 0; i < program_length; i++) {
+		if (!program[i].removed) {
+			emit(&program[i].full_instruction);
+		}
+	}
+}
+
+/************************************************
+ * NAME: optimize_length
+ * RETURN VALUE: number of instructions of the
+ * 		 program, removed ones included
+ ***********************************************/
+unsigned long optimize_length(void)
+{
+	return program_length;
+}
+
+/************************************************
+ * NAME: optimize_instruction
+ * PARAMS: i - index of an instruction
+ * RETURN VALUE: the instruction, valid until the
+ * 		 next optimize_add
+ ***********************************************/
+full_instruction_t *optimize_instruction(unsigned long i)
+{
+	return &program[i].full_instruction;
+}
+
+/************************************************
+ * NAME: optimize_remove
+ * PARAMS: i - index of an instruction
+ ***********************************************/
+void optimize_remove(unsigned long i)
+{
+	program[i].removed = 1;
+}
+
+/************************************************
+ * NAME: optimize_relocate
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: finish a pass that replaced, 
+ * 		removed or added instructions, a
+ * 		code label moves with the 
+ * 		instruction at its address
+ ***********************************************/
+int optimize_relocate(void)
+{
+	if (program_failed) {
+		return 1;
+	}
+
+	relocate_program();
+	return 0;
+}
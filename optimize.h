@@ -0,0 +1,15 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "types.h"
+
+void optimize_reset(void);
+void optimize_add(full_instruction_t *full_instruction);
+int optimize_program(unsigned long *saved);
+void optimize_replay(void (*emit)(full_instruction_t *));
+unsigned long optimize_length(void);
+full_instruction_t *optimize_instruction(unsigned long i);
+void optimize_remove(unsigned long i);
+int optimize_relocate(void);
+
+#endif /* end of include guard: OPTIMIZE_H */
@@ -0,0 +1,757 @@
+#include <stdio.h> /* for sprintf */
+#include <stdlib.h> /* for calloc, free and qsort */
+#include <string.h> /* for strcmp and memset */
+
+#include "outline.h"
+#include "optimize.h"
+#include "types.h"
+#include "table.h"
+#include "isa.h"
+#include "hash.h"
+
+/* =============================================
+ * =============================================
+ * Note: with --outline a sequence of
+ * instructions repeated in the program collected
+ * by the second pass is moved to a subroutine
+ * that ends with rts, and every copy of it is
+ * replaced by a jsr to it. the subroutines are
+ * added after the code.
+ *
+ * - every instruction gets a number, equal
+ *   instructions the same one, and the suffixes
+ *   of the numbers are sorted by their first
+ *   MAX_OUTLINE_LENGTH numbers by doubling. the
+ *   runs of sorted suffixes with a common prefix
+ *   are the repeated sequences.
+ * - a sequence doesn't contain jumps, rts or
+ *   stop, and only its first instruction may
+ *   have a label, it moves to the jsr.
+ * - the sequences are taken by the words they
+ *   would save, each takes the copies that don't
+ *   overlap the ones taken before it.
+ *
+ * jsr and rts don't set the condition flag, so
+ * the flag of an outlined sequence reaches the
+ * bne after its jsr.
+ * ==============================================
+ * ============================================*/
+
+#define MAX_OUTLINE_LENGTH (32) /* a power of 2 */
+#define OUTLINE_LABEL_FORMAT "@outline%lu"
+
+typedef struct {
+	unsigned long first; /* in the sorted suffixes */
+	unsigned long count;
+	unsigned long length;
+	long benefit; /* words saved if every copy is taken */
+} outline_candidate_t;
+
+typedef struct {
+	unsigned long start; /* index of a copy */
+	unsigned long length;
+} outline_sequence_t;
+
+/* global variables declared in parse.c */
+extern unsigned int code_index;
+
+/* internal global variables, by instruction index */
+static unsigned long program_length;
+static unsigned long *numbers = NULL; /* equal instructions have equal numbers */
+static unsigned long *offsets = NULL; /* code address, one past the end too */
+static unsigned char *labeled = NULL;
+static unsigned long *reach = NULL; /* longest sequence starting here */
+static unsigned long *suffixes = NULL; /* sorted by their first numbers */
+static unsigned long *ranks = NULL;
+static unsigned long *scratch = NULL;
+static unsigned long *counts = NULL;
+static unsigned long *prefixes = NULL; /* common prefix with the previous suffix */
+static unsigned long *calls = NULL; /* sequence + 1 of a taken copy */
+static unsigned char *taken = NULL;
+static outline_candidate_t *candidates = NULL;
+static unsigned long candidate_count;
+static outline_sequence_t *sequences = NULL;
+static unsigned long sequence_count;
+static int call_words; /* of a jsr to a label */
+
+/************************************************
+ * NAME: hash_operand
+ * PARAMS: hash - the hash so far
+ * 	   operand - the operand to add
+ * RETURN VALUE: the hash with the fields the
+ * 		 operand type uses
+ ***********************************************/
+static unsigned long hash_operand(unsigned long hash, const operand_t *operand)
+{
+	hash = hash_bytes(hash, &operand->type, sizeof(operand->type));
+	switch (operand->type) {
+		case IMMEDIATE_ADDRESS:
+			return hash_bytes(hash, &operand->value.immediate, sizeof(operand->value.immediate));
+		case DIRECT_REGISTER_ADDRESS:
+			return hash_bytes(hash, &operand->value.reg, sizeof(operand->value.reg));
+		case DIRECT_ADDRESS:
+			return hash_bytes(hash, operand->value.label, strlen(operand->value.label));
+		case INDEX_ADDRESS:
+			hash = hash_bytes(hash, operand->value.label, strlen(operand->value.label));
+			hash = hash_bytes(hash, &operand->index_type, sizeof(operand->index_type));
+			switch (operand->index_type) {
+				case IMMEDIATE:
+					return hash_bytes(hash, &operand->index.immediate, sizeof(operand->index.immediate));
+				case REGISTER:
+					return hash_bytes(hash, &operand->index.reg, sizeof(operand->index.reg));
+				case LABEL:
+					return hash_bytes(hash, operand->index.label, strlen(operand->index.label));
+			}
+			return hash;
+		default:
+			return hash;
+	}
+}
+
+/************************************************
+ * NAME: same_operand
+ * PARAMS: a, b - the operands to compare
+ * RETURN VALUE: 1 if both operands are encoded
+ * 		 the same
+ ***********************************************/
+static int same_operand(const operand_t *a, const operand_t *b)
+{
+	if (a->type != b->type) {
+		return 0;
+	}
+
+	switch (a->type) {
+		case IMMEDIATE_ADDRESS:
+			return a->value.immediate == b->value.immediate;
+		case DIRECT_REGISTER_ADDRESS:
+			return a->value.reg == b->value.reg;
+		case DIRECT_ADDRESS:
+			return strcmp(a->value.label, b->value.label) == 0;
+		case INDEX_ADDRESS:
+			if (strcmp(a->value.label, b->value.label) || a->index_type != b->index_type) {
+				return 0;
+			}
+			switch (a->index_type) {
+				case IMMEDIATE:
+					return a->index.immediate == b->index.immediate;
+				case REGISTER:
+					return a->index.reg == b->index.reg;
+				case LABEL:
+					return strcmp(a->index.label, b->index.label) == 0;
+			}
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+/************************************************
+ * NAME: hash_instruction
+ * PARAMS: full_instruction - the instruction
+ * RETURN VALUE: hash of the instruction
+ ***********************************************/
+static unsigned long hash_instruction(const full_instruction_t *full_instruction)
+{
+	unsigned long hash = HASH_SEED;
+
+	hash = hash_bytes(hash, &full_instruction->instruction, sizeof(full_instruction->instruction));
+	hash = hash_bytes(hash, &full_instruction->type, sizeof(full_instruction->type));
+	hash = hash_bytes(hash, &full_instruction->comb, sizeof(full_instruction->comb));
+	hash = hash_operand(hash, &full_instruction->src_operand);
+	return hash_operand(hash, &full_instruction->dest_operand);
+}
+
+/************************************************
+ * NAME: same_instruction
+ * PARAMS: a, b - the instructions to compare
+ * RETURN VALUE: 1 if both are encoded the same
+ ***********************************************/
+static int same_instruction(const full_instruction_t *a, const full_instruction_t *b)
+{
+	return a->instruction == b->instruction && \
+	       a->type == b->type && \
+	       a->comb == b->comb && \
+	       same_operand(&a->src_operand, &b->src_operand) && \
+	       same_operand(&a->dest_operand, &b->dest_operand);
+}
+
+/************************************************
+ * NAME: can_outline
+ * PARAMS: full_instruction - the instruction
+ * RETURN VALUE: 1 if the instruction can be in
+ * 		 a subroutine
+ ***********************************************/
+static int can_outline(const full_instruction_t *full_instruction)
+{
+	switch (full_instruction->instruction->opcode) {
+		case OPCODE_jmp:
+		case OPCODE_bne:
+		case OPCODE_jsr:
+		case OPCODE_rts:
+		case OPCODE_stop:
+			return 0;
+	}
+	return 1;
+}
+
+/************************************************
+ * NAME: number_instructions
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: give equal instructions equal
+ * 		numbers, an instruction that can't
+ * 		be outlined gets a number of its own
+ ***********************************************/
+static int number_instructions(void)
+{
+	unsigned long capacity = 1;
+	unsigned long *slots;
+	unsigned long slot;
+	unsigned long next_number = 0;
+	full_instruction_t *full_instruction;
+	unsigned long i;
+
+	while (capacity < 2 * program_length) {
+		capacity *= 2;
+	}
+	slots = calloc(capacity, sizeof(*slots)); /* index + 1 of the first one */
+	if (NULL == slots) {
+		return 1;
+	}
+
+	for (i = 0; i < program_length; i++) {
+		full_instruction = optimize_instruction(i);
+		if (!can_outline(full_instruction)) {
+			numbers[i] = next_number++;
+			continue;
+		}
+
+		slot = hash_instruction(full_instruction) & (capacity - 1);
+		while (slots[slot] && \
+		       !same_instruction(optimize_instruction(slots[slot] - 1), full_instruction)) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		if (slots[slot]) {
+			numbers[i] = numbers[slots[slot] - 1];
+		} else {
+			slots[slot] = i + 1;
+			numbers[i] = next_number++;
+		}
+	}
+
+	free(slots);
+	return 0;
+}
+
+/************************************************
+ * NAME: find_instruction
+ * PARAMS: address - a code address
+ * RETURN VALUE: index of the first instruction
+ * 		 at or after the address
+ ***********************************************/
+static unsigned long find_instruction(unsigned long address)
+{
+	unsigned long low = 0;
+	unsigned long high = program_length;
+	unsigned long middle;
+
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (offsets[middle] < address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+/************************************************
+ * NAME: mark_label
+ * PARAMS: label - a label of the source
+ * DESCRIPTION: mark the instruction of a code
+ * 		label, used with loop_labels
+ ***********************************************/
+static void mark_label(label_t *label)
+{
+	unsigned long i;
+
+	if (!label->has_address || label->section != CODE || label->type == EXTERNAL) {
+		return;
+	}
+
+	i = find_instruction(label->address);
+	if (i < program_length) {
+		labeled[i] = 1;
+	}
+}
+
+/************************************************
+ * NAME: measure_reach
+ * DESCRIPTION: the longest sequence from every
+ * 		instruction, up to a label, an
+ * 		instruction that can't be outlined
+ * 		or MAX_OUTLINE_LENGTH
+ ***********************************************/
+static void measure_reach(void)
+{
+	unsigned long i;
+	unsigned long length = 0;
+
+	offsets[0] = 0;
+	for (i = 0; i < program_length; i++) {
+		offsets[i + 1] = offsets[i] + isa_instruction_words(optimize_instruction(i));
+	}
+	loop_labels(mark_label);
+
+	for (i = program_length; i > 0; i--) {
+		if (!can_outline(optimize_instruction(i - 1))) {
+			length = 0;
+		} else {
+			length = (i < program_length && labeled[i]) ? 1 : length + 1;
+		}
+		reach[i - 1] = length < MAX_OUTLINE_LENGTH ? length : MAX_OUTLINE_LENGTH;
+	}
+}
+
+/************************************************
+ * NAME: sort_by_key
+ * PARAMS: source - suffixes to sort
+ * 	   target - the sorted suffixes
+ * 	   shift - 0 to sort by the rank, else by
+ * 	   	   the rank shift numbers later
+ * DESCRIPTION: stable counting sort, a suffix
+ * 		that ends before the shift comes
+ * 		first
+ ***********************************************/
+static void sort_by_key(const unsigned long *source, unsigned long *target, unsigned long shift)
+{
+	unsigned long i;
+	unsigned long key;
+	unsigned long total = 0;
+	unsigned long count;
+
+	memset(counts, 0, (program_length + 1) * sizeof(*counts));
+	for (i = 0; i < program_length; i++) {
+		key = source[i] + shift < program_length ? ranks[source[i] + shift] + (shift != 0) : 0;
+		counts[key]++;
+	}
+	for (i = 0; i <= program_length; i++) {
+		count = counts[i];
+		counts[i] = total;
+		total += count;
+	}
+	for (i = 0; i < program_length; i++) {
+		key = source[i] + shift < program_length ? ranks[source[i] + shift] + (shift != 0) : 0;
+		target[counts[key]++] = source[i];
+	}
+}
+
+/************************************************
+ * NAME: sort_suffixes
+ * DESCRIPTION: sort the suffixes of the numbers
+ * 		by their first MAX_OUTLINE_LENGTH
+ * 		numbers, doubling the length sorted
+ * 		by every round
+ ***********************************************/
+static void sort_suffixes(void)
+{
+	unsigned long length;
+	unsigned long rank;
+	unsigned long i;
+	unsigned long a;
+	unsigned long b;
+
+	for (i = 0; i < program_length; i++) {
+		ranks[i] = numbers[i];
+		scratch[i] = i;
+	}
+	sort_by_key(scratch, suffixes, 0);
+
+	for (length = 1; length < MAX_OUTLINE_LENGTH; length *= 2) {
+		sort_by_key(suffixes, scratch, length);
+		sort_by_key(scratch, suffixes, 0);
+
+		/* suffixes with the same 2 * length numbers share a rank */
+		rank = 0;
+		scratch[suffixes[0]] = 0;
+		for (i = 1; i < program_length; i++) {
+			a = suffixes[i - 1];
+			b = suffixes[i];
+			if (ranks[a] != ranks[b] || \
+			    (a + length < program_length ? ranks[a + length] + 1 : 0) != \
+			    (b + length < program_length ? ranks[b + length] + 1 : 0)) {
+				rank = i;
+			}
+			scratch[b] = rank;
+		}
+		memcpy(ranks, scratch, program_length * sizeof(*ranks));
+	}
+}
+
+/************************************************
+ * NAME: common_prefix
+ * PARAMS: a, b - instruction indexes
+ * RETURN VALUE: length of the sequence both
+ * 		 start with
+ ***********************************************/
+static unsigned long common_prefix(unsigned long a, unsigned long b)
+{
+	unsigned long limit = reach[a] < reach[b] ? reach[a] : reach[b];
+	unsigned long length = 0;
+
+	while (length < limit && numbers[a + length] == numbers[b + length]) {
+		length++;
+	}
+	return length;
+}
+
+/************************************************
+ * NAME: benefit
+ * PARAMS: words - words of the sequence
+ * 	   copies - number of copies replaced
+ * RETURN VALUE: words saved by outlining
+ ***********************************************/
+static long benefit(unsigned long words, unsigned long copies)
+{
+	return (long)(copies * words) - (long)(copies * call_words + words + 1);
+}
+
+/************************************************
+ * NAME: add_candidate
+ * PARAMS: first - the first sorted suffix
+ * 	   count - number of sorted suffixes
+ * 	   length - their common prefix
+ * DESCRIPTION: keep a repeated sequence that
+ * 		saves words
+ ***********************************************/
+static void add_candidate(unsigned long first, unsigned long count, unsigned long length)
+{
+	unsigned long start = suffixes[first];
+	long saved = benefit(offsets[start + length] - offsets[start], count);
+
+	if (saved > 0) {
+		candidates[candidate_count].first = first;
+		candidates[candidate_count].count = count;
+		candidates[candidate_count].length = length;
+		candidates[candidate_count].benefit = saved;
+		candidate_count++;
+	}
+}
+
+/************************************************
+ * NAME: find_candidates
+ * DESCRIPTION: every run of sorted suffixes with
+ * 		a common prefix longer than the one
+ * 		around it is a repeated sequence,
+ * 		the runs are found with a stack of
+ * 		open runs
+ ***********************************************/
+static void find_candidates(void)
+{
+	unsigned long *stack_prefix = counts; /* free after the sort */
+	unsigned long *stack_first = scratch;
+	unsigned long depth = 1;
+	unsigned long prefix;
+	unsigned long first;
+	unsigned long i;
+
+	for (i = 1; i < program_length; i++) {
+		prefixes[i] = common_prefix(suffixes[i - 1], suffixes[i]);
+	}
+
+	candidate_count = 0;
+	stack_prefix[0] = 0;
+	stack_first[0] = 0;
+	for (i = 1; i <= program_length; i++) {
+		prefix = i < program_length ? prefixes[i] : 0;
+		first = i - 1;
+		while (stack_prefix[depth - 1] > prefix) {
+			depth--;
+			first = stack_first[depth];
+			add_candidate(first, i - first, stack_prefix[depth]);
+		}
+		if (stack_prefix[depth - 1] < prefix) {
+			stack_prefix[depth] = prefix;
+			stack_first[depth] = first;
+			depth++;
+		}
+	}
+}
+
+/************************************************
+ * NAME: compare_candidates
+ * PARAMS: a, b - the candidates to compare
+ * RETURN VALUE: <0, 0 or >0, most saved first
+ ***********************************************/
+static int compare_candidates(const void *a, const void *b)
+{
+	const outline_candidate_t *x = a;
+	const outline_candidate_t *y = b;
+
+	if (x->benefit != y->benefit) {
+		return x->benefit > y->benefit ? -1 : 1;
+	}
+	return (x->first > y->first) - (x->first < y->first);
+}
+
+/************************************************
+ * NAME: compare_indexes
+ * PARAMS: a, b - the indexes to compare
+ * RETURN VALUE: <0, 0 or >0
+ ***********************************************/
+static int compare_indexes(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/************************************************
+ * NAME: is_free
+ * PARAMS: start - index of a copy
+ * 	   length - length of the sequence
+ * RETURN VALUE: 1 if no instruction of the copy
+ * 		 is taken
+ ***********************************************/
+static int is_free(unsigned long start, unsigned long length)
+{
+	unsigned long i;
+
+	for (i = 0; i < length; i++) {
+		if (taken[start + i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/************************************************
+ * NAME: take_candidate
+ * PARAMS: candidate - a repeated sequence
+ * 	   copies - room for its copies
+ * DESCRIPTION: take the copies that don't
+ * 		overlap each other or the copies
+ * 		taken before, if they still save
+ * 		words
+ ***********************************************/
+static void take_candidate(const outline_candidate_t *candidate, unsigned long *copies)
+{
+	unsigned long length = candidate->length;
+	unsigned long count = 0;
+	unsigned long end = 0;
+	unsigned long start;
+	unsigned long i;
+	unsigned long j;
+
+	memcpy(copies, suffixes + candidate->first, candidate->count * sizeof(*copies));
+	qsort(copies, candidate->count, sizeof(*copies), compare_indexes);
+	for (i = 0; i < candidate->count; i++) {
+		start = copies[i];
+		if (start >= end && is_free(start, length)) {
+			copies[count++] = start;
+			end = start + length;
+		}
+	}
+
+	start = copies[0];
+	if (0 == count || benefit(offsets[start + length] - offsets[start], count) <= 0) {
+		return;
+	}
+
+	sequences[sequence_count].start = start;
+	sequences[sequence_count].length = length;
+	sequence_count++;
+	for (i = 0; i < count; i++) {
+		calls[copies[i]] = sequence_count;
+		for (j = 0; j < length; j++) {
+			taken[copies[i] + j] = 1;
+		}
+	}
+}
+
+/************************************************
+ * NAME: take_candidates
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: take the candidates that save
+ * 		the most words first, while there
+ * 		are labels for their subroutines
+ ***********************************************/
+static int take_candidates(void)
+{
+	unsigned long *copies = scratch; /* free after the candidates are found */
+	unsigned long limit = count_free_labels();
+	unsigned long i;
+
+	qsort(candidates, candidate_count, sizeof(*candidates), compare_candidates);
+	sequences = malloc((candidate_count + 1) * sizeof(*sequences));
+	if (NULL == sequences) {
+		return 1;
+	}
+
+	sequence_count = 0;
+	for (i = 0; i < candidate_count && sequence_count < limit; i++) {
+		take_candidate(&candidates[i], copies);
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: build_call
+ * PARAMS: full_instruction - the instruction to
+ * 			      build
+ * 	   opcode - OPCODE_jsr or OPCODE_rts
+ * 	   name - the label jsr jumps to
+ ***********************************************/
+static void build_call(full_instruction_t *full_instruction, int opcode, const char *name)
+{
+	memset(full_instruction, 0, sizeof(*full_instruction));
+	full_instruction->instruction = isa_instruction(opcode);
+	full_instruction->src_operand.type = NO_ADDRESS;
+	full_instruction->dest_operand.type = NO_ADDRESS;
+	if (name) {
+		full_instruction->dest_operand.type = DIRECT_ADDRESS;
+		strncpy(full_instruction->dest_operand.value.label, name, MAX_LABEL_LENGTH - 1);
+	}
+}
+
+/************************************************
+ * NAME: rewrite_program
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: add a subroutine for every taken
+ * 		sequence after the code and replace
+ * 		its copies with calls to it
+ ***********************************************/
+static int rewrite_program(void)
+{
+	full_instruction_t full_instruction;
+	char name[MAX_LABEL_LENGTH];
+	unsigned long address = offsets[program_length];
+	outline_sequence_t *sequence;
+	label_t *label;
+	unsigned long i;
+	unsigned long j;
+
+	for (i = 0; i < sequence_count; i++) {
+		sequence = &sequences[i];
+		sprintf(name, OUTLINE_LABEL_FORMAT, i);
+		if (install_label(name, &label)) {
+			return 1;
+		}
+		label->section = CODE;
+		label->type = REGULAR;
+		label->address = address;
+		label->has_address = 1;
+		label->line = 0;
+
+		/* copied first, adding can move the program */
+		for (j = 0; j < sequence->length; j++) {
+			full_instruction = *optimize_instruction(sequence->start + j);
+			optimize_add(&full_instruction);
+		}
+		build_call(&full_instruction, OPCODE_rts, NULL);
+		optimize_add(&full_instruction);
+		address += offsets[sequence->start + sequence->length] - offsets[sequence->start] + 1;
+	}
+
+	for (i = 0; i < program_length; i++) {
+		if (calls[i]) {
+			sequence = &sequences[calls[i] - 1];
+			sprintf(name, OUTLINE_LABEL_FORMAT, calls[i] - 1);
+			build_call(optimize_instruction(i), OPCODE_jsr, name);
+			for (j = 1; j < sequence->length; j++) {
+				optimize_remove(i + j);
+			}
+		}
+	}
+
+	return optimize_relocate();
+}
+
+/************************************************
+ * NAME: release
+ * DESCRIPTION: free the tables of the pass
+ ***********************************************/
+static void release(void)
+{
+	free(numbers);
+	free(offsets);
+	free(labeled);
+	free(reach);
+	free(suffixes);
+	free(ranks);
+	free(scratch);
+	free(counts);
+	free(prefixes);
+	free(calls);
+	free(taken);
+	free(candidates);
+	free(sequences);
+	numbers = offsets = reach = suffixes = ranks = scratch = counts = prefixes = calls = NULL;
+	labeled = taken = NULL;
+	candidates = NULL;
+	sequences = NULL;
+}
+
+/************************************************
+ * NAME: allocate
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int allocate(void)
+{
+	unsigned long length = program_length + 1;
+
+	numbers = malloc(length * sizeof(*numbers));
+	offsets = malloc(length * sizeof(*offsets));
+	labeled = calloc(length, sizeof(*labeled));
+	reach = malloc(length * sizeof(*reach));
+	suffixes = malloc(length * sizeof(*suffixes));
+	ranks = malloc(length * sizeof(*ranks));
+	scratch = malloc(length * sizeof(*scratch));
+	counts = malloc(length * sizeof(*counts));
+	prefixes = malloc(length * sizeof(*prefixes));
+	calls = calloc(length, sizeof(*calls));
+	taken = calloc(length, sizeof(*taken));
+	candidates = malloc(length * sizeof(*candidates));
+
+	return !numbers || !offsets || !labeled || !reach || !suffixes || !ranks || \
+	       !scratch || !counts || !prefixes || !calls || !taken || !candidates;
+}
+
+/************************************************
+ * NAME: outline_program
+ * PARAMS: saved - number of code words saved
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: move the repeated sequences of
+ * 		the program collected by the second
+ * 		pass to subroutines, relocate the
+ * 		code labels and update the code
+ * 		length
+ ***********************************************/
+int outline_program(unsigned long *saved)
+{
+	full_instruction_t call;
+	unsigned long words = code_index;
+	int rc;
+
+	*saved = 0;
+	program_length = optimize_length();
+	if (0 == program_length) {
+		return 0;
+	}
+
+	build_call(&call, OPCODE_jsr, "");
+	call_words = isa_instruction_words(&call);
+
+	rc = allocate() || number_instructions();
+	if (!rc) {
+		measure_reach();
+		sort_suffixes();
+		find_candidates();
+		rc = take_candidates() || (sequence_count && rewrite_program());
+	}
+	release();
+
+	*saved = words - code_index;
+	return rc;
+}
@@ -0,0 +1,6 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+int outline_program(unsigned long *saved);
+
+#endif /* end of include guard: OUTLINE_H */
@@ -1,4 +1,4 @@
-#include <stdio.h> /* for fopen, fprintf and fclose */
+#include <stdio.h> /* for sprintf and fprintf */
 #include <string.h> /* for strcpy and strncat */
 #include <math.h> /* for pow */
 
@@ -6,21 +6,65 @@
 #include "types.h"
 #include "consts.h"
 #include "table.h"
+#include "image.h"
+#include "isa.h"
+#include "buffer.h"
+#include "io.h"
+#include "trace.h"
 
 /* global variables declared in parse.c that are used
  * for output */
 extern int code_index;
 extern int data_index;
-extern char data_section[DATA_SECTION_MAX_LENGTH];
-extern full_instruction_t full_instructions[CODE_SECTION_MAX_LENGTH];
-extern int full_instruction_index;
+extern word_image_t data_section;
+
+/* an output file is built in memory and written
+ * once the whole file is assembled */
+typedef struct {
+	buffer_t buffer;
+	int opened;
+	const char *extention;
+} output_file_t;
 
 /* internal global variables */
-static FILE *ob_output_file;
-static FILE *entries_output_file;
-static FILE *externals_output_file;
+static output_file_t ob_output_file = {{0}, 0, ".ob"};
+static output_file_t entries_output_file = {{0}, 0, ".ent"};
+static output_file_t externals_output_file = {{0}, 0, ".ext"};
+static int output_failed;
+/* writes a finished output file and releases its data */
+static int (*output_writer)(const char *filename, char *data, unsigned long length, arena_t *arena) = io_write;
+static arena_t *output_arena = NULL; /* the output files are built in, NULL for malloc */
+/* takes the output files a chunk at a time as they are built, NULL 
+ * to write whole files with output_writer */
+static void (*output_streamer)(const char *extention, char *data, unsigned long length) = NULL;
 static const char *original_filenme;
 static int output_code_index;
+static int code_length; /* code_index of the first pass, the second
+			   pass counts code_index again while encoding */
+static unsigned long output_spill_limit; /* bytes per output file kept in
+					    memory, 0 for no limit */
+
+static int text_open(const char *source_filename, unsigned long code_words, unsigned long data_words);
+static void text_code_word(unsigned long address, unsigned long word, linker_data_t linker_data);
+static void text_data_word(unsigned long address, unsigned long word);
+static void text_extern_use(const char *name, unsigned long address);
+static void text_label(const label_t *label, unsigned long address);
+static int text_close(int failed);
+
+/* the .ob, .ent and .ext files */
+static const output_emitter_t text_emitter = {
+	text_open,
+	text_code_word,
+	text_data_word,
+	text_extern_use,
+	text_label,
+	text_close
+};
+
+/* every event of the output pass is passed to
+ * all emitters, in the order they were added */
+static const output_emitter_t *emitters[MAX_EMITTERS] = {&text_emitter};
+static int emitter_count = 1;
 
 /************************************************
  * NAME: convert
@@ -45,101 +89,268 @@ unsigned int convert(unsigned int number)
 }
 
 /************************************************
- * NAME: output_entry_label
- * PARAMS: label - the label to output 
- * DESCRIPTION: output a label to the entry file 
+ * NAME: label_address
+ * PARAMS: label - a code or data label
+ * RETURN VALUE: the address of the label, the
+ * 		 data is placed after the code
  ***********************************************/
-static void output_entry_label(label_t *label)
+static unsigned long label_address(const label_t *label)
 {
-	/* open file for writing if not opened */
-	if (NULL == entries_output_file) {
-		char filename[MAX_FILENAME_LENGTH];
-
-		strncpy(filename, original_filenme, MAX_FILENAME_LENGTH);
-		strncat(filename, ".ent", MAX_FILENAME_LENGTH - strlen(original_filenme));
-		entries_output_file = fopen(filename, "wt");
-		if (NULL == entries_output_file) {
-			perror("couldn't create entry file");
-			return;
-		}
+	return label->address + START_OFFSET + (label->section == DATA ? code_length : 0);
+}
+
+/************************************************
+ * NAME: build_filename
+ * PARAMS: filename - output buffer of 
+ * 		      MAX_FILENAME_LENGTH bytes
+ * 	   extention - the extention to append
+ * DESCRIPTION: build an output filename from the
+ * 		original filename
+ ***********************************************/
+static void build_filename(char *filename, const char *extention)
+{
+	strncpy(filename, original_filenme, MAX_FILENAME_LENGTH);
+	strncat(filename, extention, MAX_FILENAME_LENGTH - strlen(original_filenme));
+}
+
+/************************************************
+ * NAME: stream_output_file
+ * PARAMS: file - the output file
+ * DESCRIPTION: pass the buffered bytes to the 
+ * 		streamer, which releases them
+ ***********************************************/
+static void stream_output_file(output_file_t *file)
+{
+	output_streamer(file->extention, file->buffer.data, file->buffer.length);
+	file->buffer.data = NULL;
+	file->buffer.length = 0;
+	file->buffer.capacity = 0;
+}
+
+/************************************************
+ * NAME: output_line
+ * PARAMS: file - the output file
+ * 	   line - the line to output
+ * DESCRIPTION: output a line to an output file
+ ***********************************************/
+static void output_line(output_file_t *file, const char *line)
+{
+	file->opened = 1;
+	if (buffer_append(&file->buffer, line, strlen(line))) {
+		output_failed = 1;
 	}
-	if (label->type == ENTRY) {
-		fprintf(entries_output_file, 
-			"%s\t%010u\n", 
-			label->name, 
-			convert(label->address + START_OFFSET + (label->section == DATA ? code_index : 0)));
+
+	if (output_streamer && file->buffer.length >= OUTPUT_STREAM_CHUNK_LENGTH) {
+		stream_output_file(file);
 	}
 }
 
 /************************************************
- * NAME: output_code_line
- * PARAMS: data - the code to output 
- * 	   linkder_data - the linker data 
+ * NAME: write_output_file
+ * PARAMS: file - the output file
+ * 	   failed - discard the file
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write an opened output file and
+ * 		reset it
+ ***********************************************/
+static int write_output_file(output_file_t *file, int failed)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	int rc = 0;
+
+	if (file->opened && !failed && output_streamer) {
+		/* an empty file is streamed too so it is created */
+		stream_output_file(file);
+	} else if (file->opened && !failed) {
+		build_filename(filename, file->extention);
+		if (file->buffer.spill) {
+			/* a spilled file is too big for the writer, stream it */
+			rc = buffer_write_file(&file->buffer, filename);
+		} else {
+			/* the written data is released by the writer */
+			rc = output_writer(filename, file->buffer.data, file->buffer.length, output_arena);
+			buffer_init(&file->buffer);
+		}
+	}
+
+	buffer_free(&file->buffer);
+	file->opened = 0;
+	return rc;
+}
+
+/************************************************
+ * NAME: text_open
+ * PARAMS: source_filename - the filename to 
+ * 			     output 
+ * 	   code_words - length of the code
+ * 	   data_words - length of the data
+ * RETURN VALUE: 0
+ * DESCRIPTION: start the .ob, .ent and .ext 
+ * 		files and output the ob header
+ ***********************************************/
+static int text_open(const char *source_filename, unsigned long code_words, unsigned long data_words)
+{
+	char line[MAX_OUTPUT_LINE_LENGTH];
+
+	/* streamed chunks are small and released by the streamer */
+	buffer_set_spill_limit(&ob_output_file.buffer, output_streamer ? 0 : output_spill_limit);
+	buffer_set_spill_limit(&entries_output_file.buffer, output_streamer ? 0 : output_spill_limit);
+	buffer_set_spill_limit(&externals_output_file.buffer, output_streamer ? 0 : output_spill_limit);
+	buffer_set_arena(&ob_output_file.buffer, output_streamer ? NULL : output_arena);
+	buffer_set_arena(&entries_output_file.buffer, output_streamer ? NULL : output_arena);
+	buffer_set_arena(&externals_output_file.buffer, output_streamer ? NULL : output_arena);
+
+	sprintf(line,
+		"%u\t%u\n",
+	       	convert(code_words),
+	       	convert(data_words));
+	output_line(&ob_output_file, line);
+
+	return 0;
+}
+
+/************************************************
+ * NAME: text_code_word
+ * PARAMS: address - the word address
+ * 	   word - the encoded word
+ * 	   linker_data - the linker data 
  * DESCRIPTION: output a code line to the ob file 
  ***********************************************/
-static void output_code_line(int data, linker_data_t linker_data)
+static void text_code_word(unsigned long address, unsigned long word, linker_data_t linker_data)
 {
-	fprintf(ob_output_file, 
+	char line[MAX_OUTPUT_LINE_LENGTH];
+
+	sprintf(line,
 		"%04u\t%010u\t%c\n", 
-		convert(output_code_index++), 
-		convert(data), 
+		convert(address), 
+		convert(word), 
 		linker_data);
+	output_line(&ob_output_file, line);
 }
 
 /************************************************
- * NAME: output_external_label_use
- * PARAMS: label - the label to output 
+ * NAME: text_data_word
+ * PARAMS: address - the word address
+ * 	   word - the data word
+ * DESCRIPTION: output a data line to the ob file 
+ ***********************************************/
+static void text_data_word(unsigned long address, unsigned long word)
+{
+	char line[MAX_OUTPUT_LINE_LENGTH];
+
+	sprintf(line,
+		"%04u\t%010u\n",
+		convert(address),
+		convert(word));
+	output_line(&ob_output_file, line);
+}
+
+/************************************************
+ * NAME: text_extern_use
+ * PARAMS: name - the external label
+ * 	   address - the word using it
  * DESCRIPTION: output a label to the extern file 
  ***********************************************/
-static void output_external_label_use(label_t *label)
+static void text_extern_use(const char *name, unsigned long address)
 {
-	/* open file for writing if not opened */
-	if (NULL == externals_output_file) {
-		char filename[MAX_FILENAME_LENGTH];
-
-		strncpy(filename, original_filenme, MAX_FILENAME_LENGTH);
-		strncat(filename, ".ext", MAX_FILENAME_LENGTH - strlen(original_filenme));
-		externals_output_file = fopen(filename, "wt");
-		if (NULL == externals_output_file) {
-			perror("couldn't create entry file");
-			return;
-		}
+	char line[MAX_OUTPUT_LINE_LENGTH];
+
+	sprintf(line, "%s\t%04u\n", name, convert(address));
+	output_line(&externals_output_file, line);
+}
+
+/************************************************
+ * NAME: text_label
+ * PARAMS: label - the label to output 
+ * 	   address - the label address
+ * DESCRIPTION: output a label to the entry file 
+ ***********************************************/
+static void text_label(const label_t *label, unsigned long address)
+{
+	char line[MAX_OUTPUT_LINE_LENGTH];
+
+	/* the entry file is created once there are labels */
+	entries_output_file.opened = 1;
+	if (label->type == ENTRY) {
+		sprintf(line, "%s\t%010u\n", label->name, convert(address));
+		output_line(&entries_output_file, line);
 	}
-	fprintf(externals_output_file, "%s\t%04u\n", label->name, convert(output_code_index));
+}
+
+/************************************************
+ * NAME: text_close
+ * PARAMS: failed - discard the files
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write the .ob, .ent and .ext 
+ * 		files
+ ***********************************************/
+static int text_close(int failed)
+{
+	if (output_failed) {
+		fprintf(stderr, "%s: out of memory\n", original_filenme);
+		failed = 1;
+	}
+
+	trace_begin("write_outputs", original_filenme);
+	failed |= write_output_file(&ob_output_file, failed);
+	failed |= write_output_file(&entries_output_file, failed);
+	failed |= write_output_file(&externals_output_file, failed);
+	trace_end();
+
+	return failed;
+}
+
+/************************************************
+ * NAME: output_code_word
+ * PARAMS: word - the encoded word
+ * 	   linker_data - the linker data 
+ * DESCRIPTION: pass the next code word to the
+ * 		emitters
+ ***********************************************/
+static void output_code_word(int word, linker_data_t linker_data)
+{
+	int i;
+
+	for (i = 0; i < emitter_count; i++) {
+		emitters[i]->code_word(output_code_index, word & WORD_MASK, linker_data);
+	}
+	output_code_index++;
 }
 
 /************************************************
  * NAME: output_operand_label
  * PARAMS: name - the label to output 
- * DESCRIPTION: output a label to ob file and
- * 		to extern file if needed
+ * DESCRIPTION: output the address of a label or
+ * 		an external use of it
  ***********************************************/
 static void output_operand_label(char *name)
 {
 	label_t *label = lookup_label(name);
+	int i;
+
 	if (label->type == EXTERNAL) {
-		/* output the label use the to .ext file */
-		output_external_label_use(label);
-		/* output a line with a zero data and symbol the linker 
-		 * that this line needs external linkage */
-		output_code_line(0, EXTERNAL_LINKAGE);
+		for (i = 0; i < emitter_count; i++) {
+			emitters[i]->extern_use(label->name, output_code_index);
+		}
+		/* output a zero word and symbol the linker that
+		 * this word needs external linkage */
+		output_code_word(0, EXTERNAL_LINKAGE);
 	} else {
-		output_code_line(label->address + START_OFFSET + (label->section == DATA ? code_index : 0), 
-				RELOCATBLE_LINKAGE);
+		output_code_word(label_address(label), RELOCATBLE_LINKAGE);
 	}
 }
 
 /************************************************
  * NAME: output_operand
  * PARAMS: operand - the operand to output 
- * DESCRIPTION: output an operand to ob file and
- * 		to extern file if needed
+ * DESCRIPTION: output the extra words of an 
+ * 		operand
  ***********************************************/
 static void output_operand(operand_t *operand)
 {
 	switch (operand->type) {
 		case IMMEDIATE_ADDRESS:
-			output_code_line(operand->value.immediate, ABSOLUTE_LINKAGE);
+			output_code_word(operand->value.immediate, ABSOLUTE_LINKAGE);
 			break;
 		case DIRECT_ADDRESS:
 			output_operand_label(operand->value.label);
@@ -148,7 +359,7 @@ static void output_operand(operand_t *operand)
 			output_operand_label(operand->value.label);
 			switch (operand->index_type) {
 				case IMMEDIATE:
-					output_code_line(operand->index.immediate, ABSOLUTE_LINKAGE);
+					output_code_word(operand->index.immediate, ABSOLUTE_LINKAGE);
 					break;
 				case LABEL:
 					output_operand_label(operand->index.label);
@@ -164,168 +375,207 @@ static void output_operand(operand_t *operand)
 }
 
 /************************************************
- * NAME: encode_address_mode
- * PARAMS: mode - the mode to mode 
- * RETURN VALUE: encoded mode
- * DESCRIPTION: encode an address mode 
+ * NAME: output_data
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: pass all data words to the 
+ * 		emitters
  ***********************************************/
-static int encode_address_mode(address_mode_t mode)
+static int output_data(void)
 {
-	switch (mode) {
-		case NO_ADDRESS:
-		case IMMEDIATE_ADDRESS: /* FALLTHROUGH */
-			return 0;
-		case DIRECT_ADDRESS:
+	unsigned long words[OUTPUT_DATA_CHUNK_LENGTH];
+	unsigned long count;
+	unsigned long start;
+	unsigned long i;
+	int j;
+
+	/* unpack the data image a chunk at a time */
+	for (start = 0; start < data_section.length; start += count) {
+		/* a spilled data section is read back from
+		 * its temporary file, which may fail */
+		if (image_read_words(&data_section, start, OUTPUT_DATA_CHUNK_LENGTH, words, &count)) {
 			return 1;
-		case INDEX_ADDRESS:
-			return 2;
-		case DIRECT_REGISTER_ADDRESS:
-			return 3;
+		}
+		for (i = 0; i < count; i++) {
+			for (j = 0; j < emitter_count; j++) {
+				emitters[j]->data_word(START_OFFSET + code_length + start + i, words[i]);
+			}
+		}
 	}
 	return 0;
 }
 
 /************************************************
- * NAME: output_instruction
- * PARAMS: full_instruction - the instruction to 
- * 			      output 
- * DESCRIPTION: output an instruction to ob file
+ * NAME: output_label
+ * PARAMS: label - a label of the table
+ * DESCRIPTION: pass a label to the emitters
  ***********************************************/
-static void output_instruction(full_instruction_t full_instruction)
+static void output_label(label_t *label)
 {
-	int assembled_instruction = 0;
-
-	assembled_instruction += full_instruction.comb << COMB_OFFSET;
-
-	if (full_instruction.dest_operand.type == DIRECT_REGISTER_ADDRESS)
-	{
-		assembled_instruction += full_instruction.dest_operand.value.reg << DEST_REGISTER_OFFSET;
-	}
-	else if (full_instruction.dest_operand.type == INDEX_ADDRESS \
-	         && full_instruction.dest_operand.index_type == REGISTER) 
-	{
-		assembled_instruction += full_instruction.dest_operand.index.reg << DEST_REGISTER_OFFSET;
-	}
-	assembled_instruction += encode_address_mode(full_instruction.dest_operand.type) << DEST_ADDRESS_MODE_OFFSET;
+	unsigned long address = label->type == EXTERNAL ? 0 : label_address(label);
+	int i;
 
-	if (full_instruction.src_operand.type == DIRECT_REGISTER_ADDRESS)
-	{
-		assembled_instruction += full_instruction.src_operand.value.reg << SRC_REGISTER_OFFSET;
-	}
-	else if (full_instruction.src_operand.type == INDEX_ADDRESS \
-	         && full_instruction.src_operand.index_type == REGISTER) 
-	{
-		assembled_instruction += full_instruction.src_operand.index.reg << SRC_REGISTER_OFFSET;
+	for (i = 0; i < emitter_count; i++) {
+		emitters[i]->label(label, address);
 	}
-	assembled_instruction += encode_address_mode(full_instruction.src_operand.type) << SRC_ADDRESS_MODE_OFFSET;
-
-	assembled_instruction += full_instruction.instruction->opcode << OPCODE_OFFSET;
-	assembled_instruction += full_instruction.type << TYPE_OFFSET;
+}
 
-	output_code_line(assembled_instruction, ABSOLUTE_LINKAGE);
+/************************************************
+ * NAME: output_set_writer
+ * PARAMS: writer - writes a finished output file
+ * 		    and releases its data
+ * DESCRIPTION: replace the output writer, 
+ * 		io_write is used by default
+ ***********************************************/
+void output_set_writer(int (*writer)(const char *filename, char *data, unsigned long length, arena_t *arena))
+{
+	output_writer = writer;
 }
 
 /************************************************
- * NAME: output_data
- * DESCRIPTION: output all data to the ob file
+ * NAME: output_set_streamer
+ * PARAMS: streamer - takes every chunk of an 
+ * 		      output file as soon as it is
+ * 		      built, with its extention. the
+ * 		      data is malloced and released
+ * 		      by the streamer, an empty file
+ * 		      is a chunk of length 0. NULL to
+ * 		      write whole files
+ * DESCRIPTION: a failed file is not streamed to 
+ * 		its end, the streamer removes what
+ * 		it already wrote
  ***********************************************/
-static void output_data(void)
+void output_set_streamer(void (*streamer)(const char *extention, char *data, unsigned long length))
 {
-	int i;
+	output_streamer = streamer;
+}
 
-	for (i = 0; i < data_index; i++)
-	{
-		fprintf(ob_output_file,
-			"%04u\t%010u\n",
-			convert(START_OFFSET + code_index + i),
-		       	convert(data_section[i]));
-	}
+/************************************************
+ * NAME: output_set_arena
+ * PARAMS: arena - the arena the next output 
+ * 		   files are built in, NULL for 
+ * 		   malloc
+ * DESCRIPTION: the arena is pinned by the writer
+ * 		until the files are written
+ ***********************************************/
+void output_set_arena(arena_t *arena)
+{
+	output_arena = arena;
 }
 
 /************************************************
- * NAME: output_code
- * DESCRIPTION: output all code to the ob file
+ * NAME: output_set_spill_limit
+ * PARAMS: bytes - bytes of each output file to 
+ * 		   keep in memory, 0 for no limit
+ * DESCRIPTION: bound the output memory, bigger 
+ * 		files are spilled to temporary 
+ * 		files and streamed to the output
  ***********************************************/
-static void output_code(void)
+void output_set_spill_limit(unsigned long bytes)
 {
-	int i;
-	full_instruction_t *full_instruction;
-	int code_index = START_OFFSET;
-
-	for (i = 0; i < full_instruction_index; i++, code_index++)
-	{
-		full_instruction = &full_instructions[i];
-		output_instruction(*full_instruction);
-		switch (full_instruction->instruction->num_opernads) {
-			case 2:
-				output_operand(&full_instruction->src_operand);
-			case 1:
-				output_operand(&full_instruction->dest_operand);
-				break;
-		}
-	}
+	output_spill_limit = bytes;
 }
 
 /************************************************
- * NAME: output_header
- * DESCRIPTION: output ob file header
+ * NAME: output_add_emitter
+ * PARAMS: emitter - the emitter to add, kept 
+ * 		     until the end of the run
+ * RETURN VALUE: 1 if there are too many 
+ * 		 emitters, 0 on success
+ * DESCRIPTION: add a backend to the output, it
+ * 		gets the events of the output pass
+ * 		after the .ob, .ent and .ext files
  ***********************************************/
-static void output_header(void)
+int output_add_emitter(const output_emitter_t *emitter)
 {
-	fprintf(ob_output_file, 
-		"%u\t%u\n",
-	       	convert(code_index),
-	       	convert(data_index));
+	if (emitter_count == MAX_EMITTERS) {
+		return 1;
+	}
+	emitters[emitter_count++] = emitter;
+	return 0;
 }
 
 /************************************************
- * NAME: output
+ * NAME: output_open
  * PARAMS: source_filename - the filename to 
  * 			     output 
  * RETURN VALUE: 1 on error, 0 on success
- * DESCRIPTION:  assemble instructions and output
- * 		 all parsed data to ob ext and 
- * 		 ent files 
+ * DESCRIPTION:  open the emitters, called once 
+ * 		 the first pass is done and the 
+ * 		 sections sizes are known
  * ASSUMPTIONS: using the global variables from
  * 		parse.c
  ***********************************************/
-int output(const char *source_filename)
+int output_open(const char *source_filename)
 {
-	char obj_filename[MAX_FILENAME_LENGTH];
+	int failed = 0;
+	int i;
 
 	output_code_index = START_OFFSET;
+	code_length = code_index;
 	original_filenme = source_filename;
-	entries_output_file = NULL;
-	externals_output_file = NULL;
-
-	strncpy(obj_filename, source_filename, MAX_FILENAME_LENGTH);
-	strncat(obj_filename, ".ob", MAX_FILENAME_LENGTH - strlen(source_filename));
+	output_failed = 0;
 
-	ob_output_file = fopen(obj_filename, "wt");
-	if (NULL == ob_output_file) {
-		perror("couldn't open obj file"); 
-		return 1;
+	for (i = 0; i < emitter_count; i++) {
+		failed |= emitters[i]->open(source_filename, code_length, data_index);
 	}
 
-	output_header();
-	output_code();
-	output_data();
+	return failed;
+}
 
-	fclose(ob_output_file);
+/************************************************
+ * NAME: output_full_instruction
+ * PARAMS: full_instruction - the instruction to
+ * 			      output 
+ * DESCRIPTION: encode an instruction with its 
+ * 		operands and pass the words and 
+ * 		the external label uses to the 
+ * 		emitters
+ ***********************************************/
+void output_full_instruction(full_instruction_t *full_instruction)
+{
+	output_code_word(isa_encode(full_instruction), ABSOLUTE_LINKAGE);
+	switch (full_instruction->instruction->num_opernads) {
+		case 2:
+			output_operand(&full_instruction->src_operand);
+		case 1:
+			output_operand(&full_instruction->dest_operand);
+			break;
+	}
+}
+
+/************************************************
+ * NAME: output_close
+ * PARAMS: failed - was the second pass failed
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION:  output the data section and the 
+ * 		 labels and close the emitters. if
+ * 		 the second pass failed nothing is
+ * 		 written
+ ***********************************************/
+int output_close(int failed)
+{
+	int i;
 
-	/* output all entry labels by looping on the labels table */
-	loop_labels(output_entry_label);
+	if (!failed) {
+		trace_begin("output_data", original_filenme);
+		failed = output_data();
+		trace_end();
+		if (failed) {
+			fprintf(stderr, "%s: couldn't read the spilled data back\n", original_filenme);
+		}
+	}
 
-	/* close the files if they were opened */
-	if (entries_output_file) {
-		fclose(entries_output_file);
-		entries_output_file = NULL;
+	if (!failed) {
+		/* output all labels by looping on the labels table */
+		trace_begin("output_entries", original_filenme);
+		loop_labels(output_label);
+		trace_end();
 	}
 
-	if (externals_output_file) {
-		fclose(externals_output_file);
-		externals_output_file = NULL;
+	/* every emitter is closed so a failed one discards its files */
+	for (i = 0; i < emitter_count; i++) {
+		failed |= emitters[i]->close(failed);
 	}
 
-	return 0;
+	return failed;
 }
@@ -1,6 +1,32 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
-int output(const char *source_filename);
+#include "types.h"
+#include "arena.h"
+
+/* a backend of the output. the words of the code
+ * and then the data are passed in address order,
+ * an external use before the word using it and
+ * then every label of the table, entries and 
+ * externals too. the address of an external 
+ * label is 0 */
+typedef struct {
+	int (*open)(const char *source_filename, unsigned long code_words, unsigned long data_words);
+	void (*code_word)(unsigned long address, unsigned long word, linker_data_t linker_data);
+	void (*data_word)(unsigned long address, unsigned long word);
+	void (*extern_use)(const char *name, unsigned long address);
+	void (*label)(const label_t *label, unsigned long address);
+	int (*close)(int failed);
+} output_emitter_t;
+
+unsigned int convert(unsigned int number);
+int output_open(const char *source_filename);
+void output_full_instruction(full_instruction_t *full_instruction);
+int output_close(int failed);
+void output_set_writer(int (*writer)(const char *filename, char *data, unsigned long length, arena_t *arena));
+void output_set_streamer(void (*streamer)(const char *extention, char *data, unsigned long length));
+int output_add_emitter(const output_emitter_t *emitter);
+void output_set_arena(arena_t *arena);
+void output_set_spill_limit(unsigned long bytes);
 
 #endif /* end of include guard: OUTPUT_H */
@@ -1,24 +1,30 @@
 #include <stdlib.h> /* for strtol */
-#include <stdio.h> /* for fopen, fclose, fgets */
+#include <stdio.h> /* for perror */
 #include <string.h> /* for strncpy and strncat */
 #include <ctype.h> /* for isalpha and isalnum */
-#include <limits.h> /* for LONG_MIN and LONG_MAX */
+#include <limits.h> /* for LONG_MIN and CHAR_BIT */
 
 #include "consts.h"
 #include "types.h"
 #include "table.h"
 #include "parse.h"
+#include "image.h"
+#include "isa.h"
+#include "io.h"
+#include "datafile.h"
+#include "pool.h"
+#include "trace.h"
+#include "define.h"
 
 /* gloabl variables that the parsed file is stored in
  * used by the output function in output.c */
-full_instruction_t full_instructions[CODE_SECTION_MAX_LENGTH];
-int full_instruction_index = 0;
-char data_section[DATA_SECTION_MAX_LENGTH];
+word_image_t data_section;
 unsigned int data_index = 0;
 unsigned int code_index = 0;
 
 /* global variables used internaly for parsing */
 static int label_defined; 
+static int undefined_allowed; /* constants may be defined after their use */
 static enum {
 	FIRST_PASS,
 	SECOND_PASS
@@ -27,76 +33,21 @@ static char label_definition[MAX_LABEL_LENGTH];
 static char label_declaration[MAX_LABEL_LENGTH];
 static char *input_line = NULL; /* the current parsed line */
 static char *input_line_start = NULL; /* the current parsed line start */
-static char *input_filename = NULL; /* used for errors */
+static char *input_filename = NULL; /* used for errors and data files */
+static char *input_text = NULL; /* kept between the passes */
+static unsigned long input_length = 0;
+static unsigned long input_offset = 0; /* the next line offset */
+static FILE *input_file = NULL; /* a streamed input, read a line at a time */
+static char *line_buffer = NULL; /* the current line, reused for every line */
+static unsigned long line_capacity = 0;
+static int input_streamed = 0; /* stream the input instead of reading it */
+static int strings_pooled = 0; /* share equal strings and suffixes */
+static arena_t *input_arena = NULL; /* the source is read to, NULL for malloc */
+static const char *source_text = NULL; /* a source held in memory, NULL to read it */
+static unsigned long source_length = 0;
+static void (*error_handler)(unsigned int, unsigned int, const char *) = NULL;
+static void (*instruction_emitter)(full_instruction_t *); /* second pass output */
 static unsigned int input_linenumber = 0; /* used for errors */
-/* available instructions */
-static instruction_t instructions[] = {
-	{"mov", IMMEDIATE_ADDRESS | DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		2,
-		0},
-	{"cmp", IMMEDIATE_ADDRESS | DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		IMMEDIATE_ADDRESS | DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		2,
-		1},
-	{"add", IMMEDIATE_ADDRESS | DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS,
-		2,
-		2},
-	{"sub", IMMEDIATE_ADDRESS | DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		2,
-		3},
-	{"lea", DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS,
-		2,
-		6},
-	{"not", NO_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		4},
-	{"clr", NO_ADDRESS,
-	       	DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		5},
-	{"inc", NO_ADDRESS,
-	       	DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		7},
-	{"dec", NO_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		8},
-	{"jmp", NO_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		9},
-	{"bne", NO_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		10},
-	{"red", NO_ADDRESS, 
-		DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		11},
-	{"prn", NO_ADDRESS, 
-		IMMEDIATE_ADDRESS | DIRECT_ADDRESS | INDEX_ADDRESS | DIRECT_REGISTER_ADDRESS, 
-		1,
-		12},
-	{"jsr", NO_ADDRESS, 
-		DIRECT_ADDRESS, 
-		1,
-		13},
-	{"rts", NO_ADDRESS, 
-		NO_ADDRESS, 
-		0,
-		14},
-	{"stop", NO_ADDRESS, 
-		 NO_ADDRESS, 
-		 0,
-		 15},
-};
-
 /* =============================================
  * =============================================
  * Note: all parsing function start with parse_
@@ -118,6 +69,13 @@ static instruction_t instructions[] = {
  ***********************************************/
 void parse_error(char *gripe)
 {
+	if (error_handler) {
+		error_handler(input_linenumber,
+			      (unsigned int)(input_line - input_line_start),
+			      gripe);
+		return;
+	}
+
 	fprintf(stderr, "%s:%u:%u: error: %s\n",
 			input_filename,
 			input_linenumber,
@@ -305,42 +263,233 @@ static int parse_label_declaration(void)
 	return parse_label(label_declaration);
 }
 
+/* binary operators of expressions, from the lowest precedence */
+#define EXPRESSION_LEVELS (5)
+static const struct {
+	char token[3];
+	int level;
+} expression_operators[] = {
+	{"|", 0},
+	{"&", 1},
+	{"<<", 2},
+	{">>", 2},
+	{"+", 3},
+	{"-", 3},
+	{"*", 4},
+	{"/", 4}
+};
+
+static int parse_expression_level(long *x, int level);
+
 /************************************************
- * NAME: parse_number
+ * NAME: parse_expression_constant
  * RETURN VALUE: 0 on success, 1 otherwise
- * PARAMS: x - number output parameter
- * DESCRIPTION: parse an integer
+ * PARAMS: x - the constant value
+ * DESCRIPTION: parse the name of a constant, a
+ * 		constant used by an instruction 
+ * 		may be defined later so it is 0 
+ * 		until the second pass
  ************************************************/
-static int parse_number(long *x)
+static int parse_expression_constant(long *x)
 {
-	char *p;
+	char name[MAX_LABEL_LENGTH + 1];
+	char *name_begin = input_line;
+	const long *value;
 
-	*x = strtol(input_line, &p, 10);
-	if (*x == LONG_MIN || *x == LONG_MAX) {
-		parse_error("long overflow or underflow");
+	if (parse_label(name)) {
 		return 1;
 	}
 
-	input_line = p;
+	value = define_lookup(name);
+	if (value) {
+		*x = *value;
+	} else if (undefined_allowed) {
+		*x = 0;
+	} else {
+		input_line = name_begin;
+		parse_error("constant isn't defined");
+		return 1;
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: parse_expression_primary
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: x - the value output parameter
+ * DESCRIPTION: parse a number, a constant, a 
+ * 		parenthesized expression or a 
+ * 		signed primary
+ ************************************************/
+static int parse_expression_primary(long *x)
+{
+	const char *p;
+
+	parse_whitespace();
+	if (*input_line == '-' || *input_line == '+') {
+		if (*input_line++ == '+') {
+			return parse_expression_primary(x);
+		}
+		if (parse_expression_primary(x)) {
+			return 1;
+		}
+		*x = (long)(0UL - (unsigned long)*x);
+		return 0;
+	} else if (*input_line == '(') {
+		return parse_string("(") || \
+		       parse_expression_level(x, 0) || \
+		       parse_whitespace() || \
+		       parse_string(")");
+	} else if (isalpha(*input_line)) {
+		return parse_expression_constant(x);
+	}
+
+	p = input_line;
+	switch (scan_number(&p, input_line + strlen(input_line), x)) {
+		case SCAN_NUMBER_MISSING:
+			parse_error("expected number");
+			return 1;
+		case SCAN_NUMBER_OVERFLOW:
+			parse_error("long overflow or underflow");
+			return 1;
+	}
+
+	input_line = (char *)p;
+	return 0;
+}
+
+/************************************************
+ * NAME: apply_operator
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: token - the binary operator
+ * 	   x - the left operand and the result
+ * 	   y - the right operand
+ * DESCRIPTION: fold a binary operator, sums and
+ * 		products wrap around like the 
+ * 		machine words they end up in. an
+ * 		invalid division or shift is 0 
+ * 		while constants may be undefined
+ ************************************************/
+static int apply_operator(const char *token, long *x, long y)
+{
+	switch (token[0]) {
+		case '|':
+			*x |= y;
+			break;
+		case '&':
+			*x &= y;
+			break;
+		case '+':
+			*x = (long)((unsigned long)*x + (unsigned long)y);
+			break;
+		case '-':
+			*x = (long)((unsigned long)*x - (unsigned long)y);
+			break;
+		case '*':
+			*x = (long)((unsigned long)*x * (unsigned long)y);
+			break;
+		case '/':
+			if (0 == y || (LONG_MIN == *x && -1 == y)) {
+				/* a constant defined later is 0 on the
+				 * first pass, the second pass checks */
+				if (undefined_allowed) {
+					*x = 0;
+					break;
+				}
+				parse_error("invalid division");
+				return 1;
+			}
+			*x /= y;
+			break;
+		default: /* << and >> */
+			if (y < 0 || y >= (long)(sizeof(long) * CHAR_BIT)) {
+				if (undefined_allowed) {
+					*x = 0;
+					break;
+				}
+				parse_error("invalid shift");
+				return 1;
+			}
+			*x = '<' == token[0] ? (long)((unsigned long)*x << y) : *x >> y;
+			break;
+	}
 
 	return 0;
 }
 
 /************************************************
- * NAME: parse_data_number
+ * NAME: parse_expression_level
  * RETURN VALUE: 0 on success, 1 otherwise
- * DESCRIPTION: parse an integer into data section
+ * PARAMS: x - the value output parameter
+ * 	   level - the lowest operator precedence
+ * 	   	   to parse
+ * DESCRIPTION: parse the operands and operators
+ * 		of a precedence level, left to 
+ * 		right
  ************************************************/
-static int parse_data_number(void)
+static int parse_expression_level(long *x, int level)
 {
-	long int x;
+	const char *token;
+	long y;
+	int i;
 
-	if (parse_number(&x)) {
+	if (EXPRESSION_LEVELS == level) {
+		return parse_expression_primary(x);
+	}
+
+	if (parse_expression_level(x, level + 1)) {
 		return 1;
 	}
 
-	data_section[data_index] = x;
-	data_index++;
+	for (;;) {
+		parse_whitespace();
+		token = NULL;
+		for (i = 0; i < (int)(sizeof(expression_operators)/sizeof(expression_operators[0])); i++) {
+			if (expression_operators[i].level == level && \
+			    strncmp(input_line, expression_operators[i].token, 
+				    strlen(expression_operators[i].token)) == 0) {
+				token = expression_operators[i].token;
+				break;
+			}
+		}
+		if (NULL == token) {
+			return 0;
+		}
+
+		input_line += strlen(token);
+		if (parse_expression_level(&y, level + 1) || apply_operator(token, x, y)) {
+			return 1;
+		}
+	}
+}
+
+/************************************************
+ * NAME: parse_expression
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: x - the value output parameter
+ * DESCRIPTION: parse an integer expression and
+ * 		fold it to its value
+ ************************************************/
+static int parse_expression(long *x)
+{
+	return parse_expression_level(x, 0);
+}
+
+/************************************************
+ * NAME: append_data_numbers
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: values - the numbers to append
+ * 	   count - number of values
+ * DESCRIPTION: append numbers to the data section
+ ************************************************/
+static int append_data_numbers(const long *values, unsigned long count)
+{
+	if (image_append_words(&data_section, values, count)) {
+		parse_error("out of memory");
+		return 1;
+	}
+	data_index += count;
 	return 0;
 }
 
@@ -379,6 +528,7 @@ static int install_label_defintion(label_section_t section)
 	l->section = section;
 	l->address = section == CODE ? code_index : data_index;
 	l->has_address = 1;
+	l->line = input_linenumber;
 
 	return 0;
 }
@@ -408,6 +558,7 @@ static int install_label_declaration(label_type_t type)
 		}
 
 		l->has_address = 0;
+		l->line = input_linenumber;
 		strncpy(l->name, label_declaration, strlen(label_declaration));
 	}
 
@@ -416,35 +567,100 @@ static int install_label_declaration(label_type_t type)
 	return 0;
 }
 
+/************************************************
+ * NAME: ends_data_item
+ * PARAMS: p - the text after a number
+ * RETURN VALUE: 1 if the number is a whole item
+ * 		 of a data list
+ ************************************************/
+static int ends_data_item(const char *p)
+{
+	while (isblank(*p)) {
+		p++;
+	}
+	return *p == ',' || *p == '\0' || *p == '\n';
+}
+
 /************************************************
  * NAME: parse_data_directive
  * RETURN VALUE: 0 on success, 1 otherwise
- * DESCRIPTION: parse a data directive 
+ * DESCRIPTION: parse a data directive, the list
+ * 		of numbers is parsed in a single scan
+ * 		and appended a chunk at a time
  ************************************************/
 static int parse_data_directive(void)
 {
+	long values[PARSE_DATA_CHUNK_LENGTH];
+	unsigned long count = 0;
+	const char *p = input_line;
+	const char *end = input_line + strlen(input_line);
+	const char *item;
+
 	/* if a label is defined install it */
 	if (label_defined && install_label_defintion(DATA)) {
 		return 1;
 	}
-	
-	/* parse at least one number */
-	if (parse_data_number()) {
-		return 1;
-	}
 
-	/* parse the rest of the numbers */
-	while (strchr(input_line, ',')) {
-		if (parse_whitespace() || \
-		    parse_string(",") || \
-		    parse_whitespace() || \
-		    parse_data_number() || \
-		    parse_whitespace()) {
-			return 1;
+	/* parse at least one number, then one after each comma */
+	for (;;) {
+		while (isblank(*p)) {
+			p++;
+		}
+
+		/* a plain number is scanned in place, anything
+		 * else is an expression */
+		item = p;
+		if (scan_number(&p, end, &values[count]) != SCAN_NUMBER_OK || !ends_data_item(p)) {
+			input_line = (char *)item;
+			if (parse_expression(&values[count])) {
+				return 1;
+			}
+			p = input_line;
 		}
+
+		if (++count == PARSE_DATA_CHUNK_LENGTH) {
+			if (append_data_numbers(values, count)) {
+				return 1;
+			}
+			count = 0;
+		}
+
+		while (isblank(*p)) {
+			p++;
+		}
+		if (*p != ',') {
+			break;
+		}
+		p++;
 	}
 
-	return 0;
+	input_line = (char *)p;
+	return append_data_numbers(values, count);
+}
+
+/************************************************
+ * NAME: parse_pooled_string
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * DESCRIPTION: add the string to the string pool
+ ************************************************/
+static int parse_pooled_string(void)
+{
+	char *close = strchr(input_line, '"');
+
+	if (NULL == close) {
+		input_line += strlen(input_line);
+		return parse_string("\"");
+	}
+
+	if (pool_add(input_line,
+		     close - input_line,
+		     label_defined ? lookup_label(label_definition) : NULL)) {
+		parse_error("out of memory");
+		return 1;
+	}
+
+	input_line = close;
+	return parse_string("\"");
 }
 
 /************************************************
@@ -464,10 +680,18 @@ static int parse_string_directive(void)
 		return 1;
 	}
 
+	/* a pooled string is laid out after the first pass */
+	if (strings_pooled) {
+		return parse_pooled_string();
+	}
+
 	/* parse all chaacters until " */
 	while (*input_line && *input_line != '"')
 	{
-		data_section[data_index] = *input_line;
+		if (image_append(&data_section, *input_line)) {
+			parse_error("out of memory");
+			return 1;
+		}
 		data_index++;
 		input_line++;
 	}
@@ -478,13 +702,89 @@ static int parse_string_directive(void)
 	}
 
 	/* close the string */
-	data_section[data_index] = '\0';
+	if (image_append(&data_section, '\0')) {
+		parse_error("out of memory");
+		return 1;
+	}
 	/* for last byte */
 	data_index++;
 
 	return 0;
 }
 
+/************************************************
+ * NAME: parse_data_file
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: format - the data file format
+ * DESCRIPTION: parse a quoted filename and copy 
+ * 		the file words to the data section
+ ************************************************/
+static int parse_data_file(datafile_format_t format)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	const word_image_t *words;
+	const char *error;
+	char *close;
+
+	/* a filename is quoted */
+	if (parse_string("\"")) {
+		return 1;
+	}
+
+	close = strchr(input_line, '"');
+	if (NULL == close) {
+		parse_error("expected \"");
+		return 1;
+	}
+	if (close - input_line >= MAX_FILENAME_LENGTH) {
+		parse_error("filename too long");
+		return 1;
+	}
+	strncpy(filename, input_line, close - input_line);
+	filename[close - input_line] = '\0';
+
+	/* install the label if defined  */
+	if (label_defined && install_label_defintion(DATA)) {
+		return 1;
+	}
+
+	if (datafile_load(filename, input_filename, format, &words, &error)) {
+		parse_error((char *)error);
+		return 1;
+	}
+
+	if (image_append_image(&data_section, words)) {
+		parse_error("out of memory");
+		return 1;
+	}
+	data_index += words->length;
+
+	input_line = close + 1;
+	return 0;
+}
+
+/************************************************
+ * NAME: parse_incbin_directive
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * DESCRIPTION: parse an incbin directive, every 
+ * 		byte of the file is a data word
+ ************************************************/
+static int parse_incbin_directive(void)
+{
+	return parse_data_file(DATAFILE_BINARY);
+}
+
+/************************************************
+ * NAME: parse_datafile_directive
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * DESCRIPTION: parse a datafile directive, the 
+ * 		file holds comma separated numbers
+ ************************************************/
+static int parse_datafile_directive(void)
+{
+	return parse_data_file(DATAFILE_CSV);
+}
+
 /************************************************
  * NAME: parse_entry_directive
  * RETURN VALUE: 0 on success, 1 otherwise
@@ -505,6 +805,42 @@ static int parse_extern_directive(void)
 	return parse_label_declaration() || install_label_declaration(EXTERNAL);
 }
 
+/************************************************
+ * NAME: parse_define_directive
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * DESCRIPTION: parse a define directive, the 
+ * 		expression is folded and the 
+ * 		constant installed
+ ************************************************/
+static int parse_define_directive(void)
+{
+	char name[MAX_LABEL_LENGTH + 1];
+	long value;
+
+	if (label_defined) {
+		parse_error("a constant can't have a label");
+		return 1;
+	}
+
+	if (parse_label(name)) {
+		return 1;
+	}
+	if (define_lookup(name)) {
+		parse_error("constant already defined");
+		return 1;
+	}
+
+	if (parse_whitespace() || parse_string("=") || parse_expression(&value)) {
+		return 1;
+	}
+
+	if (define_install(name, value)) {
+		parse_error("out of memory");
+		return 1;
+	}
+	return 0;
+}
+
 /************************************************
  * NAME: parse_end_of_line
  * RETURN VALUE: 0 on success, 1 otherwise
@@ -533,10 +869,14 @@ static int parse_directive(void)
 		char name[MAX_DIRECTIVE_NAME_LENGTH];
 		int (*function)(void);
 	} directives[] = {
+		/* datafile is before data so data doesn't match it */
+		{"datafile", parse_datafile_directive},
 		{"data", parse_data_directive},
+		{"incbin", parse_incbin_directive},
 		{"string", parse_string_directive},
 		{"entry", parse_entry_directive},
 		{"extern", parse_extern_directive},
+		{"define", parse_define_directive},
 			};
 	int i;
 
@@ -653,6 +993,32 @@ static int is_direct_register_operand(void)
 	return is_register_operand();
 }
 
+/************************************************
+ * NAME: is_constant_operand
+ * RETURN VALUE: is a defined constant
+ * DESCRIPTION: check if parsing the name of a
+ * 		constant rather than of a label
+ * ************************************************/
+static int is_constant_operand(void)
+{
+	char name[MAX_LABEL_LENGTH + 1];
+	int length;
+
+	if (!isalpha(*input_line)) {
+		return 0;
+	}
+
+	for (length = 0; isalnum(input_line[length]); length++) {
+		if (length == MAX_LABEL_LENGTH) {
+			return 0;
+		}
+		name[length] = input_line[length];
+	}
+	name[length] = '\0';
+
+	return define_lookup(name) != NULL;
+}
+
 /************************************************
  * NAME: parse_register
  * RETURN VALUE: 0 on success, 1 otherwise
@@ -682,7 +1048,7 @@ static int parse_register(int *reg)
  * ************************************************/
 static int parse_instruction_operand_immediate(long *immediate)
 {
-	return parse_string("#") || parse_number(immediate);
+	return parse_string("#") || parse_expression(immediate);
 }
 
 /************************************************
@@ -701,11 +1067,11 @@ static int parse_instruction_operand_register_direct(int *reg)
  * RETURN VALUE: 0 on success, 1 otherwise
  * PARAMS: operand - a pointer to the operand to
  * 		     to be parsed
- * 	   available_address_modes - the available 
- * 	                             address modes 
+ * 	   instruction - the parsed instruction
+ * 	   slot - ISA_SOURCE or ISA_DESTINATION
  * DESCRIPTION: parse an operand  
  * ************************************************/
-static int parse_instruction_operand(operand_t *operand, int available_address_modes)
+static int parse_instruction_operand(operand_t *operand, instruction_t *instruction, int slot)
 {
 	/* check for immediate operand */
 	if (is_immediate_operand()) {
@@ -742,10 +1108,11 @@ static int parse_instruction_operand(operand_t *operand, int available_address_m
 					return 1;
 				}
 			/* check for index immediate operand */
-			} else if (isdigit(*input_line) || *input_line == '-' || *input_line == '+') {
+			} else if (isdigit(*input_line) || *input_line == '-' || *input_line == '+' || \
+				   *input_line == '(' || is_constant_operand()) {
 				operand->index_type = IMMEDIATE;
 				code_index++;
-				if (parse_number(&(operand->index.immediate))) {
+				if (parse_expression(&(operand->index.immediate))) {
 					return 1;
 				}
 			/* index direct operand */
@@ -766,7 +1133,7 @@ static int parse_instruction_operand(operand_t *operand, int available_address_m
 	}
 
 	/* check if the address mode is available */
-	if (!(operand->type & available_address_modes)) {
+	if (!isa_mode_allowed(instruction, slot, operand->type)) {
 		parse_error("address mode not allowed for this instruction");
 		return 1;
 	}
@@ -782,19 +1149,22 @@ static int parse_instruction_operand(operand_t *operand, int available_address_m
  * ************************************************/
 static int parse_instruction_name(instruction_t **instruction)
 {
-	int i;
+	char *name = input_line;
 
-	for (i = 0; i < sizeof(instructions)/sizeof(instructions[0]); i++) {
-		if (strncmp(input_line, instructions[i].name, strlen(instructions[i].name)) == 0) {
-			*instruction = &instructions[i];
-			return parse_string((*instruction)->name);
-		}
+	/* a mnemonic is made of alphabetic characters only */
+	while (isalpha(*input_line)) {
+		input_line++;
 	}
 
-	/* instruction not found */
-	parse_error("invalid instruction");
-	return 1;
+	*instruction = isa_lookup(name, input_line - name);
+	if (NULL == *instruction) {
+		/* instruction not found */
+		input_line = name;
+		parse_error("invalid instruction");
+		return 1;
+	}
 
+	return 0;
 }
 
 /************************************************
@@ -804,16 +1174,20 @@ static int parse_instruction_name(instruction_t **instruction)
  *************************************************/
 static int parse_instruction(void)
 {
-	/* get an instruction to hold parseed instruction */
-	full_instruction_t *full_instruction = &full_instructions[full_instruction_index];
-	full_instruction_index++;
-
+	/* only a single instruction is held at a time, on the
+	 * second pass it is encoded as soon as it is parsed */
+	full_instruction_t instruction;
+	full_instruction_t *full_instruction = &instruction;
 
 	/* install label if on first pass */
 	if (label_defined && pass == FIRST_PASS && install_label_defintion(CODE)) {
 		return 1;
 	}
 
+	/* the operands are encoded on the second pass, when
+	 * all constants are known */
+	undefined_allowed = pass == FIRST_PASS;
+
 	/* parse instruction name */
 	if (parse_instruction_name(&(full_instruction->instruction))) {
 		return 1;
@@ -826,20 +1200,34 @@ static int parse_instruction(void)
 
 	code_index++;
 	/* parse instruction operands */
+	full_instruction->src_operand.type = NO_ADDRESS;
+	full_instruction->dest_operand.type = NO_ADDRESS;
 	switch (full_instruction->instruction->num_opernads) {
 		case 2:
-			return parse_whitespace_must() || \
-			       parse_instruction_operand(&(full_instruction->src_operand),
-					       		full_instruction->instruction->src_address_modes) || \
-			       parse_whitespace() || \
-			       parse_string(",") || \
-			       parse_whitespace() || \
-			       parse_instruction_operand(&(full_instruction->dest_operand), 
-							full_instruction->instruction->dest_address_modes);
+			if (parse_whitespace_must() || \
+			    parse_instruction_operand(&(full_instruction->src_operand),
+				    		      full_instruction->instruction, ISA_SOURCE) || \
+			    parse_whitespace() || \
+			    parse_string(",") || \
+			    parse_whitespace() || \
+			    parse_instruction_operand(&(full_instruction->dest_operand), 
+						      full_instruction->instruction, ISA_DESTINATION)) {
+				return 1;
+			}
+			break;
 		case 1: 
-			return parse_whitespace_must() || \
-			       parse_instruction_operand(&(full_instruction->dest_operand), 
-						        full_instruction->instruction->dest_address_modes);
+			if (parse_whitespace_must() || \
+			    parse_instruction_operand(&(full_instruction->dest_operand), 
+						      full_instruction->instruction, ISA_DESTINATION)) {
+				return 1;
+			}
+			break;
+	}
+
+	/* on the second pass all labels are known so the
+	 * instruction can be encoded right away */
+	if (pass == SECOND_PASS) {
+		instruction_emitter(full_instruction);
 	}
 
 	return 0;
@@ -899,6 +1287,7 @@ static int parse_line(char *line)
 	/* init global variables corresponding to a single 
 	 * line parse */
 	label_defined = 0;
+	undefined_allowed = 0;
 	input_line = input_line_start = line;
 
 	/* parse a line only if it's not a
@@ -909,26 +1298,260 @@ static int parse_line(char *line)
 	return 0;
 }
 
+/************************************************
+ * NAME: reserve_line
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: length - bytes needed in the line buffer
+ * DESCRIPTION: grow the line buffer
+ * ************************************************/
+static int reserve_line(unsigned long length)
+{
+	unsigned long capacity = line_capacity ? line_capacity : MAX_LINE_LENGTH;
+	char *grown;
+
+	if (length <= line_capacity) {
+		return 0;
+	}
+
+	while (capacity < length) {
+		capacity *= 2;
+	}
+
+	grown = realloc(line_buffer, capacity);
+	if (NULL == grown) {
+		return 1;
+	}
+
+	line_buffer = grown;
+	line_capacity = capacity;
+	return 0;
+}
+
+/************************************************
+ * NAME: read_line
+ * RETURN VALUE: the next input line, NULL at the
+ * 		 end of the input
+ * DESCRIPTION: copy the next input line to the 
+ * 		line buffer, which grows to fit long
+ * 		lines. if it can't grow a long line 
+ * 		is split like fgets does
+ * ************************************************/
+static char *read_line(void)
+{
+	unsigned long length = input_length - input_offset;
+	unsigned long used = 0;
+	char *newline;
+
+	if (reserve_line(MAX_LINE_LENGTH)) {
+		return NULL;
+	}
+
+	if (input_file) {
+		while (fgets(line_buffer + used, line_capacity - used, input_file)) {
+			used += strlen(line_buffer + used);
+			if (line_buffer[used - 1] == '\n' || reserve_line(used + MAX_LINE_LENGTH)) {
+				break;
+			}
+		}
+		return used ? line_buffer : NULL;
+	}
+
+	if (input_offset >= input_length) {
+		return NULL;
+	}
+
+	newline = memchr(input_text + input_offset, '\n', length);
+	if (newline) {
+		length = newline - (input_text + input_offset) + 1;
+	}
+
+	if (reserve_line(length + 1)) {
+		length = line_capacity - 1;
+	}
+
+	memcpy(line_buffer, input_text + input_offset, length);
+	line_buffer[length] = '\0';
+	input_offset += length;
+
+	return line_buffer;
+}
+
+/************************************************
+ * NAME: release_input
+ * DESCRIPTION: release the input file contents
+ * ************************************************/
+static void release_input(void)
+{
+	/* arena memory is released by resetting the arena and
+	 * a source in memory belongs to the caller */
+	if (NULL == input_arena && NULL == source_text) {
+		free(input_text);
+	}
+	input_text = NULL;
+	if (input_file) {
+		fclose(input_file);
+		input_file = NULL;
+	}
+}
+
+/**************************************************
+ * NAME: open_input
+ * PARAMS: filename - the assembly file
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: read the whole file or open it for
+ * 		streaming, sets errno on error
+ * ************************************************/
+static int open_input(const char *filename)
+{
+	if (source_text) {
+		input_text = (char *)source_text;
+		input_length = source_length;
+		input_offset = 0;
+		return 0;
+	}
+
+	if (input_streamed) {
+		input_file = fopen(filename, "r");
+		return NULL == input_file;
+	}
+
+	input_text = io_read(filename, &input_length, input_arena);
+	input_offset = 0;
+	return NULL == input_text;
+}
+
+/**************************************************
+ * NAME: rewind_input
+ * DESCRIPTION: restart reading from the beginning
+ * 		of the file
+ * ************************************************/
+static void rewind_input(void)
+{
+	if (input_file) {
+		rewind(input_file);
+	}
+	input_offset = 0;
+}
+
+/**************************************************
+ * NAME: parse_set_arena
+ * PARAMS: arena - the arena the next source is 
+ * 		   read to, NULL for malloc
+ * ************************************************/
+void parse_set_arena(arena_t *arena)
+{
+	input_arena = arena;
+}
+
+/**************************************************
+ * NAME: parse_set_source
+ * PARAMS: text - the source to parse instead of 
+ * 		  reading the file, NULL to read it
+ * 	   length - the source length
+ * DESCRIPTION: parse a source held in memory, the
+ * 		filename is then used for errors only
+ * ************************************************/
+void parse_set_source(const char *text, unsigned long length)
+{
+	source_text = text;
+	source_length = length;
+}
+
+/**************************************************
+ * NAME: parse_set_error_handler
+ * PARAMS: handler - invoked with the line, column
+ * 		     and message of every error, 
+ * 		     NULL to print them
+ * ************************************************/
+void parse_set_error_handler(void (*handler)(unsigned int linenumber, 
+					     unsigned int column, 
+					     const char *gripe))
+{
+	error_handler = handler;
+}
+
+/**************************************************
+ * NAME: parse_line_number
+ * RETURN VALUE: the number of the line being 
+ * 		 parsed, used by emitters
+ * ************************************************/
+unsigned int parse_line_number(void)
+{
+	return input_linenumber;
+}
+
+/**************************************************
+ * NAME: parse_set_string_pool
+ * PARAMS: enabled - pool the strings
+ * DESCRIPTION: place every .string once after the
+ * 		rest of the data, sharing equal 
+ * 		strings and suffixes of longer ones
+ * ************************************************/
+void parse_set_string_pool(int enabled)
+{
+	strings_pooled = enabled;
+}
+
+/**************************************************
+ * NAME: parse_set_memory_limit
+ * PARAMS: bytes - memory for the source and the
+ * 		   data section, 0 for no limit
+ * DESCRIPTION: bound the parser memory, the 
+ * 		source is streamed a line at a time
+ * 		and the data section is spilled to a
+ * 		temporary file
+ * ************************************************/
+void parse_set_memory_limit(unsigned long bytes)
+{
+	input_streamed = bytes != 0;
+	/* words are packed two in IMAGE_PAIR_BYTES bytes */
+	image_set_spill_limit(&data_section, bytes / IMAGE_PAIR_BYTES * 2);
+}
+
 /* exported functions */
 
 /************************************************
- * NAME: parse_file
+ * NAME: layout_string_pool
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * DESCRIPTION: append the string pool to the data
+ * 		section and report the saved words
+ * ************************************************/
+static int layout_string_pool(void)
+{
+	unsigned long saved;
+
+	trace_begin("string_pool", input_filename);
+	if (pool_layout(&data_section, &data_index, &saved)) {
+		trace_end();
+		fprintf(stderr, "%s: out of memory\n", input_filename);
+		return 1;
+	}
+	trace_end();
+
+	if (saved) {
+		printf("%s: string pool saved %lu words\n", input_filename, saved);
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: parse_first_pass
  * RETURN VALUE: 0 on success, 1 otherwise
  * PARAMS: filename - the filename to parse  
- * DESCRIPTION: run the first and second pass on 
- * 		a given file
+ * DESCRIPTION: run the first pass on a given 
+ * 		file, installing all labels and
+ * 		filling the data section. the file
+ * 		contents are kept for the second pass
  * ************************************************/
-int parse_file(char *filename)
+int parse_first_pass(char *filename)
 {
-	FILE *fp;
-	char line[MAX_LINE_LENGTH];
+	char *line;
 	int failed = 0;
 
 	init_labels();
+	define_reset();
 
-	fp = fopen(filename, "rt");
-
-	if (NULL == fp) {
+	if (open_input(filename)) {
 		perror("couldn't open assembly file"); 
 		return 1;
 	}
@@ -938,50 +1561,113 @@ int parse_file(char *filename)
 
 	/* initialized global variables for first pass */
 	pass = FIRST_PASS;
-	full_instruction_index = 0;
 	code_index = 0;
 	data_index = 0;
+	image_reset(&data_section);
+	pool_reset();
 
 	/* first pass (expecting failure) */
+	trace_begin("pass 1", filename);
 	for (input_linenumber = 1;
-	     fgets(line, MAX_LINE_LENGTH, fp);
+	     (line = read_line());
 	     input_linenumber++) {
 		failed |= parse_line(line);
 	}
+	trace_end();
+
+	if (!failed && strings_pooled) {
+		failed = layout_string_pool();
+	}
 
 	/* first pass failed so close the file
 	 * and return (no need to do a second pass) */
 	if (failed)
 	{
-		fclose(fp);
+		release_input();
 		return 1;
 	}
 
-	/* rewind to the beginning of the file
-	 * note that rewind (from stdlib) is not used on purpose */
-	if (fseek(fp, 0, SEEK_SET)) {
-		perror("input file rewind failed");
-		fclose(fp);
-	}
+	return 0;
+}
+
+/************************************************
+ * NAME: parse_release
+ * DESCRIPTION: release the file read by a first
+ * 		pass that isn't followed by a 
+ * 		second pass
+ * ************************************************/
+void parse_release(void)
+{
+	release_input();
+}
+
+/************************************************
+ * NAME: parse_second_pass
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: emit - invoked with every instruction
+ * 		  as soon as it is parsed
+ * DESCRIPTION: run the second pass on the file
+ * 		read by parse_first_pass and 
+ * 		release it
+ * ************************************************/
+int parse_second_pass(void (*emit)(full_instruction_t *))
+{
+	char *line;
+	int failed = 0;
+
+	/* rewind to the beginning of the file */
+	rewind_input();
 
 	/* initialized global variables for second pass 
 	 * data index is not initialized on purpose */
 	pass = SECOND_PASS;
-	full_instruction_index = 0;
 	code_index = 0;
+	instruction_emitter = emit;
 
 	/* second pass */
+	trace_begin("pass 2", input_filename);
 	for (input_linenumber = 1;
-	     fgets(line, MAX_LINE_LENGTH, fp);
+	     (line = read_line());
 	     input_linenumber++) {
 		if (parse_line(line))
 		{
 			failed = 1;
 		}
 	}
+	trace_end();
 
-	fclose(fp);
+	release_input();
 	
 	return failed;
 }
 
+/************************************************
+ * NAME: parse_source_line
+ * RETURN VALUE: 0 on success, 1 otherwise
+ * PARAMS: filename - the source filename, data
+ * 		      files are found next to it
+ * 	   line - a terminated line of the source
+ * 	   linenumber - the number of the line
+ * 	   emit - the second pass output, NULL to
+ * 	   	  parse the line as the first pass
+ * DESCRIPTION: parse a single line against the
+ * 		labels and constants the tables
+ * 		already hold. code_index and
+ * 		data_index count the words of the
+ * 		line only
+ ************************************************/
+int parse_source_line(char *filename,
+		      char *line,
+		      unsigned int linenumber,
+		      void (*emit)(full_instruction_t *))
+{
+	input_filename = filename;
+	input_linenumber = linenumber;
+	pass = emit ? SECOND_PASS : FIRST_PASS;
+	instruction_emitter = emit;
+	code_index = 0;
+	data_index = 0;
+	image_reset(&data_section);
+
+	return parse_line(line);
+}
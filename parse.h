@@ -1,6 +1,23 @@
 #ifndef PARSE_H
 #define PARSE_H
 
-int parse_file(char *filename);
+#include "types.h"
+#include "arena.h"
+
+int parse_first_pass(char *filename);
+int parse_second_pass(void (*emit)(full_instruction_t *));
+void parse_release(void);
+void parse_set_memory_limit(unsigned long bytes);
+void parse_set_string_pool(int enabled);
+void parse_set_arena(arena_t *arena);
+void parse_set_source(const char *text, unsigned long length);
+void parse_set_error_handler(void (*handler)(unsigned int linenumber, 
+					     unsigned int column, 
+					     const char *gripe));
+unsigned int parse_line_number(void);
+int parse_source_line(char *filename,
+		      char *line,
+		      unsigned int linenumber,
+		      void (*emit)(full_instruction_t *));
 
 #endif /* end of include guard: PARSE_H */
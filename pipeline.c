@@ -0,0 +1,484 @@
+#define _DEFAULT_SOURCE /* for _SC_NPROCESSORS_ONLN */
+
+#include <stdio.h> /* for fprintf */
+#include <stdlib.h> /* for malloc and free */
+#include <string.h> /* for strcmp, strncpy and strerror */
+#include <errno.h> /* for errno */
+#include <fcntl.h> /* for open */
+#include <unistd.h> /* for write, close, unlink and sysconf */
+#include <pthread.h> /* for the stage threads */
+
+#include "pipeline.h"
+#include "consts.h"
+#include "types.h"
+#include "parse.h"
+#include "output.h"
+#include "trace.h"
+
+/* =============================================
+ * =============================================
+ * Note: with --pipeline the second pass, the
+ * encoding and the writing of a source run on
+ * three threads. the second pass pushes every
+ * parsed instruction to a ring, the encoder 
+ * thread encodes it to the output files and 
+ * streams them a chunk at a time to a second
+ * ring, and the writer thread writes the chunks
+ * to disk. a full ring blocks its producer, so
+ * the memory in flight is bounded.
+ *
+ * the rings have a single producer and a single
+ * consumer, so the positions are updated 
+ * without a lock. the lock is taken only to 
+ * sleep on an empty or full ring, and a 
+ * sleeping side is woken once half of the ring
+ * can be taken, not for every element.
+ *
+ * the output files are written while the 
+ * source is still assembled, they are removed
+ * again if it fails.
+ * ==============================================
+ * ============================================*/
+
+#define PIPELINE_INSTRUCTIONS (1024)
+#define PIPELINE_CHUNKS (16)
+#define RING_SPINS (256)
+#define PIPELINE_OUTPUTS (3)
+
+/* a bounded single producer single consumer queue */
+typedef struct {
+	unsigned char *slots;
+	unsigned long element_size;
+	unsigned long capacity; /* a power of two */
+	unsigned long head; /* the next slot to pop, moved by the consumer */
+	unsigned long tail; /* the next slot to push, moved by the producer */
+	int closed; /* nothing more will be pushed */
+	int waiters;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} ring_t;
+
+/* a chunk of an output file, owned by the writer once pushed */
+typedef struct {
+	const char *extention;
+	char *data;
+	unsigned long length;
+} output_chunk_t;
+
+/* internal global variables */
+static ring_t instructions;
+static ring_t chunks;
+static int second_pass_failed;
+static int encode_failed;
+static int write_failed;
+static const char *pipeline_filename; /* without the .as extention */
+static struct {
+	const char *extention;
+	int fd;
+	int created;
+} outputs[PIPELINE_OUTPUTS] = {
+	{".ob", -1, 0},
+	{".ent", -1, 0},
+	{".ext", -1, 0}
+};
+
+/************************************************
+ * NAME: ring_init
+ * PARAMS: ring - the ring to init
+ * 	   element_size - the size of an element
+ * 	   capacity - number of elements, a power
+ * 	              of two
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int ring_init(ring_t *ring, unsigned long element_size, unsigned long capacity)
+{
+	ring->slots = malloc(element_size * capacity);
+	ring->element_size = element_size;
+	ring->capacity = capacity;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->closed = 0;
+	ring->waiters = 0;
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->changed, NULL);
+	return NULL == ring->slots;
+}
+
+/************************************************
+ * NAME: ring_free
+ * PARAMS: ring - the ring to free
+ ***********************************************/
+static void ring_free(ring_t *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->changed);
+}
+
+/************************************************
+ * NAME: ring_wait
+ * PARAMS: ring - the ring
+ * 	   position - the position moved by the
+ * 	   	      other side
+ * 	   stuck - the position value to wait on
+ * DESCRIPTION: wait until the other side moves
+ * 		the position or closes the ring,
+ * 		spinning briefly before sleeping
+ ***********************************************/
+static void ring_wait(ring_t *ring, unsigned long *position, unsigned long stuck)
+{
+	int i;
+
+	for (i = 0; i < RING_SPINS; i++) {
+		if (__atomic_load_n(position, __ATOMIC_ACQUIRE) != stuck || \
+		    __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+	}
+
+	/* the waiters count is seen by the other side either 
+	 * before it moves the position or after this thread
+	 * checks it again, so no wakeup is lost */
+	pthread_mutex_lock(&ring->lock);
+	__atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(position, __ATOMIC_SEQ_CST) == stuck && \
+	       !__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+		pthread_cond_wait(&ring->changed, &ring->lock);
+	}
+	__atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/************************************************
+ * NAME: ring_notify
+ * PARAMS: ring - the ring
+ * 	   ready - there is enough for the other
+ * 	           side to take
+ * DESCRIPTION: wake the other side if it sleeps,
+ * 		called after a position is moved
+ ***********************************************/
+static void ring_notify(ring_t *ring, int ready)
+{
+	if (ready && __atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_broadcast(&ring->changed);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+/************************************************
+ * NAME: ring_push
+ * PARAMS: ring - the ring
+ * 	   element - the element to copy in
+ * DESCRIPTION: push an element, waiting while 
+ * 		the ring is full
+ ***********************************************/
+static void ring_push(ring_t *ring, const void *element)
+{
+	unsigned long tail = ring->tail;
+
+	while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->capacity) {
+		ring_wait(ring, &ring->head, tail - ring->capacity);
+	}
+
+	memcpy(ring->slots + (tail & (ring->capacity - 1)) * ring->element_size,
+	       element,
+	       ring->element_size);
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	ring_notify(ring, tail + 1 - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= ring->capacity / 2);
+}
+
+/************************************************
+ * NAME: ring_pop
+ * PARAMS: ring - the ring
+ * 	   element - the element to copy out
+ * RETURN VALUE: 1 once the ring is closed and 
+ * 		 empty, 0 otherwise
+ * DESCRIPTION: pop an element, waiting while the
+ * 		ring is empty
+ ***********************************************/
+static int ring_pop(ring_t *ring, void *element)
+{
+	unsigned long head = ring->head;
+
+	while (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+		if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+			/* the last elements may be pushed right before closing */
+			if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+				return 1;
+			}
+			break;
+		}
+		ring_wait(ring, &ring->tail, head);
+	}
+
+	memcpy(element,
+	       ring->slots + (head & (ring->capacity - 1)) * ring->element_size,
+	       ring->element_size);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+	ring_notify(ring, __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - (head + 1) <= ring->capacity / 2);
+	return 0;
+}
+
+/************************************************
+ * NAME: ring_close
+ * PARAMS: ring - the ring
+ * DESCRIPTION: mark the end of the elements,
+ * 		called by the producer
+ ***********************************************/
+static void ring_close(ring_t *ring)
+{
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+	ring_notify(ring, 1);
+}
+
+/************************************************
+ * NAME: push_instruction
+ * PARAMS: full_instruction - a parsed instruction
+ * DESCRIPTION: hand an instruction to the 
+ * 		encoder, used as the second pass
+ * 		emitter
+ ***********************************************/
+static void push_instruction(full_instruction_t *full_instruction)
+{
+	ring_push(&instructions, full_instruction);
+}
+
+/************************************************
+ * NAME: push_chunk
+ * PARAMS: extention - the output file extention
+ * 	   data - the chunk, malloced
+ * 	   length - the chunk length
+ * DESCRIPTION: hand a chunk to the writer, used
+ * 		as the output streamer
+ ***********************************************/
+static void push_chunk(const char *extention, char *data, unsigned long length)
+{
+	output_chunk_t chunk;
+
+	chunk.extention = extention;
+	chunk.data = data;
+	chunk.length = length;
+	ring_push(&chunks, &chunk);
+}
+
+/************************************************
+ * NAME: finish_encoding
+ * DESCRIPTION: output the data and the entries
+ * 		and close the chunks ring
+ ***********************************************/
+static void finish_encoding(void)
+{
+	encode_failed = output_close(second_pass_failed);
+	ring_close(&chunks);
+}
+
+/************************************************
+ * NAME: encoder
+ * DESCRIPTION: the encoder stage, encodes the 
+ * 		instructions until the second pass
+ * 		is done
+ ***********************************************/
+static void *encoder(void *unused)
+{
+	full_instruction_t full_instruction;
+
+	trace_thread_name("encoder");
+	trace_begin("encode", pipeline_filename);
+	while (0 == ring_pop(&instructions, &full_instruction)) {
+		output_full_instruction(&full_instruction);
+	}
+	trace_end();
+
+	/* the second pass result is set before the ring is closed */
+	finish_encoding();
+	return NULL;
+}
+
+/************************************************
+ * NAME: write_chunk
+ * PARAMS: chunk - the chunk to write
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write a chunk to its output file,
+ * 		the file is created by its first
+ * 		chunk
+ ***********************************************/
+static int write_chunk(const output_chunk_t *chunk)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	unsigned long done = 0;
+	long n;
+	int i;
+
+	for (i = 0; strcmp(outputs[i].extention, chunk->extention); i++)
+		;
+
+	strncpy(filename, pipeline_filename, MAX_FILENAME_LENGTH);
+	strncat(filename, outputs[i].extention, MAX_FILENAME_LENGTH - strlen(pipeline_filename));
+
+	if (outputs[i].fd < 0) {
+		outputs[i].fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (outputs[i].fd < 0) {
+			fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+			return 1;
+		}
+		outputs[i].created = 1;
+	}
+
+	while (done < chunk->length) {
+		n = write(outputs[i].fd, chunk->data + done, chunk->length - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+			return 1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: writer
+ * DESCRIPTION: the writer stage, writes the 
+ * 		chunks until the encoder is done.
+ * 		after an error the chunks are only
+ * 		released, so the encoder never 
+ * 		blocks on a full ring
+ ***********************************************/
+static void *writer(void *unused)
+{
+	output_chunk_t chunk;
+
+	trace_thread_name("writer");
+	while (0 == ring_pop(&chunks, &chunk)) {
+		if (!write_failed) {
+			trace_begin("write", chunk.extention);
+			write_failed = write_chunk(&chunk);
+			trace_end();
+		}
+		free(chunk.data);
+	}
+	return NULL;
+}
+
+/************************************************
+ * NAME: close_outputs
+ * PARAMS: failed - remove the created files
+ ***********************************************/
+static void close_outputs(int failed)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	int i;
+
+	for (i = 0; i < PIPELINE_OUTPUTS; i++) {
+		if (outputs[i].fd >= 0 && close(outputs[i].fd)) {
+			write_failed = failed = 1;
+		}
+		if (outputs[i].created && failed) {
+			strncpy(filename, pipeline_filename, MAX_FILENAME_LENGTH);
+			strncat(filename, outputs[i].extention, MAX_FILENAME_LENGTH - strlen(pipeline_filename));
+			unlink(filename);
+		}
+		outputs[i].fd = -1;
+		outputs[i].created = 0;
+	}
+}
+
+/************************************************
+ * NAME: start_writer
+ * PARAMS: thread - the writer thread
+ * RETURN VALUE: 1 if the stages can't run at
+ * 		 once, 0 on success
+ * DESCRIPTION: set up the rings and start the 
+ * 		writer stage
+ ***********************************************/
+static int start_writer(pthread_t *thread)
+{
+	/* on a single processor the threads only add switches */
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		return 1;
+	}
+
+	if (ring_init(&instructions, sizeof(full_instruction_t), PIPELINE_INSTRUCTIONS)) {
+		ring_free(&instructions);
+		return 1;
+	}
+
+	if (ring_init(&chunks, sizeof(output_chunk_t), PIPELINE_CHUNKS) || \
+	    pthread_create(thread, NULL, writer, NULL)) {
+		ring_free(&instructions);
+		ring_free(&chunks);
+		return 1;
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: pipeline_assemble
+ * PARAMS: actual_source_filename - the source 
+ * 				    filename
+ * 	   source_filename - the source filename
+ * 	   		     without the .as 
+ * 	   		     extention
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: run the first pass, then the 
+ * 		second pass, the encoding and the
+ * 		writing at once. without threads 
+ * 		or a second processor the stages 
+ * 		run one after another
+ ***********************************************/
+int pipeline_assemble(char *actual_source_filename, const char *source_filename)
+{
+	pthread_t writer_thread;
+	pthread_t encoder_thread;
+	int encoding = 0;
+
+	if (parse_first_pass(actual_source_filename)) {
+		return 1;
+	}
+
+	pipeline_filename = source_filename;
+	second_pass_failed = encode_failed = write_failed = 0;
+
+	if (start_writer(&writer_thread)) {
+		if (output_open(source_filename)) {
+			parse_release();
+			return 1;
+		}
+		return output_close(parse_second_pass(output_full_instruction));
+	}
+
+	output_set_streamer(push_chunk);
+	if (output_open(source_filename)) {
+		/* the writer returns once the ring is closed */
+		parse_release();
+		ring_close(&chunks);
+		pthread_join(writer_thread, NULL);
+		output_set_streamer(NULL);
+		close_outputs(1);
+		ring_free(&instructions);
+		ring_free(&chunks);
+		return 1;
+	}
+	encoding = 0 == pthread_create(&encoder_thread, NULL, encoder, NULL);
+
+	second_pass_failed = parse_second_pass(encoding ? push_instruction : output_full_instruction);
+	if (encoding) {
+		ring_close(&instructions);
+		pthread_join(encoder_thread, NULL);
+	} else {
+		finish_encoding();
+	}
+	pthread_join(writer_thread, NULL);
+	output_set_streamer(NULL);
+
+	close_outputs(second_pass_failed || encode_failed || write_failed);
+	ring_free(&instructions);
+	ring_free(&chunks);
+
+	return second_pass_failed || encode_failed || write_failed;
+}
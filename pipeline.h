@@ -0,0 +1,6 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+int pipeline_assemble(char *actual_source_filename, const char *source_filename);
+
+#endif /* end of include guard: PIPELINE_H */
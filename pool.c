@@ -0,0 +1,186 @@
+#include <stdlib.h> /* for realloc, free and qsort */
+
+#include "pool.h"
+#include "buffer.h"
+
+/* =============================================
+ * =============================================
+ * Note: pooled strings are placed after the rest
+ * of the data section. they are sorted by their
+ * reversed text, so a string that is a suffix 
+ * of another (identical strings included) comes
+ * right before it and shares its tail. every
+ * string ends with the same zero word so 
+ * sharing a suffix shares the terminator too.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_POOL_CAPACITY (64)
+
+typedef struct {
+	unsigned long start; /* offset of the text in pool_text */
+	unsigned long length; /* without the terminator */
+	label_t *label; /* NULL for a string without a label */
+	unsigned long address; /* offset from the start of the pool */
+} pooled_string_t;
+
+/* internal global variables */
+static buffer_t pool_text;
+static pooled_string_t *pooled_strings = NULL;
+static unsigned long pooled_count = 0;
+static unsigned long pooled_capacity = 0;
+
+/************************************************
+ * NAME: pool_reset
+ * DESCRIPTION: empty the pool but keep the 
+ * 		allocated memory for reuse
+ ***********************************************/
+void pool_reset(void)
+{
+	pool_text.length = 0;
+	pooled_count = 0;
+}
+
+/************************************************
+ * NAME: pool_add
+ * PARAMS: text - the string, not terminated
+ * 	   length - the string length
+ * 	   label - the label of the string, NULL
+ * 	           if there is none
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: add a string to the pool, its 
+ * 		address is set by pool_layout
+ ***********************************************/
+int pool_add(const char *text, unsigned long length, label_t *label)
+{
+	unsigned long capacity = pooled_capacity ? pooled_capacity * 2 : MIN_POOL_CAPACITY;
+	pooled_string_t *grown;
+	pooled_string_t *string;
+
+	if (pooled_count == pooled_capacity) {
+		grown = realloc(pooled_strings, capacity * sizeof(*pooled_strings));
+		if (NULL == grown) {
+			return 1;
+		}
+		pooled_strings = grown;
+		pooled_capacity = capacity;
+	}
+
+	string = &pooled_strings[pooled_count];
+	string->start = pool_text.length;
+	string->length = length;
+	string->label = label;
+	if (buffer_append(&pool_text, text, length)) {
+		return 1;
+	}
+
+	pooled_count++;
+	return 0;
+}
+
+/************************************************
+ * NAME: compare_reversed
+ * PARAMS: a, b - the pooled strings to compare
+ * RETURN VALUE: <0, 0 or >0 like strcmp
+ * DESCRIPTION: compare strings from their last
+ * 		character backwards
+ ***********************************************/
+static int compare_reversed(const void *a, const void *b)
+{
+	const pooled_string_t *x = a;
+	const pooled_string_t *y = b;
+	const unsigned char *p = (unsigned char *)pool_text.data + x->start + x->length;
+	const unsigned char *q = (unsigned char *)pool_text.data + y->start + y->length;
+	unsigned long n = x->length < y->length ? x->length : y->length;
+
+	for (; n; n--) {
+		if (*--p != *--q) {
+			return *p - *q;
+		}
+	}
+
+	if (x->length != y->length) {
+		return x->length < y->length ? -1 : 1;
+	}
+	/* keep equal strings in a stable order */
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/************************************************
+ * NAME: is_suffix
+ * PARAMS: suffix - the maybe suffix
+ * 	   string - the longer string
+ * RETURN VALUE: 1 if suffix ends string
+ ***********************************************/
+static int is_suffix(const pooled_string_t *suffix, const pooled_string_t *string)
+{
+	const char *p = pool_text.data + suffix->start + suffix->length;
+	const char *q = pool_text.data + string->start + string->length;
+	unsigned long n = suffix->length;
+
+	if (suffix->length > string->length) {
+		return 0;
+	}
+
+	for (; n; n--) {
+		if (*--p != *--q) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/************************************************
+ * NAME: pool_layout
+ * PARAMS: data - the data section to append the
+ * 		  pool to
+ * 	   data_index - the data section length,
+ * 	                advanced by the pool length
+ * 	   saved - number of words saved by 
+ * 	           sharing
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: lay out the pooled strings at the
+ * 		end of the data section and point
+ * 		their labels at them
+ ***********************************************/
+int pool_layout(word_image_t *data, unsigned int *data_index, unsigned long *saved)
+{
+	pooled_string_t *owner = NULL; /* the last string laid out */
+	pooled_string_t *string;
+	unsigned long length = 0;
+	unsigned long total = 0;
+	unsigned long i;
+	unsigned long j;
+
+	qsort(pooled_strings, pooled_count, sizeof(*pooled_strings), compare_reversed);
+
+	/* a suffix sorts before the strings that end with it */
+	for (i = pooled_count; i > 0; i--) {
+		string = &pooled_strings[i - 1];
+		total += string->length + 1;
+
+		if (owner && is_suffix(string, owner)) {
+			string->address = owner->address + owner->length - string->length;
+		} else {
+			string->address = length;
+			for (j = 0; j < string->length; j++) {
+				if (image_append(data, pool_text.data[string->start + j])) {
+					return 1;
+				}
+			}
+			if (image_append(data, '\0')) {
+				return 1;
+			}
+			length += string->length + 1;
+			owner = string;
+		}
+
+		if (string->label) {
+			string->label->address = *data_index + string->address;
+		}
+	}
+
+	*data_index += length;
+	*saved = total - length;
+	return 0;
+}
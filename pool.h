@@ -0,0 +1,11 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "types.h"
+#include "image.h"
+
+void pool_reset(void);
+int pool_add(const char *text, unsigned long length, label_t *label);
+int pool_layout(word_image_t *data, unsigned int *data_index, unsigned long *saved);
+
+#endif /* end of include guard: POOL_H */
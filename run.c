@@ -0,0 +1,460 @@
+#include <stdio.h> /* for fprintf, tmpfile and fread */
+#include <stdlib.h> /* for atol, rand and exit */
+#include <string.h> /* for strcmp and memcmp */
+#include <limits.h> /* for LONG_MAX */
+
+#include "consts.h"
+#include "types.h"
+#include "isa.h"
+#include "objfile.h"
+#include "machine.h"
+#include "jit.h"
+
+/* =============================================
+ * =============================================
+ * run - run an object file created by the 
+ * assembler on the machine of machine.c:
+ *
+ *   run [-i | -c] [-n steps] file
+ *   run -f count [seed]
+ *
+ * file is given without the .ob extention, red
+ * reads stdin and prn writes stdout. the 
+ * program runs translated by jit.c, -i runs it 
+ * on the interpreter and -c runs it on both and 
+ * compares them. -f compares them on count 
+ * random programs, which sometimes write over
+ * their own code.
+ *
+ * Note: external words are loaded as 0.
+ * ==============================================
+ * ============================================*/
+
+#define FUZZ_STEPS (20000)
+#define MAX_FUZZ_WORDS (256) /* of code, then of data */
+
+typedef enum {
+	ENGINE_JIT,
+	ENGINE_INTERPRETER,
+	ENGINE_COMPARE
+} engine_t;
+
+static const char *status_names[] = {
+	"running",
+	"stopped",
+	"invalid instruction",
+	"stack overflow",
+	"stack underflow",
+	"out of steps"
+};
+
+/************************************************
+ * NAME: run_engine
+ * PARAMS: machine - a loaded machine
+ * 	   jit - run it translated
+ * RETURN VALUE: why the machine stopped
+ ***********************************************/
+static machine_status_t run_engine(machine_t *machine, int jit)
+{
+	return jit ? jit_run(machine) : machine_run(machine);
+}
+
+/************************************************
+ * NAME: same_file
+ * PARAMS: first, second - files written from 
+ * 			   the start
+ * RETURN VALUE: 1 if their contents are equal
+ ***********************************************/
+static int same_file(FILE *first, FILE *second)
+{
+	char first_buffer[4096];
+	char second_buffer[4096];
+	size_t first_length;
+	size_t second_length;
+
+	rewind(first);
+	rewind(second);
+	do {
+		first_length = fread(first_buffer, 1, sizeof(first_buffer), first);
+		second_length = fread(second_buffer, 1, sizeof(second_buffer), second);
+		if (first_length != second_length || memcmp(first_buffer, second_buffer, first_length)) {
+			return 0;
+		}
+	} while (first_length);
+	return 1;
+}
+
+/************************************************
+ * NAME: same_machine
+ * PARAMS: first, second - machines that ran
+ * RETURN VALUE: NULL if their states are equal,
+ * 		 the first field that differs
+ ***********************************************/
+static const char *same_machine(const machine_t *first, const machine_t *second)
+{
+	if (memcmp(first->registers, second->registers, sizeof(first->registers))) {
+		return "registers";
+	}
+	if (first->pc != second->pc) {
+		return "pc";
+	}
+	if (first->result != second->result) {
+		return "result";
+	}
+	if (first->budget != second->budget) {
+		return "steps";
+	}
+	if (first->sp != second->sp || memcmp(first->stack, second->stack, first->sp * sizeof(*first->stack))) {
+		return "stack";
+	}
+	if (memcmp(first->memory, second->memory, MACHINE_WORDS * sizeof(*first->memory))) {
+		return "memory";
+	}
+	return NULL;
+}
+
+/************************************************
+ * NAME: compare
+ * PARAMS: interpreted - a loaded machine
+ * 	   translated - the same machine
+ * 	   name - the program, for messages
+ * RETURN VALUE: 1 if they differ, 0 if they ran
+ * 		 the same
+ * DESCRIPTION: run the machines on the two 
+ * 		engines, both read their input 
+ * 		from its start and write their 
+ * 		output files
+ ***********************************************/
+static int compare(machine_t *interpreted, machine_t *translated, const char *name)
+{
+	machine_status_t expected;
+	machine_status_t status;
+	const char *field;
+
+	if (interpreted->input) {
+		rewind(interpreted->input);
+	}
+	expected = run_engine(interpreted, 0);
+	if (translated->input) {
+		rewind(translated->input);
+	}
+	status = run_engine(translated, 1);
+	field = same_machine(interpreted, translated);
+
+	if (expected != status) {
+		fprintf(stderr, "%s: interpreter %s, jit %s\n", name, status_names[expected], status_names[status]);
+		return 1;
+	}
+	if (field) {
+		fprintf(stderr, "%s: %s differ after %s\n", name, field, status_names[status]);
+		return 1;
+	}
+	if (!same_file(interpreted->output, translated->output)) {
+		fprintf(stderr, "%s: output differs\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: random_word
+ * RETURN VALUE: a random 20 bit word
+ ***********************************************/
+static unsigned int random_word(void)
+{
+	return ((unsigned int)rand() << 10 ^ (unsigned int)rand()) & WORD_MASK;
+}
+
+/************************************************
+ * NAME: random_operand
+ * PARAMS: machine - the machine
+ * 	   jump - the operand is a jump target
+ * 	   mode - the operand address mode
+ * 	   reg - the operand register field
+ * 	   pc - the next operand word, moved past
+ * 	        the operand words
+ * 	   targets - marked at the words that are
+ * 	   	     fixed to an instruction
+ ***********************************************/
+static void random_operand(machine_t *machine,
+			   int jump,
+			   address_mode_t mode,
+			   int reg,
+			   unsigned int *pc,
+			   unsigned char *targets)
+{
+	unsigned int *memory = machine->memory;
+
+	switch (mode) {
+		case IMMEDIATE_ADDRESS:
+			memory[(*pc)++] = rand() % 4 ? rand() % 16 : random_word();
+			break;
+		case DIRECT_ADDRESS:
+		case INDEX_ADDRESS: /* FALLTHROUGH */
+			if (jump) {
+				targets[*pc - START_OFFSET] = 1;
+			}
+			/* mostly data, sometimes code */
+			memory[(*pc)++] = START_OFFSET + (rand() % 8 ? MAX_FUZZ_WORDS : 0) + rand() % MAX_FUZZ_WORDS;
+			if (mode == INDEX_ADDRESS && 0 == reg) {
+				memory[(*pc)++] = rand() % 16;
+			}
+			break;
+		case DIRECT_REGISTER_ADDRESS:
+		case NO_ADDRESS: /* FALLTHROUGH */
+			break;
+	}
+}
+
+/************************************************
+ * NAME: random_program
+ * PARAMS: machine - an initialized machine
+ * DESCRIPTION: fill the machine with random
+ * 		instructions whose jumps go to 
+ * 		instructions, and data after them
+ ***********************************************/
+static void random_program(machine_t *machine)
+{
+	unsigned char targets[MAX_FUZZ_WORDS + 4] = {0};
+	unsigned int starts[MAX_FUZZ_WORDS];
+	decoded_instruction_t decoded;
+	unsigned int pc = START_OFFSET;
+	unsigned int count = 0;
+	unsigned int word;
+	unsigned int i;
+	int opcode;
+
+	while (pc < START_OFFSET + MAX_FUZZ_WORDS) {
+		do {
+			word = random_word();
+		} while (isa_decode(word, &decoded) || 
+			 (decoded.instruction->opcode == OPCODE_stop && rand() % 16) ||
+			 (decoded.instruction->opcode == OPCODE_rts && rand() % 4));
+		opcode = decoded.instruction->opcode;
+		starts[count++] = pc;
+		machine->memory[pc++] = word;
+		random_operand(machine, 0, decoded.src_address_mode, decoded.src_register, &pc, targets);
+		random_operand(machine, 
+			       opcode == OPCODE_jmp || opcode == OPCODE_bne || opcode == OPCODE_jsr,
+			       decoded.dest_address_mode, 
+			       decoded.dest_register, 
+			       &pc, 
+			       targets);
+	}
+	for (i = 0; i < MAX_FUZZ_WORDS; i++) {
+		if (targets[i]) {
+			machine->memory[START_OFFSET + i] = starts[rand() % count];
+		}
+		machine->memory[START_OFFSET + MAX_FUZZ_WORDS + i] = rand() % 2 ? rand() % 16 : random_word();
+	}
+	for (i = 0; i < MACHINE_REGISTERS; i++) {
+		machine->registers[i] = rand() % 4 ? rand() % 16 : starts[rand() % count];
+	}
+	machine->budget = FUZZ_STEPS;
+}
+
+/************************************************
+ * NAME: fuzz
+ * PARAMS: count - number of programs
+ * 	   seed - of the random programs
+ * RETURN VALUE: 1 if the engines differ, 0 if
+ * 		 they ran the same
+ ***********************************************/
+static int fuzz(long count, unsigned int seed)
+{
+	machine_t interpreted;
+	machine_t translated;
+	char name[64];
+	int rc = 0;
+	long i;
+
+	for (i = 0; i < count && !rc; i++) {
+		if (machine_init(&interpreted, NULL, tmpfile()) || machine_init(&translated, NULL, tmpfile()) || 
+		    NULL == interpreted.output || NULL == translated.output) {
+			perror("couldn't create machine");
+			exit(EXIT_FAILURE);
+		}
+		srand(seed + i);
+		random_program(&interpreted);
+		srand(seed + i);
+		random_program(&translated);
+		sprintf(name, "program %ld", i);
+		rc = compare(&interpreted, &translated, name);
+		fclose(interpreted.output);
+		fclose(translated.output);
+		machine_free(&interpreted);
+		machine_free(&translated);
+	}
+	return rc;
+}
+
+/************************************************
+ * NAME: load_program
+ * PARAMS: machine - the machine to load
+ * 	   source_filename - the object filename
+ * 			     without extention
+ * 	   input - read by red
+ * 	   output - written by prn
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int load_program(machine_t *machine, const char *source_filename, FILE *input, FILE *output)
+{
+	char filename[MAX_FILENAME_LENGTH];
+	objfile_t object;
+	objfile_error_t error;
+
+	strncpy(filename, source_filename, MAX_FILENAME_LENGTH);
+	strncat(filename, ".ob", MAX_FILENAME_LENGTH - strlen(source_filename));
+	if (objfile_load(filename, 1, &object, &error)) {
+		if (error.line) {
+			fprintf(stderr, "%s:%lu:%lu: error: %s\n",
+				filename, error.line, error.column, error.message);
+		} else if (error.message) {
+			fprintf(stderr, "%s: %s\n", filename, error.message);
+		} else {
+			perror("couldn't read object file");
+		}
+		objfile_free(&object);
+		return 1;
+	}
+
+	if (machine_init(machine, input, output)) {
+		perror("couldn't create machine");
+		exit(EXIT_FAILURE);
+	}
+	machine_load(machine, &object);
+	objfile_free(&object);
+	return 0;
+}
+
+/************************************************
+ * NAME: copy_input
+ * RETURN VALUE: a file with the contents of 
+ * 		 stdin
+ ***********************************************/
+static FILE *copy_input(void)
+{
+	char buffer[4096];
+	FILE *input = tmpfile();
+	size_t length;
+
+	if (NULL == input) {
+		perror("couldn't copy input");
+		exit(EXIT_FAILURE);
+	}
+	while ((length = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+		fwrite(buffer, 1, length, input);
+	}
+	return input;
+}
+
+/************************************************
+ * NAME: run_file
+ * PARAMS: source_filename - the object filename
+ * 			     without extention
+ * 	   engine - how to run it
+ * 	   steps - the budget of the machine
+ * RETURN VALUE: 1 on error, 0 on success
+ ***********************************************/
+static int run_file(const char *source_filename, engine_t engine, long steps)
+{
+	machine_t interpreted;
+	machine_t translated;
+	machine_status_t status;
+	FILE *input;
+	int rc;
+
+	if (engine != ENGINE_COMPARE) {
+		if (load_program(&translated, source_filename, stdin, stdout)) {
+			return 1;
+		}
+		translated.budget = steps;
+		status = run_engine(&translated, engine == ENGINE_JIT);
+		machine_free(&translated);
+		if (status != MACHINE_STOPPED) {
+			fprintf(stderr, "%s: %s at %u\n", source_filename, status_names[status], translated.pc);
+			return 1;
+		}
+		return 0;
+	}
+
+	input = copy_input();
+	if (load_program(&interpreted, source_filename, input, tmpfile())) {
+		fclose(input);
+		return 1;
+	}
+	if (load_program(&translated, source_filename, input, tmpfile())) {
+		machine_free(&interpreted);
+		fclose(input);
+		return 1;
+	}
+	if (NULL == interpreted.output || NULL == translated.output) {
+		perror("couldn't create machine");
+		exit(EXIT_FAILURE);
+	}
+
+	interpreted.budget = translated.budget = steps;
+	rc = compare(&interpreted, &translated, source_filename);
+	fclose(interpreted.output);
+	fclose(translated.output);
+	fclose(input);
+	machine_free(&interpreted);
+	machine_free(&translated);
+	return rc;
+}
+
+/************************************************
+ * NAME: main
+ ***********************************************/
+int main(int argc, char *argv[])
+{
+	engine_t engine = ENGINE_JIT;
+	long steps = LONG_MAX;
+	int rc = 0;
+	int i = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-f") == 0) {
+#if !defined(__x86_64__)
+		/* without a jit there is nothing to compare the interpreter to */
+		printf("the jit isn't built for this target, nothing to fuzz\n");
+		return EXIT_SUCCESS;
+#else
+		if (jit_init()) {
+			fprintf(stderr, "the jit isn't available\n");
+			return EXIT_FAILURE;
+		}
+		rc = fuzz(atol(argv[2]), argc > 3 ? (unsigned int)atol(argv[3]) : 1);
+		jit_release();
+		return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+#endif
+	}
+
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-i") == 0) {
+			engine = ENGINE_INTERPRETER;
+		} else if (strcmp(argv[i], "-c") == 0) {
+			engine = ENGINE_COMPARE;
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			steps = atol(argv[++i]);
+		} else {
+			break;
+		}
+	}
+	if (i + 1 != argc) {
+		fprintf(stderr, "usage: run [-i | -c] [-n steps] file\n       run -f count [seed]\n");
+		return EXIT_FAILURE;
+	}
+
+	if (engine != ENGINE_INTERPRETER && jit_init()) {
+		/* the interpreter runs where there is no jit */
+		engine = engine == ENGINE_JIT ? ENGINE_INTERPRETER : engine;
+		if (engine == ENGINE_COMPARE) {
+			fprintf(stderr, "the jit isn't available\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	rc = run_file(argv[i], engine, steps);
+	jit_release();
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200112L /* for mmap and fstat */
+
+#include <stdio.h> /* for fprintf and perror */
+#include <string.h> /* for memcmp and memcpy */
+#include <fcntl.h> /* for open */
+#include <unistd.h> /* for close */
+#include <sys/stat.h> /* for fstat */
+#include <sys/mman.h> /* for mmap */
+
+#include "symfile.h"
+#include "consts.h"
+#include "types.h"
+#include "table.h"
+#include "buffer.h"
+#include "define.h"
+
+/* =============================================
+ * =============================================
+ * Note: a symbol file is the labels table left
+ * by the first pass of a source that only 
+ * declares labels, stored as is after a short
+ * header. loading it maps the file and attaches
+ * the records to the labels table, every source
+ * then starts with the same table it would have
+ * after parsing the declarations. the records 
+ * are in the layout of this build, a file made
+ * by another build is rejected by the header.
+ * ==============================================
+ * ============================================*/
+
+#define SYMFILE_MAGIC "ASSYMS01"
+#define SYMFILE_MAGIC_LENGTH (8)
+
+typedef struct {
+	char magic[SYMFILE_MAGIC_LENGTH];
+	unsigned long label_size;
+	unsigned long max_label_length;
+	unsigned long count;
+} symfile_header_t;
+
+/* global variables declared in parse.c */
+extern int code_index;
+extern int data_index;
+
+static void *symfile_map = NULL;
+static unsigned long symfile_map_length = 0;
+
+/* the symbol file being written */
+static buffer_t symfile_buffer;
+static int symfile_failed;
+
+/************************************************
+ * NAME: add_label
+ * PARAMS: label - a label of the table
+ * DESCRIPTION: add a label to the symbol file,
+ * 		only declarations can be added
+ ***********************************************/
+static void add_label(label_t *label)
+{
+	if (label->type == REGULAR || label->has_address) {
+		fprintf(stderr, "label defined in a symbol file: %s\n", label->name);
+		symfile_failed = 1;
+	}
+	symfile_failed |= buffer_append(&symfile_buffer, (const char *)label, sizeof(*label));
+}
+
+/************************************************
+ * NAME: symfile_write
+ * PARAMS: filename - the symbol file to create
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write the labels table of the 
+ * 		last source to a symbol file, the
+ * 		source can't have code, data or 
+ * 		constants
+ ***********************************************/
+int symfile_write(const char *filename)
+{
+	symfile_header_t header;
+
+	if (code_index || data_index || define_count()) {
+		fprintf(stderr, "%s: a symbol file can only declare labels\n", filename);
+		return 1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SYMFILE_MAGIC, SYMFILE_MAGIC_LENGTH);
+	header.label_size = sizeof(label_t);
+	header.max_label_length = MAX_LABEL_LENGTH;
+
+	buffer_init(&symfile_buffer);
+	symfile_failed = buffer_append(&symfile_buffer, (const char *)&header, sizeof(header));
+	loop_labels(add_label);
+
+	/* the count is known once the labels are added */
+	if (!symfile_failed) {
+		((symfile_header_t *)symfile_buffer.data)->count = \
+			(symfile_buffer.length - sizeof(header)) / sizeof(label_t);
+		symfile_failed = buffer_write_file(&symfile_buffer, filename);
+	}
+
+	buffer_free(&symfile_buffer);
+	return symfile_failed;
+}
+
+/************************************************
+ * NAME: symfile_load
+ * PARAMS: filename - the symbol file
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: map a symbol file and attach its
+ * 		labels, every source starts with 
+ * 		them until the file is released
+ ***********************************************/
+int symfile_load(const char *filename)
+{
+	const symfile_header_t *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(filename);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return 1;
+	}
+
+	if ((unsigned long)st.st_size < sizeof(*header)) {
+		fprintf(stderr, "%s: not a symbol file\n", filename);
+		close(fd);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		perror(filename);
+		return 1;
+	}
+
+	header = map;
+	if (memcmp(header->magic, SYMFILE_MAGIC, SYMFILE_MAGIC_LENGTH) || \
+	    header->label_size != sizeof(label_t) || \
+	    header->max_label_length != MAX_LABEL_LENGTH || \
+	    header->count > MAX_LABELS || \
+	    st.st_size != (off_t)(sizeof(*header) + header->count * sizeof(label_t))) {
+		fprintf(stderr, "%s: not a symbol file of this assembler\n", filename);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	symfile_release();
+	symfile_map = map;
+	symfile_map_length = st.st_size;
+	if (attach_labels((const label_t *)(header + 1), header->count)) {
+		fprintf(stderr, "%s: out of memory\n", filename);
+		symfile_release();
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************
+ * NAME: symfile_release
+ * DESCRIPTION: detach the labels and unmap the
+ * 		symbol file
+ ***********************************************/
+void symfile_release(void)
+{
+	if (symfile_map) {
+		attach_labels(NULL, 0);
+		munmap(symfile_map, symfile_map_length);
+		symfile_map = NULL;
+	}
+}
@@ -0,0 +1,8 @@
+#ifndef SYMFILE_H
+#define SYMFILE_H
+
+int symfile_write(const char *filename);
+int symfile_load(const char *filename);
+void symfile_release(void);
+
+#endif /* end of include guard: SYMFILE_H */
@@ -1,15 +1,81 @@
 #include <stdio.h> /* for fprintf */
-#include <string.h> /* for strncmp */
+#include <stdlib.h> /* for malloc, calloc and free */
+#include <string.h> /* for memset and memmove */
 
 #include "table.h"
 #include "consts.h"
 #include "types.h"
 #include "as.h"
+#include "hash.h"
 
-/* all labels declared or defined 
- * in a source file */
+/* =============================================
+ * =============================================
+ * Note: the labels a source installs and the
+ * attached labels are indexed by name tables.
+ * the index of the attached labels is built
+ * once by attach_labels. an attached label is
+ * copied on its first use by a source and the
+ * copy is stamped with the generation of the
+ * source, so init_labels only starts a new
+ * generation instead of copying them all
+ * ==============================================
+ * ============================================*/
+
+static const char *label_name(unsigned long entry);
+static const char *attached_label_name(unsigned long entry);
+
+/* all labels installed by a source file */
 static label_t labels[MAX_LABELS];
 static int free_label_index = 0;
+static name_table_t label_index = NAME_TABLE(label_name);
+/* labels every source starts with, loaded 
+ * from a symbol file */
+static const label_t *attached_labels = NULL;
+static int attached_label_count = 0;
+static name_table_t attached_index = NAME_TABLE(attached_label_name);
+/* the copies the source uses, valid if stamped
+ * with the current generation */
+static label_t *attached_copies = NULL;
+static unsigned long *copy_generations = NULL;
+static unsigned long generation = 1;
+/* a table of the caller used instead, NULL for none */
+static label_t *(*redirected_lookup)(char *name) = NULL;
+static label_t *(*redirected_install)(char *name) = NULL;
+
+/************************************************
+ * NAME: label_name
+ * PARAMS: entry - the index in labels
+ * RETURN VALUE: the label name
+ ***********************************************/
+static const char *label_name(unsigned long entry)
+{
+	return labels[entry].name;
+}
+
+/************************************************
+ * NAME: attached_label_name
+ * PARAMS: entry - the index in attached_labels
+ * RETURN VALUE: the label name
+ ***********************************************/
+static const char *attached_label_name(unsigned long entry)
+{
+	return attached_labels[entry].name;
+}
+
+/************************************************
+ * NAME: use_attached_label
+ * PARAMS: entry - the index in attached_labels
+ * RETURN VALUE: the copy of the label the source
+ * 		 uses
+ ***********************************************/
+static label_t *use_attached_label(unsigned long entry)
+{
+	if (copy_generations[entry] != generation) {
+		attached_copies[entry] = attached_labels[entry];
+		copy_generations[entry] = generation;
+	}
+	return &attached_copies[entry];
+}
 
 /************************************************
  * NAME: init_labels
@@ -18,6 +84,75 @@ static int free_label_index = 0;
 void init_labels(void)
 {
 	free_label_index = 0;
+	name_table_reset(&label_index);
+	if (0 == ++generation) {
+		/* the stamps wrapped around, a stale one could match */
+		if (attached_label_count) {
+			memset(copy_generations, 0, attached_label_count * sizeof(*copy_generations));
+		}
+		generation = 1;
+	}
+}
+
+/************************************************
+ * NAME: attach_labels
+ * PARAMS: preset - the labels, kept by the 
+ * 		    caller until detached
+ * 	   count - number of labels, at most
+ * 	   	   MAX_LABELS
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: set the labels init_labels 
+ * 		starts the table with, NULL to 
+ * 		start with an empty table
+ ***********************************************/
+int attach_labels(const label_t *preset, int count)
+{
+	int i;
+
+	free(attached_copies);
+	free(copy_generations);
+	attached_copies = NULL;
+	copy_generations = NULL;
+	attached_labels = NULL;
+	attached_label_count = 0;
+	name_table_release(&attached_index);
+
+	if (NULL == preset || 0 == count) {
+		return 0;
+	}
+
+	attached_copies = malloc(count * sizeof(*attached_copies));
+	copy_generations = calloc(count, sizeof(*copy_generations));
+	if (NULL == attached_copies || NULL == copy_generations) {
+		attach_labels(NULL, 0);
+		return 1;
+	}
+
+	attached_labels = preset;
+	for (i = 0; i < count; i++) {
+		if (name_table_add(&attached_index, preset[i].name)) {
+			attach_labels(NULL, 0);
+			return 1;
+		}
+	}
+	attached_label_count = count;
+	return 0;
+}
+
+/************************************************
+ * NAME: redirect_labels
+ * PARAMS: lookup - finds a label, NULL if there
+ * 		    is none
+ * 	   install - adds a label, NULL if it
+ * 	   	     can't
+ * DESCRIPTION: keep the labels in a table of the
+ * 		caller instead of the labels array,
+ * 		NULL for both to go back to it
+ ***********************************************/
+void redirect_labels(label_t *(*lookup)(char *name), label_t *(*install)(char *name))
+{
+	redirected_lookup = lookup;
+	redirected_install = install;
 }
 
 /************************************************
@@ -30,12 +165,20 @@ void init_labels(void)
  ***********************************************/
 int validate_labels(void)
 {
+	const label_t *label;
 	int i;
 	int failed = 0;
 
-	for (i = 0; i < free_label_index; i++)
+	for (i = 0; i < attached_label_count + free_label_index; i++)
 	{
-		label_t *label = &labels[i];
+		if (i >= attached_label_count) {
+			label = &labels[i - attached_label_count];
+		} else if (copy_generations[i] == generation) {
+			label = &attached_copies[i];
+		} else {
+			label = &attached_labels[i];
+		}
+
 		switch (label->type) {
 			case REGULAR: /* FALLTHROUGH */
 			case ENTRY: 
@@ -65,12 +208,26 @@ void loop_labels(void (*fun)(label_t *))
 {
 	int i;
 
+	for (i = 0; i < attached_label_count; i++)
+	{
+		fun(use_attached_label(i));
+	}
 	for (i = 0; i < free_label_index; i++)
 	{
 		fun(&labels[i]);
 	}
 }
 
+/************************************************
+ * NAME: count_free_labels
+ * RETURN VALUE: number of labels that can still
+ * 		 be installed
+ ***********************************************/
+int count_free_labels(void)
+{
+	return MAX_LABELS - attached_label_count - free_label_index;
+}
+
 /************************************************
  * NAME: install_label
  * PARAMS: name - the name of the label to be 
@@ -83,7 +240,7 @@ void loop_labels(void (*fun)(label_t *))
 int install_label(char *name, label_t **label)
 {
 	/* check that there is a free space for the label */
-	if (free_label_index == MAX_LABELS) {
+	if (NULL == redirected_install && 0 == count_free_labels()) {
 		parse_error("too many labels defined");
 		return 1;
 	}
@@ -94,8 +251,22 @@ int install_label(char *name, label_t **label)
 		return 1;
 	}
 
-	*label = &labels[free_label_index++];
-	memmove((*label)->name, name, MAX_LABEL_LENGTH);
+	if (redirected_install) {
+		*label = redirected_install(name);
+		if (NULL == *label) {
+			parse_error("out of memory");
+			return 1;
+		}
+		memmove((*label)->name, name, MAX_LABEL_LENGTH);
+	} else {
+		*label = &labels[free_label_index];
+		memmove((*label)->name, name, MAX_LABEL_LENGTH);
+		if (name_table_add(&label_index, (*label)->name)) {
+			parse_error("out of memory");
+			return 1;
+		}
+		free_label_index++;
+	}
 
 	return 0;
 }
@@ -110,13 +281,17 @@ int install_label(char *name, label_t **label)
  ***********************************************/
 label_t* lookup_label(char *name)
 {
-	int i;
-	
-	for (i = 0; i < free_label_index; i++) {
-		if (strncmp(labels[i].name, name, strlen(name)) == 0) {
-			return &labels[i];
-		}
+	unsigned long entry;
+
+	if (redirected_lookup) {
+		return redirected_lookup(name);
 	}
 	
-	return NULL;
+	entry = name_table_find(&label_index, name);
+	if (entry) {
+		return &labels[entry - 1];
+	}
+
+	entry = name_table_find(&attached_index, name);
+	return entry ? use_attached_label(entry - 1) : NULL;
 }
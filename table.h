@@ -6,7 +6,10 @@ int install_label(char *name, label_t **label);
 label_t* lookup_label(char *name);
 int validate_labels(void);
 void init_labels(void);
+int attach_labels(const label_t *preset, int count);
+void redirect_labels(label_t *(*lookup)(char *name), label_t *(*install)(char *name));
 void loop_labels(void (*fun)(label_t *));
+int count_free_labels(void);
 
 #ifdef DEBUG
 void print_labels(void);
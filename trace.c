@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200112L /* for clock_gettime */
+
+#include <stdio.h> /* for fopen and fprintf */
+#include <stdlib.h> /* for malloc, realloc and free */
+#include <string.h> /* for strlen */
+#include <time.h> /* for clock_gettime */
+#include <pthread.h> /* for the thread buffers */
+
+#include "trace.h"
+#include "buffer.h"
+
+/* =============================================
+ * =============================================
+ * Note: every thread records its events to its
+ * own buffer, found with a thread key, so 
+ * tracing takes no lock after a thread's first
+ * event. the buffers are written as chrome 
+ * trace event json by trace_close, once all 
+ * the other threads are done.
+ * ==============================================
+ * ============================================*/
+
+#define MIN_EVENTS_CAPACITY (256)
+#define NO_DETAIL (-1L)
+
+typedef struct {
+	char phase; /* 'B' begin, 'E' end or 'M' thread name */
+	const char *name; /* a string literal */
+	long detail; /* offset in the thread strings, NO_DETAIL if none */
+	unsigned long timestamp; /* nanoseconds since trace_open */
+} trace_event_t;
+
+typedef struct thread_trace {
+	int tid;
+	trace_event_t *events;
+	unsigned long length;
+	unsigned long capacity;
+	buffer_t strings; /* the copied event details */
+	struct thread_trace *next;
+} thread_trace_t;
+
+/* internal global variables */
+static int tracing = 0;
+static FILE *trace_file = NULL;
+static pthread_key_t trace_key;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_trace_t *threads = NULL;
+static int next_tid = 1;
+static struct timespec trace_start;
+
+/************************************************
+ * NAME: elapsed
+ * RETURN VALUE: nanoseconds since trace_open
+ ***********************************************/
+static unsigned long elapsed(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - trace_start.tv_sec) * 1000000000UL + \
+	       now.tv_nsec - trace_start.tv_nsec;
+}
+
+/************************************************
+ * NAME: current_thread
+ * RETURN VALUE: the buffer of the calling thread,
+ * 		 NULL if it can't be allocated
+ ***********************************************/
+static thread_trace_t *current_thread(void)
+{
+	thread_trace_t *thread = pthread_getspecific(trace_key);
+
+	if (thread) {
+		return thread;
+	}
+
+	thread = malloc(sizeof(*thread));
+	if (NULL == thread) {
+		return NULL;
+	}
+	thread->events = NULL;
+	thread->length = 0;
+	thread->capacity = 0;
+	buffer_init(&thread->strings);
+
+	pthread_mutex_lock(&threads_lock);
+	thread->tid = next_tid++;
+	thread->next = threads;
+	threads = thread;
+	pthread_mutex_unlock(&threads_lock);
+
+	pthread_setspecific(trace_key, thread);
+	return thread;
+}
+
+/************************************************
+ * NAME: record
+ * PARAMS: phase - the event phase
+ * 	   name - the event name
+ * 	   detail - the event detail, NULL if none
+ * DESCRIPTION: record an event of the calling
+ * 		thread, events that don't fit are
+ * 		dropped
+ ***********************************************/
+static void record(char phase, const char *name, const char *detail)
+{
+	thread_trace_t *thread = current_thread();
+	unsigned long capacity;
+	trace_event_t *grown;
+	trace_event_t *event;
+
+	if (NULL == thread) {
+		return;
+	}
+
+	if (thread->length == thread->capacity) {
+		capacity = thread->capacity ? thread->capacity * 2 : MIN_EVENTS_CAPACITY;
+		grown = realloc(thread->events, capacity * sizeof(*grown));
+		if (NULL == grown) {
+			return;
+		}
+		thread->events = grown;
+		thread->capacity = capacity;
+	}
+
+	event = &thread->events[thread->length];
+	event->phase = phase;
+	event->name = name;
+	event->detail = NO_DETAIL;
+	if (detail) {
+		event->detail = thread->strings.length;
+		if (buffer_append(&thread->strings, detail, strlen(detail) + 1)) {
+			return;
+		}
+	}
+	event->timestamp = elapsed();
+	thread->length++;
+}
+
+/************************************************
+ * NAME: write_string
+ * PARAMS: s - the string to write
+ * DESCRIPTION: write a quoted json string
+ ***********************************************/
+static void write_string(const char *s)
+{
+	putc('"', trace_file);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fprintf(trace_file, "\\%c", *s);
+		} else if ((unsigned char)*s < ' ') {
+			fprintf(trace_file, "\\u%04x", (unsigned char)*s);
+		} else {
+			putc(*s, trace_file);
+		}
+	}
+	putc('"', trace_file);
+}
+
+/************************************************
+ * NAME: write_event
+ * PARAMS: thread - the thread of the event
+ * 	   event - the event to write
+ ***********************************************/
+static void write_event(const thread_trace_t *thread, const trace_event_t *event)
+{
+	fprintf(trace_file,
+		"{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%lu.%03lu",
+		event->phase,
+		thread->tid,
+		event->timestamp / 1000,
+		event->timestamp % 1000);
+
+	if (event->name) {
+		fputs(",\"name\":", trace_file);
+		write_string(event->name);
+	}
+
+	if (event->detail != NO_DETAIL) {
+		/* thread names are metadata events with a name argument */
+		fputs(event->phase == 'M' ? ",\"args\":{\"name\":" : ",\"args\":{\"file\":", trace_file);
+		write_string(thread->strings.data + event->detail);
+		putc('}', trace_file);
+	}
+
+	putc('}', trace_file);
+}
+
+/* exported functions */
+
+/************************************************
+ * NAME: trace_open
+ * PARAMS: filename - the trace file to create
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: start recording events, the 
+ * 		calling thread is named main
+ ***********************************************/
+int trace_open(const char *filename)
+{
+	trace_file = fopen(filename, "w");
+	if (NULL == trace_file) {
+		perror(filename);
+		return 1;
+	}
+
+	if (pthread_key_create(&trace_key, NULL)) {
+		fclose(trace_file);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &trace_start);
+	tracing = 1;
+	trace_thread_name("main");
+	return 0;
+}
+
+/************************************************
+ * NAME: trace_thread_name
+ * PARAMS: name - the name of the calling thread
+ * DESCRIPTION: name the track of the calling
+ * 		thread
+ ***********************************************/
+void trace_thread_name(const char *name)
+{
+	if (tracing) {
+		record('M', "thread_name", name);
+	}
+}
+
+/************************************************
+ * NAME: trace_begin
+ * PARAMS: name - the span name, a string literal
+ * 	   detail - the file the span works on,
+ * 	            NULL if none
+ * DESCRIPTION: begin a span on the calling 
+ * 		thread, a no-op unless tracing
+ ***********************************************/
+void trace_begin(const char *name, const char *detail)
+{
+	if (tracing) {
+		record('B', name, detail);
+	}
+}
+
+/************************************************
+ * NAME: trace_end
+ * DESCRIPTION: end the last span begun on the
+ * 		calling thread
+ ***********************************************/
+void trace_end(void)
+{
+	if (tracing) {
+		record('E', NULL, NULL);
+	}
+}
+
+/************************************************
+ * NAME: trace_close
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: write all the recorded events and
+ * 		stop tracing, called once the other
+ * 		threads are done
+ ***********************************************/
+int trace_close(void)
+{
+	thread_trace_t *thread;
+	unsigned long i;
+	int first = 1;
+
+	if (!tracing) {
+		return 0;
+	}
+	tracing = 0;
+
+	fputs("{\"traceEvents\":[\n", trace_file);
+	for (; threads; threads = thread) {
+		for (i = 0; i < threads->length; i++) {
+			if (!first) {
+				fputs(",\n", trace_file);
+			}
+			first = 0;
+			write_event(threads, &threads->events[i]);
+		}
+
+		thread = threads->next;
+		free(threads->events);
+		buffer_free(&threads->strings);
+		free(threads);
+	}
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", trace_file);
+
+	pthread_key_delete(trace_key);
+	if (fclose(trace_file)) {
+		perror("couldn't write trace");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+int trace_open(const char *filename);
+void trace_thread_name(const char *name);
+void trace_begin(const char *name, const char *detail);
+void trace_end(void);
+int trace_close(void);
+
+#endif /* end of include guard: TRACE_H */
@@ -26,6 +26,7 @@ typedef struct {
 	char name[MAX_LABEL_LENGTH];
 	int address;
 	int has_address;
+	unsigned int line; /* where it is defined or declared */
 } label_t;
 
 typedef enum {
@@ -71,4 +72,14 @@ typedef struct {
 	operand_t dest_operand;
 } full_instruction_t;
 
+typedef struct {
+	instruction_t *instruction;
+	int type;
+	int comb;
+	address_mode_t src_address_mode;
+	int src_register;
+	address_mode_t dest_address_mode;
+	int dest_register;
+} decoded_instruction_t;
+
 #endif /* end of include guard: TYPES_H */
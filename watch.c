@@ -0,0 +1,421 @@
+#define _POSIX_C_SOURCE 200112L /* for clock_gettime */
+
+#include <stdio.h> /* for printf and perror */
+#include <stdlib.h> /* for malloc and free */
+#include <string.h> /* for strcmp, strrchr and memcmp */
+#include <unistd.h> /* for read */
+#include <time.h> /* for clock_gettime */
+#include <sys/inotify.h> /* for inotify_init and inotify_add_watch */
+
+#include "watch.h"
+#include "consts.h"
+#include "types.h"
+#include "table.h"
+#include "parse.h"
+#include "io.h"
+
+/* =============================================
+ * =============================================
+ * Note: watch mode keeps every source in memory
+ * with the symbol table it assembled to, and
+ * the last contents of every output file, which
+ * hold its encoded image. a source is looked at
+ * again only when inotify reports it was 
+ * written:
+ *
+ * - a source saved with the same text isn't
+ *   assembled at all.
+ * - a changed source is assembled from the text
+ *   read for the comparison, and an output is
+ *   written only if its bytes changed.
+ * - the symbol tables of all the sources are
+ *   passed to the round callback, so checks
+ *   across the sources don't reassemble the
+ *   sources that didn't change.
+ *
+ * the directories of the sources are watched,
+ * not the sources themselves, so editors that 
+ * save by renaming a new file over the source
+ * are noticed too.
+ * ==============================================
+ * ============================================*/
+
+#define WATCH_EVENTS_LENGTH (64 * 1024)
+
+typedef struct {
+	const char *source_filename; /* without the .as extention */
+	char name[MAX_FILENAME_LENGTH]; /* the .as filename within its directory */
+	int wd; /* the directory watch */
+	int changed;
+	char *text; /* the source last assembled, NULL before */
+	unsigned long text_length;
+	label_t *labels; /* its symbol table, if it assembled */
+	unsigned long label_count;
+} watched_source_t;
+
+typedef struct cached_output {
+	char filename[MAX_FILENAME_LENGTH];
+	char *data; /* NULL if the file doesn't exist */
+	unsigned long length;
+	struct cached_output *next;
+} cached_output_t;
+
+static cached_output_t *cached_outputs = NULL;
+static int outputs_written; /* outputs written by the last assembly */
+static watched_source_t *sources = NULL;
+static int source_count = 0;
+static watched_source_t *kept_source; /* the source keep_label adds to */
+static unsigned long kept_capacity;
+static int keep_failed;
+
+/************************************************
+ * NAME: find_cached_output
+ * PARAMS: filename - the output filename
+ * RETURN VALUE: the cached output, loaded from
+ * 		 the disk on first use, or NULL
+ ***********************************************/
+static cached_output_t *find_cached_output(const char *filename)
+{
+	cached_output_t *cached;
+
+	for (cached = cached_outputs; cached; cached = cached->next) {
+		if (strcmp(cached->filename, filename) == 0) {
+			return cached;
+		}
+	}
+
+	cached = malloc(sizeof(cached_output_t));
+	if (NULL == cached) {
+		return NULL;
+	}
+
+	strncpy(cached->filename, filename, MAX_FILENAME_LENGTH - 1);
+	cached->filename[MAX_FILENAME_LENGTH - 1] = '\0';
+	cached->data = io_read(filename, &cached->length, NULL);
+	cached->next = cached_outputs;
+	cached_outputs = cached;
+	return cached;
+}
+
+/************************************************
+ * NAME: watch_write
+ * PARAMS: filename - the output filename
+ * 	   data - the contents, released once
+ * 	          written
+ * 	   length - the contents length
+ * 	   arena - the arena holding the contents,
+ * 	           NULL for malloc
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: an output writer that writes a
+ * 		file only if its contents changed
+ ***********************************************/
+int watch_write(const char *filename, char *data, unsigned long length, arena_t *arena)
+{
+	cached_output_t *cached = find_cached_output(filename);
+	char *copy;
+
+	if (cached && cached->data && cached->length == length && \
+	    memcmp(cached->data, data, length) == 0) {
+		if (NULL == arena) {
+			free(data);
+		}
+		return 0;
+	}
+
+	if (cached) {
+		copy = malloc(length + 1);
+		if (copy) {
+			memcpy(copy, data, length);
+		}
+		free(cached->data);
+		cached->data = copy;
+		cached->length = length;
+	}
+
+	outputs_written++;
+	return io_write(filename, data, length, arena);
+}
+
+/************************************************
+ * NAME: elapsed_milliseconds
+ * PARAMS: start - the start time
+ * RETURN VALUE: milliseconds since start
+ ***********************************************/
+static double elapsed_milliseconds(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/************************************************
+ * NAME: add_watch
+ * PARAMS: inotify_fd - the inotify instance
+ * 	   source - the source to watch
+ * RETURN VALUE: 1 on error, 0 on success
+ * DESCRIPTION: watch the directory of a source
+ ***********************************************/
+static int add_watch(int inotify_fd, watched_source_t *source)
+{
+	char directory[MAX_FILENAME_LENGTH];
+	char *slash;
+
+	strncpy(directory, source->source_filename, MAX_FILENAME_LENGTH - 1);
+	directory[MAX_FILENAME_LENGTH - 1] = '\0';
+
+	slash = strrchr(directory, '/');
+	if (slash) {
+		strncpy(source->name, slash + 1, MAX_FILENAME_LENGTH - 4);
+		*slash = '\0';
+		if (slash == directory) {
+			strcpy(directory, "/");
+		}
+	} else {
+		strncpy(source->name, directory, MAX_FILENAME_LENGTH - 4);
+		strcpy(directory, ".");
+	}
+	source->name[MAX_FILENAME_LENGTH - 4] = '\0';
+	strcat(source->name, ".as");
+
+	/* a directory watched twice gets the same descriptor */
+	source->wd = inotify_add_watch(inotify_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (source->wd < 0) {
+		perror(directory);
+		return 1;
+	}
+
+	return 0;
+}
+
+/************************************************
+ * NAME: keep_label
+ * PARAMS: label - a label of the assembled 
+ * 		   source
+ * DESCRIPTION: add the label to the symbol 
+ * 		table kept for the source, used
+ * 		with loop_labels
+ ***********************************************/
+static void keep_label(label_t *label)
+{
+	unsigned long capacity = kept_capacity ? kept_capacity * 2 : 64;
+	label_t *grown;
+
+	if (keep_failed) {
+		return;
+	}
+
+	if (kept_source->label_count == kept_capacity) {
+		grown = realloc(kept_source->labels, capacity * sizeof(label_t));
+		if (NULL == grown) {
+			keep_failed = 1;
+			return;
+		}
+		kept_source->labels = grown;
+		kept_capacity = capacity;
+	}
+
+	kept_source->labels[kept_source->label_count++] = *label;
+}
+
+/************************************************
+ * NAME: keep_symbols
+ * PARAMS: source - the source just assembled
+ * 	   failed - it failed to assemble
+ * DESCRIPTION: replace the symbol table kept
+ * 		for the source, a source that
+ * 		failed has none
+ ***********************************************/
+static void keep_symbols(watched_source_t *source, int failed)
+{
+	free(source->labels);
+	source->labels = NULL;
+	source->label_count = 0;
+	if (failed) {
+		return;
+	}
+
+	kept_source = source;
+	kept_capacity = 0;
+	keep_failed = 0;
+	loop_labels(keep_label);
+	if (keep_failed) {
+		free(source->labels);
+		source->labels = NULL;
+		source->label_count = 0;
+	}
+}
+
+/************************************************
+ * NAME: reassemble
+ * PARAMS: source - a source reported written
+ * 	   assemble - assembles a single source
+ * RETURN VALUE: 1 if it failed, 0 if it
+ * 		 assembled, -1 if its text didn't
+ * 		 change
+ * DESCRIPTION: read the source and assemble it
+ * 		from memory if it changed, a source
+ * 		that can't be read is assembled 
+ * 		from the disk to report the error
+ ***********************************************/
+static int reassemble(watched_source_t *source, int (*assemble)(const char *))
+{
+	char filename[MAX_FILENAME_LENGTH];
+	unsigned long length;
+	char *text;
+	int failed;
+
+	strncpy(filename, source->source_filename, MAX_FILENAME_LENGTH - 4);
+	filename[MAX_FILENAME_LENGTH - 4] = '\0';
+	strcat(filename, ".as");
+	text = io_read(filename, &length, NULL);
+
+	if (text && source->text && source->text_length == length && \
+	    memcmp(source->text, text, length) == 0) {
+		free(text);
+		return -1;
+	}
+
+	parse_set_source(text, length);
+	failed = assemble(source->source_filename);
+	parse_set_source(NULL, 0);
+
+	free(source->text);
+	source->text = text;
+	source->text_length = length;
+	keep_symbols(source, failed);
+	return failed;
+}
+
+/************************************************
+ * NAME: watch_loop_symbols
+ * PARAMS: fun - invoked with every label kept 
+ * 		 and the source it belongs to
+ * DESCRIPTION: go over the symbol tables of the
+ * 		watched sources that assembled
+ ***********************************************/
+void watch_loop_symbols(void (*fun)(const char *source_filename, label_t *label))
+{
+	unsigned long j;
+	int i;
+
+	for (i = 0; i < source_count; i++) {
+		for (j = 0; j < sources[i].label_count; j++) {
+			fun(sources[i].source_filename, &sources[i].labels[j]);
+		}
+	}
+}
+
+/************************************************
+ * NAME: release_sources
+ * DESCRIPTION: free the kept sources
+ ***********************************************/
+static void release_sources(void)
+{
+	int i;
+
+	for (i = 0; i < source_count; i++) {
+		free(sources[i].text);
+		free(sources[i].labels);
+	}
+	free(sources);
+	sources = NULL;
+	source_count = 0;
+}
+
+/************************************************
+ * NAME: watch_sources
+ * PARAMS: source_filenames - the sources without
+ * 			      the .as extention
+ * 	   count - number of sources
+ * 	   assemble - assembles a single source
+ * 	   round - invoked after sources of a 
+ * 	   	   change are assembled, NULL for
+ * 	   	   none
+ * RETURN VALUE: 1 on error, doesn't return 
+ * 		 otherwise
+ * DESCRIPTION: assemble all the sources, then 
+ * 		reassemble every source that is
+ * 		changed and report the latency 
+ * 		from the change to the written
+ * 		outputs
+ ***********************************************/
+int watch_sources(char *source_filenames[], 
+		  int count, 
+		  int (*assemble)(const char *), 
+		  void (*round)(void))
+{
+	static long events[WATCH_EVENTS_LENGTH / sizeof(long)]; /* aligned for the events */
+	struct inotify_event *event;
+	struct timespec start;
+	long length;
+	long offset;
+	int inotify_fd;
+	int assembled;
+	int failed;
+	int i;
+
+	sources = calloc(count, sizeof(watched_source_t));
+	inotify_fd = inotify_init();
+	if (NULL == sources || inotify_fd < 0) {
+		perror("couldn't start watching");
+		free(sources);
+		sources = NULL;
+		return 1;
+	}
+	source_count = count;
+
+	for (i = 0; i < count; i++) {
+		sources[i].source_filename = source_filenames[i];
+		if (add_watch(inotify_fd, &sources[i])) {
+			release_sources();
+			close(inotify_fd);
+			return 1;
+		}
+		/* the first round assembles every source */
+		sources[i].changed = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		assembled = 0;
+		for (i = 0; i < count; i++) {
+			if (!sources[i].changed) {
+				continue;
+			}
+
+			sources[i].changed = 0;
+			outputs_written = 0;
+			failed = reassemble(&sources[i], assemble);
+			assembled |= failed >= 0;
+			printf("%s: %s in %.3f ms\n",
+			       sources[i].source_filename,
+			       failed > 0 ? "failed" : outputs_written ? "updated" : "unchanged",
+			       elapsed_milliseconds(&start));
+			fflush(stdout);
+		}
+		/* the symbol tables are the same if no source was assembled */
+		if (round && assembled) {
+			round();
+		}
+
+		length = read(inotify_fd, events, sizeof(events));
+		if (length <= 0) {
+			perror("couldn't read changes");
+			release_sources();
+			close(inotify_fd);
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		/* a source saved several times is reassembled once */
+		for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)((char *)events + offset);
+			for (i = 0; event->len && i < count; i++) {
+				if (sources[i].wd == event->wd && strcmp(sources[i].name, event->name) == 0) {
+					sources[i].changed = 1;
+				}
+			}
+		}
+	}
+}
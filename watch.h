@@ -0,0 +1,14 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "arena.h"
+#include "types.h"
+
+int watch_write(const char *filename, char *data, unsigned long length, arena_t *arena);
+int watch_sources(char *source_filenames[], 
+		  int count, 
+		  int (*assemble)(const char *), 
+		  void (*round)(void));
+void watch_loop_symbols(void (*fun)(const char *source_filename, label_t *label));
+
+#endif /* end of include guard: WATCH_H */